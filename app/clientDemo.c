@@ -0,0 +1,216 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "DS-Lab-Assignment/util.h"
+#include "DS-Lab-Assignment/chatClient.h"
+
+/* example of the client library: drives a server through every kind of request with two users, sending
+ * messages from one to the other and checking each reply, then leaves the server as it found it;
+ * exits with an error if a reply isn't the expected one:
+ *     clientdemo <host> <port>          (host: a Unix socket path if it starts with '/') */
+
+#define DEMO_SENDER "demo-sender"
+#define DEMO_RECIPIENT "demo-recipient"
+#define DEMO_SENDS 16                   /* messages sent at once, more than the requests the client keeps in flight */
+#define DEMO_STREAM_SIZE 100000         /* content size of the streamed message */
+#define DEMO_DELIVERY_TIMEOUT_MS 5000   /* time the messages and their ACKs have to reach the listener */
+
+/* makes a request with the future in scope as its callback args, and checks its reply code;
+ * the request is made again for as long as the server is too busy for it */
+#define EXPECT(REQUEST_CALL, WHAT, STATUS, RESULT) \
+    do { \
+        CHECK_ERROR(!(future = cc_future_new()), "Out of memory", GEN_ERR_ANY) \
+        CHECK_FUNC_ERROR(expect(future, REQUEST_CALL, WHAT, STATUS, RESULT), GEN_ERR_ANY) \
+    } while (ret_val == FALSE);
+
+int n_sends_done = 0;
+int n_sends_busy = 0;           /* sends the server was too busy for, to be made again */
+int n_sends_failed = 0;
+int retry_after_ms = 0;
+int n_messages = 0;             /* messages pushed to the listener */
+int n_acks = 0;                 /* ACKs pushed to the listener */
+pthread_mutex_t mutex_demo = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t cond_demo = PTHREAD_COND_INITIALIZER;
+char stream_content[DEMO_STREAM_SIZE];
+
+void on_message(const char *sender, unsigned int msg_id, const char *content, size_t len, void *args);
+void on_ack(unsigned int msg_id, void *args);
+void on_send_done(const cc_result_t *result, void *args);
+void sleep_ms(int ms);
+int wait_for(const int *counter, int target, int timeout_ms);
+int expect(cc_future_t *future, int submitted, const char *what, int status, cc_result_t *result);
+int run_demo(cc_client_t *client);
+
+
+void on_message(const char *sender, const unsigned int msg_id, const char *content, const size_t len, void *args) {
+    /* counts the messages pushed to the listener */
+    (void) sender; (void) msg_id; (void) content; (void) len; (void) args;
+    pthread_mutex_lock(&mutex_demo);
+    n_messages++;
+    pthread_cond_broadcast(&cond_demo);
+    pthread_mutex_unlock(&mutex_demo);
+}
+
+
+void on_ack(const unsigned int msg_id, void *args) {
+    /* counts the ACKs pushed to the listener */
+    (void) msg_id; (void) args;
+    pthread_mutex_lock(&mutex_demo);
+    n_acks++;
+    pthread_cond_broadcast(&cond_demo);
+    pthread_mutex_unlock(&mutex_demo);
+}
+
+
+void on_send_done(const cc_result_t *result, void *args) {
+    /* counts the sends done, and the ones that failed */
+    (void) args;
+    pthread_mutex_lock(&mutex_demo);
+    n_sends_done++;
+    if (result->status == SRV_ERR_BUSY) {
+        n_sends_busy++;
+        if (result->retry_after_ms > retry_after_ms) retry_after_ms = result->retry_after_ms;
+    } else if (result->status != SRV_SUCCESS) n_sends_failed++;
+    pthread_cond_broadcast(&cond_demo);
+    pthread_mutex_unlock(&mutex_demo);
+}
+
+
+void sleep_ms(const int ms) {
+    /* sleeps for a given time in milliseconds */
+    struct timespec interval = {ms / 1000, (ms % 1000) * 1000000L};
+    nanosleep(&interval, NULL);
+}
+
+
+int wait_for(const int *counter, const int target, const int timeout_ms) {
+    /* waits for a counter to reach a target; returns FALSE if it didn't in time */
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&mutex_demo);
+    while (*counter < target && pthread_cond_timedwait(&cond_demo, &mutex_demo, &deadline) == 0);
+    int reached = *counter >= target;
+    pthread_mutex_unlock(&mutex_demo);
+    return reached;
+}
+
+
+int expect(cc_future_t *future, const int submitted, const char *const what, const int status,
+           cc_result_t *result) {
+    /* waits for the request of a future, if it could be submitted, and checks its reply code; returns FALSE,
+     * once the retry-after time is over, if the server was too busy for it, and TRUE if it got the expected
+     * one: its result is then given back if asked for, and must be freed with cc_result_free */
+    cc_result_t own_result;
+    if (!result) result = &own_result;
+    if (submitted < 0) {
+        cc_future_free(future);
+        return GEN_ERR_ANY;
+    }
+
+    cc_future_wait(future, result);
+    cc_future_free(future);
+    printf("d> %s: %d\n", what, result->status); fflush(stdout);
+    int got_status = result->status;
+    if (result == &own_result || got_status != status) cc_result_free(result);
+    if (got_status == SRV_ERR_BUSY && status != SRV_ERR_BUSY) {
+        sleep_ms(result->retry_after_ms);
+        return FALSE;
+    }
+    CHECK_ERROR(got_status != status, what, GEN_ERR_ANY)
+    return TRUE;
+}
+
+
+int run_demo(cc_client_t *client) {
+    /* sends every kind of request through the client, checking their replies */
+    int ret_val;    /* needed for error-checking macros */
+    cc_future_t *future;
+    cc_result_t result;
+
+    /* users left by a previous run that failed halfway are unregistered first */
+    const char *users[] = {DEMO_SENDER, DEMO_RECIPIENT};
+    for (int i = 0; i < 2; i++) {
+        CHECK_ERROR(!(future = cc_future_new()), "Out of memory", GEN_ERR_ANY)
+        if (cc_unregister(client, users[i], cc_future_done, future) >= 0) cc_future_wait(future, &result);
+        cc_future_free(future);
+    }
+
+    EXPECT(cc_register(client, DEMO_SENDER, cc_future_done, future), "REGISTER " DEMO_SENDER, SRV_SUCCESS, NULL)
+    EXPECT(cc_register(client, DEMO_RECIPIENT, cc_future_done, future), "REGISTER " DEMO_RECIPIENT, SRV_SUCCESS,
+           NULL)
+    EXPECT(cc_register(client, DEMO_RECIPIENT, cc_future_done, future), "REGISTER " DEMO_RECIPIENT " again",
+           SRV_ERR_REG_USR_ALREADY_REG, NULL)
+    EXPECT(cc_connect(client, DEMO_SENDER, cc_future_done, future), "CONNECT " DEMO_SENDER, SRV_SUCCESS, NULL)
+    EXPECT(cc_connect(client, DEMO_RECIPIENT, cc_future_done, future), "CONNECT " DEMO_RECIPIENT, SRV_SUCCESS, NULL)
+
+    /* sends are all queued at once, with a callback; the client keeps CC_MAX_IN_FLIGHT of them in flight,
+     * and the ones the server was too busy for are made again after the longest retry-after time */
+    int n_to_send = DEMO_SENDS;
+    while (n_to_send) {
+        n_sends_done = n_sends_busy = retry_after_ms = 0;
+        for (int i = 0; i < n_to_send; i++) {
+            CHECK_FUNC_ERROR(cc_send(client, DEMO_SENDER, DEMO_RECIPIENT, "hello from the demo", on_send_done, NULL),
+                             GEN_ERR_ANY)
+        }
+        CHECK_ERROR(!wait_for(&n_sends_done, n_to_send, CC_REQUEST_TIMEOUT_MS), "Sends not done in time",
+                    GEN_ERR_ANY)
+        printf("d> SEND x%d: %d busy, %d failed\n", n_to_send, n_sends_busy, n_sends_failed); fflush(stdout);
+        n_to_send = n_sends_busy;
+        if (n_to_send) sleep_ms(retry_after_ms);
+    } // END while
+    CHECK_ERROR(n_sends_failed, "Some sends failed", GEN_ERR_ANY)
+
+    memset(stream_content, 'x', sizeof stream_content);
+    EXPECT(cc_send_stream(client, DEMO_SENDER, DEMO_RECIPIENT, stream_content, sizeof stream_content, cc_future_done,
+                          future), "SEND_STREAM", SRV_SUCCESS, NULL)
+
+    EXPECT(cc_connected_users(client, DEMO_SENDER, cc_future_done, future), "CONNECTEDUSERS", SRV_SUCCESS, &result)
+    int found = 0;
+    for (size_t pos = 0; pos < result.users_len; pos += strlen(result.users + pos) + 1)
+        found += !strcmp(result.users + pos, DEMO_SENDER) || !strcmp(result.users + pos, DEMO_RECIPIENT);
+    cc_result_free(&result);
+    CHECK_ERROR(found != 2, "Demo users not listed as connected", GEN_ERR_ANY)
+
+    /* every message reaches the recipient, and its ACK the sender, through the client listener */
+    CHECK_ERROR(!wait_for(&n_messages, DEMO_SENDS + 1, DEMO_DELIVERY_TIMEOUT_MS) ||
+                !wait_for(&n_acks, DEMO_SENDS + 1, DEMO_DELIVERY_TIMEOUT_MS), "Messages not delivered in time",
+                GEN_ERR_ANY)
+    printf("d> delivered %d messages, %d ACKs\n", n_messages, n_acks); fflush(stdout);
+
+    EXPECT(cc_disconnect(client, DEMO_SENDER, cc_future_done, future), "DISCONNECT " DEMO_SENDER, SRV_SUCCESS, NULL)
+    EXPECT(cc_disconnect(client, DEMO_RECIPIENT, cc_future_done, future), "DISCONNECT " DEMO_RECIPIENT, SRV_SUCCESS,
+           NULL)
+    EXPECT(cc_unregister(client, DEMO_SENDER, cc_future_done, future), "UNREGISTER " DEMO_SENDER, SRV_SUCCESS, NULL)
+    EXPECT(cc_unregister(client, DEMO_RECIPIENT, cc_future_done, future), "UNREGISTER " DEMO_RECIPIENT, SRV_SUCCESS,
+           NULL)
+    return 0;
+}
+
+
+int main(int argc, char **argv) {
+    int server_port = -1;
+    if (argc != 3 || str_to_num(argv[2], (void *) &server_port, INT) < 0) {
+        fprintf(stderr, "Usage: clientdemo <host> <port>\n");
+        return GEN_ERR_INV_ARGS;
+    }
+
+    cc_listener_t listener = {on_message, on_ack, NULL, NULL};
+    cc_client_t *client = cc_create(argv[1], server_port, &listener);
+    if (!client) {
+        fprintf(stderr, "Could not create client\n");
+        return GEN_ERR_ANY;
+    }
+    int result = run_demo(client);
+    cc_destroy(client);
+
+    printf("d> demo %s\n", result < 0 ? "FAILED" : "OK");
+    return result < 0 ? GEN_ERR_ANY : 0;
+}
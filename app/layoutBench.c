@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include "DS-Lab-Assignment/util.h"
+#include "DS-Lab-Assignment/dbms/dbms.h"
+
+/* benchmark of the user table layouts: creates a DB with a given number of users in the current folder,
+ * then times user table creation, lookups of random users, deletions and, for a flat DB switched to the
+ * hashed layout, its migration:
+ *     layoutbench <n_users> flat|hashed|migrate */
+
+#define BENCH_LOOKUPS 100000    /* random users read after creating them */
+#define BENCH_DELETES 10000     /* random users deleted at the end */
+
+long long elapsed_us(const struct timespec *start);
+int create_users(int n_users);
+void read_users(int n_users);
+void delete_users(int n_users);
+
+
+long long elapsed_us(const struct timespec *start) {
+    /* microseconds since a given start time */
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000000LL + (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+
+int create_users(const int n_users) {
+    /* creates users bench<0> ... bench<n_users - 1> */
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < n_users; i++) {
+        entry_t entry;
+        bzero(&entry, sizeof entry);
+        entry.type = ENT_TYPE_UD;
+        sprintf(entry.username, "bench%d", i);
+        if (db_creat_usr_tbl(&entry) < 0) {
+            fprintf(stderr, "Could not create user %s\n", entry.username);
+            return GEN_ERR_ANY;
+        }
+    }
+
+    long long us = elapsed_us(&start);
+    printf("b> created %d users in %lld ms: %.1f us per user\n", n_users, us / 1000, (double) us / n_users);
+    return 0;
+}
+
+
+void read_users(const int n_users) {
+    /* reads the userdata entries of BENCH_LOOKUPS random users, most of them missing the directory fd cache */
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int n_failed = 0;
+    for (int i = 0; i < BENCH_LOOKUPS; i++) {
+        entry_t entry;
+        entry.type = ENT_TYPE_UD;
+        sprintf(entry.username, "bench%d", rand() % n_users);
+        if (db_io_op_usr_ent(&entry, READ) < 0) n_failed++;
+    }
+
+    long long us = elapsed_us(&start);
+    printf("b> read %d random users in %lld ms: %.2f us per user (%d failed)\n", BENCH_LOOKUPS, us / 1000,
+           (double) us / BENCH_LOOKUPS, n_failed);
+}
+
+
+void delete_users(const int n_users) {
+    /* deletes BENCH_DELETES users (or every user, if there are fewer) */
+    int n_deletes = (n_users < BENCH_DELETES) ? n_users : BENCH_DELETES;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < n_deletes; i++) {
+        char username[MAX_STR_SIZE];
+        sprintf(username, "bench%d", (int) ((long long) i * n_users / n_deletes));
+        db_del_usr_tbl(username);
+    }
+
+    long long us = elapsed_us(&start);
+    printf("b> deleted %d users in %lld ms: %.1f us per user\n", n_deletes, us / 1000, (double) us / n_deletes);
+}
+
+
+int main(int argc, char **argv) {
+    int ret_val;    /* needed for error-checking macros */
+    int n_users;
+    char layout;
+    int migrate = argc == 3 && !strcmp(argv[2], "migrate");
+    if (argc != 3 || str_to_num(argv[1], (void *) &n_users, INT) < 0 || n_users <= 0 ||
+        (!migrate && db_layout_parse(argv[2], &layout) < 0)) {
+        fprintf(stderr, "Usage: layoutbench <n_users> flat|hashed|migrate\n");
+        return GEN_ERR_INV_ARGS;
+    }
+
+    /* a flat DB is created first to be migrated */
+    db_layout_use(migrate ? DB_LAYOUT_FLAT : layout);
+    CHECK_FUNC_ERROR(db_init_db(), GEN_ERR_ANY)
+    CHECK_FUNC_ERROR(db_recover(FALSE), GEN_ERR_ANY)
+    CHECK_FUNC_ERROR(create_users(n_users), GEN_ERR_ANY)
+    read_users(n_users);
+
+    if (migrate) {
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        db_layout_use(DB_LAYOUT_HASHED);
+        CHECK_FUNC_ERROR(db_init_db(), GEN_ERR_ANY)
+        CHECK_FUNC_ERROR(db_layout_migrate(), GEN_ERR_ANY)
+        printf("b> migrated to hashed layout in %lld ms\n", elapsed_us(&start) / 1000);
+        read_users(n_users);
+    }
+
+    delete_users(n_users);
+    db_checkpoint();
+    return 0;
+}
@@ -0,0 +1,348 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "DS-Lab-Assignment/util.h"
+#include "DS-Lab-Assignment/trace.h"
+
+/* replays a trace recorded by a server (server -T) against a server, at the original speed, scaled by a factor,
+ * or as fast as it goes (factor 0), then reports throughput and latency per op_code:
+ *     replay [-x <speed factor>] [-c <connections>] <trace file> <host> <port>
+ * CONNECT requests are given the port of a listener of the replay, which drains what the server sends users */
+
+#define REPLAY_CONNECTIONS 16   /* default number of requests in flight at a time */
+#define REPLAY_MAX_OPS 32       /* max number of different op_codes reported */
+#define REPLAY_LATE_US 1000     /* requests sent later than this after their time in the trace are late */
+#define LISTENER_MAX_CONNS 1024 /* max number of server connections drained at a time by the listener */
+
+typedef struct {
+    long long time_us;          /* since the trace started */
+    long long body_size;        /* content size of a SEND_STREAM request, -1 otherwise */
+    int fields_len;
+    char *fields;
+    int reply_code;             /* first byte of the reply, or GEN_ERR_ANY if there was none */
+    long long latency_us;       /* until the first byte of the reply */
+} replay_req_t;
+
+typedef struct {
+    char op_code[32];
+    int n_reqs;
+    int n_replied;
+    int n_errors;               /* requests without a reply or with an error reply */
+    long long *latencies_us;
+} replay_op_t;
+
+replay_req_t *reqs = NULL;
+int n_reqs = 0;
+int next_req = 0;               /* next request to be sent by a replay thread */
+int n_late = 0;
+pthread_mutex_t mutex_replay = PTHREAD_MUTEX_INITIALIZER;
+double speed = 1;
+long long start_us;
+struct sockaddr_in server_addr;
+char listen_port[16];
+char content[STREAM_CHUNK_SIZE];  /* made-up content of streamed messages */
+
+long long now_us(void);
+int load_trace(const char *path);
+int start_listener(void);
+void *listener_thread(void *args);
+int send_request(const replay_req_t *req, long long *first_byte_us);
+void *replay_thread(void *args);
+int cmp_latency(const void *a, const void *b);
+void report(long long elapsed_us);
+
+
+long long now_us(void) {
+    /* monotonic timestamp in microseconds */
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+
+int load_trace(const char *const path) {
+    /* reads every request of a trace into memory, in the order they were received, so that they can be sent
+     * as fast as possible; the port of CONNECT requests (their third field) is replaced with the one of the replay listener */
+    static tr_request_t request;
+    size_t space = 0;
+    long long time_us = 0;
+    int result;
+
+    FILE *trace = tr_open(path);
+    if (!trace) return GEN_ERR_ANY;
+    while ((result = tr_read(trace, &request)) > 0) {
+        if (n_reqs == (int) space) {
+            space = space ? 2 * space : 1024;
+            replay_req_t *new_reqs = realloc(reqs, space * sizeof(replay_req_t));
+            if (!new_reqs) {
+                result = GEN_ERR_ANY;
+                break;
+            }
+            reqs = new_reqs;
+        }
+
+        int len = request.fields_len;
+        char *op_code = request.fields;
+        if (len > 0 && request.fields[len - 1] == '\0' && !strcmp(op_code, CONNECT)) {
+            char *username = op_code + strlen(op_code) + 1;
+            if (username < request.fields + len) {
+                char *port = username + strlen(username) + 1;
+                len = (int) (port - request.fields);
+                memcpy(port, listen_port, strlen(listen_port) + 1);
+                len += (int) strlen(listen_port) + 1;
+            }
+        }
+
+        replay_req_t *req = &reqs[n_reqs];
+        time_us += request.delay_us;
+        req->time_us = time_us;
+        req->body_size = request.body_size;
+        req->fields_len = len;
+        req->fields = malloc(len);
+        if (!req->fields) {
+            result = GEN_ERR_ANY;
+            break;
+        }
+        memcpy(req->fields, request.fields, len);
+
+        /* requests are recorded once served, so one may follow a request received after it: it's moved back
+         * to its place, which is never far */
+        replay_req_t served = *req;
+        int at = n_reqs;
+        while (at > 0 && reqs[at - 1].time_us > served.time_us) {
+            reqs[at] = reqs[at - 1];
+            at--;
+        }
+        reqs[at] = served;
+        n_reqs++;
+    }
+
+    fclose(trace);
+    return result;
+}
+
+
+int start_listener(void) {
+    /* opens the listener the server sends messages to, on a port picked by the OS */
+    int ret_val;    /* needed for error-checking macros */
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof addr;
+    int listen_sd;
+
+    CHECK_FUNC_ERROR_WITH_ERRNO(listen_sd = socket(AF_INET, SOCK_STREAM, 0), GEN_ERR_ANY)
+    bzero(&addr, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    CHECK_SOCK_ERROR(bind(listen_sd, (struct sockaddr *) &addr, sizeof addr), listen_sd)
+    CHECK_SOCK_ERROR(listen(listen_sd, SOMAXCONN), listen_sd)
+    CHECK_SOCK_ERROR(getsockname(listen_sd, (struct sockaddr *) &addr, &addr_len), listen_sd)
+    sprintf(listen_port, "%d", ntohs(addr.sin_port));
+
+    pthread_t listen_th;
+    CHECK_ERROR(pthread_create(&listen_th, NULL, listener_thread, (void *) (long) listen_sd) != 0,
+                "Could not start listener thread", GEN_ERR_ANY)
+    pthread_detach(listen_th);
+    return 0;
+}
+
+
+void *listener_thread(void *args) {
+    /* accepts the connections the server makes to deliver messages and ACKs, and reads them until closed */
+    static struct pollfd poll_fds[1 + LISTENER_MAX_CONNS];
+    char buffer[STREAM_CHUNK_SIZE];
+    int n_conns = 0;
+
+    poll_fds[0] = (struct pollfd) {(int) (long) args, POLLIN, 0};
+    while (TRUE) {
+        if (poll(poll_fds, 1 + n_conns, -1) < 0) continue;
+
+        /* going backwards, the connection moved into a freed slot has been looked at already */
+        for (int i = n_conns; i >= 1; i--) {
+            if (!poll_fds[i].revents) continue;
+            if (read(poll_fds[i].fd, buffer, sizeof buffer) > 0) continue;
+            close(poll_fds[i].fd);
+            poll_fds[i] = poll_fds[n_conns--];
+        }
+
+        if (poll_fds[0].revents && n_conns < LISTENER_MAX_CONNS) {
+            int conn_sd = accept(poll_fds[0].fd, NULL, NULL);
+            if (conn_sd >= 0) poll_fds[++n_conns] = (struct pollfd) {conn_sd, POLLIN, 0};
+        }
+    } // END while
+    return NULL;
+}
+
+
+int send_request(const replay_req_t *req, long long *first_byte_us) {
+    /* makes a request on a new connection, sending a made-up content of the traced size for streams,
+     * and reads the reply until the server closes the connection; returns its first byte */
+    unsigned char reply[STREAM_CHUNK_SIZE];
+    int reply_code = GEN_ERR_ANY;
+
+    int sd = socket(AF_INET, SOCK_STREAM, 0);
+    if (sd < 0) return GEN_ERR_ANY;
+    if (connect(sd, (struct sockaddr *) &server_addr, sizeof server_addr) < 0 ||
+        write_bytes(sd, req->fields, req->fields_len) < 0) {
+        close(sd);
+        return GEN_ERR_ANY;
+    }
+
+    /* stream content is sent in frames; a 0-length frame ends it */
+    long long pos = 0;
+    while (req->body_size >= 0) {
+        int frame_len = (req->body_size - pos < STREAM_CHUNK_SIZE) ? (int) (req->body_size - pos) : STREAM_CHUNK_SIZE;
+        char len_str[16]; sprintf(len_str, "%d", frame_len);
+        if (write_bytes(sd, len_str, (int) strlen(len_str) + 1) < 0 ||
+            (frame_len && write_bytes(sd, content, frame_len) < 0)) {
+            close(sd);
+            return GEN_ERR_ANY;
+        }
+        if (!frame_len) break;
+        pos += frame_len;
+    }
+
+    ssize_t bytes_read;
+    while ((bytes_read = read(sd, reply, sizeof reply)) > 0)
+        if (reply_code < 0) {
+            reply_code = reply[0];
+            *first_byte_us = now_us();
+        }
+
+    close(sd);
+    return reply_code;
+}
+
+
+void *replay_thread(void *args) {
+    /* sends the next request not sent yet, at its time in the trace scaled by the speed factor, until there
+     * are none left; a request is late if every replay thread was busy at its time */
+    while (TRUE) {
+        pthread_mutex_lock(&mutex_replay);
+        int i = next_req++;
+        pthread_mutex_unlock(&mutex_replay);
+        if (i >= n_reqs) return NULL;
+        replay_req_t *req = &reqs[i];
+
+        if (speed > 0) {
+            long long send_us = start_us + (long long) ((double) req->time_us / speed);
+            long long wait_us = send_us - now_us();
+            if (wait_us > 0) {
+                struct timespec wait = {wait_us / 1000000, (wait_us % 1000000) * 1000};
+                nanosleep(&wait, NULL);
+            } else if (wait_us < -REPLAY_LATE_US) {
+                pthread_mutex_lock(&mutex_replay);
+                n_late++;
+                pthread_mutex_unlock(&mutex_replay);
+            }
+        }
+
+        long long sent_us = now_us();
+        long long first_byte_us = sent_us;
+        req->reply_code = send_request(req, &first_byte_us);
+        req->latency_us = first_byte_us - sent_us;
+    } // END while
+}
+
+
+int cmp_latency(const void *a, const void *b) {
+    /* order of latencies for qsort */
+    long long latency_a = *(const long long *) a, latency_b = *(const long long *) b;
+    return (latency_a > latency_b) - (latency_a < latency_b);
+}
+
+
+void report(const long long elapsed_us) {
+    /* prints throughput, and latency percentiles (in us) per op_code */
+    static replay_op_t ops[REPLAY_MAX_OPS];
+    int n_ops = 0, n_failed = 0;
+
+    for (int i = 0; i < n_reqs; i++) {
+        const char *op_code = reqs[i].fields_len ? reqs[i].fields : "";
+        int op = 0;
+        while (op < n_ops && strcmp(ops[op].op_code, op_code) != 0) op++;
+        if (op == n_ops) {
+            if (n_ops == REPLAY_MAX_OPS) continue;
+            snprintf(ops[op].op_code, sizeof ops[op].op_code, "%s", op_code);
+            ops[op].latencies_us = malloc(n_reqs * sizeof(long long));
+            if (!ops[op].latencies_us) continue;
+            n_ops++;
+        }
+
+        if (reqs[i].reply_code != SRV_SUCCESS) ops[op].n_errors++;
+        if (reqs[i].reply_code < 0) n_failed++;
+        else ops[op].latencies_us[ops[op].n_replied++] = reqs[i].latency_us;
+        ops[op].n_reqs++;
+    }
+
+    printf("r> replayed %d requests in %lld ms: %.0f requests/s (%d without reply, %d sent late)\n", n_reqs,
+           elapsed_us / 1000, elapsed_us ? (double) n_reqs * 1000000 / (double) elapsed_us : 0.0, n_failed, n_late);
+    printf("r> %-16s %8s %8s %10s %10s %10s %10s\n", "op_code", "requests", "errors", "p50 us", "p90 us",
+           "p99 us", "max us");
+    for (int op = 0; op < n_ops; op++) {
+        int n_replied = ops[op].n_replied;
+        long long *latencies_us = ops[op].latencies_us;
+        qsort(latencies_us, n_replied, sizeof(long long), cmp_latency);
+#define PERCENTILE(P) (n_replied ? latencies_us[(n_replied - 1) * (P) / 100] : 0)
+        printf("r> %-16s %8d %8d %10lld %10lld %10lld %10lld\n", ops[op].op_code, ops[op].n_reqs, ops[op].n_errors,
+               PERCENTILE(50), PERCENTILE(90), PERCENTILE(99), PERCENTILE(100));
+#undef PERCENTILE
+    }
+}
+
+
+int main(int argc, char **argv) {
+    int ret_val;    /* needed for error-checking macros */
+    int n_conns = REPLAY_CONNECTIONS;
+    int server_port = -1;
+    int opt;
+    while ((opt = getopt(argc, argv, "x:c:")) != -1) {
+        switch (opt) {
+            case 'x':
+                speed = strtod(optarg, NULL);
+                CHECK_ARGS(speed < 0, "Invalid Speed Factor")
+                break;
+            case 'c':
+                CHECK_ARGS((str_to_num(optarg, (void *) &n_conns, INT) < 0 || n_conns <= 0), "Invalid Connections")
+                break;
+            default:
+                fprintf(stderr, "Usage: replay [-x <speed factor, 0 for max>] [-c <connections>] "
+                                "<trace file> <host> <port>\n");
+                return GEN_ERR_INV_ARGS;
+        }
+    }
+    if (argc - optind != 3 || str_to_num(argv[optind + 2], (void *) &server_port, INT) < 0) {
+        fprintf(stderr, "Usage: replay [-x <speed factor, 0 for max>] [-c <connections>] "
+                        "<trace file> <host> <port>\n");
+        return GEN_ERR_INV_ARGS;
+    }
+
+    struct hostent *server_host = gethostbyname(argv[optind + 1]);
+    CHECK_ERROR(!server_host, "Unknown server host", GEN_ERR_ANY)
+    bzero(&server_addr, sizeof server_addr);
+    server_addr.sin_family = AF_INET;
+    memcpy(&server_addr.sin_addr, server_host->h_addr_list[0], server_host->h_length);
+    server_addr.sin_port = htons(server_port);
+
+    signal(SIGPIPE, SIG_IGN);
+    memset(content, 'x', sizeof content);
+    CHECK_FUNC_ERROR(start_listener(), GEN_ERR_ANY)
+    CHECK_FUNC_ERROR(load_trace(argv[optind]), GEN_ERR_ANY)
+
+    pthread_t *threads = malloc(n_conns * sizeof(pthread_t));
+    CHECK_ERROR(!threads, "Out of memory", GEN_ERR_ANY)
+    start_us = now_us();
+    for (int i = 0; i < n_conns; i++) pthread_create(&threads[i], NULL, replay_thread, NULL);
+    for (int i = 0; i < n_conns; i++) pthread_join(threads[i], NULL);
+
+    report(now_us() - start_us);
+    return 0;
+}
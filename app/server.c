@@ -1,3 +1,4 @@
+#define _GNU_SOURCE     /* needed for struct ucred */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,26 +11,39 @@
 #include <arpa/inet.h>
 #include <pthread.h>
 #include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
 #include "DS-Lab-Assignment/netUtil.h"
+#include "DS-Lab-Assignment/admission.h"
+#include "DS-Lab-Assignment/scheduler.h"
+#include "DS-Lab-Assignment/reaper.h"
+#include "DS-Lab-Assignment/heartbeat.h"
+#include "DS-Lab-Assignment/replication.h"
+#include "DS-Lab-Assignment/cluster.h"
+#include "DS-Lab-Assignment/handoff.h"
+#include "DS-Lab-Assignment/trace.h"
 #include "DS-Lab-Assignment/dbms/dbms.h"
+#include "DS-Lab-Assignment/dbms/dbmsEngine.h"
 #include "DS-Lab-Assignment/services.h"
 
 /* prototypes */
 void *service_thread(void *args);
 void set_server_error_code_std(reply_t *reply, int req_error_code);
+void request_drain(int signal);
+void queue_conn(int client_sd, int class);
+void drain_server(int server_sd, int unix_sd);
 
 
-/* connection queue */
-int conn_q[MAX_CONN_BACKLOG];   /* array of client sockets; used as a connection queue */
-int conn_q_size = 0;            /* current number of backlogged connections */
-int service_th_pos = 0;         /* connection queue position used by service threads to handle connections */
+/* connections are queued by request class (see scheduler.h); accepted connections whose op_code
+ * hasn't arrived yet wait here, so that they can be classified, for up to SCHED_PEEK_MS */
+int peek_sd[MAX_CONN_BACKLOG];
+long long peek_deadline_ms[MAX_CONN_BACKLOG];
+int n_peek = 0;
 
 #define THREAD_POOL_SIZE 5      /* max number of service threads running */
 
-/* mutex and cond vars for conn_q access */
-pthread_mutex_t mutex_conn_q;
-pthread_cond_t cond_conn_q_not_empty;
-pthread_cond_t cond_conn_q_not_full;
+int drain_pipe[2];      /* written to by the SIGTERM handler, to wake the main thread up */
 
 pthread_mutex_t mutex_db;                   /* mutex for atomic operations on the DB */
 pthread_attr_t th_attr;                     /* service thread attributes */
@@ -48,47 +62,67 @@ void set_server_error_code_std(reply_t *reply, const int req_error_code) {
 
 void *service_thread(void *args) {
     while (TRUE) {
-        int client_socket;
-
-        /* copy client socket descriptor from connection queue */
-        pthread_mutex_lock(&mutex_conn_q);
-
-        /* there are no connections to handle, so sleep */
-        while (conn_q_size == 0)
-            pthread_cond_wait(&cond_conn_q_not_empty, &mutex_conn_q);
-
-        /* deque client socket descriptor */
-        client_socket = conn_q[service_th_pos];
-        service_th_pos = (service_th_pos + 1) % MAX_CONN_BACKLOG;
-        conn_q_size -= 1;
-
-        /* signal that there is space for new connections */
-        if (conn_q_size == MAX_CONN_BACKLOG - 1) pthread_cond_signal(&cond_conn_q_not_full);
-
-        pthread_mutex_unlock(&mutex_conn_q);
+        /* take the next job: a connection or a background task; sleeps if there are none */
+        sched_job_t job;
+        sched_take(&job);
+        if (job.socket < 0) {
+            job.task(job.args);
+            sched_done(&job);
+            continue;
+        }
+        int client_socket = job.socket;
 
         /* handle connection now
-         * receive op_code */
-        request_t request;
-        if (recv_string(client_socket, request.op_code) == -1) continue;
-
-        if (!strcmp(request.op_code, REGISTER))
-            srv_register(client_socket, &request);
-        else if (!strcmp(request.op_code, UNREGISTER))
-            srv_unregister(client_socket, &request);
-        else if (!strcmp(request.op_code, CONNECT))
-            srv_connect(client_socket, &request);
-        else if (!strcmp(request.op_code, DISCONNECT))
-            srv_disconnect(client_socket, &request);
-        else if (!strcmp(request.op_code, SEND))
-            srv_send(client_socket, &request);
+         * receive op_code; request fields are parsed in place in the connection buffer */
+        conn_t conn;
+        slice_t op_code;
+        rp_watch_t watch;
+        conn_init(&conn, client_socket);
+        rp_watch(&watch, client_socket);    /* a client that stalls is reaped, so it can't hold this thread */
+        conn.watch = &watch;
+        long long trace_time_us = tr_clock();
+
+        if (recv_slice(&conn, &op_code) >= 0) {
+            /* once served, the parsed part of the connection buffer holds the request fields, unless it was
+             * released: streams trace themselves, and requests sent over node links are traced by the node
+             * they were made to */
+            int traced = tr_enabled() && strcmp(op_code.ptr, SEND_STREAM) != 0 && strcmp(op_code.ptr, NODE_LINK) != 0;
+
+            if (!strcmp(op_code.ptr, REGISTER))
+                srv_register(&conn);
+            else if (!strcmp(op_code.ptr, UNREGISTER))
+                srv_unregister(&conn);
+            else if (!strcmp(op_code.ptr, CONNECT))
+                srv_connect(&conn);
+            else if (!strcmp(op_code.ptr, DISCONNECT))
+                srv_disconnect(&conn);
+            else if (!strcmp(op_code.ptr, SEND))
+                srv_send(&conn);
+            else if (!strcmp(op_code.ptr, SEND_STREAM))
+                srv_send_stream(&conn);
+            else if (!strcmp(op_code.ptr, SEND_EXT))
+                srv_send_ext(&conn);
+            else if (!strcmp(op_code.ptr, CONNECTEDUSERS))
+                srv_connected_users(&conn);
+            else if (!strcmp(op_code.ptr, HISTORY))
+                srv_history(&conn);
+            else if (!strcmp(op_code.ptr, NODE_LINK))
+                srv_node_link(&conn);
+
+            if (traced) tr_record(trace_time_us, conn.buffer, conn.start, -1);
+        }
+
+        rp_unwatch(&watch);
+        close(client_socket);
+        sched_done(&job);
     } // end outer while
 }
 
 
 void shutdown_server() {
     /* destroy server resources before shutting it down */
-    pthread_mutex_destroy(&mutex_conn_q);
+    db_engine->dur_flush();
+    tr_flush();
     pthread_mutex_destroy(&mutex_db);
     pthread_attr_destroy(&th_attr);
     fprintf(stderr, "Shutting down server\n");
@@ -96,29 +130,157 @@ void shutdown_server() {
 }
 
 
+void request_drain(int signal) {
+    /* SIGTERM: the main thread drains the server and shuts it down */
+    char byte = (char) signal;
+    if (write(drain_pipe[1], &byte, 1) < 0) return;
+}
+
+
+void queue_conn(const int client_sd, const int class) {
+    /* queue a connection to be served by a service thread; if its queue is full, the client is told to retry */
+    if (sched_put_conn(client_sd, class) < 0) {
+        send_busy_reply(client_sd, ADM_RETRY_AFTER_MS);
+        close(client_sd);
+    }
+}
+
+
+void drain_server(const int server_sd, const int unix_sd) {
+    /* graceful shutdown: stop accepting connections, wait for backlogged and in-flight ones to be handled,
+     * then leave the DB ready for the next server; a listening socket handed over stays open in the new one */
+    close(server_sd);
+    if (unix_sd >= 0) close(unix_sd);
+
+    /* connections still being classified are served as well */
+    while (n_peek > 0) queue_conn(peek_sd[--n_peek], SCHED_MESSAGE);
+
+    int jobs_left = sched_drain(DRAIN_TIMEOUT_MS);
+    if (jobs_left) {
+        printf("s> drain timed out: %d jobs dropped\n", jobs_left); fflush(stdout);
+    }
+
+    /* the next server recovers the DB from the checkpoint */
+    db_engine->checkpoint();
+    db_engine->dur_flush();
+    tr_flush();
+    printf("s> drained: shutting down server\n"); fflush(stdout);
+    exit(0);
+}
+
+
 int main(int argc, char **argv) {
     int ret_val;    /* needed for error-checking macros */
     struct hostent *server_host;
     struct in_addr server_in;
     struct sockaddr_in server_addr, client_addr;
     socklen_t addr_size = sizeof(struct sockaddr_in);
-    int server_sd, client_sd;
+    int server_sd, client_sd, unix_sd = -1;
     int val = 1;
 
-    if (argc != 3 || strcmp(argv[1], "-p") != 0) {
-        fprintf(stderr, "Usage: server -p <port>\n");
+    /* parse server options */
+    int server_port = -1;
+    char dur_policy = DUR_NONE;     /* durability policy for DB writes */
+    int msg_ttl = MSG_TTL_DEFAULT;  /* default time to live of pending messages */
+    int hb_interval = HB_INTERVAL;  /* time between listening thread heartbeats */
+    int repl_port = -1;             /* port where standby servers connect, if any */
+    const char *primary = NULL;     /* "host:port" of the primary server if this one is a standby */
+    const char *cluster = NULL;     /* "host:port" of every node, comma-separated, in cluster mode */
+    int node = 0;                   /* position of this server in the cluster node list */
+    const char *ho_path = NULL;     /* handoff socket path, for graceful restarts */
+    const char *unix_path = NULL;   /* Unix socket path also listened on, for clients on this host */
+    char layout = DB_LAYOUT_FLAT;   /* user table layout asked for: a flat DB asked to be hashed is migrated */
+    int history = FALSE;            /* delivered messages are kept in the message history */
+    const char *trace_path = NULL;  /* trace file the requests are recorded to, if any */
+    int idle_timeout = CONN_IDLE_TIMEOUT_MS;        /* time a client may stall a request, 0 for no limit */
+    int request_timeout = CONN_REQUEST_TIMEOUT_MS;  /* time a client has to send a request, 0 for no limit */
+    int opt;
+    while ((opt = getopt(argc, argv, "p:d:t:b:r:s:c:n:Hu:e:l:L:T:i:q:")) != -1) {
+        switch (opt) {
+            case 'p':
+                CHECK_ARGS((str_to_num(optarg, (void *) &server_port, INT) < 0), "Invalid Port")
+                break;
+            case 'd':
+                CHECK_ARGS((db_dur_parse_policy(optarg, &dur_policy) < 0), "Invalid Durability Policy")
+                break;
+            case 't':
+                CHECK_ARGS((str_to_num(optarg, (void *) &msg_ttl, INT) < 0 || msg_ttl < 0), "Invalid Message TTL")
+                break;
+            case 'b':
+                CHECK_ARGS((str_to_num(optarg, (void *) &hb_interval, INT) < 0 || hb_interval < 0),
+                           "Invalid Heartbeat Interval")
+                break;
+            case 'r':
+                CHECK_ARGS((str_to_num(optarg, (void *) &repl_port, INT) < 0), "Invalid Replication Port")
+                break;
+            case 's':
+                primary = optarg;
+                break;
+            case 'c':
+                cluster = optarg;
+                break;
+            case 'n':
+                CHECK_ARGS((str_to_num(optarg, (void *) &node, INT) < 0), "Invalid Node Index")
+                break;
+            case 'H':
+                history = TRUE;
+                break;
+            case 'u':
+                ho_path = optarg;
+                break;
+            case 'e':
+                CHECK_ARGS((db_use_engine(optarg) < 0), "Invalid Storage Engine")
+                break;
+            case 'l':
+                unix_path = optarg;
+                break;
+            case 'L':
+                CHECK_ARGS((db_layout_parse(optarg, &layout) < 0), "Invalid User Table Layout")
+                db_layout_use(layout);
+                break;
+            case 'T':
+                trace_path = optarg;
+                break;
+            case 'i':
+                CHECK_ARGS((str_to_num(optarg, (void *) &idle_timeout, INT) < 0 || idle_timeout < 0),
+                           "Invalid Idle Timeout")
+                break;
+            case 'q':
+                CHECK_ARGS((str_to_num(optarg, (void *) &request_timeout, INT) < 0 || request_timeout < 0),
+                           "Invalid Request Timeout")
+                break;
+            default:
+                fprintf(stderr, "Usage: server -p <port> [-d none|periodic|group] [-t <ttl>] [-b <heartbeat>] [-H]\n"
+                                "              [-r <replication port>] [-s <primary host>:<replication port>]\n"
+                                "              [-c <host>:<port>,<host>:<port>,... -n <node index>]\n"
+                                "              [-u <handoff socket path>] [-e dir|mem] [-l <unix socket path>]\n"
+                                "              [-L flat|hashed] [-T <trace file>] [-i <idle timeout>] [-q <request timeout>]\n");
+                return GEN_ERR_INV_ARGS;
+        }
+    }
+
+    if (server_port < 0 || optind != argc) {
+        fprintf(stderr, "Usage: server -p <port> [-d none|periodic|group] [-t <ttl>] [-b <heartbeat>] [-H]\n"
+                        "              [-r <replication port>] [-s <primary host>:<replication port>]\n"
+                        "              [-c <host>:<port>,<host>:<port>,... -n <node index>]\n"
+                        "              [-u <handoff socket path>] [-e dir|mem] [-l <unix socket path>]\n"
+                        "              [-L flat|hashed] [-T <trace file>] [-i <idle timeout>] [-q <request timeout>]\n");
         return GEN_ERR_INV_ARGS;
     }
 
-    int server_port;
-    CHECK_ARGS((str_to_num(argv[2], (void *) &server_port, INT) < 0), "Invalid Port")
+    /* graceful restart: take the listening socket over from the server running at the handoff socket, if any,
+     * once it has drained its work and exited; connections meanwhile wait in the listen backlog */
+    server_sd = -1;
+    if (ho_path) {
+        int took_over;
+        CHECK_FUNC_ERROR(took_over = ho_take_over(ho_path, &server_sd), GEN_ERR_ANY)
+        if (took_over) {
+            printf("s> took over listening socket from previous server\n"); fflush(stdout);
+        }
+    }
 
-    /* set up connection queue */
-    pthread_mutex_init(&mutex_conn_q, NULL);
-    pthread_cond_init(&cond_conn_q_not_empty, NULL);
-    pthread_cond_init(&cond_conn_q_not_full, NULL);
-    /* conn_q position used by main thread to enqueue connections */
-    int producer_pos = 0;
+    /* set up connection queues */
+    sched_init(THREAD_POOL_SIZE);
 
     /* make service threads detached */
     pthread_attr_init(&th_attr);
@@ -133,21 +295,76 @@ int main(int argc, char **argv) {
     sigemptyset(&keyboard_interrupt.sa_mask);
     sigaction(SIGINT, &keyboard_interrupt, NULL);
 
+    /* a listening thread that goes away in the middle of a transfer must not kill the server */
+    signal(SIGPIPE, SIG_IGN);
+
+    /* set up SIGTERM signal handler to drain the server before shutting it down */
+    CHECK_FUNC_ERROR_WITH_ERRNO(pipe(drain_pipe), GEN_ERR_ANY)
+    struct sigaction terminate;
+    terminate.sa_handler = request_drain;
+    terminate.sa_flags = 0;
+    sigemptyset(&terminate.sa_mask);
+    sigaction(SIGTERM, &terminate, NULL);
+
+    /* in cluster mode, users are spread across nodes */
+    if (cluster) {
+        CHECK_FUNC_ERROR(cl_init(cluster, node), GEN_ERR_ANY)
+    }
+
     /* set up DB */
-    CHECK_FUNC_ERROR(db_init_db(), GEN_ERR_ANY)
+    printf("s> storage engine: %s\n", db_engine->name); fflush(stdout);
+    CHECK_FUNC_ERROR(db_engine->init_db(), GEN_ERR_ANY)
+    CHECK_FUNC_ERROR(db_engine->recover(server_sd >= 0), GEN_ERR_ANY)
+    CHECK_FUNC_ERROR(db_engine->hist_init(history), GEN_ERR_ANY)
+
+    /* a standby keeps a copy of the primary's DB, and only starts serving once the primary is lost */
+    if (primary) {
+        CHECK_FUNC_ERROR(repl_standby_run(primary), GEN_ERR_ANY)
+    }
+    if (repl_port >= 0) {
+        CHECK_FUNC_ERROR(repl_primary_init(repl_port), GEN_ERR_ANY)
+    }
 
-    /* get server up & running */
-    CHECK_FUNC_ERROR_WITH_ERRNO(server_sd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP), GEN_ERR_ANY)
-    CHECK_SOCK_ERROR(setsockopt(server_sd, SOL_SOCKET, SO_REUSEADDR,
-                                (char *) &val,sizeof(int)), server_sd)
+    CHECK_FUNC_ERROR(db_engine->dur_init(dur_policy), GEN_ERR_ANY)
+    CHECK_FUNC_ERROR(db_engine->exp_init(msg_ttl, srv_notify_expired), GEN_ERR_ANY)
+    CHECK_FUNC_ERROR(hb_init(hb_interval), GEN_ERR_ANY)
+    CHECK_FUNC_ERROR(rp_init(idle_timeout, request_timeout), GEN_ERR_ANY)
+    if (trace_path) {
+        CHECK_FUNC_ERROR(tr_init(trace_path), GEN_ERR_ANY)
+    }
 
-    bzero((char *) &server_addr, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = INADDR_ANY;
-    server_addr.sin_port = htons(server_port);
+    /* get server up & running, unless its listening socket has been taken over */
+    if (server_sd < 0) {
+        CHECK_FUNC_ERROR_WITH_ERRNO(server_sd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP), GEN_ERR_ANY)
+        CHECK_SOCK_ERROR(setsockopt(server_sd, SOL_SOCKET, SO_REUSEADDR,
+                                    (char *) &val,sizeof(int)), server_sd)
+
+        bzero((char *) &server_addr, sizeof(server_addr));
+        server_addr.sin_family = AF_INET;
+        server_addr.sin_addr.s_addr = INADDR_ANY;
+        server_addr.sin_port = htons(server_port);
+
+        /* a standby taking over may have to wait for the port of the lost primary to be freed */
+        struct timespec bind_retry = {0, REPL_BIND_RETRY_MS * 1000000L};
+        int bind_tries = primary ? REPL_BIND_TRIES : 1;
+        while ((ret_val = bind(server_sd, (struct sockaddr *) &server_addr, sizeof server_addr)) < 0 &&
+               errno == EADDRINUSE && --bind_tries > 0)
+            nanosleep(&bind_retry, NULL);
+        CHECK_SOCK_ERROR(ret_val, server_sd)
+        CHECK_SOCK_ERROR(listen(server_sd, LISTEN_BACKLOG), server_sd)
+    }
 
-    CHECK_SOCK_ERROR(bind(server_sd, (struct sockaddr *) &server_addr, sizeof server_addr), server_sd)
-    CHECK_SOCK_ERROR(listen(server_sd, LISTEN_BACKLOG), server_sd)
+    /* a new server started with the same handoff socket path takes this one over */
+    int ho_socket = -1;
+    if (ho_path) {
+        CHECK_FUNC_ERROR(ho_socket = ho_listen(ho_path), GEN_ERR_ANY)
+    }
+
+    /* clients on this host may skip TCP, connecting through a Unix socket; it isn't handed over, the next
+     * server binds the path again */
+    if (unix_path) {
+        CHECK_FUNC_ERROR(unix_sd = unix_listen(unix_path), GEN_ERR_ANY)
+    }
 
     /* now create thread pool */
     for (int i = 0; i < THREAD_POOL_SIZE; i++) {
@@ -163,26 +380,85 @@ int main(int argc, char **argv) {
 
     printf("s> init server %s:%i\n", inet_ntoa(server_in), server_port); fflush(stdout);
 
+    /* listening sockets, drain pipe and handoff socket, followed by the connections being classified */
+    struct pollfd poll_fds[4 + MAX_CONN_BACKLOG] = {{server_sd, POLLIN, 0}, {drain_pipe[0], POLLIN, 0},
+                                                    {ho_socket, POLLIN, 0}, {unix_sd, POLLIN, 0}};
     while (TRUE) {      /* main server loop: accept connections from clients and queue them */
-        CHECK_FUNC_ERROR_WITH_ERRNO(client_sd = accept(server_sd, (struct sockaddr *) &client_addr,
-                &addr_size), -1)
-
-        /* add connection to conn_q backlog */
-        pthread_mutex_lock(&mutex_conn_q);
-
-        /* if the connection queue is full, the main server thread sleeps:
-         * no new connections can be opened until one is processed */
-        while (conn_q_size == MAX_CONN_BACKLOG)
-            pthread_cond_wait(&cond_conn_q_not_full, &mutex_conn_q);
-
-        /* enqueue new connection */
-        conn_q[producer_pos] = client_sd;
-        producer_pos = (producer_pos + 1) % MAX_CONN_BACKLOG;
-        conn_q_size += 1;
-
-        /* signal that there are connections to handle */
-        if (conn_q_size == 1) pthread_cond_signal(&cond_conn_q_not_empty);
-
-        pthread_mutex_unlock(&mutex_conn_q);
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long long now_ms = now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+        int timeout_ms = -1;
+        for (int i = 0; i < n_peek; i++) {
+            poll_fds[4 + i] = (struct pollfd) {peek_sd[i], POLLIN, 0};
+            int peek_left_ms = (peek_deadline_ms[i] > now_ms) ? (int) (peek_deadline_ms[i] - now_ms) : 0;
+            if (timeout_ms < 0 || peek_left_ms < timeout_ms) timeout_ms = peek_left_ms;
+        }
+
+        if (poll(poll_fds, 4 + n_peek, timeout_ms) < 0) {
+            if (errno == EINTR) continue;
+            CHECK_ERROR_WITH_ERRNO(TRUE, "Server poll error", GEN_ERR_ANY)
+        }
+
+        /* a new server is taking over: pass it the listening socket, then drain this one */
+        if (poll_fds[2].revents && ho_hand_over(ho_socket, server_sd) >= 0) {
+            printf("s> handing over to new server: draining\n"); fflush(stdout);
+            drain_server(server_sd, unix_sd);
+        }
+        /* SIGTERM */
+        if (poll_fds[1].revents) {
+            printf("s> draining\n"); fflush(stdout);
+            if (ho_path) unlink(ho_path);
+            if (unix_path) unlink(unix_path);
+            drain_server(server_sd, unix_sd);
+        }
+
+        /* queue the connections whose op_code has arrived, and those that have waited too long for it;
+         * going backwards, the connection moved into a freed slot has been looked at already */
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        now_ms = now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+        for (int i = n_peek - 1; i >= 0; i--) {
+            int class = poll_fds[4 + i].revents ? sched_classify(peek_sd[i]) : GEN_ERR_ANY;
+            if (class < 0 && peek_deadline_ms[i] <= now_ms) class = SCHED_MESSAGE;
+            if (class < 0) continue;
+            queue_conn(peek_sd[i], class);
+            n_peek -= 1;
+            peek_sd[i] = peek_sd[n_peek];
+            peek_deadline_ms[i] = peek_deadline_ms[n_peek];
+        }
+
+        /* admission control: instead of making every client wait while the connection queues
+         * are full, connections are shed with a busy reply telling the client when to retry;
+         * past ADM_QUEUE_HIGH connections, clients that have been opening the most are shed first */
+        int retry_after_ms;
+        if (poll_fds[0].revents) {
+            CHECK_FUNC_ERROR_WITH_ERRNO(client_sd = accept(server_sd, (struct sockaddr *) &client_addr,
+                    &addr_size), -1)
+            retry_after_ms = adm_admit_ip(client_addr.sin_addr, sched_depth() + n_peek);
+        } else if (poll_fds[3].revents) {
+            /* clients connected through the Unix socket are admitted by the user running them */
+            CHECK_FUNC_ERROR_WITH_ERRNO(client_sd = accept(unix_sd, NULL, NULL), -1)
+            struct ucred cred;
+            socklen_t cred_len = sizeof cred;
+            if (getsockopt(client_sd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) < 0) {
+                perror("Could not get Unix socket peer credentials");
+                close(client_sd);
+                continue;
+            }
+            retry_after_ms = adm_admit_local(cred.uid, sched_depth() + n_peek);
+        } else continue;
+        if (retry_after_ms) {
+            send_busy_reply(client_sd, retry_after_ms);
+            close(client_sd);
+            continue;
+        }
+
+        /* queue new connection by the class of its request, once its op_code has arrived */
+        int class = sched_classify(client_sd);
+        if (class >= 0) queue_conn(client_sd, class);
+        else if (n_peek < MAX_CONN_BACKLOG) {
+            peek_sd[n_peek] = client_sd;
+            peek_deadline_ms[n_peek] = now_ms + SCHED_PEEK_MS;
+            n_peek += 1;
+        } else queue_conn(client_sd, SCHED_MESSAGE);
     } // END while
 }
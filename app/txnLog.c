@@ -0,0 +1,61 @@
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "DS-Lab-Assignment/util.h"
+#include "DS-Lab-Assignment/dbms/dbmsTxn.h"
+
+/* writes the transaction log record of a message stored for a user to a log slot of a stopped server, as a
+ * server that crashed before applying the transaction would have left it, so that recovery can be tested;
+ * with -t, the record is torn: its last byte is cut off, as if the crash happened while it was written:
+ *     txnlog [-t] <log slot> <sender> <recipient> <msg id> <content> */
+
+
+int main(int argc, char **argv) {
+    int ret_val;    /* needed for error-checking macros */
+    int torn = FALSE;
+    unsigned int msg_id;
+    int opt;
+    while ((opt = getopt(argc, argv, "t")) != -1) {
+        switch (opt) {
+            case 't':
+                torn = TRUE;
+                break;
+            default:
+                fprintf(stderr, "Usage: txnlog [-t] <log slot> <sender> <recipient> <msg id> <content>\n");
+                return GEN_ERR_INV_ARGS;
+        }
+    }
+    if (argc - optind != 5 || str_to_num(argv[optind + 3], (void *) &msg_id, UINT) < 0) {
+        fprintf(stderr, "Usage: txnlog [-t] <log slot> <sender> <recipient> <msg id> <content>\n");
+        return GEN_ERR_INV_ARGS;
+    }
+    const char *sender = argv[optind + 1], *recipient = argv[optind + 2], *content = argv[optind + 4];
+    CHECK_ARGS(strlen(sender) >= MAX_STR_SIZE || strlen(recipient) >= MAX_STR_SIZE, "Invalid Username")
+    CHECK_ARGS(strlen(content) >= MAX_MSG_SIZE, "Invalid Content")
+
+    /* the writes of SEND storing a message for a disconnected user: its last message ID, then the message */
+    txn_write_t writes[2];
+    bzero(writes, sizeof writes);
+    writes[0].op = DB_MUT_PUT;
+    writes[0].mode = MODIFY;
+    strcpy(writes[0].entry.username, recipient);
+    writes[0].entry.type = ENT_TYPE_UD;
+    writes[0].entry.user.status = STATUS_DCN;
+    writes[0].entry.user.last_msg_id = msg_id;
+    writes[1].op = DB_MUT_PUT;
+    writes[1].mode = CREATE;
+    strcpy(writes[1].entry.username, recipient);
+    writes[1].entry.type = ENT_TYPE_P_MSG;
+    strcpy(writes[1].entry.msg.sender, sender);
+    writes[1].entry.msg.id = msg_id;
+    strcpy(writes[1].entry.msg.content, content);
+
+    int log_fd;
+    CHECK_FUNC_ERROR_WITH_ERRNO(log_fd = open(argv[optind], O_WRONLY | O_CREAT | O_TRUNC, 0600), GEN_ERR_ANY)
+    int len = db_txn_log_record(log_fd, writes, 2);
+    if (len >= 0 && torn) len = ftruncate(log_fd, len - 1);
+    close(log_fd);
+    return len < 0 ? GEN_ERR_ANY : 0;
+}
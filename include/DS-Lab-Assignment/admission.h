@@ -0,0 +1,14 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <sys/types.h>
+#include <netinet/in.h>
+#include "DS-Lab-Assignment/util.h"
+
+/**** Admission Control Functions: return 0 if the request is admitted,
+ * or the number of milliseconds the client should wait before retrying ****/
+int adm_admit_ip(struct in_addr ip, int queue_depth);
+int adm_admit_local(uid_t uid, int queue_depth);
+int adm_admit_user(const char *username, int socket);
+
+#endif //ADMISSION_H
@@ -0,0 +1,69 @@
+#ifndef CHAT_CLIENT_H
+#define CHAT_CLIENT_H
+
+#include <stddef.h>
+#include "DS-Lab-Assignment/util.h"
+
+#define CC_MAX_IN_FLIGHT 8              /* requests sent to the server at the same time; the rest are queued */
+#define CC_REQUEST_TIMEOUT_MS 10000     /* time a request may take, from connecting to the whole reply */
+#define CC_RECV_CHUNK_SIZE 4096         /* bytes read from a socket at a time */
+
+/**** Client Library Error Codes: Results Of Requests With No Server Reply ****/
+#define CC_ERR_IO -10           /* request couldn't be sent, or its reply couldn't be received */
+#define CC_ERR_TIMEOUT -11      /* request took longer than CC_REQUEST_TIMEOUT_MS */
+#define CC_ERR_CLOSED -12       /* client destroyed before the request was done */
+
+typedef struct cc_client cc_client_t;
+typedef struct cc_future cc_future_t;
+
+typedef struct {
+    /*** Result Of A Request ***/
+    int status;                     /* server reply code (SRV_SUCCESS, SRV_ERR_...), or CC_ERR_... */
+    unsigned int msg_id;            /* send requests: ID given to the message */
+    int retry_after_ms;             /* SRV_ERR_BUSY: time to wait before retrying */
+    char node_addr[MAX_STR_SIZE];   /* SRV_ERR_REDIRECT: "host:port" of the node the user lives in */
+    char *users;                    /* CONNECTEDUSERS: usernames, each one '\0'-terminated; */
+    size_t users_len;               /* HISTORY: messages, each one made of 5 '\0'-terminated fields */
+    size_t n_users;
+} cc_result_t;
+
+/* called once per request, in the client thread; the result is only valid during the call */
+typedef void (*cc_done_cb)(const cc_result_t *result, void *args);
+
+typedef struct {
+    /*** Callbacks For Services Served By The Client Listening Socket; any of them may be NULL;
+     * called in the client thread, with arguments only valid during the call ***/
+    void (*on_message)(const char *sender, unsigned int msg_id, const char *content, size_t len, void *args);
+    void (*on_ack)(unsigned int msg_id, void *args);     /* also once per ACK of a SEND_MESS_ACKS batch */
+    void (*on_expired)(unsigned int msg_id, const char *recipient, void *args);
+    void *args;
+} cc_listener_t;
+
+/**** Client Functions: A Host Starting With '/' Is The Unix Socket Path Of A Server On This Host ****/
+cc_client_t *cc_create(const char *host, int port, const cc_listener_t *listener);
+void cc_destroy(cc_client_t *client);
+int cc_listen_port(const cc_client_t *client);
+
+/**** Requests: Queued Right Away, Their Callback Is Called Once They Are Done ****/
+int cc_register(cc_client_t *client, const char *username, cc_done_cb done, void *args);
+int cc_unregister(cc_client_t *client, const char *username, cc_done_cb done, void *args);
+int cc_connect(cc_client_t *client, const char *username, cc_done_cb done, void *args);
+int cc_disconnect(cc_client_t *client, const char *username, cc_done_cb done, void *args);
+int cc_send(cc_client_t *client, const char *sender, const char *recipient, const char *content,
+            cc_done_cb done, void *args);
+int cc_send_ext(cc_client_t *client, const char *sender, const char *recipient, const char *content, int ttl,
+                int normalize, const char *token, cc_done_cb done, void *args);
+int cc_send_stream(cc_client_t *client, const char *sender, const char *recipient, const char *content,
+                   size_t len, cc_done_cb done, void *args);
+int cc_connected_users(cc_client_t *client, const char *username, cc_done_cb done, void *args);
+int cc_history(cc_client_t *client, const char *username, const char *peer, long long since, int max_messages,
+               cc_done_cb done, void *args);
+
+/**** Futures: Pass cc_future_done As Callback And The Future As Its Args, Then Wait On It ****/
+cc_future_t *cc_future_new(void);
+void cc_future_done(const cc_result_t *result, void *future);
+void cc_future_wait(cc_future_t *future, cc_result_t *result);
+void cc_future_free(cc_future_t *future);
+void cc_result_free(cc_result_t *result);
+
+#endif //CHAT_CLIENT_H
@@ -0,0 +1,24 @@
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include <sys/socket.h>
+#include "DS-Lab-Assignment/util.h"
+
+/**** Cluster Membership Functions: users are spread across nodes by consistent hashing ****/
+int cl_init(const char *nodes, int self);
+int cl_enabled(void);
+int cl_n_nodes(void);
+int cl_self(void);
+int cl_home(const char *username);
+int cl_is_local(const char *username);
+const char *cl_node_addr(int node);
+int cl_link_admit(const struct sockaddr_storage *peer_addr);
+void cl_link_done(void);
+
+/**** Inter-Node Requests: sent over a persistent link to the node at hand ****/
+int cl_forward_send(const char *sender, const char *recipient, const char *content, int ttl, unsigned int *msg_id);
+int cl_forward_ack(unsigned int msg_id, const char *sender);
+int cl_forward_expired(unsigned int msg_id, const char *sender, const char *recipient);
+int cl_get_connected(int node, char **users, size_t *users_len, size_t *n_users);
+
+#endif //CLUSTER_H
@@ -1,13 +1,62 @@
 #ifndef DBMS_H
 #define DBMS_H
 
-/**** Functions Called By The Server To Manage The DB ****/
+/**** Directory Engine Functions: The Server Calls Them Through db_engine (dbmsEngine.h) ****/
 int db_init_db(void);
 int db_get_pend_msg(entry_t *entry);
+int db_get_pend_msgs(const char *username, entry_t *entries, size_t max_entries, size_t *n_entries);
+int db_del_pend_msgs(entry_t *entries, size_t n_entries);
 int db_empty_db(void);
 int db_user_exists(const char *username);
+int db_user_connected(const char *username);
+int db_get_connected_users(char **users, size_t *users_len, size_t *n_users);
 int db_io_op_usr_ent(entry_t *entry, char mode);
+int db_next_msg_id(const char *username, unsigned int *msg_id);
 int db_creat_usr_tbl(entry_t *entry);
 int db_del_usr_tbl(const char *username);
+int db_open_msg_body(const entry_t *entry, char mode);
+int db_close_msg_body(int body_fd, char mode);
+int db_del_msg_body(const entry_t *entry);
+
+/**** Recovery Functions ****/
+int db_recover(int keep_cn_users);
+int db_checkpoint(void);
+
+/**** Durability Functions ****/
+int db_dur_init(char policy);
+int db_dur_parse_policy(const char *string, char *policy);
+void db_dur_note_write(void);
+int db_dur_syncs(void);
+int db_dur_commit_wait(void);
+int db_dur_sync_wait(void);
+void db_dur_flush(void);
+
+/**** User Table Layout Functions ****/
+int db_layout_parse(const char *string, char *layout);
+void db_layout_use(char layout);
+int db_layout_migrate(void);
+
+/**** Pending Message Expiry Functions ****/
+int db_exp_init(int default_ttl, void (*notify)(const entry_t *msg_entry));
+long long db_exp_deadline(int ttl);
+
+/**** Second ACK Queue Functions ****/
+int db_ack_queue_put(const char *username, unsigned int msg_id);
+int db_ack_queue_take(const char *username, unsigned int **msg_ids, size_t *n_msg_ids);
+int db_ack_queue_release(const char *username);
+
+/**** Message History Functions ****/
+int db_hist_init(int enabled);
+int db_hist_enabled(void);
+int db_hist_put(const entry_t *msg_entry);
+int db_hist_get(const char *username, const char *peer, long long since, size_t max_records,
+                char **records, size_t *records_len, size_t *n_records);
+int db_hist_del_user(const char *username);
+
+/**** Replication Functions ****/
+void db_repl_set_hook(void (*hook)(char op, const entry_t *entry));
+int db_repl_reset(void);
+int db_repl_apply(char op, entry_t *entry);
+int db_repl_snapshot(int (*emit)(char op, const entry_t *entry, void *args), void *args);
 
 #endif //DBMS_H
@@ -0,0 +1,69 @@
+#ifndef DBMS_ENGINE_H
+#define DBMS_ENGINE_H
+
+#include <stddef.h>
+#include "DS-Lab-Assignment/util.h"
+#include "DS-Lab-Assignment/dbms/dbmsTxn.h"
+
+typedef struct {
+    /*** Storage Engine: The DB Functions Called By The Server ***/
+    const char *name;
+
+    /** set up, recovery and durability **/
+    int (*init_db)(void);
+    int (*recover)(int keep_cn_users);
+    int (*checkpoint)(void);
+    int (*dur_init)(char policy);
+    int (*dur_commit_wait)(void);
+    void (*dur_flush)(void);
+    int (*exp_init)(int default_ttl, void (*notify)(const entry_t *msg_entry));
+
+    /** users and their entries **/
+    int (*user_exists)(const char *username);
+    int (*user_connected)(const char *username);
+    int (*get_connected_users)(char **users, size_t *users_len, size_t *n_users);
+    int (*io_op_usr_ent)(entry_t *entry, char mode);
+    int (*next_msg_id)(const char *username, unsigned int *msg_id);
+    int (*creat_usr_tbl)(entry_t *entry);
+    int (*del_usr_tbl)(const char *username);
+
+    /** transactions: writes of several entries, applied all together (see dbmsTxn.h) **/
+    int (*txn_apply)(const txn_write_t *writes, size_t n_writes);
+
+    /** pending messages, and bodies of streamed ones **/
+    int (*get_pend_msg)(entry_t *entry);
+    int (*get_pend_msgs)(const char *username, entry_t *entries, size_t max_entries, size_t *n_entries);
+    int (*del_pend_msgs)(entry_t *entries, size_t n_entries);
+    int (*open_msg_body)(const entry_t *entry, char mode);
+    int (*close_msg_body)(int body_fd, char mode);
+    int (*del_msg_body)(const entry_t *entry);
+
+    /** second ACK queue **/
+    int (*ack_queue_put)(const char *username, unsigned int msg_id);
+    int (*ack_queue_take)(const char *username, unsigned int **msg_ids, size_t *n_msg_ids);
+    int (*ack_queue_release)(const char *username);
+
+    /** message history **/
+    int (*hist_init)(int enabled);
+    int (*hist_enabled)(void);
+    int (*hist_put)(const entry_t *msg_entry);
+    int (*hist_get)(const char *username, const char *peer, long long since, size_t max_records,
+                    char **records, size_t *records_len, size_t *n_records);
+
+    /** replication **/
+    void (*repl_set_hook)(void (*hook)(char op, const entry_t *entry));
+    int (*repl_reset)(void);
+    int (*repl_apply)(char op, entry_t *entry);
+    int (*repl_snapshot)(int (*emit)(char op, const entry_t *entry, void *args), void *args);
+} db_engine_t;
+
+/**** Storage Engines ****/
+extern const db_engine_t db_dir_engine;    /* "dir": a directory per user table, a file per entry (default) */
+extern const db_engine_t db_mem_engine;    /* "mem": everything in memory, lost on exit; for benchmarking */
+
+/* storage engine in use; must be set before setting up the DB */
+extern const db_engine_t *db_engine;
+
+int db_use_engine(const char *name);
+
+#endif //DBMS_ENGINE_H
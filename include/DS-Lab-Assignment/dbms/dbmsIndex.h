@@ -0,0 +1,34 @@
+#ifndef DBMS_INDEX_H
+#define DBMS_INDEX_H
+
+#include "DS-Lab-Assignment/util.h"
+
+#define IDX_INIT_BUCKETS 65536      /* initial number of hash buckets; doubled as the index grows */
+
+/*** User Metadata Kept In Memory ***/
+typedef struct {
+    unsigned char status;       /* STATUS_DCN or STATUS_CN */
+    unsigned int last_msg_id;   /* last message ID given to the user */
+    unsigned int pend_msgs;     /* number of messages in the user's pending messages table */
+    unsigned int reserved_msg_id;   /* IDs up to this one can be given without writing to disk */
+} idx_meta_t;
+
+/*** Functions called internally in dbms module to manage the in-memory user index ***/
+int idx_init(void);
+int idx_is_ready(void);
+int idx_put(const char *username, const idx_meta_t *meta, int dirty);
+int idx_del(const char *username);
+int idx_get(const char *username, idx_meta_t *meta);
+int idx_set_userdata(const char *username, unsigned char status, unsigned int last_msg_id);
+int idx_next_msg_id(const char *username, unsigned int *msg_id);
+int idx_reserve_msg_ids(const char *username, unsigned int reserved_msg_id);
+int idx_msg_id_after(unsigned int msg_id, unsigned int other_msg_id);
+int idx_add_pend_msgs(const char *username, int delta);
+int idx_test_and_set_dirty(const char *username);
+void idx_clear_dirty(void);
+void idx_clear(void);
+size_t idx_size(void);
+int idx_get_connected(char **names, size_t *names_len, size_t *n_names);
+int idx_for_each(int (*func)(const char *username, const idx_meta_t *meta, void *args), void *args);
+
+#endif //DBMS_INDEX_H
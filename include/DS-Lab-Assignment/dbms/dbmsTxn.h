@@ -0,0 +1,38 @@
+#ifndef DBMS_TXN_H
+#define DBMS_TXN_H
+
+#include <stddef.h>
+#include "DS-Lab-Assignment/util.h"
+
+typedef struct {
+    /*** Transaction Write: a username entry created or modified (DB_MUT_PUT, with CREATE or MODIFY mode),
+     * a username entry deleted (DB_MUT_DEL), or a whole user table deleted (DB_MUT_RMTBL) ***/
+    char op;
+    char mode;
+    entry_t entry;
+} txn_write_t;
+
+typedef struct {
+    /*** Transaction: its users are locked from begin to commit (or abort), so that no other transaction
+     * gets in between; entries are read right away, and writes are buffered until commit ***/
+    int stripes[TXN_MAX_USERS];     /* user lock stripes held, in ascending order */
+    int n_stripes;
+    txn_write_t writes[TXN_MAX_WRITES];
+    size_t n_writes;
+} db_txn_t;
+
+/**** Transaction Functions: the same for every storage engine, which applies the writes (txn_apply) ****/
+int db_txn_begin(db_txn_t *txn, const char *const *usernames, size_t n_users);
+int db_txn_read(db_txn_t *txn, entry_t *entry);
+int db_txn_put(db_txn_t *txn, const entry_t *entry, char mode);
+int db_txn_del(db_txn_t *txn, const entry_t *entry);
+int db_txn_drop_user(db_txn_t *txn, const char *username);
+int db_txn_commit(db_txn_t *txn);
+void db_txn_abort(db_txn_t *txn);
+
+/**** Transaction Log Functions: directory engine ****/
+int db_txn_recover(void);
+int db_txn_apply(const txn_write_t *writes, size_t n_writes);
+int db_txn_log_record(int log_fd, const txn_write_t *writes, size_t n_writes);
+
+#endif //DBMS_TXN_H
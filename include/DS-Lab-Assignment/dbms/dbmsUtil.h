@@ -4,11 +4,55 @@
 #include <dirent.h>
 #include "DS-Lab-Assignment/util.h"
 
+/**** Inner Tables Of A User Table, Kept Open By The Directory FD Cache ****/
+#define DIR_PEND_MSGS 0
+#define DIR_MSG_BODIES 1
+#define DIR_N_SUB_TABLES 2
+
+#define TABLE_NAME_SIZE (MAX_STR_SIZE + 16)     /* user table name relative to the DB root folder, shards included */
+
+typedef struct {
+    /*** Open directories of a user table, handed out by the directory fd cache ***/
+    char username[MAX_STR_SIZE];
+    int table_fd;                       /* <username>-table */
+    int sub_fds[DIR_N_SUB_TABLES];      /* its inner tables, opened on first use (-1 until then) */
+    int refs;                           /* number of threads using the entry */
+    int stale;                          /* table deleted while in use: closed by the last dir_put */
+    int detached;                       /* not cached, since its stripe was full of entries in use */
+    int stripe;                         /* cache stripe its username hashes to */
+    unsigned long last_use;
+} dir_ent_t;
+
 /*** Functions called internally in dbms module ***/
 int open_file(const char *path, char mode);
+int open_file_at(int dir_fd, const char *name, char mode);
 int open_directory(const char *path, char mode, DIR **directory);
+int open_directory_at(int dir_fd, const char *name, char mode, DIR **directory);
 int remove_recursive(const char *path);
 int read_entry(int entry_fd, entry_t *entry);
 int write_entry(int entry_fd, entry_t *entry);
+int write_entry_at(int tmp_dir_fd, int dir_fd, const char *name, const entry_t *entry, char mode);
+int load_user_meta(const char *username);
+void journal_user(const char *username);
+void ckpt_hold(void);
+void ckpt_release(void);
+void exp_arm(const entry_t *entry);
+void exp_disarm(const entry_t *entry);
+void note_mutation(char op, const entry_t *entry);
+int dir_cache_init(void);
+int dir_root_fd(void);
+dir_ent_t *dir_get(const char *username);
+int dir_sub_fd(dir_ent_t *ent, int sub_table, int create);
+void dir_put(dir_ent_t *ent);
+void dir_forget(const char *username);
+void dir_forget_all(void);
+int layout_init(void);
+int table_open(const char *username);
+int table_create(const char *username);
+int table_remove(const char *username);
+int table_for_each(int (*func)(const char *username, void *args), void *args);
+void layout_hold(void);
+void layout_release(void);
+void layout_migrate_start(void);
 
 #endif //DBMS_UTILS_H
@@ -0,0 +1,19 @@
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "DS-Lab-Assignment/util.h"
+
+/**** Results Of Claiming A SEND Token ****/
+#define DD_NEW 0        /* first try: the SEND must be served, then settled */
+#define DD_SENT 1       /* retry of a SEND already served: its message ID is returned */
+#define DD_BUSY 2       /* first try still being served after DEDUP_WAIT_MS, or too many of them */
+#define DD_REUSED 3     /* token already used by the sender for another message */
+
+/**** Idempotent SEND Functions: a bounded table of recent tokens per sender ****/
+uint64_t dd_req_hash(const char *recipient, const char *content, size_t content_len);
+int dd_claim(const char *sender, const char *token, uint64_t req_hash, unsigned int *msg_id);
+void dd_settle(const char *sender, const char *token, unsigned int msg_id, int sent);
+
+#endif //DEDUP_H
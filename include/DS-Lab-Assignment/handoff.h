@@ -0,0 +1,11 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include "DS-Lab-Assignment/util.h"
+
+/**** Listening Socket Handoff Functions (Graceful Restart) ****/
+int ho_take_over(const char *path, int *listen_socket);
+int ho_listen(const char *path);
+int ho_hand_over(int ho_socket, int listen_socket);
+
+#endif //HANDOFF_H
@@ -0,0 +1,9 @@
+#ifndef HEARTBEAT_H
+#define HEARTBEAT_H
+
+#include "DS-Lab-Assignment/util.h"
+
+/**** Listener Liveness Functions ****/
+int hb_init(int interval);
+
+#endif //HEARTBEAT_H
@@ -3,14 +3,50 @@
 
 #define MAX_CONN_BACKLOG 10     /* max number of open client connections waiting to get processed */
 #define LISTEN_BACKLOG 10       /* max number of waiting clients */
+#define UNIX_RETRY_MS 10        /* time between tries to connect to a Unix socket whose backlog is full */
+#define ADM_QUEUE_HIGH 7        /* open connections waiting past which heavy clients are shed */
+#define CONN_BUF_SIZE 4096      /* size of a connection receive buffer: must fit a whole request */
 
+#include <sys/socket.h>
 #include "DS-Lab-Assignment/util.h"
 
+/***** Types Used For Receiving Requests *****/
+typedef struct {
+    /*** Client Connection: received bytes are parsed in place ***/
+    int socket;
+    int start;                  /* position of the first byte not parsed yet */
+    int end;                    /* position after the last byte received */
+    struct rp_watch *watch;     /* deadlines the peer is held to while receiving, if any (see reaper.h) */
+    char buffer[CONN_BUF_SIZE];
+} conn_t;
+
+typedef struct {
+    /*** Request Field: points into a connection buffer, '\0'-terminated;
+     * valid until the connection buffer is released ***/
+    const char *ptr;
+    int len;
+} slice_t;
+
 /*** Sending functions ***/
 int send_server_reply(int socket, const reply_t *reply);
 int send_string(int socket, const char *string);
+int send_frame(int socket, const char *buffer, int len);
+int send_busy_reply(int socket, int retry_after_ms);
+int send_redirect_reply(int socket, const char *node_addr);
+int connect_timeout(int socket, const struct sockaddr *addr, socklen_t addr_len, int timeout_ms);
+
+/*** Addressing functions ***/
+socklen_t set_listener_addr(const struct userdata *user, struct sockaddr_storage *addr);
+int unix_listen(const char *path);
+int unix_path_valid(const char *path, int len);
+int username_valid(const char *username);
 
 /*** Receiving functions ***/
 int recv_string(int socket, char *string);
+void conn_init(conn_t *conn, int socket);
+void conn_release(conn_t *conn);
+int recv_slice(conn_t *conn, slice_t *slice);
+int recv_bytes(conn_t *conn, char *buffer, int len);
+int recv_frame(conn_t *conn, char *buffer, int buf_space);
 
 #endif //NETUTILS_H
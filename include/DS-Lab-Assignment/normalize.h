@@ -0,0 +1,7 @@
+#ifndef NORMALIZE_H
+#define NORMALIZE_H
+
+/**** Message Content Normalization Functions ****/
+int norm_collapse_spaces(char *string, int len);
+
+#endif //NORMALIZE_H
@@ -0,0 +1,27 @@
+#ifndef REAPER_H
+#define REAPER_H
+
+#include "DS-Lab-Assignment/util.h"
+#include "DS-Lab-Assignment/timerWheel.h"
+
+typedef struct rp_watch {
+    /*** Watched Connection: a client connection being served, which is shut down if its peer keeps
+     * the server waiting for too long; only time spent waiting on the peer counts ***/
+    tw_timer_t timer;               /* ticks are ms; goes off when the connection may be reaped */
+    int socket;
+    long long request_deadline_ms;  /* time by which the request fields must be in; 0 once they are */
+    long long wait_start_ms;        /* time the server started waiting on the peer, or last got bytes from it */
+    int waiting;                    /* the server is blocked receiving from the peer */
+} rp_watch_t;
+
+/**** Connection Reaping Functions: a single thread ticks a timer wheel with a timer per connection
+ * being served, so that stalled peers can't hold service threads ****/
+int rp_init(int idle_timeout_ms, int request_timeout_ms);
+void rp_watch(rp_watch_t *watch, int socket);
+void rp_send_deadline(int socket);
+void rp_unwatch(rp_watch_t *watch);
+void rp_wait_begin(rp_watch_t *watch);
+void rp_wait_end(rp_watch_t *watch);
+void rp_request_done(rp_watch_t *watch);
+
+#endif //REAPER_H
@@ -0,0 +1,10 @@
+#ifndef REPLICATION_H
+#define REPLICATION_H
+
+#include "DS-Lab-Assignment/util.h"
+
+/**** Replication Functions ****/
+int repl_primary_init(int repl_port);
+int repl_standby_run(const char *primary);
+
+#endif //REPLICATION_H
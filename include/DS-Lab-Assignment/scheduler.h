@@ -0,0 +1,31 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "DS-Lab-Assignment/util.h"
+
+/**** Request Classes, Highest Priority First ****/
+#define SCHED_CONTROL 0         /* REGISTER, UNREGISTER, CONNECT, DISCONNECT, CONNECTEDUSERS */
+#define SCHED_MESSAGE 1         /* SEND, SEND_EXT, SEND_STREAM, HISTORY, node links */
+#define SCHED_BACKGROUND 2      /* deliveries to users that have just connected */
+#define SCHED_N_CLASSES 3
+
+typedef struct {
+    /*** Job Taken By A Service Thread: a client connection to serve, or a background task ***/
+    int socket;                 /* -1 for a task */
+    void (*task)(void *args);
+    void *args;
+    int class;
+} sched_job_t;
+
+/**** Request Scheduling Functions: service threads take jobs from one queue per class,
+ * by weighted round robin, so control requests aren't held up by message traffic ****/
+void sched_init(int n_threads);
+int sched_classify(int socket);
+int sched_put_conn(int socket, int class);
+int sched_put_task(void (*task)(void *args), void *args);
+void sched_take(sched_job_t *job);
+void sched_done(const sched_job_t *job);
+int sched_depth(void);
+int sched_drain(int timeout_ms);
+
+#endif //SCHEDULER_H
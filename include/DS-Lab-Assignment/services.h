@@ -1,15 +1,25 @@
 #ifndef SERVICES_H
 #define SERVICES_H
 
-#include "DS-Lab-Assignment/util.h"
+#include "DS-Lab-Assignment/netUtil.h"
 
 /****** Services ******/
 
 /*** Services Called By Client, Served By Server ***/
-void srv_register(int socket, request_t *request);
-void srv_unregister(int socket, request_t *request);
-void srv_connect(int socket, request_t *request);
-void srv_disconnect(int socket, request_t *request);
-void srv_send(int socket, request_t *request);
+void srv_register(conn_t *conn);
+void srv_unregister(conn_t *conn);
+void srv_connect(conn_t *conn);
+void srv_disconnect(conn_t *conn);
+void srv_send(conn_t *conn);
+void srv_send_ext(conn_t *conn);
+void srv_send_stream(conn_t *conn);
+void srv_connected_users(conn_t *conn);
+void srv_history(conn_t *conn);
+
+/*** Services Called By Another Node, Served By Server (Cluster Mode) ***/
+void srv_node_link(conn_t *conn);
+
+/*** Notifications Sent By Server On Its Own ***/
+void srv_notify_expired(const entry_t *msg_entry);
 
 #endif //SERVICES_H
@@ -0,0 +1,29 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#define TW_LEVELS 4             /* number of wheels; each one covers TW_SLOTS times the range of the previous one */
+#define TW_SLOT_BITS 6
+#define TW_SLOTS (1 << TW_SLOT_BITS)
+#define TW_MAX_TICKS (1ULL << (TW_LEVELS * TW_SLOT_BITS))   /* timers further away are cascaded down later */
+
+/*** Timer: embedded in (or pointed to by) whatever it times out ***/
+typedef struct tw_timer {
+    unsigned long long expires;     /* tick at which the timer goes off */
+    void *data;                     /* owner of the timer */
+    struct tw_timer **pprev;        /* link pointing to this timer: previous timer's next, or slot head */
+    struct tw_timer *next;
+} tw_timer_t;
+
+/*** Hierarchical Timer Wheel: adding and removing a timer is O(1), and so is every tick,
+ * whatever the number of timers; it is not thread safe, so its owner must lock it ***/
+typedef struct {
+    unsigned long long now;         /* last tick processed */
+    tw_timer_t *slots[TW_LEVELS][TW_SLOTS];
+} timer_wheel_t;
+
+void tw_init(timer_wheel_t *wheel, unsigned long long now);
+void tw_add(timer_wheel_t *wheel, tw_timer_t *timer);
+void tw_del(timer_wheel_t *wheel, tw_timer_t *timer);
+tw_timer_t *tw_advance(timer_wheel_t *wheel, unsigned long long now);
+
+#endif //TIMER_WHEEL_H
@@ -0,0 +1,26 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include "DS-Lab-Assignment/netUtil.h"
+
+typedef struct {
+    /*** Traced Request: its fields as received, op_code first, each one '\0'-terminated ***/
+    long long delay_us;         /* time since the previous request in the trace; negative if received before it */
+    long long body_size;        /* content size of a SEND_STREAM request, whose frames aren't traced; -1 otherwise */
+    int fields_len;
+    char fields[CONN_BUF_SIZE];
+} tr_request_t;
+
+/**** Request Tracing Functions: the server appends the requests it gets to a trace file ****/
+int tr_init(const char *path);
+int tr_enabled(void);
+long long tr_clock(void);
+void tr_record(long long time_us, const char *fields, int fields_len, long long body_size);
+void tr_flush(void);
+
+/**** Trace Reading Functions ****/
+FILE *tr_open(const char *path);
+int tr_read(FILE *trace, tr_request_t *request);
+
+#endif //TRACE_H
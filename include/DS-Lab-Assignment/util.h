@@ -8,6 +8,11 @@
 #define MAX_MSG_SIZE 256                /* size of message content string */
 #define MSG_ID_MAX_VALUE 4294967295     /* max message ID value (actually max unsigned int value on amd64) */
 #define MSG_ID_MAX_STR_SIZE 10          /* max length of message ID as a string */
+#define MSG_ID_BLOCK 1024               /* message IDs reserved at a time on disk for each user */
+#define MSG_ID_LOCK_STRIPES 64          /* mutexes keeping message ID high-water marks in order, a stripe of users each */
+#define STREAM_CHUNK_SIZE 4096          /* max size of a streamed message frame */
+#define STREAM_MAX_SIZE 1073741824      /* max size of a whole streamed message (1 GiB) */
+#define UNIX_PATH_MAX_SIZE 108          /* size of a Unix socket path, '\0' included (sun_path on Linux) */
 
 /********** Services: Operation Codes **********/
 
@@ -17,10 +22,37 @@
 #define CONNECT "CONNECT"
 #define DISCONNECT "DISCONNECT"
 #define SEND "SEND"
+#define SEND_STREAM "SEND_STREAM"
+#define SEND_EXT "SEND_EXT"
+#define CONNECTEDUSERS "CONNECTEDUSERS"
+#define HISTORY "HISTORY"
 
 /***** Services Called By Server, Served By Client Listening Thread *****/
 #define SEND_MESSAGE "SEND_MESSAGE"
 #define SEND_MESS_ACK "SEND_MESS_ACK"
+#define SEND_MESS_ACKS "SEND_MESS_ACKS"     /* second ACKs queued while the sender was offline */
+#define SEND_MESSAGE_STREAM "SEND_MESSAGE_STREAM"
+#define SEND_MESS_EXPIRED "SEND_MESS_EXPIRED"
+#define HEARTBEAT "HEARTBEAT"
+
+/***** Services Called By Another Node Over A Node Link, Served By Server (Cluster Mode) *****/
+#define NODE_LINK "NODE_LINK"           /* opens the link: requests below follow, one at a time */
+#define NODE_SEND "NODE_SEND"
+#define NODE_ACK "NODE_ACK"
+#define NODE_EXPIRED "NODE_EXPIRED"
+#define NODE_CONNECTED "NODE_CONNECTED"
+
+/***** Replication: Sent By Primary Server, Applied By Standby Server *****/
+#define REPL_SYNC "REPL_SYNC"           /* a full copy of the DB follows: standby empties its own */
+#define REPL_SYNCED "REPL_SYNCED"       /* full copy sent: mutations follow as they happen */
+#define REPL_MUTATION "REPL_MUTATION"
+#define REPL_PING "REPL_PING"           /* sent when there are no mutations, so standby knows primary is alive */
+#define REPL_RESYNC "REPL_RESYNC"       /* standby dropped, primary still alive: it must connect and sync again */
+
+/***** SEND_EXT Options: "key=value" strings *****/
+#define SEND_OPT_TTL "ttl"      /* seconds the message may wait as pending before it expires */
+#define SEND_OPT_NORM "norm"    /* 1: runs of whitespace in the content are collapsed into a single space */
+#define SEND_OPT_TOKEN "tok"    /* idempotency token: a retry with the same one gets the ID of the first try */
 
 
 /******************** ERROR CODES ********************/
@@ -34,6 +66,8 @@
 
 /****** General Server Error Codes ******/
 #define SRV_SUCCESS 0
+#define SRV_ERR_REDIRECT 8      /* any service: user lives in another node; followed by its "host:port" */
+#define SRV_ERR_BUSY 9          /* any service: server overloaded; followed by retry-after time in ms */
 #define TEST_ERR_CODE 100
 
 /****** Register Service ******/
@@ -58,6 +92,15 @@
 #define SRV_ERR_SEND_USR_NOT_EXISTS 1
 #define SRV_ERR_SEND_ANY 2
 
+/****** Connected Users Service ******/
+#define SRV_ERR_CONNUSRS_USR_NOT_CN 1
+#define SRV_ERR_CONNUSRS_ANY 2
+
+/****** History Service ******/
+#define SRV_ERR_HIST_USR_NOT_CN 1
+#define SRV_ERR_HIST_ANY 2
+#define SRV_ERR_HIST_DISABLED 3     /* server isn't keeping message history */
+
 /********** DBMS Error Codes **********/
 #define DBMS_SUCCESS 100
 #define DBMS_ERR_ANY -100
@@ -85,11 +128,133 @@
 #define DB_DIR "users"                          /* database directory name */
 #define USERDATA_ENTRY "userdata.entry"         /* userdata entry name */
 #define PEND_MSGS_TABLE "pend_msgs-table"       /* pending messages table name */
+#define MSG_BODIES_TABLE "msg_bodies-table"     /* streamed message bodies table name */
+#define ACK_QUEUE_ENTRY "acks.queue"            /* second ACKs waiting for their sender to connect */
+#define ACK_BATCH_ENTRY "acks.batch"            /* second ACKs being sent to their sender */
+#define CHECKPOINT_ENTRY ".checkpoint"          /* user index checkpoint name, in DB root folder */
+#define JOURNAL_ENTRY ".journal"                /* users modified since last checkpoint, in DB root folder */
+#define HIST_DIR ".history"                     /* message history, in DB root folder: a folder per user, */
+#define HIST_LOG_EXT ".log"                     /* holding a log and an index per conversation with users */
+#define HIST_IDX_EXT ".idx"                     /* whose username is higher */
+#define LAYOUT_ENTRY ".layout"                  /* user table layout of the DB, in DB root folder */
+#define TXN_LOG_ENTRY ".txnlog"                 /* transaction log slots, in DB root folder: .txnlog-<slot> */
+#define TMP_ENTRY_EXT ".tmp"                    /* entry being written, in its user table: .<entry name>.tmp */
 
 /**** DB Entry Types ****/
 #define ENT_TYPE_UD 'u'       /* userdata entry type */
 #define ENT_TYPE_P_MSG 'm'    /* pending message entry type */
 
+/**** DB Mutations Passed To The Mutation Hook ****/
+#define DB_MUT_PUT 'p'        /* username entry created or modified */
+#define DB_MUT_DEL 'd'        /* username entry deleted */
+#define DB_MUT_RMTBL 't'      /* user table deleted */
+
+/**** Durability Policies ****/
+#define DUR_NONE 'n'        /* never sync: DB writes are left in the OS page cache */
+#define DUR_PERIODIC 'p'    /* DB writes are synced every DUR_PERIOD_MS milliseconds */
+#define DUR_GROUP 'g'       /* writers wait for their batch of DB writes to be synced */
+#define DUR_PERIOD_MS 1000  /* sync period for DUR_PERIODIC policy */
+
+/**** Checkpoints ****/
+#define CKPT_JOURNAL_MAX_SIZE (1 << 20)     /* journal size (bytes) that triggers a checkpoint */
+#define CKPT_PERIOD_MS 60000                /* max time between checkpoints, if any user has been journaled */
+
+/**** User Table Layouts ****/
+#define DB_LAYOUT_FLAT 'f'      /* every user table in the DB root folder */
+#define DB_LAYOUT_HASHED 'h'    /* user tables spread over 2 levels of shard folders named after username hashes */
+
+/**** Directory FD Cache ****/
+#define DIR_CACHE_SIZE 64   /* user tables whose directories are kept open by the DBMS */
+#define DIR_CACHE_STRIPES 8 /* mutexes locking the cache, each one a stripe of its tables; must divide DIR_CACHE_SIZE */
+#define PEND_MSGS_BATCH 16  /* pending messages read from the DB at once when delivering them */
+
+/**** Transactions ****/
+#define TXN_MAX_USERS 4         /* users a transaction can lock */
+#define TXN_MAX_WRITES 4        /* writes a transaction can buffer */
+#define TXN_LOCK_STRIPES 64     /* mutexes locking users for transactions, each one a stripe of them */
+#define TXN_LOG_SLOTS 8         /* transaction log slots: transactions logged at once by the directory engine */
+
+/**** In-Memory Storage Engine ****/
+#define MEM_BUCKETS 65536       /* hash buckets holding the user tables; must be a power of 2 */
+#define MEM_LOCK_STRIPES 64     /* mutexes guarding the buckets, each one a stripe of them */
+
+
+/**** Admission Control ****/
+#define ADM_USER_RATE 20            /* requests per second allowed on behalf of a user */
+#define ADM_USER_BURST 40           /* requests a user can make in a burst */
+#define ADM_IP_RATE 50              /* connections per second allowed from a source IP */
+#define ADM_IP_BURST 100            /* connections a source IP can open in a burst */
+#define ADM_RETRY_AFTER_MS 200      /* retry-after time given to clients shed because of queue depth */
+
+
+/**** Request Scheduling ****/
+#define SCHED_WEIGHT_CONTROL 8      /* control requests (REGISTER, CONNECT, ...) served per scheduling round */
+#define SCHED_WEIGHT_MESSAGE 4      /* message requests (SEND, HISTORY, ...) served per scheduling round */
+#define SCHED_WEIGHT_BACKGROUND 1   /* background deliveries run per scheduling round */
+#define SCHED_CONTROL_RESERVED 1    /* service threads kept for control requests */
+#define SCHED_PEEK_MS 50            /* time a new connection has to send its op_code before it's queued anyway */
+
+
+/**** Connection Deadlines ****/
+#define CONN_IDLE_TIMEOUT_MS 10000      /* time a client may keep a service thread waiting without sending a byte */
+#define CONN_REQUEST_TIMEOUT_MS 30000   /* time a client has to send the fields of its request */
+#define RP_TICK_MS 100                  /* time between checks for connections to reap */
+
+
+/**** Request Tracing ****/
+#define TRACE_MAGIC "CHATTRC2"      /* first bytes of a trace file */
+#define TRACE_BUF_SIZE 262144       /* bytes of trace records buffered before they're written out */
+#define TRACE_FLUSH_MS 1000         /* time after which buffered trace records are written out anyway */
+
+
+/**** Idempotent SEND ****/
+#define DEDUP_TOKEN_SIZE 64         /* max size of a SEND token, '\0' included */
+#define DEDUP_PER_SENDER 32         /* SEND tokens remembered per sender; the oldest ones are dropped first */
+#define DEDUP_TTL 600               /* seconds a SEND token is remembered for */
+#define DEDUP_WAIT_MS 5000          /* time a retry waits for its first try to be served */
+
+
+/**** Graceful Restart ****/
+#define DRAIN_TIMEOUT_MS 30000      /* time a server shutting down gracefully waits for its work to be done */
+
+
+/**** Message History ****/
+#define HIST_PAGE_MAX 256           /* max number of messages sent in a HISTORY reply */
+#define HIST_LOCK_STRIPES 64        /* locks appends to conversations, picked by conversation hash */
+
+
+/**** Pending Message Expiry ****/
+#define MSG_TTL_DEFAULT 604800      /* default time to live of a pending message (s); 0 means forever */
+#define EXP_BATCH_SIZE 256          /* max number of expired messages removed per tick */
+#define EXP_HASH_BUCKETS 65536      /* hash buckets used to find the expiry timer of a message */
+
+
+/**** Listener Liveness ****/
+#define HB_INTERVAL 5               /* default time between heartbeat rounds (s); 0 means no heartbeats */
+#define HB_TIMEOUT_MS 1000          /* time a listening thread has to accept a heartbeat connection */
+#define HB_BATCH_SIZE 64            /* max number of listening threads probed at once */
+#define CLT_CONNECT_TIMEOUT_MS 2000 /* time a listening thread has to accept a message connection */
+
+
+/**** Replication ****/
+#define REPL_PING_MS 200            /* max time between two records sent to the standby */
+#define REPL_TIMEOUT_MS 600         /* time without records after which standby connects to primary again */
+#define REPL_RETRY_MS 500           /* time between standby attempts to connect to primary */
+#define REPL_TAKEOVER_MS 3000       /* time primary has to be unreachable for, once lost, before standby takes over */
+#define REPL_QUEUE_MAX 16384        /* mutations waiting to be shipped past which standby is dropped */
+#define REPL_BIND_RETRY_MS 10       /* time between attempts to bind the port of a lost primary */
+#define REPL_BIND_TRIES 50
+
+
+/**** Cluster ****/
+#define CL_VNODES 64                /* points each node has in the consistent hashing ring */
+#define CL_LINK_TIMEOUT_MS 5000     /* time a node has to reply to a request sent over a node link */
+#define CL_LINKS_PER_NODE 2         /* node links served at once per other node: a link and its replacement */
+
+
+/**** Message Flags ****/
+#define MSG_FLAG_STREAM 0x1     /* message content is stored in the message bodies table */
+
 
 /**** Number Casting Stuff ****/
 #define INT 'i'
@@ -171,23 +336,11 @@ typedef struct {
     char sender[MAX_STR_SIZE];      /* username of sender client */
     unsigned int id;            /* message ID */
     char content[MAX_MSG_SIZE]; /* message content */
+    unsigned int flags;         /* MSG_FLAG_* bits */
+    unsigned long long size;    /* size of a streamed message body */
+    long long expires_at;       /* time (s since the Epoch) when a pending message expires; 0 for never */
 } message_t;
 
-typedef struct {
-    /*** Client Request ***/
-    char op_code[MAX_STR_SIZE];     /* operation code that indicates the service called */
-    union {
-        struct {
-            char username[MAX_STR_SIZE];    /* member used for REGISTER, UNREGISTER, CONNECT & DISCONNECT services */
-            char client_port[MAX_STR_SIZE]; /* client listening thread port; member only used for CONNECT service */
-        };
-        struct {    /* members used for SEND, SEND_MESSAGE & SEND_MESS_ACK services */
-            char recipient[MAX_STR_SIZE];    /* username of recipient client */
-            message_t message;
-        };
-    };
-} request_t;
-
 typedef struct {
     /*** Server Reply ***/
     unsigned char server_error_code;        /* error code returned by the server; client interprets it
@@ -202,7 +355,8 @@ struct userdata {
     unsigned char status;   /* STATUS_DCN := disconnected; STATUS_CN := connected */
     struct in_addr ip;      /* client IP for receiving thread */
     uint16_t port;          /* client port for receiving thread */
-    unsigned int last_msg_id;
+    unsigned int last_msg_id;   /* high-water mark: no message ID beyond it has been given to the user */
+    char sock_path[UNIX_PATH_MAX_SIZE]; /* Unix socket path of receiving thread; empty if it listens on TCP */
 };
 
 
@@ -225,7 +379,7 @@ typedef struct {
 /*connect*/
 //receive op_code
 //receive username
-//receive port
+//receive port, or Unix socket path (starting with '/') for a listening thread on the server host
 
 /*send*/
 //receive op_code
@@ -243,6 +397,88 @@ typedef struct {
 //send message ID
 //send message content
 
+/*send_stream*/
+//receive op_code
+//receive sender username
+//receive recipient username
+//receive frames: frame length string followed by that many content bytes; "0" length ends the stream
+//set message ID
+//send message ID to sender client (first ACK: server got the whole message)
+
+/*send streamed content to recipient, forwarded frame by frame*/
+//send op_code
+//send sender username
+//send message ID
+//send frames
+
+/*connectedusers*/
+//receive op_code
+//receive username (must be connected)
+//send number of connected users
+//send frames holding the connected usernames, each one '\0'-terminated; "0" length ends the stream
+
+/*history: messages delivered between two users, in time order, a page at a time*/
+//receive op_code
+//receive username (must be connected)
+//receive peer username
+//receive timestamp (ms since the Epoch) after which messages are sent; "0" for the first ones
+//receive max number of messages (up to HIST_PAGE_MAX)
+//send number of messages; fewer than asked for means there are no more
+//send frames holding the messages, each one made of '\0'-terminated strings:
+//  timestamp (the next page starts after the last one), sender, message ID, size, content
+//  (content is empty for streamed messages, only their size is kept); "0" length ends the stream
+
+/*send_ext: same as send, with options after message content*/
+//receive op_code
+//receive sender username
+//receive recipient username
+//receive message content
+//receive options, each one a "key=value" string; an empty string ends them
+//normalize message content if asked to (norm=1)
+//if a token was given (tok=<token>) and the sender sent a message with it in the last DEDUP_TTL seconds:
+//  send that message's ID to sender client, and nothing else
+//set message ID
+//send message ID to sender client (first ACK: server got the message)
+
+/*node link: persistent connection from a node to another one, in cluster mode*/
+//receive NODE_LINK
+//receive requests, one at a time, until the link is closed; each one gets its reply before the next one
+/*node_send: message to a user of this node from a user of the other node; replied like send*/
+//receive op_code, sender username, recipient username, message content, ttl (-1 for the default one)
+//send server error code, followed by message ID if success
+/*node_ack: second ack to a sender of this node*/
+//receive op_code, message ID, sender username
+//send server error code
+/*node_expired: expiry notification to a sender of this node*/
+//receive op_code, message ID, sender username, recipient username
+//send server error code
+/*node_connected: users connected to this node; replied like connectedusers*/
+//receive op_code
+
+/*replication: primary server to standby server, one connection per standby*/
+//send REPL_SYNC
+//send records for every entry in the DB, then REPL_SYNCED
+//send records for every DB mutation as it happens, or REPL_PING if there are none for REPL_PING_MS
+//(standby too slow) send REPL_RESYNC, then close the connection
+/*replication record*/
+//send REPL_MUTATION
+//send mutation (DB_MUT_*) as a 1-char string
+//send frame holding the entry_t
+//(streamed pending message created or modified) send frames holding message body; "0" length ends them
+
+/*heartbeat: listening thread liveness probe, nothing is sent back*/
+//send op_code
+
+/*notify sender that a pending message expired before it could be delivered*/
+//send op_code
+//send message ID
+//send recipient username
+
 /*send second ack to sender (message got delivered)*/
 //send op_code
 //send message ID
+
+/*send second acks queued while the sender couldn't get them, once it connects*/
+//send op_code
+//send number of message IDs
+//send frames holding the message IDs, each one '\0'-terminated; "0" length ends the stream
@@ -0,0 +1,84 @@
+"""Benchmark of the per-message latency of a SEND whose blank spaces are normalized: by the serverWS.py SOAP service
+before the SEND (the client's former path), or by the server itself on SEND_EXT with norm=1.
+It needs the server running, and serverWS.py too for the SOAP path:
+    python benchmark.py <server_ip> <server_port> [n_messages]"""
+
+# ******************** IMPORTS ***********************
+import sys
+import time
+import zeep
+from src import netUtil, util
+
+# requests per second allowed on behalf of a user by the server (ADM_USER_RATE)
+USER_RATE = 20
+MESSAGE = "a  message   with\t\tsome    blank  spaces   to be   collapsed"
+
+
+# ******************** FUNCTIONS *********************
+def request(server_address, op_code, username, recipient=None, message=None, options=None):
+    """Function in charge of sending a request and receiving its server error code, and message ID if any"""
+    req = util.Request()
+    req.header.op_code = op_code
+    req.header.username = username
+    req.item.recipient_username = recipient
+    req.item.message = message
+    with netUtil.connect_socket(server_address) as sock:
+        if options is not None:
+            netUtil.send_ext_request(sock, req, options)
+        elif message is not None:
+            netUtil.send_message_request(sock, req)
+        else:
+            netUtil.send_header(sock, req)
+        error_code = netUtil.receive_server_error_code(sock)
+        if error_code == util.EC.SUCCESS.value and message is not None:
+            netUtil.receive_string(sock)
+    return error_code
+
+
+def soap_send(server_address):
+    """Former client path: a new SOAP client normalizes the message, then it's sent with a plain SEND"""
+    web_client = zeep.Client(wsdl='http://localhost:8000/?wsdl')
+    message = web_client.service.remove(MESSAGE)
+    return request(server_address, util.SEND, "bench_a", "bench_b", message)
+
+
+def server_send(server_address):
+    """Current client path: the message is normalized by the server"""
+    return request(server_address, util.SEND_EXT, "bench_a", "bench_b", MESSAGE, {util.SEND_OPT_NORM: 1})
+
+
+def measure(name, send, server_address, n_messages):
+    """Function in charge of timing n_messages sends, paced so that the server doesn't shed them"""
+    latencies = []
+    for _ in range(n_messages):
+        start = time.perf_counter()
+        if send(server_address) != util.EC.SUCCESS.value:
+            print(f"{name}: SEND FAIL")
+            return
+        latencies.append(time.perf_counter() - start)
+        time.sleep(max(0.0, 1 / USER_RATE - latencies[-1]))
+    latencies.sort()
+    print(f"{name}: {n_messages} messages, mean {sum(latencies) / n_messages * 1000:.3f} ms, "
+          f"median {latencies[n_messages // 2] * 1000:.3f} ms, max {latencies[-1] * 1000:.3f} ms")
+
+
+def main():
+    if len(sys.argv) < 3:
+        print("Usage: python benchmark.py <server_ip> <server_port> [n_messages]")
+        return
+    server_address = (sys.argv[1], int(sys.argv[2]))
+    n_messages = int(sys.argv[3]) if len(sys.argv) > 3 else 10
+
+    # messages are stored as pending for bench_b, and removed with it
+    request(server_address, util.REGISTER, "bench_a")
+    request(server_address, util.REGISTER, "bench_b")
+    try:
+        measure("SOAP normalization + SEND", soap_send, server_address, n_messages)
+        measure("SEND_EXT norm=1", server_send, server_address, n_messages)
+    finally:
+        request(server_address, util.UNREGISTER, "bench_a")
+        request(server_address, util.UNREGISTER, "bench_b")
+
+
+if __name__ == "__main__":
+    main()
@@ -1,6 +1,7 @@
 import argparse
-import zeep
+import re
 import socket
+import time
 from threading import Thread
 from src import netUtil, util
 
@@ -116,6 +117,8 @@ class Client:
         listen_sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
         listen_sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
         listen_sock.bind(("", 0))
+        # listen before the thread starts, so that it can be ended right away if the connection fails
+        listen_sock.listen(1)
         # we get the port using getsockname
         listening_port = listen_sock.getsockname()[1]
         # fill up the request
@@ -208,26 +211,60 @@ class Client:
     # * @return EC.SEND_USR_NOT_EXISTS if the user does not exist
     # * @return EC.SEND_ANY if another error occurred
     def send(self, recipient, message):
-        # web services
-        wsdl = 'http://localhost:8000/?wsdl'
-        web_client = zeep.Client(wsdl=wsdl)
-        message = web_client.service.remove(message)
-
         # first, we create the request
         request = util.Request()
         reply = util.Reply()
-        # fill up the request
-        request.header.op_code = util.SEND
+        # fill up the request: the server collapses runs of blank spaces in the message (norm=1)
+        request.header.op_code = util.SEND_EXT
         request.header.username = self._connected_user
         request.item.recipient_username = str(recipient)
-        if len(message) > 255:
-            print("ERROR, MESSAGE TOO LONG")
         request.item.message = str(message)
+        # messages too long for a plain SEND are streamed, blank spaces collapsed here
+        if len(message) > util.MAX_MSG_SIZE:
+            return self.send_stream(recipient, re.sub(r"\s\s+", " ", message).encode())
         # now, we connect to the socket
         with netUtil.connect_socket((self.server, self.port)) as sock:
             if sock:
                 # and send te message request
-                netUtil.send_message_request(sock, request)
+                netUtil.send_ext_request(sock, request, {util.SEND_OPT_NORM: 1})
+                # receive server reply (error code)
+                reply.server_error_code = netUtil.receive_server_error_code(sock)
+            else:
+                # socket error
+                reply.server_error_code = util.EC.SEND_ANY.value
+
+            # print the corresponding error message
+            if reply.server_error_code == util.EC.SUCCESS.value:
+                # in case of success, return the corresponding message id
+                message_id = netUtil.receive_string(sock)
+                print(f"SEND OK - MESSAGE {message_id}")
+            elif reply.server_error_code == util.EC.SEND_USR_NOT_EXISTS.value:
+                print("SEND FAIL / USER DOES NOT EXIST")
+            elif reply.server_error_code == util.EC.SEND_ANY.value:
+                print("SEND FAIL")
+
+        return reply.server_error_code
+
+    # *
+    # * @param recipient - Recipient user name
+    # * @param content - Message content (bytes) to be streamed, of any size
+    # *
+    # * @return EC.SUCCESS if the server had successfully received the message
+    # * @return EC.SEND_USR_NOT_EXISTS if the user does not exist
+    # * @return EC.SEND_ANY if another error occurred
+    def send_stream(self, recipient, content):
+        # first, we create the request
+        request = util.Request()
+        reply = util.Reply()
+        # fill up the request
+        request.header.op_code = util.SEND_STREAM
+        request.header.username = self._connected_user
+        request.item.recipient_username = str(recipient)
+        # now, we connect to the socket
+        with netUtil.connect_socket((self.server, self.port)) as sock:
+            if sock:
+                # and stream the message
+                netUtil.send_stream_request(sock, request, content)
                 # receive server reply (error code)
                 reply.server_error_code = netUtil.receive_server_error_code(sock)
             else:
@@ -246,6 +283,95 @@ class Client:
 
         return reply.server_error_code
 
+    # *
+    # * @return EC.SUCCESS if successful
+    # * @return EC.CONNECTEDUSERS_USR_NOT_CN if the user of this session is not connected
+    # * @return EC.CONNECTEDUSERS_ANY if another error occurred
+    def connected_users(self):
+        # first, we create the request
+        request = util.Request()
+        reply = util.Reply()
+        # fill up the request
+        request.header.op_code = util.CONNECTEDUSERS
+        request.header.username = self._connected_user if self._connected_user else ""
+        # now, we connect to the socket
+        with netUtil.connect_socket((self.server, self.port)) as sock:
+            if sock:
+                # and send the request
+                netUtil.send_header(sock, request)
+                # receive server reply (error code)
+                reply.server_error_code = netUtil.receive_server_error_code(sock)
+            else:
+                # socket error
+                reply.server_error_code = util.EC.CONNECTEDUSERS_ANY.value
+
+            # print the corresponding error message
+            if reply.server_error_code == util.EC.SUCCESS.value:
+                # in case of success, receive the number of users and the users themselves
+                n_users = netUtil.receive_string(sock)
+                users = netUtil.receive_frames(sock).decode().split('\0')[:-1]
+                print(f"CONNECTED USERS ({n_users} users connected) OK {', '.join(users)}")
+            elif reply.server_error_code == util.EC.CONNECTEDUSERS_USR_NOT_CN.value:
+                print("CONNECTED USERS FAIL / USER IS NOT CONNECTED")
+            elif reply.server_error_code == util.EC.CONNECTEDUSERS_ANY.value:
+                print("CONNECTED USERS FAIL")
+
+        return reply.server_error_code
+
+    # *
+    # * @param peer - User name of the other end of the conversation
+    # *
+    # * @return EC.SUCCESS if successful
+    # * @return EC.HISTORY_USR_NOT_CN if the user of this session is not connected
+    # * @return EC.HISTORY_DISABLED if the server isn't keeping message history
+    # * @return EC.HISTORY_ANY if another error occurred
+    def history(self, peer):
+        # first, we create the request
+        request = util.Request()
+        reply = util.Reply()
+        # fill up the request
+        request.header.op_code = util.HISTORY
+        request.header.username = self._connected_user if self._connected_user else ""
+        request.item.recipient_username = str(peer)
+        # the history is read a page at a time, each one after the timestamp of the last message of the previous one
+        since, n_messages = 0, 0
+        reply.server_error_code = util.EC.SUCCESS.value
+        page_len = util.HIST_PAGE_MAX
+        while reply.server_error_code == util.EC.SUCCESS.value and page_len == util.HIST_PAGE_MAX:
+            with netUtil.connect_socket((self.server, self.port)) as sock:
+                if sock:
+                    netUtil.send_history_request(sock, request, since, util.HIST_PAGE_MAX)
+                    reply.server_error_code = netUtil.receive_server_error_code(sock)
+                else:
+                    # socket error
+                    reply.server_error_code = util.EC.HISTORY_ANY.value
+                    break
+
+                if reply.server_error_code == util.EC.SUCCESS.value:
+                    # each message is made of 5 fields: timestamp, sender, message ID, size and content
+                    page_len = int(netUtil.receive_string(sock))
+                    fields = netUtil.receive_frames(sock).decode(errors='replace').split('\0')[:-1]
+                    for pos in range(0, len(fields) - 4, 5):
+                        timestamp, sender, message_id, size, content = fields[pos:pos + 5]
+                        since = int(timestamp)
+                        if not content and int(size):
+                            content = f"({size} bytes streamed, content not kept)"
+                        print(f" {time.strftime('%Y-%m-%d %H:%M:%S', time.localtime(since / 1000))} "
+                              f"MESSAGE {message_id} FROM {sender}: {content}")
+                    n_messages += page_len
+
+        # print the corresponding error message
+        if reply.server_error_code == util.EC.SUCCESS.value:
+            print(f"HISTORY {peer} ({n_messages} messages) OK")
+        elif reply.server_error_code == util.EC.HISTORY_USR_NOT_CN.value:
+            print("HISTORY FAIL / USER IS NOT CONNECTED")
+        elif reply.server_error_code == util.EC.HISTORY_DISABLED.value:
+            print("HISTORY FAIL / SERVER IS NOT KEEPING HISTORY")
+        elif reply.server_error_code == util.EC.HISTORY_ANY.value:
+            print("HISTORY FAIL")
+
+        return reply.server_error_code
+
     def shell(self):
         """Simple Command Line Interface for the client. It calls the protocol functions."""
         while True:
@@ -288,6 +414,25 @@ class Client:
                         else:
                             print("Syntax error. Usage: SEND <userName> <message>")
 
+                    elif line[0] == "SENDATTACH":
+                        if len(line) == 3:
+                            with open(line[2], 'rb') as attachment:
+                                self.send_stream(line[1], attachment.read())
+                        else:
+                            print("Syntax error. Usage: SENDATTACH <userName> <filePath>")
+
+                    elif line[0] == "CONNECTEDUSERS":
+                        if len(line) == 1:
+                            self.connected_users()
+                        else:
+                            print("Syntax error. Usage: CONNECTEDUSERS")
+
+                    elif line[0] == "HISTORY":
+                        if len(line) == 2:
+                            self.history(line[1])
+                        else:
+                            print("Syntax error. Usage: HISTORY <userName>")
+
                     elif line[0] == "QUIT":
                         if len(line) == 1:
                             if self._connected_user:
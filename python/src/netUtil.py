@@ -59,9 +59,81 @@ def send_message_request(sock, request):
         print(f"send_message_request fail: {ex}")
 
 
+def send_ext_request(sock, request, options: dict):
+    """Function in charge of sending a SEND_EXT request to the server socket: the same fields as a message request,
+    followed by its options as "key=value" strings, ended by an empty string"""
+    try:
+        # first, send the fields of a plain message request
+        send_message_request(sock, request)
+        # then the options
+        for key, value in options.items():
+            sock.sendall(f"{key}={value}".encode('ascii'))
+            sock.sendall(b'\0')
+        sock.sendall(b'\0')
+    except socket.error as ex:
+        print(f"send_ext_request fail: {ex}")
+
+
+def send_history_request(sock, request, since: int, max_messages: int):
+    """Function in charge of sending the header, the peer user, the timestamp after which messages are wanted
+    and the max number of messages to the server socket"""
+    try:
+        # first, send the header
+        send_header(sock, request)
+        # then the peer user, the timestamp and the number of messages
+        for field in (request.item.recipient_username, str(since), str(max_messages)):
+            sock.sendall(field.encode('ascii'))
+            sock.sendall(b'\0')
+    except socket.error as ex:
+        print(f"send_history_request fail: {ex}")
+
+
+def send_stream_request(sock, request, content: bytes):
+    """Function in charge of sending the header, the recipient user and the message content to the server socket,
+    in frames of at most util.STREAM_CHUNK_SIZE bytes"""
+    try:
+        # first, send the header
+        send_header(sock, request)
+        # we send the recipient user
+        sock.sendall(request.item.recipient_username.encode('ascii'))
+        sock.sendall(b'\0')
+        # and then the content, frame by frame: length string followed by the bytes
+        for pos in range(0, len(content), util.STREAM_CHUNK_SIZE):
+            frame = content[pos:pos + util.STREAM_CHUNK_SIZE]
+            sock.sendall(str(len(frame)).encode('ascii') + b'\0')
+            sock.sendall(frame)
+        # a 0-length frame ends the stream
+        sock.sendall(b'0\0')
+    except socket.error as ex:
+        print(f"send_stream_request fail: {ex}")
+
+
+def receive_frames(sock):
+    """Function in charge of receiving a streamed message content from a given socket"""
+    content = bytearray()
+    while True:
+        frame_len = int(receive_string(sock))
+        if frame_len == 0:
+            return bytes(content)
+        while frame_len > 0:
+            chunk = sock.recv(frame_len)
+            if not chunk:
+                raise socket.error("stream ended in the middle of a frame")
+            content += chunk
+            frame_len -= len(chunk)
+
+
 def receive_server_error_code(sock):
     """Function in charge of receiving a byte representing the error code from the server"""
     error_code = int.from_bytes(sock.recv(1), "big")
+    # an overloaded server tells the client when to retry
+    if error_code == util.EC.BUSY.value:
+        retry_after_ms = receive_string(sock)
+        print(f"SERVER BUSY - RETRY AFTER {retry_after_ms} ms")
+    # in a cluster, the client is told which node the user lives in
+    elif error_code == util.EC.REDIRECT.value:
+        node_address = receive_string(sock)
+        print(f"USER LIVES IN ANOTHER NODE - RETRY AT {node_address}")
     return error_code
 
 
@@ -83,8 +155,7 @@ def receive_string(sock):
 
 
 def listen_and_accept(sock):
-    """Function in charge of listening at a free port and accepting the connection, receiving server replies"""
-    sock.listen(1)
+    """Function in charge of accepting the connections at an already listening socket, receiving server replies"""
     # first, create the reply
     reply = util.Reply()
     connected = True
@@ -100,10 +171,31 @@ def listen_and_accept(sock):
                 reply.item.message_id = receive_string(connection)
                 reply.item.message = receive_string(connection)
                 print(f"c> MESSAGE {reply.item.message_id} FROM {reply.header.username}:\n {reply.item.message}\nEND")
+            # in the case of a streamed message:
+            elif reply.header.op_code == util.SEND_MESSAGE_STREAM:
+                reply.header.username = receive_string(connection)
+                reply.item.message_id = receive_string(connection)
+                content = receive_frames(connection)
+                reply.item.message = content.decode(errors='replace')
+                print(f"c> MESSAGE {reply.item.message_id} FROM {reply.header.username} ({len(content)} bytes):\n"
+                      f" {reply.item.message}\nEND")
             # in case of a message acknowledgement:
             elif reply.header.op_code == util.SEND_MESS_ACK:
                 reply.item.message_id = receive_string(connection)
                 print(f"c> SEND MESSAGE {reply.item.message_id} OK")
+            # in case of message acknowledgements queued while the client was offline:
+            elif reply.header.op_code == util.SEND_MESS_ACKS:
+                receive_string(connection)      # number of message IDs
+                for message_id in receive_frames(connection).split(b'\0')[:-1]:
+                    print(f"c> SEND MESSAGE {message_id.decode()} OK")
+            # in case a message has expired before it could be delivered:
+            elif reply.header.op_code == util.SEND_MESS_EXPIRED:
+                reply.item.message_id = receive_string(connection)
+                reply.header.username = receive_string(connection)
+                print(f"c> MESSAGE {reply.item.message_id} TO {reply.header.username} EXPIRED")
+            # server checking that this listening thread is alive: nothing to do
+            elif reply.header.op_code == util.HEARTBEAT:
+                pass
             elif reply.header.op_code == util.END_LISTEN_THREAD:
                 # end thread
                 connected = False
@@ -9,12 +9,32 @@ UNREGISTER = 'UNREGISTER'
 CONNECT = 'CONNECT'
 DISCONNECT = 'DISCONNECT'
 SEND = 'SEND'
+SEND_STREAM = 'SEND_STREAM'
+SEND_EXT = 'SEND_EXT'
+CONNECTEDUSERS = 'CONNECTEDUSERS'
+HISTORY = 'HISTORY'
 QUIT = 'QUIT'
 TEST = "TEST"
 
 # services called by server, served by client
 SEND_MESSAGE = 'SEND_MESSAGE'
 SEND_MESS_ACK = 'SEND_MESS_ACK'
+SEND_MESS_ACKS = 'SEND_MESS_ACKS'
+SEND_MESSAGE_STREAM = 'SEND_MESSAGE_STREAM'
+SEND_MESS_EXPIRED = 'SEND_MESS_EXPIRED'
+HEARTBEAT = 'HEARTBEAT'
+
+# SEND_EXT options: "key=value" strings sent after the message content, ended by an empty string
+SEND_OPT_TTL = 'ttl'
+SEND_OPT_NORM = 'norm'
+SEND_OPT_TOKEN = 'tok'
+
+# streamed messages: max content size that fits in a plain SEND, and frame size
+MAX_MSG_SIZE = 255
+STREAM_CHUNK_SIZE = 4096
+
+# max number of messages the server sends in a HISTORY reply
+HIST_PAGE_MAX = 256
 
 # op code used to end the client receiving thread
 END_LISTEN_THREAD = "END_LISTEN_THREAD"
@@ -29,6 +49,10 @@ class EC(Enum):
     ----------
     SUCCESS: int
         general success code for any operation
+    BUSY: int
+        general code for a request shed by the server because of overload
+    REDIRECT: int
+        general code for a request sent to a node of a cluster where its user doesn't live
     REGISTER: enum
         error codes for REGISTER service
     UNREGISTER: enum
@@ -39,9 +63,15 @@ class EC(Enum):
         error codes for DISCONNECT service
     SEND: enum
         error codes for SEND service
+    CONNECTEDUSERS: enum
+        error codes for CONNECTEDUSERS service
+    HISTORY: enum
+        error codes for HISTORY service
  """
 
     SUCCESS = 0
+    REDIRECT = 8    # any service: user lives in another node, followed by its address (host:port)
+    BUSY = 9        # any service: server overloaded, followed by the retry-after time in ms
 
     REGISTER_USR_ALREADY_REG = 1
     REGISTER_ANY = 2
@@ -62,6 +92,13 @@ class EC(Enum):
     SEND_USR_NOT_EXISTS = 1
     SEND_ANY = 2
 
+    CONNECTEDUSERS_USR_NOT_CN = 1
+    CONNECTEDUSERS_ANY = 2
+
+    HISTORY_USR_NOT_CN = 1
+    HISTORY_ANY = 2
+    HISTORY_DISABLED = 3    # the server isn't keeping message history
+
 
 class Header:
     """
@@ -1,7 +1,136 @@
 import unittest
+import contextlib
+import glob
+import io
 import os
+import signal
+import socket
+import subprocess
+import tempfile
+import time
+from threading import Thread
 from client import Client
-from src import util
+from src import netUtil, util
+
+# binaries of the tests that need a server or a tool of their own, relative to the build directory they are run from
+SERVER_BIN = os.path.abspath(os.getenv("SERVER_BIN", "app/server"))
+REPLAY_BIN = os.path.abspath(os.getenv("REPLAY_BIN", "app/replay"))
+TXNLOG_BIN = os.path.abspath(os.getenv("TXNLOG_BIN", "app/txnlog"))
+# storage engine of the shared server: "dir" (default) or "mem"
+SERVER_ENGINE = os.getenv("SERVER_ENGINE", "dir")
+
+
+def write_txn_record(path, sender, recipient, msg_id, content, torn=False):
+    """Function in charge of writing the transaction of a message stored for a user to a transaction log slot,
+    as a server that crashed before applying it leaves it; the record is written by TXNLOG_BIN, with the server's
+    own types, and a torn one has its last byte cut off"""
+    subprocess.run([TXNLOG_BIN] + (["-t"] if torn else []) + [path, sender, recipient, str(msg_id), content],
+                   check=True)
+
+
+def new_client(port):
+    """Function in charge of creating a client of the server listening at the given port"""
+    client = Client()
+    client.server = os.getenv("SERVER_IP")
+    client.port = port
+    return client
+
+
+def start_server(port, data_dir, *args):
+    """Function in charge of starting a server of its own at the given port and data directory, waiting until it
+    accepts connections"""
+    server = subprocess.Popen([SERVER_BIN, "-p", str(port), *args], cwd=data_dir,
+                              stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    for _ in range(50):
+        try:
+            socket.create_connection((os.getenv("SERVER_IP"), port)).close()
+            break
+        except OSError:
+            time.sleep(0.1)
+    return server
+
+
+def stop_server(server, crash=False):
+    """Function in charge of stopping a server started by start_server, either cleanly or by crashing it"""
+    server.send_signal(signal.SIGKILL if crash else signal.SIGINT)
+    server.wait()
+
+
+def send_ext(client, recipient, message, options):
+    """Function in charge of sending a SEND_EXT request with the given options on behalf of the client's connected
+    user, returning the server error code and the message ID"""
+    request = util.Request()
+    request.header.op_code = util.SEND_EXT
+    request.header.username = client._connected_user
+    request.item.recipient_username = recipient
+    request.item.message = message
+    with netUtil.connect_socket((client.server, client.port)) as sock:
+        netUtil.send_ext_request(sock, request, options)
+        error_code = netUtil.receive_server_error_code(sock)
+        message_id = netUtil.receive_string(sock) if error_code == util.EC.SUCCESS.value else None
+    return error_code, message_id
+
+
+def history_page(client, peer, since, max_messages):
+    """Function in charge of asking for a page of the conversation between the client's connected user and the peer,
+    returning the server error code and the (timestamp, sender, message ID, size, content) of each message"""
+    request = util.Request()
+    request.header.op_code = util.HISTORY
+    request.header.username = client._connected_user
+    request.item.recipient_username = peer
+    with netUtil.connect_socket((client.server, client.port)) as sock:
+        netUtil.send_history_request(sock, request, since, max_messages)
+        error_code = netUtil.receive_server_error_code(sock)
+        if error_code != util.EC.SUCCESS.value:
+            return error_code, None
+        netUtil.receive_string(sock)        # number of messages
+        fields = netUtil.receive_frames(sock).decode().split('\0')[:-1]
+    return error_code, [tuple(fields[pos:pos + 5]) for pos in range(0, len(fields), 5)]
+
+
+def register_from(source_ip, port, user):
+    """Function in charge of sending a REGISTER request from the given source IP, returning the server error code and
+    the retry-after time (ms) of a busy reply"""
+    with socket.create_connection((os.getenv("SERVER_IP"), port), source_address=(source_ip, 0)) as sock:
+        request = util.Request()
+        request.header.op_code = util.REGISTER
+        request.header.username = user
+        netUtil.send_header(sock, request)
+        error_code = int.from_bytes(sock.recv(1), "big")
+        retry_after_ms = int(netUtil.receive_string(sock)) if error_code == util.EC.BUSY.value else None
+    return error_code, retry_after_ms
+
+
+def register_at(port, user):
+    """Function in charge of sending a REGISTER request to the server at the given port, returning the server error
+    code and the address of the user's home node in a redirect reply"""
+    request = util.Request()
+    request.header.op_code = util.REGISTER
+    request.header.username = user
+    with netUtil.connect_socket((os.getenv("SERVER_IP"), port)) as sock:
+        netUtil.send_header(sock, request)
+        error_code = int.from_bytes(sock.recv(1), "big")
+        node_address = netUtil.receive_string(sock) if error_code == util.EC.REDIRECT.value else None
+    return error_code, node_address
+
+
+def unix_request(server_path, request, send):
+    """Function in charge of sending a request through the server's Unix socket with the given netUtil send function,
+    returning the server error code"""
+    with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as sock:
+        sock.connect(server_path)
+        send(sock, request)
+        return netUtil.receive_server_error_code(sock)
+
+
+def capture_output(action, wait=0.5):
+    """Function in charge of running the given action and returning its result, along with what the clients print
+    meanwhile (listening threads included, waiting for them for the given seconds)"""
+    output = io.StringIO()
+    with contextlib.redirect_stdout(output):
+        result = action()
+        time.sleep(wait)
+    return result, output.getvalue()
 
 
 class MyTestCase(unittest.TestCase):
@@ -33,11 +162,17 @@ class MyTestCase(unittest.TestCase):
         # try to connect another user while there is a user already connected
         self.assertEqual(client_b.connect("c"), util.EC.CONNECT_DIFF_USR_CN.value)
 
+        # connected users tests
+        # both users are connected, so either of them can ask
+        self.assertEqual(client_a.connected_users(), util.EC.SUCCESS.value)
+
         # disconnect tests
         # disconnects from user-b successfully
         self.assertEqual(client_b.disconnect("b"), util.EC.SUCCESS.value)
         # try to disconnect again from user-b, which was disconnected before
         self.assertEqual(client_b.disconnect("b"), util.EC.DISCONNECT_USR_NOT_CN.value)
+        # a disconnected user cannot ask who is connected
+        self.assertEqual(client_b.connected_users(), util.EC.CONNECTEDUSERS_USR_NOT_CN.value)
         # try to disconnect a different user than the one that is actually connected
         self.assertEqual(client_a.disconnect("c"), util.EC.DISCONNECT_DIFF_USR_CN.value)
         # disconnects from user-a successfully
@@ -86,7 +221,12 @@ class MyTestCase(unittest.TestCase):
         print(f"Message sent from a to b: {msg3}")
         self.assertEqual(client_a.send("b", msg3), util.EC.SUCCESS.value)
 
-        # case 4: user-a tries to send message to user-b, which is disconnected
+        # case 4: message longer than a plain SEND allows, streamed from user-a to user-b
+        msg_long = "long message " * 1000
+        print(f"Streamed message sent from a to b: {len(msg_long)} chars")
+        self.assertEqual(client_a.send("b", msg_long), util.EC.SUCCESS.value)
+
+        # case 5: user-a tries to send message to user-b, which is disconnected
         # disconnect user-b
         self.assertEqual(client_b.disconnect("b"), util.EC.SUCCESS.value)
         # send message from user-a to user-b (disconnected)
@@ -100,6 +240,508 @@ class MyTestCase(unittest.TestCase):
         self.assertEqual(client_a.unregister("a"), util.EC.SUCCESS.value)
         self.assertEqual(client_b.unregister("b"), util.EC.SUCCESS.value)
 
+    def test_recovery_after_restart(self):
+        # a server of its own, so that it can be crashed and restarted on the same data
+        port = int(os.getenv("SERVER_PORT")) + 1
+        data_dir = tempfile.mkdtemp()
+        server = start_server(port, data_dir)
+        client_a = new_client(port)
+        client_b = new_client(port)
+
+        # user-a sends a message to user-b, which is disconnected, so it is stored
+        self.assertEqual(client_a.register("a"), util.EC.SUCCESS.value)
+        self.assertEqual(client_b.register("b"), util.EC.SUCCESS.value)
+        self.assertEqual(client_a.connect("a"), util.EC.SUCCESS.value)
+        self.assertEqual(client_a.send("b", "before crash"), util.EC.SUCCESS.value)
+
+        # the server crashes and restarts on the same data
+        stop_server(server, crash=True)
+        server = start_server(port, data_dir)
+        try:
+            # both users are still registered, and nobody is connected anymore
+            self.assertEqual(client_b.register("b"), util.EC.REGISTER_USR_ALREADY_REG.value)
+            self.assertEqual(new_client(port).connect("a"), util.EC.SUCCESS.value)
+            # user-b connects and receives the message stored before the crash
+            result, output = capture_output(lambda: client_b.connect("b"))
+            self.assertEqual(result, util.EC.SUCCESS.value)
+            self.assertIn("c> MESSAGE 1 FROM a:\n before crash\nEND", output)
+        finally:
+            stop_server(server)
+
+    @unittest.skipIf(SERVER_ENGINE == "mem", "pending messages don't expire in memory")
+    def test_send_ttl(self):
+        client_a = new_client(int(os.getenv("SERVER_PORT")))
+        client_b = new_client(int(os.getenv("SERVER_PORT")))
+        self.assertEqual(client_a.register("a"), util.EC.SUCCESS.value)
+        self.assertEqual(client_b.register("b"), util.EC.SUCCESS.value)
+        self.assertEqual(client_a.connect("a"), util.EC.SUCCESS.value)
+
+        # a message must be allowed to live for some time
+        self.assertEqual(send_ext(client_a, "b", "never", {util.SEND_OPT_TTL: 0})[0], util.EC.SEND_ANY.value)
+        self.assertEqual(send_ext(client_a, "b", "never", {util.SEND_OPT_TTL: "x"})[0], util.EC.SEND_ANY.value)
+
+        # user-b is disconnected, so the message expires after 1 second and user-a is told
+        (error_code, message_id), output = capture_output(
+            lambda: send_ext(client_a, "b", "short lived", {util.SEND_OPT_TTL: 1}), wait=2.5)
+        self.assertEqual(error_code, util.EC.SUCCESS.value)
+        self.assertIn(f"c> MESSAGE {message_id} TO b EXPIRED", output)
+        # so user-b never receives it
+        result, output = capture_output(lambda: client_b.connect("b"))
+        self.assertEqual(result, util.EC.SUCCESS.value)
+        self.assertNotIn("short lived", output)
+
+        self.assertEqual(client_a.unregister("a"), util.EC.SUCCESS.value)
+        self.assertEqual(client_b.unregister("b"), util.EC.SUCCESS.value)
+
+    def test_send_normalization(self):
+        client_a = new_client(int(os.getenv("SERVER_PORT")))
+        client_b = new_client(int(os.getenv("SERVER_PORT")))
+        self.assertEqual(client_a.register("a"), util.EC.SUCCESS.value)
+        self.assertEqual(client_b.register("b"), util.EC.SUCCESS.value)
+        self.assertEqual(client_a.connect("a"), util.EC.SUCCESS.value)
+        self.assertEqual(client_b.connect("b"), util.EC.SUCCESS.value)
+
+        # with norm=1 the server collapses runs of blank spaces, with norm=0 the message is left as it is
+        (error_code, _), output = capture_output(lambda: send_ext(client_a, "b", "1 2  3\t\t4", {util.SEND_OPT_NORM: 1}))
+        self.assertEqual(error_code, util.EC.SUCCESS.value)
+        self.assertIn("FROM a:\n 1 2 3 4\nEND", output)
+        (error_code, _), output = capture_output(lambda: send_ext(client_a, "b", "1 2  3", {util.SEND_OPT_NORM: 0}))
+        self.assertEqual(error_code, util.EC.SUCCESS.value)
+        self.assertIn("FROM a:\n 1 2  3\nEND", output)
+        # any other value is rejected
+        self.assertEqual(send_ext(client_a, "b", "1 2  3", {util.SEND_OPT_NORM: 2})[0], util.EC.SEND_ANY.value)
+
+        self.assertEqual(client_a.unregister("a"), util.EC.SUCCESS.value)
+        self.assertEqual(client_b.unregister("b"), util.EC.SUCCESS.value)
+
+    def test_send_acks_while_disconnected(self):
+        client_a = new_client(int(os.getenv("SERVER_PORT")))
+        client_b = new_client(int(os.getenv("SERVER_PORT")))
+        self.assertEqual(client_a.register("a"), util.EC.SUCCESS.value)
+        self.assertEqual(client_b.register("b"), util.EC.SUCCESS.value)
+
+        # user-a sends two messages to user-b, which is disconnected, and then disconnects too
+        self.assertEqual(client_a.connect("a"), util.EC.SUCCESS.value)
+        first_id = send_ext(client_a, "b", "first", {})[1]
+        second_id = send_ext(client_a, "b", "second", {})[1]
+        self.assertEqual(client_a.disconnect("a"), util.EC.SUCCESS.value)
+        # user-b receives them while user-a is away, so their acknowledgements are kept for user-a
+        result, output = capture_output(lambda: client_b.connect("b"))
+        self.assertEqual(result, util.EC.SUCCESS.value)
+        self.assertIn("first", output)
+        self.assertIn("second", output)
+        # and user-a gets them all when it connects again, only once
+        result, output = capture_output(lambda: client_a.connect("a"))
+        self.assertEqual(result, util.EC.SUCCESS.value)
+        self.assertIn(f"c> SEND MESSAGE {first_id} OK", output)
+        self.assertIn(f"c> SEND MESSAGE {second_id} OK", output)
+        self.assertEqual(client_a.disconnect("a"), util.EC.SUCCESS.value)
+        result, output = capture_output(lambda: client_a.connect("a"))
+        self.assertEqual(result, util.EC.SUCCESS.value)
+        self.assertNotIn("SEND MESSAGE", output)
+
+        self.assertEqual(client_a.unregister("a"), util.EC.SUCCESS.value)
+        self.assertEqual(client_b.unregister("b"), util.EC.SUCCESS.value)
+
+    def test_history_paging(self):
+        # the shared server does not keep message history
+        client_a = new_client(int(os.getenv("SERVER_PORT")))
+        self.assertEqual(client_a.register("a"), util.EC.SUCCESS.value)
+        self.assertEqual(client_a.connect("a"), util.EC.SUCCESS.value)
+        self.assertEqual(client_a.history("b"), util.EC.HISTORY_DISABLED.value)
+        self.assertEqual(client_a.unregister("a"), util.EC.SUCCESS.value)
+
+        # so a server of its own is started, keeping it
+        port = int(os.getenv("SERVER_PORT")) + 1
+        server = start_server(port, tempfile.mkdtemp(), "-H")
+        try:
+            client_a = new_client(port)
+            client_b = new_client(port)
+            self.assertEqual(client_a.register("a"), util.EC.SUCCESS.value)
+            self.assertEqual(client_b.register("b"), util.EC.SUCCESS.value)
+            # the history is only available to connected users
+            self.assertEqual(client_a.history("b"), util.EC.HISTORY_USR_NOT_CN.value)
+            self.assertEqual(client_a.connect("a"), util.EC.SUCCESS.value)
+            self.assertEqual(client_b.connect("b"), util.EC.SUCCESS.value)
+
+            # a conversation of 5 messages, read in pages of 2 messages
+            for pos in range(5):
+                sender, recipient = (client_a, "b") if pos % 2 == 0 else (client_b, "a")
+                self.assertEqual(sender.send(recipient, f"message {pos}"), util.EC.SUCCESS.value)
+            pages, since = [], 0
+            while not pages or pages[-1]:
+                error_code, page = history_page(client_b, "a", since, 2)
+                self.assertEqual(error_code, util.EC.SUCCESS.value)
+                self.assertLessEqual(len(page), 2)
+                pages.append(page)
+                since = int(page[-1][0]) if page else since
+            # every message is there once, in order, whichever the user asking
+            self.assertEqual([len(page) for page in pages], [2, 2, 1, 0])
+            messages = [message for page in pages for message in page]
+            self.assertEqual([content for _, _, _, _, content in messages], [f"message {pos}" for pos in range(5)])
+            self.assertEqual([sender for _, sender, _, _, _ in messages], ["a", "b", "a", "b", "a"])
+            self.assertEqual(history_page(client_a, "b", 0, 10), (util.EC.SUCCESS.value, messages))
+            self.assertEqual(client_a.history("b"), util.EC.SUCCESS.value)
+        finally:
+            stop_server(server)
+
+    def test_send_token_retry(self):
+        client_a = new_client(int(os.getenv("SERVER_PORT")))
+        client_b = new_client(int(os.getenv("SERVER_PORT")))
+        self.assertEqual(client_a.register("a"), util.EC.SUCCESS.value)
+        self.assertEqual(client_b.register("b"), util.EC.SUCCESS.value)
+        self.assertEqual(client_a.connect("a"), util.EC.SUCCESS.value)
+
+        # a SEND retried with the same token gets the ID of the first one, and isn't stored twice
+        first = send_ext(client_a, "b", "retried", {util.SEND_OPT_TOKEN: "t1"})
+        self.assertEqual(first[0], util.EC.SUCCESS.value)
+        self.assertEqual(send_ext(client_a, "b", "retried", {util.SEND_OPT_TOKEN: "t1"}), first)
+        # the same token can't be used for another message, and a token can't be empty
+        self.assertEqual(send_ext(client_a, "b", "other", {util.SEND_OPT_TOKEN: "t1"})[0], util.EC.SEND_ANY.value)
+        self.assertEqual(send_ext(client_a, "b", "other", {util.SEND_OPT_TOKEN: ""})[0], util.EC.SEND_ANY.value)
+        # another token is another message
+        second = send_ext(client_a, "b", "retried", {util.SEND_OPT_TOKEN: "t2"})
+        self.assertEqual(second[0], util.EC.SUCCESS.value)
+        self.assertNotEqual(second[1], first[1])
+
+        # so user-b receives the message once per token
+        result, output = capture_output(lambda: client_b.connect("b"))
+        self.assertEqual(result, util.EC.SUCCESS.value)
+        self.assertEqual(output.count("retried"), 2)
+
+        self.assertEqual(client_a.unregister("a"), util.EC.SUCCESS.value)
+        self.assertEqual(client_b.unregister("b"), util.EC.SUCCESS.value)
+
+    def test_user_rate_limit(self):
+        port = int(os.getenv("SERVER_PORT"))
+        # a client hammering the server on behalf of a user is told to back off, and when to retry
+        replies = [register_from("127.0.0.3", port, "limited") for _ in range(3 * 40)]
+        busy = [retry_after_ms for error_code, retry_after_ms in replies if error_code == util.EC.BUSY.value]
+        self.assertTrue(busy)
+        self.assertTrue(all(retry_after_ms > 0 for retry_after_ms in busy))
+        # but it only uses up its own requests: the same user is still served from elsewhere
+        self.assertEqual(register_from("127.0.0.4", port, "limited"), (util.EC.REGISTER_USR_ALREADY_REG.value, None))
+        self.assertEqual(new_client(port).unregister("limited"), util.EC.SUCCESS.value)
+
+    def test_msg_ids_after_crash(self):
+        # a server of its own, crashed in the middle of a block of message IDs
+        port = int(os.getenv("SERVER_PORT")) + 1
+        data_dir = tempfile.mkdtemp()
+        server = start_server(port, data_dir)
+        try:
+            client_a = new_client(port)
+            self.assertEqual(client_a.register("a"), util.EC.SUCCESS.value)
+            self.assertEqual(new_client(port).register("b"), util.EC.SUCCESS.value)
+            self.assertEqual(client_a.connect("a"), util.EC.SUCCESS.value)
+            ids = [int(send_ext(client_a, "b", f"before {pos}", {})[1]) for pos in range(3)]
+            self.assertEqual(ids, sorted(set(ids)))
+        finally:
+            stop_server(server, crash=True)
+
+        # once restarted, the IDs given out keep increasing, so no ID is given twice
+        server = start_server(port, data_dir)
+        try:
+            client_a = new_client(port)
+            self.assertEqual(client_a.connect("a"), util.EC.SUCCESS.value)
+            error_code, message_id = send_ext(client_a, "b", "after", {})
+            self.assertEqual(error_code, util.EC.SUCCESS.value)
+            self.assertGreater(int(message_id), max(ids))
+        finally:
+            stop_server(server)
+
+    def test_reap_stalled_client(self):
+        # a server of its own, with short connection deadlines (ms)
+        port = int(os.getenv("SERVER_PORT")) + 1
+        server = start_server(port, tempfile.mkdtemp(), "-i", "300", "-q", "1000")
+        try:
+            # a client sends half an op_code and stalls
+            with socket.create_connection((os.getenv("SERVER_IP"), port)) as sock:
+                sock.sendall(b"REGI")
+                sock.settimeout(5)
+                # so the server closes the connection instead of waiting for it forever
+                self.assertEqual(sock.recv(1), b"")
+            # and keeps serving everyone else
+            self.assertEqual(new_client(port).register("a"), util.EC.SUCCESS.value)
+        finally:
+            stop_server(server)
+
+    def test_unix_sockets(self):
+        # a server of its own, also listening at a Unix socket
+        port = int(os.getenv("SERVER_PORT")) + 1
+        data_dir = tempfile.mkdtemp()
+        server_path = os.path.join(data_dir, "server.sock")
+        server = start_server(port, data_dir, "-l", server_path)
+        try:
+            # user-b registers through the Unix socket
+            request = util.Request()
+            request.header.op_code = util.REGISTER
+            request.header.username = "b"
+            self.assertEqual(unix_request(server_path, request, netUtil.send_header), util.EC.SUCCESS.value)
+            # and connects with a listening thread at a Unix socket too, given by its path
+            listen_path = os.path.join(data_dir, "b.sock")
+            listen_sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            listen_sock.bind(listen_path)
+            listen_sock.listen(1)
+            Thread(target=netUtil.listen_and_accept, args=(listen_sock,), daemon=True).start()
+            request.header.op_code = util.CONNECT
+            request.item.listening_port = listen_path
+            self.assertEqual(unix_request(server_path, request, netUtil.send_connection_request),
+                             util.EC.SUCCESS.value)
+
+            # so a message sent by user-a over TCP is delivered through it
+            client_a = new_client(port)
+            self.assertEqual(client_a.register("a"), util.EC.SUCCESS.value)
+            self.assertEqual(client_a.connect("a"), util.EC.SUCCESS.value)
+            result, output = capture_output(lambda: client_a.send("b", "over unix"))
+            self.assertEqual(result, util.EC.SUCCESS.value)
+            self.assertIn("FROM a:\n over unix\nEND", output)
+        finally:
+            stop_server(server)
+
+    def test_graceful_restart(self):
+        # a server of its own, handing over its listening socket through a handoff socket
+        port = int(os.getenv("SERVER_PORT")) + 1
+        data_dir = tempfile.mkdtemp()
+        handoff_path = os.path.join(data_dir, "handoff.sock")
+        old_server = start_server(port, data_dir, "-u", handoff_path)
+        new_server = None
+        try:
+            client_a = new_client(port)
+            client_b = new_client(port)
+            self.assertEqual(client_a.register("a"), util.EC.SUCCESS.value)
+            self.assertEqual(client_b.register("b"), util.EC.SUCCESS.value)
+            self.assertEqual(client_a.connect("a"), util.EC.SUCCESS.value)
+            self.assertEqual(client_b.connect("b"), util.EC.SUCCESS.value)
+
+            # a request is half sent when a new server starts at the same handoff socket
+            with socket.create_connection((os.getenv("SERVER_IP"), port)) as sock:
+                sock.sendall(b"SEND\0a\0")
+                new_server = start_server(port, data_dir, "-u", handoff_path)
+                time.sleep(0.3)
+                # the old server finishes it before exiting
+                def finish_request():
+                    sock.sendall(b"b\0during the switch\0")
+                    return netUtil.receive_server_error_code(sock)
+                error_code, output = capture_output(finish_request)
+                self.assertEqual(error_code, util.EC.SUCCESS.value)
+                self.assertIn("FROM a:\n during the switch\nEND", output)
+            old_server.wait(timeout=5)
+
+            # and the new one serves whatever comes next, user-b still connected
+            result, output = capture_output(lambda: client_a.send("b", "after the switch"))
+            self.assertEqual(result, util.EC.SUCCESS.value)
+            self.assertIn("FROM a:\n after the switch\nEND", output)
+        finally:
+            if old_server.poll() is None:
+                stop_server(old_server)
+            if new_server:
+                stop_server(new_server)
+
+    def test_layout_migration(self):
+        # a server of its own, keeping user tables in the flat layout
+        port = int(os.getenv("SERVER_PORT")) + 1
+        data_dir = tempfile.mkdtemp()
+        server = start_server(port, data_dir, "-L", "flat")
+        try:
+            client_a = new_client(port)
+            self.assertEqual(client_a.register("a"), util.EC.SUCCESS.value)
+            self.assertEqual(new_client(port).register("b"), util.EC.SUCCESS.value)
+            self.assertEqual(client_a.connect("a"), util.EC.SUCCESS.value)
+            self.assertEqual(client_a.send("b", "kept while moving"), util.EC.SUCCESS.value)
+        finally:
+            stop_server(server)
+        self.assertTrue(os.path.isdir(os.path.join(data_dir, "users", "b-table")))
+
+        # restarted with the hashed layout, tables are moved into shard folders while requests are served
+        server = start_server(port, data_dir, "-L", "hashed")
+        try:
+            for _ in range(50):
+                if not glob.glob(os.path.join(data_dir, "users", "*-table")):
+                    break
+                time.sleep(0.1)
+            self.assertEqual(glob.glob(os.path.join(data_dir, "users", "*-table")), [])
+            self.assertEqual(len(glob.glob(os.path.join(data_dir, "users", "??", "??", "*-table"))), 2)
+            # with users and their pending messages kept
+            self.assertEqual(new_client(port).register("b"), util.EC.REGISTER_USR_ALREADY_REG.value)
+            result, output = capture_output(lambda: new_client(port).connect("b"))
+            self.assertEqual(result, util.EC.SUCCESS.value)
+            self.assertIn("FROM a:\n kept while moving\nEND", output)
+        finally:
+            stop_server(server)
+
+    def test_cluster(self):
+        # two nodes of a cluster of their own, each one the home of part of the users
+        ports = [int(os.getenv("SERVER_PORT")) + 1, int(os.getenv("SERVER_PORT")) + 2]
+        nodes = ",".join(f"{os.getenv('SERVER_IP')}:{port}" for port in ports)
+        servers = [start_server(port, tempfile.mkdtemp(), "-c", nodes, "-n", str(pos))
+                   for pos, port in enumerate(ports)]
+        try:
+            # users registered at the first node: those living in the second one are redirected to it
+            home = {}
+            for pos in range(16):
+                user = f"u{pos}"
+                error_code, node_address = register_at(ports[0], user)
+                if error_code == util.EC.REDIRECT.value:
+                    self.assertEqual(node_address, f"{os.getenv('SERVER_IP')}:{ports[1]}")
+                    error_code, node_address = register_at(ports[1], user)
+                    home[user] = ports[1]
+                else:
+                    home[user] = ports[0]
+                self.assertEqual(error_code, util.EC.SUCCESS.value)
+            sender = next(user for user in home if home[user] == ports[0])
+            recipient = next(user for user in home if home[user] == ports[1])
+
+            # a message sent at the sender's node reaches a recipient living in the other one
+            client_sender = new_client(ports[0])
+            client_recipient = new_client(ports[1])
+            self.assertEqual(client_sender.connect(sender), util.EC.SUCCESS.value)
+            self.assertEqual(client_recipient.connect(recipient), util.EC.SUCCESS.value)
+            result, output = capture_output(lambda: client_sender.send(recipient, "across nodes"))
+            self.assertEqual(result, util.EC.SUCCESS.value)
+            self.assertIn(f"FROM {sender}:\n across nodes\nEND", output)
+        finally:
+            for server in servers:
+                stop_server(server)
+
+    def test_lost_listener(self):
+        # a server of its own, checking listening threads every second
+        port = int(os.getenv("SERVER_PORT")) + 1
+        server = start_server(port, tempfile.mkdtemp(), "-b", "1")
+        try:
+            client_a = new_client(port)
+            self.assertEqual(client_a.register("a"), util.EC.SUCCESS.value)
+            self.assertEqual(client_a.register("b"), util.EC.SUCCESS.value)
+            self.assertEqual(client_a.connect("a"), util.EC.SUCCESS.value)
+            # user-b connects with a listening thread that then goes away without disconnecting
+            listen_sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+            listen_sock.bind(("", 0))
+            listen_sock.listen(1)
+            request = util.Request()
+            request.header.op_code = util.CONNECT
+            request.header.username = "b"
+            request.item.listening_port = str(listen_sock.getsockname()[1])
+            with netUtil.connect_socket((os.getenv("SERVER_IP"), port)) as sock:
+                netUtil.send_connection_request(sock, request)
+                self.assertEqual(netUtil.receive_server_error_code(sock), util.EC.SUCCESS.value)
+            listen_sock.close()
+            time.sleep(3)
+
+            # so user-b is marked as disconnected, and a message sent to it is kept as pending
+            result, output = capture_output(client_a.connected_users, wait=0)
+            self.assertEqual(result, util.EC.SUCCESS.value)
+            self.assertIn("(1 users connected) OK a\n", output)
+            self.assertEqual(client_a.send("b", "kept for later"), util.EC.SUCCESS.value)
+            result, output = capture_output(lambda: new_client(port).connect("b"))
+            self.assertEqual(result, util.EC.SUCCESS.value)
+            self.assertIn("FROM a:\n kept for later\nEND", output)
+        finally:
+            stop_server(server)
+
+    def test_stalled_streams(self):
+        # a server of its own, never reaping stalled clients
+        port = int(os.getenv("SERVER_PORT")) + 1
+        server = start_server(port, tempfile.mkdtemp(), "-i", "0", "-q", "0")
+        stalled = []
+        try:
+            client_a = new_client(port)
+            self.assertEqual(client_a.register("a"), util.EC.SUCCESS.value)
+            # more streams than service threads start and never go on, holding every thread they can get
+            for _ in range(8):
+                sock = socket.create_connection((os.getenv("SERVER_IP"), port))
+                sock.sendall(b"SEND_STREAM\0a\0")
+                stalled.append(sock)
+            time.sleep(0.3)
+
+            # control requests still have a thread of their own
+            start = time.monotonic()
+            client_b = new_client(port)
+            self.assertEqual(client_b.register("b"), util.EC.SUCCESS.value)
+            self.assertEqual(client_b.connect("b"), util.EC.SUCCESS.value)
+            self.assertLess(time.monotonic() - start, 1)
+
+            # whereas a message request waits for the streams to go away
+            with socket.create_connection((os.getenv("SERVER_IP"), port)) as sock:
+                sock.sendall(b"SEND\0b\0a\0waiting\0")
+                sock.settimeout(0.5)
+                self.assertRaises(socket.timeout, sock.recv, 1)
+                for stalled_sock in stalled:
+                    stalled_sock.close()
+                sock.settimeout(5)
+                self.assertEqual(sock.recv(1), bytes([util.EC.SUCCESS.value]))
+        finally:
+            for sock in stalled:
+                sock.close()
+            stop_server(server)
+
+    def test_trace_replay(self):
+        # a server of its own, recording a trace of the requests it serves
+        port = int(os.getenv("SERVER_PORT")) + 1
+        trace_path = os.path.join(tempfile.mkdtemp(), "requests.trace")
+        server = start_server(port, tempfile.mkdtemp(), "-T", trace_path)
+        try:
+            client_a = new_client(port)
+            client_b = new_client(port)
+            self.assertEqual(client_a.register("a"), util.EC.SUCCESS.value)
+            self.assertEqual(client_b.register("b"), util.EC.SUCCESS.value)
+            self.assertEqual(client_a.connect("a"), util.EC.SUCCESS.value)
+            self.assertEqual(client_b.connect("b"), util.EC.SUCCESS.value)
+            for pos in range(3):
+                self.assertEqual(client_a.send("b", f"traced {pos}"), util.EC.SUCCESS.value)
+            self.assertEqual(client_b.disconnect("b"), util.EC.SUCCESS.value)
+        finally:
+            # requests are traced once served: the server is drained, so that none is left out
+            server.send_signal(signal.SIGTERM)
+            server.wait()
+
+        # replayed one request at a time against an empty server, every request gets the same reply
+        server = start_server(port, tempfile.mkdtemp())
+        try:
+            replay = subprocess.run([REPLAY_BIN, "-c", "1", "-x", "0", trace_path, os.getenv("SERVER_IP"), str(port)],
+                                    capture_output=True, text=True, timeout=30)
+            self.assertEqual(replay.returncode, 0, replay.stderr)
+            self.assertIn("r> replayed 8 requests", replay.stdout)
+            self.assertIn("(0 without reply", replay.stdout)
+            errors = {line.split()[1]: int(line.split()[3]) for line in replay.stdout.splitlines()[2:]}
+            self.assertEqual(errors, {"REGISTER": 0, "CONNECT": 0, "SEND_EXT": 0, "DISCONNECT": 0})
+            # and leaves the server as the original requests did
+            self.assertEqual(new_client(port).register("b"), util.EC.REGISTER_USR_ALREADY_REG.value)
+        finally:
+            stop_server(server)
+
+    def test_transaction_redo(self):
+        # a server of its own, whose transaction log is written while it is stopped
+        port = int(os.getenv("SERVER_PORT")) + 1
+        data_dir = tempfile.mkdtemp()
+        server = start_server(port, data_dir)
+        client_b = new_client(port)
+        self.assertEqual(new_client(port).register("a"), util.EC.SUCCESS.value)
+        self.assertEqual(client_b.register("b"), util.EC.SUCCESS.value)
+        stop_server(server)
+
+        # a transaction storing a message for user-b was logged, but the server stopped before applying it
+        txn_log = os.path.join(data_dir, "users", ".txnlog-3")
+        write_txn_record(txn_log, "a", "b", 7, "redone")
+        # so it is redone when the server starts again, and its log slot emptied
+        server = start_server(port, data_dir)
+        try:
+            result, output = capture_output(lambda: client_b.connect("b"))
+            self.assertEqual(result, util.EC.SUCCESS.value)
+            self.assertIn("c> MESSAGE 7 FROM a:\n redone\nEND", output)
+            self.assertEqual(os.path.getsize(txn_log), 0)
+            self.assertEqual(client_b.disconnect("b"), util.EC.SUCCESS.value)
+        finally:
+            stop_server(server)
+
+        # whereas a transaction whose record was torn while being logged is left out
+        write_txn_record(txn_log, "a", "b", 8, "torn", torn=True)
+        server = start_server(port, data_dir)
+        try:
+            result, output = capture_output(lambda: client_b.connect("b"))
+            self.assertEqual(result, util.EC.SUCCESS.value)
+            self.assertNotIn("torn", output)
+        finally:
+            stop_server(server)
+
 
 if __name__ == '__main__':
     unittest.main()
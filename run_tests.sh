@@ -8,5 +8,12 @@ cd build
 app/server -p $SERVER_PORT > /dev/null 2>&1 &
 python ../python/serverWS.py > /dev/null 2>&1 &
 python ../python/tests.py
+app/clientdemo $SERVER_IP $SERVER_PORT
 pkill -SIGINT '^server$'
-pkill -SIGTERM '^python$'
\ No newline at end of file
+
+# the same tests, against a server keeping its DB in memory
+while pgrep '^server$' > /dev/null; do sleep 0.1; done
+app/server -p $SERVER_PORT -e mem > /dev/null 2>&1 &
+SERVER_ENGINE=mem python ../python/tests.py
+pkill -SIGINT '^server$'
+pkill -SIGTERM '^python$'
@@ -0,0 +1,170 @@
+#define _GNU_SOURCE     /* needed for struct ucred */
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "DS-Lab-Assignment/netUtil.h"
+#include "DS-Lab-Assignment/admission.h"
+
+
+#define ADM_TABLE_SIZE 4096     /* number of token buckets kept per table; must be a power of 2 */
+#define ADM_PROBE_LEN 8         /* max number of slots looked at to find a key's bucket */
+
+/* token bucket of a client (a user and its source, a source IP, or a local user id),
+ * identified by the hash of its key */
+typedef struct {
+    uint64_t key_hash;          /* 0 for a free slot */
+    double tokens;
+    long long last_refill_ms;
+} adm_bucket_t;
+
+typedef struct {
+    adm_bucket_t buckets[ADM_TABLE_SIZE];
+    double rate;                /* tokens added per second */
+    double burst;               /* max tokens in a bucket */
+    pthread_mutex_t mutex;
+} adm_table_t;
+
+static adm_table_t adm_users = {.rate = ADM_USER_RATE, .burst = ADM_USER_BURST,
+                                .mutex = PTHREAD_MUTEX_INITIALIZER};
+static adm_table_t adm_ips = {.rate = ADM_IP_RATE, .burst = ADM_IP_BURST,
+                              .mutex = PTHREAD_MUTEX_INITIALIZER};
+
+static long long adm_now_ms(void);
+static uint64_t adm_hash(const void *key, size_t len);
+static adm_bucket_t *adm_get_bucket(adm_table_t *table, uint64_t key_hash, long long now_ms);
+static int adm_take_token(adm_table_t *table, uint64_t key_hash, double min_tokens_left);
+static int adm_admit_conn(uint64_t key_hash, int queue_depth);
+
+
+static long long adm_now_ms(void) {
+    /*** Returns a monotonic timestamp in milliseconds ***/
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+}
+
+
+static uint64_t adm_hash(const void *key, const size_t len) {
+    /*** 64-bit FNV-1a hash of a key; never 0, which marks free slots ***/
+    const unsigned char *byte = key;
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= byte[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash ? hash : 1;
+}
+
+
+static adm_bucket_t *adm_get_bucket(adm_table_t *table, const uint64_t key_hash, const long long now_ms) {
+    /*** Finds the bucket of a key and refills it, or sets up a full one; a slot can be taken
+     * over once its bucket has refilled completely, since a full bucket holds no state;
+     * returns NULL if every probed slot is in use; table mutex must be held ***/
+    adm_bucket_t *free_slot = NULL;
+
+    for (int i = 0; i < ADM_PROBE_LEN; i++) {
+        adm_bucket_t *bucket = &table->buckets[(key_hash + i) & (ADM_TABLE_SIZE - 1)];
+        if (bucket->key_hash) {
+            /* refill bucket */
+            bucket->tokens += (double) (now_ms - bucket->last_refill_ms) * table->rate / 1000;
+            if (bucket->tokens > table->burst) bucket->tokens = table->burst;
+            bucket->last_refill_ms = now_ms;
+            if (bucket->key_hash == key_hash) return bucket;
+        }
+        if (!free_slot && (!bucket->key_hash || bucket->tokens >= table->burst)) free_slot = bucket;
+    }
+
+    if (free_slot) {
+        free_slot->key_hash = key_hash;
+        free_slot->tokens = table->burst;
+        free_slot->last_refill_ms = now_ms;
+    }
+    return free_slot;
+}
+
+
+static int adm_take_token(adm_table_t *table, const uint64_t key_hash, const double min_tokens_left) {
+    /*** Takes a token from the bucket of a key if at least min_tokens_left would remain in it;
+     * returns 0 on success, or the milliseconds until that will be possible ***/
+    long long now_ms = adm_now_ms();
+    int retry_after_ms = 0;
+
+    pthread_mutex_lock(&table->mutex);
+    adm_bucket_t *bucket = adm_get_bucket(table, key_hash, now_ms);
+    /* if the table is crowded, let the request in rather than punish an unknown client */
+    if (bucket) {
+        /* a token is taken even when the request is rejected,
+         * so a client that keeps hammering the server stays throttled;
+         * the retry-after time leaves room for the token the retry will take */
+        bucket->tokens -= 1;
+        if (bucket->tokens < min_tokens_left) {
+            if (bucket->tokens < -table->burst) bucket->tokens = -table->burst;
+            retry_after_ms = (int) ((min_tokens_left + 1 - bucket->tokens) * 1000 / table->rate) + 1;
+        }
+    }
+    pthread_mutex_unlock(&table->mutex);
+
+    return retry_after_ms;
+}
+
+
+static int adm_admit_conn(const uint64_t key_hash, const int queue_depth) {
+    /*** Admission control for a new connection from a given client, given the number
+     * of connections waiting to be served: past ADM_QUEUE_HIGH connections, only clients
+     * that have used less than half their burst get in, so heavy clients are shed first;
+     * when the connection queue is full, every connection is shed ***/
+    if (queue_depth >= MAX_CONN_BACKLOG) return ADM_RETRY_AFTER_MS;
+
+    double min_tokens_left = (queue_depth >= ADM_QUEUE_HIGH) ? adm_ips.burst / 2 : 0;
+    int retry_after_ms = adm_take_token(&adm_ips, key_hash, min_tokens_left);
+
+    if (retry_after_ms && retry_after_ms < ADM_RETRY_AFTER_MS && queue_depth >= ADM_QUEUE_HIGH)
+        retry_after_ms = ADM_RETRY_AFTER_MS;
+    return retry_after_ms;
+}
+
+
+int adm_admit_ip(const struct in_addr ip, const int queue_depth) {
+    /*** Admission control for a new TCP connection, by its source IP ***/
+    return adm_admit_conn(adm_hash(&ip, sizeof ip), queue_depth);
+}
+
+
+int adm_admit_local(const uid_t uid, const int queue_depth) {
+    /*** Admission control for a new Unix socket connection, by the user id of its process,
+     * so local users don't share a single bucket; the key is tagged not to clash with an IP ***/
+    unsigned char key[1 + sizeof uid];
+    key[0] = 'U';
+    memcpy(key + 1, &uid, sizeof uid);
+    return adm_admit_conn(adm_hash(key, sizeof key), queue_depth);
+}
+
+
+int adm_admit_user(const char *const username, const int socket) {
+    /*** Rate limiting of the requests made on behalf of a given user; the bucket is keyed by the user
+     * and the client making the request (its source IP, or its user id over a Unix socket), so a client
+     * can't use up the requests of someone else's account ***/
+    size_t username_len = strlen(username) + 1;
+    unsigned char key[username_len + sizeof(struct in_addr) + sizeof(uid_t)];
+    memcpy(key, username, username_len);
+    size_t key_len = username_len;
+
+    struct sockaddr_storage addr;
+    socklen_t addr_len = sizeof addr;
+    struct ucred cred;
+    socklen_t cred_len = sizeof cred;
+    if (getpeername(socket, (struct sockaddr *) &addr, &addr_len) == 0) {
+        if (addr.ss_family == AF_INET) {
+            memcpy(key + key_len, &((struct sockaddr_in *) &addr)->sin_addr, sizeof(struct in_addr));
+            key_len += sizeof(struct in_addr);
+        } else if (addr.ss_family == AF_UNIX &&
+                   getsockopt(socket, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) == 0) {
+            memcpy(key + key_len, &cred.uid, sizeof(uid_t));
+            key_len += sizeof(uid_t);
+        }
+    }
+    return adm_take_token(&adm_users, adm_hash(key, key_len), 0);
+}
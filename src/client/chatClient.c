@@ -0,0 +1,918 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include "DS-Lab-Assignment/netUtil.h"
+#include "DS-Lab-Assignment/chatClient.h"
+
+/**** Kinds Of Server Reply ****/
+#define CC_REPLY_CODE 'c'       /* just the reply code */
+#define CC_REPLY_MSG_ID 'i'     /* followed by the message ID if successful */
+#define CC_REPLY_USERS 'u'      /* followed by the number of users (or history messages) and frames holding them */
+
+
+/* request to the server: one connection per request, as the server serves them */
+typedef struct cc_request {
+    char reply_kind;            /* CC_REPLY_CODE, CC_REPLY_MSG_ID or CC_REPLY_USERS */
+    char *out;                  /* whole request, as sent to the server */
+    size_t out_len;
+    size_t out_space;
+    size_t out_pos;             /* bytes of the request already sent */
+    char *in;                   /* reply received so far */
+    size_t in_len;
+    size_t in_space;
+    int socket;                 /* -1 while queued */
+    int connected;
+    long long deadline_ms;
+    cc_done_cb done;
+    void *args;
+    struct cc_request *next;
+} cc_request_t;
+
+/* connection opened by the server to the listening socket to push a service request */
+typedef struct cc_push {
+    int socket;
+    char *in;
+    size_t in_len;
+    size_t in_space;
+    long long deadline_ms;
+    struct cc_push *next;
+} cc_push_t;
+
+struct cc_client {
+    struct sockaddr_storage server_addr;
+    socklen_t server_addr_len;
+    cc_listener_t listener;
+    int listen_socket;          /* -1 if the client has no listener */
+    int listen_port;
+    char listen_path[UNIX_PATH_MAX_SIZE];   /* Unix socket path of the listener; empty if it listens on TCP */
+    int wake_pipe[2];           /* written to when a request is queued or the client is destroyed */
+    pthread_t client_thread;
+
+    pthread_mutex_t mutex_queue;
+    cc_request_t *queue_head;   /* requests waiting to be sent */
+    cc_request_t *queue_tail;
+    int stopping;
+
+    /* only used by the client thread */
+    cc_request_t *in_flight[CC_MAX_IN_FLIGHT];
+    int n_in_flight;
+    cc_push_t *pushes;
+};
+
+struct cc_future {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond_done;
+    int done;
+    cc_result_t result;
+};
+
+static long long cc_now_ms(void);
+static int cc_buf_add(char **buffer, size_t *len, size_t *space, const char *bytes, size_t n_bytes);
+static int cc_recv_into(int socket, char **buffer, size_t *len, size_t *space);
+static int cc_next_field(const char *buffer, size_t len, size_t *pos, const char **field);
+static int cc_next_frame(const char *buffer, size_t len, size_t *pos, const char **frame, int *frame_len);
+static int cc_parse_reply(const cc_request_t *req, cc_result_t *result);
+static void cc_push_dispatch(const cc_client_t *client, cc_push_t *push);
+static void cc_request_free(cc_request_t *req);
+static void cc_request_finish(cc_request_t *req, int status);
+static int cc_request_start(cc_client_t *client, cc_request_t *req);
+static int cc_request_io(cc_request_t *req, short revents);
+static void cc_accept_pushes(cc_client_t *client);
+static void cc_serve_pushes(cc_client_t *client, const struct pollfd *poll_fds, long long now_ms);
+static void cc_poll_round(cc_client_t *client, struct pollfd *poll_fds);
+static void cc_shutdown(cc_client_t *client);
+static void *cc_thread(void *args);
+static void cc_free(cc_client_t *client);
+static cc_request_t *cc_request_new(char reply_kind, const char *op_code, const char *username);
+static int cc_request_add(cc_request_t *req, const char *bytes, size_t n_bytes);
+static int cc_submit(cc_client_t *client, cc_request_t *req, cc_done_cb done, void *args);
+static int cc_field_is_valid(const char *field);
+static int cc_user_request(cc_client_t *client, const char *op_code, const char *username, const char *port,
+                           cc_done_cb done, void *args);
+
+
+/***** Buffers & Parsing *****/
+static long long cc_now_ms(void) {
+    /*** Monotonic time in ms ***/
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+
+static int cc_buf_add(char **buffer, size_t *len, size_t *space, const char *bytes, const size_t n_bytes) {
+    /*** Appends n_bytes bytes to a buffer, doubling its space as needed ***/
+    if (*len + n_bytes > *space) {
+        size_t new_space = *space ? *space : CC_RECV_CHUNK_SIZE;
+        while (new_space < *len + n_bytes) new_space *= 2;
+        char *new_buffer = realloc(*buffer, new_space);
+        CHECK_ERROR_WITH_ERRNO(!new_buffer, "Could not grow client buffer", GEN_ERR_ANY)
+        *buffer = new_buffer;
+        *space = new_space;
+    }
+    if (bytes) memcpy(*buffer + *len, bytes, n_bytes);
+    *len += n_bytes;
+    return 0;
+}
+
+
+static int cc_recv_into(const int socket, char **buffer, size_t *len, size_t *space) {
+    /*** Receives the bytes available in a non-blocking socket into a buffer;
+     * returns 0 on EOF, GEN_ERR_ANY on error and TRUE otherwise ***/
+    while (TRUE) {
+        if (cc_buf_add(buffer, len, space, NULL, CC_RECV_CHUNK_SIZE) < 0) return GEN_ERR_ANY;
+        *len -= CC_RECV_CHUNK_SIZE;     /* only room was made */
+
+        ssize_t bytes_read = recv(socket, *buffer + *len, CC_RECV_CHUNK_SIZE, 0);
+        if (bytes_read < 0 && errno == EINTR) continue;
+        if (bytes_read < 0) return (errno == EAGAIN || errno == EWOULDBLOCK) ? TRUE : GEN_ERR_ANY;
+        if (bytes_read == 0) return 0;
+        *len += bytes_read;
+    }
+}
+
+
+static int cc_next_field(const char *buffer, const size_t len, size_t *pos, const char **field) {
+    /*** Finds the '\0'-terminated field starting at *pos; returns FALSE if it isn't all in yet ***/
+    const char *field_end = memchr(buffer + *pos, '\0', len - *pos);
+    if (!field_end) return FALSE;
+
+    *field = buffer + *pos;
+    *pos = field_end - buffer + 1;
+    return TRUE;
+}
+
+
+static int cc_next_frame(const char *buffer, const size_t len, size_t *pos, const char **frame, int *frame_len) {
+    /*** Finds the frame starting at *pos (length string followed by that many bytes);
+     * returns FALSE if it isn't all in yet and GEN_ERR_ANY if it's invalid ***/
+    size_t start = *pos;
+    const char *len_str;
+    if (!cc_next_field(buffer, len, &start, &len_str)) return FALSE;
+    if (str_to_num(len_str, (void *) frame_len, INT) < 0 || *frame_len < 0 || *frame_len > STREAM_CHUNK_SIZE)
+        return GEN_ERR_ANY;
+    if (len - start < (size_t) *frame_len) return FALSE;
+
+    *frame = buffer + start;
+    *pos = start + *frame_len;
+    return TRUE;
+}
+
+
+static int cc_parse_reply(const cc_request_t *req, cc_result_t *result) {
+    /*** Parses the reply received so far; returns TRUE once it's all in, FALSE if more bytes
+     * are needed and GEN_ERR_ANY if it's invalid; the users of a CONNECTEDUSERS reply
+     * are counted in result->users_len, and only copied if result->users is allocated ***/
+    size_t pos = 1;
+    const char *field;
+    if (req->in_len < 1) return FALSE;
+    result->status = (unsigned char) req->in[0];
+
+    /* errors followed by a field */
+    if (result->status == SRV_ERR_BUSY) {
+        if (!cc_next_field(req->in, req->in_len, &pos, &field)) return FALSE;
+        return (str_to_num(field, (void *) &result->retry_after_ms, INT) < 0) ? GEN_ERR_ANY : TRUE;
+    }
+    if (result->status == SRV_ERR_REDIRECT) {
+        if (!cc_next_field(req->in, req->in_len, &pos, &field)) return FALSE;
+        snprintf(result->node_addr, MAX_STR_SIZE, "%s", field);
+        return TRUE;
+    }
+    if (result->status != SRV_SUCCESS || req->reply_kind == CC_REPLY_CODE) return TRUE;
+
+    if (!cc_next_field(req->in, req->in_len, &pos, &field)) return FALSE;
+    if (req->reply_kind == CC_REPLY_MSG_ID)
+        return (str_to_num(field, (void *) &result->msg_id, UINT) < 0) ? GEN_ERR_ANY : TRUE;
+
+    /* CC_REPLY_USERS: number of users, then frames until an empty one */
+    unsigned int n_users;
+    if (str_to_num(field, (void *) &n_users, UINT) < 0) return GEN_ERR_ANY;
+    result->n_users = n_users;
+    result->users_len = 0;
+    while (TRUE) {
+        const char *frame;
+        int frame_len;
+        int found = cc_next_frame(req->in, req->in_len, &pos, &frame, &frame_len);
+        if (found != TRUE) return found;
+        if (!frame_len) return TRUE;
+
+        if (result->users) memcpy(result->users + result->users_len, frame, frame_len);
+        result->users_len += frame_len;
+    } // END while
+}
+
+
+static void cc_push_dispatch(const cc_client_t *client, cc_push_t *push) {
+    /*** Parses a service request pushed by the server to the listening socket, once
+     * its connection has been closed, and calls the listener callback for it ***/
+    const cc_listener_t *listener = &client->listener;
+    const char *op_code, *sender, *msg_id_str, *content, *recipient;
+    unsigned int msg_id;
+    size_t pos = 0;
+    if (!cc_next_field(push->in, push->in_len, &pos, &op_code)) return;
+
+    if (!strcmp(op_code, SEND_MESSAGE)) {
+        if (!cc_next_field(push->in, push->in_len, &pos, &sender) ||
+            !cc_next_field(push->in, push->in_len, &pos, &msg_id_str) ||
+            !cc_next_field(push->in, push->in_len, &pos, &content) ||
+            str_to_num(msg_id_str, (void *) &msg_id, UINT) < 0)
+            return;
+        if (listener->on_message) listener->on_message(sender, msg_id, content, strlen(content), listener->args);
+
+    } else if (!strcmp(op_code, SEND_MESSAGE_STREAM)) {
+        if (!cc_next_field(push->in, push->in_len, &pos, &sender) ||
+            !cc_next_field(push->in, push->in_len, &pos, &msg_id_str) ||
+            str_to_num(msg_id_str, (void *) &msg_id, UINT) < 0)
+            return;
+
+        /* frames are joined in place: length strings are dropped, so there's always room for them */
+        char *stream_content = push->in + pos;
+        size_t stream_len = 0;
+        while (TRUE) {
+            const char *frame;
+            int frame_len;
+            if (cc_next_frame(push->in, push->in_len, &pos, &frame, &frame_len) != TRUE) return;
+            if (!frame_len) break;
+            memmove(stream_content + stream_len, frame, frame_len);
+            stream_len += frame_len;
+        } // END while
+        stream_content[stream_len] = '\0';
+        if (listener->on_message) listener->on_message(sender, msg_id, stream_content, stream_len, listener->args);
+
+    } else if (!strcmp(op_code, SEND_MESS_ACK)) {
+        if (!cc_next_field(push->in, push->in_len, &pos, &msg_id_str) ||
+            str_to_num(msg_id_str, (void *) &msg_id, UINT) < 0)
+            return;
+        if (listener->on_ack) listener->on_ack(msg_id, listener->args);
+
+    } else if (!strcmp(op_code, SEND_MESS_ACKS)) {
+        const char *n_msg_ids_str;
+        if (!cc_next_field(push->in, push->in_len, &pos, &n_msg_ids_str)) return;
+
+        /* frames are joined in place, like streamed content; each message ID is '\0'-terminated */
+        char *msg_ids_str = push->in + pos;
+        size_t msg_ids_len = 0;
+        while (TRUE) {
+            const char *frame;
+            int frame_len;
+            if (cc_next_frame(push->in, push->in_len, &pos, &frame, &frame_len) != TRUE) return;
+            if (!frame_len) break;
+            memmove(msg_ids_str + msg_ids_len, frame, frame_len);
+            msg_ids_len += frame_len;
+        } // END while
+
+        if (msg_ids_len && msg_ids_str[msg_ids_len - 1] != '\0') return;
+        for (size_t id_pos = 0; id_pos < msg_ids_len; id_pos += strlen(msg_ids_str + id_pos) + 1)
+            if (str_to_num(msg_ids_str + id_pos, (void *) &msg_id, UINT) >= 0 && listener->on_ack)
+                listener->on_ack(msg_id, listener->args);
+
+    } else if (!strcmp(op_code, SEND_MESS_EXPIRED)) {
+        if (!cc_next_field(push->in, push->in_len, &pos, &msg_id_str) ||
+            !cc_next_field(push->in, push->in_len, &pos, &recipient) ||
+            str_to_num(msg_id_str, (void *) &msg_id, UINT) < 0)
+            return;
+        if (listener->on_expired) listener->on_expired(msg_id, recipient, listener->args);
+    }
+    /* HEARTBEAT: the connection being accepted is all the server needs */
+}
+
+
+/***** Client Thread *****/
+static void cc_request_free(cc_request_t *req) {
+    /*** Frees a request and closes its connection ***/
+    if (req->socket >= 0) close(req->socket);
+    free(req->out);
+    free(req->in);
+    free(req);
+}
+
+
+static void cc_request_finish(cc_request_t *req, const int status) {
+    /*** Calls the callback of a request with its result (the parsed reply if status is SRV_SUCCESS,
+     * the given error otherwise), and frees it ***/
+    cc_result_t result;
+    bzero(&result, sizeof(cc_result_t));
+    result.status = status;
+
+    if (status == SRV_SUCCESS && cc_parse_reply(req, &result) == TRUE && result.users_len) {
+        /* second pass to copy the users, now that their length is known */
+        result.users = malloc(result.users_len);
+        if (!result.users || cc_parse_reply(req, &result) != TRUE) result.status = CC_ERR_IO;
+    }
+
+    if (req->done) req->done(&result, req->args);
+    free(result.users);
+    cc_request_free(req);
+}
+
+
+static int cc_request_start(cc_client_t *client, cc_request_t *req) {
+    /*** Starts the non-blocking connection of a request to the server ***/
+    req->deadline_ms = cc_now_ms() + CC_REQUEST_TIMEOUT_MS;
+    req->socket = socket(client->server_addr.ss_family, SOCK_STREAM, 0);
+    if (req->socket < 0) return GEN_ERR_ANY;
+    fcntl(req->socket, F_SETFL, fcntl(req->socket, F_GETFL) | O_NONBLOCK);
+
+    if (connect(req->socket, (struct sockaddr *) &client->server_addr, client->server_addr_len) == 0)
+        req->connected = TRUE;
+    else if (errno != EINPROGRESS) return GEN_ERR_ANY;
+    return 0;
+}
+
+
+static int cc_request_io(cc_request_t *req, const short revents) {
+    /*** Moves a request along after poll: finishes connecting, sends what's left of it
+     * and receives its reply; returns TRUE if the request has been finished (and freed) ***/
+    if (!req->connected) {
+        int sock_error = 0;
+        socklen_t error_len = sizeof(sock_error);
+        getsockopt(req->socket, SOL_SOCKET, SO_ERROR, &sock_error, &error_len);
+        if (sock_error) {
+            cc_request_finish(req, CC_ERR_IO);
+            return TRUE;
+        }
+        req->connected = TRUE;
+    }
+
+    while ((revents & POLLOUT) && req->out_pos < req->out_len) {
+        ssize_t bytes_sent = send(req->socket, req->out + req->out_pos, req->out_len - req->out_pos, MSG_NOSIGNAL);
+        if (bytes_sent < 0 && errno == EINTR) continue;
+        if (bytes_sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (bytes_sent < 0) {
+            cc_request_finish(req, CC_ERR_IO);
+            return TRUE;
+        }
+        req->out_pos += bytes_sent;
+    } // END while
+
+    if (!(revents & (POLLIN | POLLHUP | POLLERR))) return FALSE;
+    int recv_result = cc_recv_into(req->socket, &req->in, &req->in_len, &req->in_space);
+
+    /* the server may reply before the whole request has been sent (a rejected stream) */
+    cc_result_t result;
+    bzero(&result, sizeof(cc_result_t));
+    int parse_result = cc_parse_reply(req, &result);
+    if (parse_result == TRUE) cc_request_finish(req, SRV_SUCCESS);
+    else if (parse_result < 0 || recv_result <= 0) cc_request_finish(req, CC_ERR_IO);
+    else return FALSE;
+    return TRUE;
+}
+
+
+static void cc_accept_pushes(cc_client_t *client) {
+    /*** Accepts the connections opened by the server to the listening socket ***/
+    int push_socket;
+    while ((push_socket = accept(client->listen_socket, NULL, NULL)) >= 0) {
+        cc_push_t *push = calloc(1, sizeof(cc_push_t));
+        if (!push) {
+            close(push_socket);
+            continue;
+        }
+        fcntl(push_socket, F_SETFL, fcntl(push_socket, F_GETFL) | O_NONBLOCK);
+        push->socket = push_socket;
+        push->deadline_ms = cc_now_ms() + CC_REQUEST_TIMEOUT_MS;
+        push->next = client->pushes;
+        client->pushes = push;
+    }
+}
+
+
+static void cc_serve_pushes(cc_client_t *client, const struct pollfd *poll_fds, const long long now_ms) {
+    /*** Receives the service requests pushed by the server; poll_fds holds the pushes in list order;
+     * the server closes the connection once it has sent the whole service request ***/
+    cc_push_t **link = &client->pushes;
+    int fd = 0;
+    while (*link) {
+        cc_push_t *push = *link;
+        int done = FALSE;
+
+        if (poll_fds[fd++].revents) {
+            int recv_result = cc_recv_into(push->socket, &push->in, &push->in_len, &push->in_space);
+            if (recv_result == 0) cc_push_dispatch(client, push);
+            /* no message is bigger than a whole stream, with a length string per frame */
+            done = recv_result <= 0 ||
+                   push->in_len > STREAM_MAX_SIZE + (STREAM_MAX_SIZE / STREAM_CHUNK_SIZE + 1) * 16 + 4 * MAX_MSG_SIZE;
+        } else done = push->deadline_ms <= now_ms;
+
+        if (!done) {
+            link = &push->next;
+            continue;
+        }
+        *link = push->next;
+        close(push->socket);
+        free(push->in);
+        free(push);
+    } // END while
+}
+
+
+static void cc_poll_round(cc_client_t *client, struct pollfd *poll_fds) {
+    /*** Waits for any socket of the client to be ready, or for the first deadline,
+     * and handles what's ready; poll_fds must have room for every socket ***/
+    long long now_ms = cc_now_ms();
+    long long first_deadline_ms = -1;
+    int n_fds = 0;
+
+    poll_fds[n_fds].fd = client->wake_pipe[0];
+    poll_fds[n_fds++].events = POLLIN;
+    poll_fds[n_fds].fd = client->listen_socket;     /* ignored by poll if negative */
+    poll_fds[n_fds++].events = POLLIN;
+    for (int i = 0; i < client->n_in_flight; i++) {
+        cc_request_t *req = client->in_flight[i];
+        poll_fds[n_fds].fd = req->socket;
+        poll_fds[n_fds++].events = (!req->connected || req->out_pos < req->out_len) ? POLLIN | POLLOUT : POLLIN;
+        if (first_deadline_ms < 0 || req->deadline_ms < first_deadline_ms) first_deadline_ms = req->deadline_ms;
+    }
+    int first_push_fd = n_fds;
+    for (cc_push_t *push = client->pushes; push; push = push->next) {
+        poll_fds[n_fds].fd = push->socket;
+        poll_fds[n_fds++].events = POLLIN;
+        if (first_deadline_ms < 0 || push->deadline_ms < first_deadline_ms) first_deadline_ms = push->deadline_ms;
+    }
+
+    int timeout_ms = (first_deadline_ms < 0) ? -1 :
+                     (first_deadline_ms > now_ms) ? (int) (first_deadline_ms - now_ms) : 0;
+    if (poll(poll_fds, n_fds, timeout_ms) < 0) return;     /* interrupted: try again */
+    now_ms = cc_now_ms();
+
+    /* wake-ups just get the client thread to take the queued requests */
+    if (poll_fds[0].revents) {
+        char drain[64];
+        while (read(client->wake_pipe[0], drain, sizeof(drain)) > 0);
+    }
+
+    /* requests: finished ones are replaced with the last one, so go backwards */
+    for (int i = client->n_in_flight - 1; i >= 0; i--) {
+        cc_request_t *req = client->in_flight[i];
+        int finished = FALSE;
+        if (poll_fds[2 + i].revents) finished = cc_request_io(req, poll_fds[2 + i].revents);
+        else if (req->deadline_ms <= now_ms) {
+            cc_request_finish(req, CC_ERR_TIMEOUT);
+            finished = TRUE;
+        }
+        if (finished) client->in_flight[i] = client->in_flight[--client->n_in_flight];
+    }
+
+    cc_serve_pushes(client, poll_fds + first_push_fd, now_ms);
+    if (poll_fds[1].revents) cc_accept_pushes(client);
+}
+
+
+static void cc_shutdown(cc_client_t *client) {
+    /*** Fails every request not done yet with CC_ERR_CLOSED and drops pushes being received ***/
+    while (client->n_in_flight > 0) cc_request_finish(client->in_flight[--client->n_in_flight], CC_ERR_CLOSED);
+
+    pthread_mutex_lock(&client->mutex_queue);
+    cc_request_t *queued = client->queue_head;
+    client->queue_head = client->queue_tail = NULL;
+    pthread_mutex_unlock(&client->mutex_queue);
+    while (queued) {
+        cc_request_t *next = queued->next;
+        cc_request_finish(queued, CC_ERR_CLOSED);
+        queued = next;
+    }
+
+    while (client->pushes) {
+        cc_push_t *push = client->pushes;
+        client->pushes = push->next;
+        close(push->socket);
+        free(push->in);
+        free(push);
+    }
+}
+
+
+static void *cc_thread(void *args) {
+    /*** Client thread: sends queued requests, at most CC_MAX_IN_FLIGHT at a time,
+     * receives their replies and serves the listening socket, all over non-blocking sockets;
+     * request and listener callbacks are called from here ***/
+    cc_client_t *client = (cc_client_t *) args;
+    struct pollfd *poll_fds = NULL;
+    size_t poll_space = 0;
+
+    while (TRUE) {
+        /* take queued requests while there's room for them in flight */
+        cc_request_t *started = NULL, **started_tail = &started;
+        int n_started = 0;
+        pthread_mutex_lock(&client->mutex_queue);
+        int stopping = client->stopping;
+        while (!stopping && client->queue_head && client->n_in_flight + n_started < CC_MAX_IN_FLIGHT) {
+            *started_tail = client->queue_head;
+            started_tail = &client->queue_head->next;
+            client->queue_head = client->queue_head->next;
+            n_started++;
+        }
+        if (!client->queue_head) client->queue_tail = NULL;
+        *started_tail = NULL;
+        pthread_mutex_unlock(&client->mutex_queue);
+        if (stopping) break;
+
+        while (started) {
+            cc_request_t *req = started;
+            started = req->next;
+            if (cc_request_start(client, req) < 0) cc_request_finish(req, CC_ERR_IO);
+            else client->in_flight[client->n_in_flight++] = req;
+        }
+
+        /* room for the wake pipe, the listening socket, requests in flight and pushes */
+        size_t n_fds = 2 + CC_MAX_IN_FLIGHT;
+        for (cc_push_t *push = client->pushes; push; push = push->next) n_fds++;
+        if (n_fds > poll_space) {
+            struct pollfd *new_poll_fds = realloc(poll_fds, n_fds * sizeof(struct pollfd));
+            if (!new_poll_fds) {
+                perror("Could not allocate client poll set");
+                break;
+            }
+            poll_fds = new_poll_fds;
+            poll_space = n_fds;
+        }
+
+        cc_poll_round(client, poll_fds);
+    } // END while
+
+    cc_shutdown(client);
+    free(poll_fds);
+    return NULL;
+}
+
+
+static void cc_free(cc_client_t *client) {
+    /*** Frees a client whose thread isn't running ***/
+    if (client->listen_socket >= 0) close(client->listen_socket);
+    if (client->listen_path[0]) unlink(client->listen_path);
+    if (client->wake_pipe[0] >= 0) close(client->wake_pipe[0]);
+    if (client->wake_pipe[1] >= 0) close(client->wake_pipe[1]);
+    pthread_mutex_destroy(&client->mutex_queue);
+    free(client);
+}
+
+
+/***** Client Functions *****/
+cc_client_t *cc_create(const char *const host, const int port, const cc_listener_t *listener) {
+    /*** Sets up a client of the server at given host and port and starts its thread;
+     * given a listener, it also opens the listening socket whose port cc_connect sends;
+     * a host starting with '/' is the Unix socket path of a server on this host (port is then ignored),
+     * and the listening socket is then a Unix socket too ***/
+    int is_unix = host[0] == '/';
+    struct hostent *server_host = NULL;
+    if (is_unix) {
+        CHECK_ERROR(strlen(host) >= UNIX_PATH_MAX_SIZE, "Client server socket path too long", NULL)
+    } else {
+        server_host = gethostbyname(host);
+        CHECK_ERROR(!server_host, "Client gethostbyname error", NULL)
+    }
+
+    cc_client_t *client = calloc(1, sizeof(cc_client_t));
+    CHECK_ERROR_WITH_ERRNO(!client, "Could not allocate client", NULL)
+    client->listen_socket = -1;
+    client->wake_pipe[0] = client->wake_pipe[1] = -1;
+    pthread_mutex_init(&client->mutex_queue, NULL);
+
+    if (is_unix) {
+        struct sockaddr_un *server_addr = (struct sockaddr_un *) &client->server_addr;
+        server_addr->sun_family = AF_UNIX;
+        strcpy(server_addr->sun_path, host);
+        client->server_addr_len = sizeof(struct sockaddr_un);
+    } else {
+        struct sockaddr_in *server_addr = (struct sockaddr_in *) &client->server_addr;
+        server_addr->sin_family = AF_INET;
+        memcpy(&server_addr->sin_addr, server_host->h_addr, server_host->h_length);
+        server_addr->sin_port = htons(port);
+        client->server_addr_len = sizeof(struct sockaddr_in);
+    }
+
+    if (pipe(client->wake_pipe) < 0) {
+        perror("Could not create client wake pipe");
+        cc_free(client);
+        return NULL;
+    }
+    fcntl(client->wake_pipe[0], F_SETFL, fcntl(client->wake_pipe[0], F_GETFL) | O_NONBLOCK);
+    fcntl(client->wake_pipe[1], F_SETFL, fcntl(client->wake_pipe[1], F_GETFL) | O_NONBLOCK);
+
+    /* listening socket: a Unix socket bound to a path unique to this client */
+    if (listener && is_unix) {
+        client->listener = *listener;
+        snprintf(client->listen_path, UNIX_PATH_MAX_SIZE, "/tmp/chatclient-%d-%p.sock", (int) getpid(),
+                 (void *) client);
+        if ((client->listen_socket = unix_listen(client->listen_path)) < 0) {
+            client->listen_path[0] = '\0';
+            client->listen_socket = -1;
+            cc_free(client);
+            return NULL;
+        }
+        fcntl(client->listen_socket, F_SETFL, fcntl(client->listen_socket, F_GETFL) | O_NONBLOCK);
+    }
+
+    /* listening socket: bound to any free port */
+    else if (listener) {
+        struct sockaddr_in listen_addr;
+        socklen_t addr_size = sizeof(listen_addr);
+        bzero((char *) &listen_addr, sizeof(listen_addr));
+        listen_addr.sin_family = AF_INET;
+        listen_addr.sin_addr.s_addr = INADDR_ANY;
+        listen_addr.sin_port = 0;
+
+        client->listener = *listener;
+        if ((client->listen_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0 ||
+            bind(client->listen_socket, (struct sockaddr *) &listen_addr, sizeof(listen_addr)) < 0 ||
+            listen(client->listen_socket, LISTEN_BACKLOG) < 0 ||
+            getsockname(client->listen_socket, (struct sockaddr *) &listen_addr, &addr_size) < 0) {
+            perror("Could not open client listening socket");
+            cc_free(client);
+            return NULL;
+        }
+        fcntl(client->listen_socket, F_SETFL, fcntl(client->listen_socket, F_GETFL) | O_NONBLOCK);
+        client->listen_port = ntohs(listen_addr.sin_port);
+    }
+
+    if (pthread_create(&client->client_thread, NULL, cc_thread, client) != 0) {
+        perror("Could not create client thread");
+        cc_free(client);
+        return NULL;
+    }
+    return client;
+}
+
+
+void cc_destroy(cc_client_t *client) {
+    /*** Stops the client thread, failing the requests not done yet with CC_ERR_CLOSED,
+     * and frees the client; must not be called from a callback ***/
+    pthread_mutex_lock(&client->mutex_queue);
+    client->stopping = TRUE;
+    pthread_mutex_unlock(&client->mutex_queue);
+    if (write(client->wake_pipe[1], "", 1) < 0) perror("Could not wake client thread");
+
+    pthread_join(client->client_thread, NULL);
+    cc_free(client);
+}
+
+
+int cc_listen_port(const cc_client_t *const client) {
+    /*** Returns the port of the client listening socket, -1 if it has none or it is a Unix socket ***/
+    return (client->listen_socket >= 0 && !client->listen_path[0]) ? client->listen_port : -1;
+}
+
+
+/***** Requests *****/
+static cc_request_t *cc_request_new(const char reply_kind, const char *const op_code, const char *const username) {
+    /*** Sets up a request with its operation code and username fields ***/
+    cc_request_t *req = calloc(1, sizeof(cc_request_t));
+    CHECK_ERROR_WITH_ERRNO(!req, "Could not allocate client request", NULL)
+    req->reply_kind = reply_kind;
+    req->socket = -1;
+
+    if (cc_request_add(req, op_code, strlen(op_code) + 1) < 0 ||
+        cc_request_add(req, username, strlen(username) + 1) < 0) {
+        cc_request_free(req);
+        return NULL;
+    }
+    return req;
+}
+
+
+static int cc_request_add(cc_request_t *req, const char *bytes, const size_t n_bytes) {
+    /*** Appends bytes to a request: strings must include their '\0' ***/
+    return cc_buf_add(&req->out, &req->out_len, &req->out_space, bytes, n_bytes);
+}
+
+
+static int cc_submit(cc_client_t *client, cc_request_t *req, const cc_done_cb done, void *args) {
+    /*** Queues a request for the client thread to send it ***/
+    req->done = done;
+    req->args = args;
+
+    pthread_mutex_lock(&client->mutex_queue);
+    int stopping = client->stopping;
+    if (!stopping) {
+        if (client->queue_tail) client->queue_tail->next = req;
+        else client->queue_head = req;
+        client->queue_tail = req;
+    }
+    pthread_mutex_unlock(&client->mutex_queue);
+
+    if (stopping) {
+        cc_request_free(req);
+        return GEN_ERR_ANY;
+    }
+    /* a full pipe already has a wake-up in it */
+    if (write(client->wake_pipe[1], "", 1) < 0 && errno != EAGAIN) perror("Could not wake client thread");
+    return 0;
+}
+
+
+static int cc_field_is_valid(const char *const field) {
+    /*** Checks that a request string field fits in a server field ***/
+    return field && strlen(field) < MAX_MSG_SIZE;
+}
+
+
+static int cc_user_request(cc_client_t *client, const char *const op_code, const char *const username,
+                           const char *const port, const cc_done_cb done, void *args) {
+    /*** Queues a request made of just a username (and a port for CONNECT),
+     * whose reply is just the reply code ***/
+    CHECK_ARGS(!client || !cc_field_is_valid(username), "Invalid Username")
+    cc_request_t *req = cc_request_new(CC_REPLY_CODE, op_code, username);
+    if (!req) return GEN_ERR_ANY;
+
+    if (port && cc_request_add(req, port, strlen(port) + 1) < 0) {
+        cc_request_free(req);
+        return GEN_ERR_ANY;
+    }
+    return cc_submit(client, req, done, args);
+}
+
+
+int cc_register(cc_client_t *client, const char *const username, const cc_done_cb done, void *args) {
+    /*** Queues a REGISTER request ***/
+    return cc_user_request(client, REGISTER, username, NULL, done, args);
+}
+
+
+int cc_unregister(cc_client_t *client, const char *const username, const cc_done_cb done, void *args) {
+    /*** Queues an UNREGISTER request ***/
+    return cc_user_request(client, UNREGISTER, username, NULL, done, args);
+}
+
+
+int cc_connect(cc_client_t *client, const char *const username, const cc_done_cb done, void *args) {
+    /*** Queues a CONNECT request: messages for the user are pushed to the client listening socket ***/
+    CHECK_ARGS(!client || client->listen_socket < 0, "Client Has No Listener")
+    if (client->listen_path[0]) return cc_user_request(client, CONNECT, username, client->listen_path, done, args);
+    char port_str[16]; sprintf(port_str, "%d", client->listen_port);
+    return cc_user_request(client, CONNECT, username, port_str, done, args);
+}
+
+
+int cc_disconnect(cc_client_t *client, const char *const username, const cc_done_cb done, void *args) {
+    /*** Queues a DISCONNECT request ***/
+    return cc_user_request(client, DISCONNECT, username, NULL, done, args);
+}
+
+
+int cc_send(cc_client_t *client, const char *const sender, const char *const recipient, const char *const content,
+            const cc_done_cb done, void *args) {
+    /*** Queues a SEND request; its result has the message ID if successful ***/
+    CHECK_ARGS(!client || !cc_field_is_valid(sender) || !cc_field_is_valid(recipient) ||
+               !cc_field_is_valid(content), "Invalid Message Fields")
+    cc_request_t *req = cc_request_new(CC_REPLY_MSG_ID, SEND, sender);
+    if (!req) return GEN_ERR_ANY;
+
+    if (cc_request_add(req, recipient, strlen(recipient) + 1) < 0 ||
+        cc_request_add(req, content, strlen(content) + 1) < 0) {
+        cc_request_free(req);
+        return GEN_ERR_ANY;
+    }
+    return cc_submit(client, req, done, args);
+}
+
+
+int cc_send_ext(cc_client_t *client, const char *const sender, const char *const recipient,
+                const char *const content, const int ttl, const int normalize, const char *const token,
+                const cc_done_cb done, void *args) {
+    /*** Queues a SEND_EXT request with a given time to live in seconds (0 for the server default),
+     * asking the server to collapse whitespace runs in the content if normalize is TRUE;
+     * if an idempotency token is given (NULL otherwise), the request can be made again with it
+     * after a timeout, and the message is sent only once; its result has the message ID if successful ***/
+    CHECK_ARGS(!client || !cc_field_is_valid(sender) || !cc_field_is_valid(recipient) ||
+               !cc_field_is_valid(content) || ttl < 0 || (token && (!*token || strlen(token) >= DEDUP_TOKEN_SIZE)),
+               "Invalid Message Fields")
+    cc_request_t *req = cc_request_new(CC_REPLY_MSG_ID, SEND_EXT, sender);
+    if (!req) return GEN_ERR_ANY;
+
+    /* options follow the content, ended by an empty string */
+    char ttl_opt[32]; sprintf(ttl_opt, "%s=%d", SEND_OPT_TTL, ttl);
+    char norm_opt[32]; sprintf(norm_opt, "%s=1", SEND_OPT_NORM);
+    char token_opt[DEDUP_TOKEN_SIZE + 8];
+    if (token) sprintf(token_opt, "%s=%s", SEND_OPT_TOKEN, token);
+    if (cc_request_add(req, recipient, strlen(recipient) + 1) < 0 ||
+        cc_request_add(req, content, strlen(content) + 1) < 0 ||
+        (ttl && cc_request_add(req, ttl_opt, strlen(ttl_opt) + 1) < 0) ||
+        (normalize && cc_request_add(req, norm_opt, strlen(norm_opt) + 1) < 0) ||
+        (token && cc_request_add(req, token_opt, strlen(token_opt) + 1) < 0) ||
+        cc_request_add(req, "", 1) < 0) {
+        cc_request_free(req);
+        return GEN_ERR_ANY;
+    }
+    return cc_submit(client, req, done, args);
+}
+
+
+int cc_send_stream(cc_client_t *client, const char *const sender, const char *const recipient,
+                   const char *const content, const size_t len, const cc_done_cb done, void *args) {
+    /*** Queues a SEND_STREAM request with len bytes of content, which are copied,
+     * so the caller may reuse its buffer right away; its result has the message ID if successful ***/
+    CHECK_ARGS(!client || !cc_field_is_valid(sender) || !cc_field_is_valid(recipient) ||
+               (!content && len) || len > STREAM_MAX_SIZE, "Invalid Message Fields")
+    cc_request_t *req = cc_request_new(CC_REPLY_MSG_ID, SEND_STREAM, sender);
+    if (!req) return GEN_ERR_ANY;
+
+    int result = cc_request_add(req, recipient, strlen(recipient) + 1);
+    for (size_t pos = 0; result == 0 && pos < len; pos += STREAM_CHUNK_SIZE) {
+        int frame_len = (len - pos < STREAM_CHUNK_SIZE) ? (int) (len - pos) : STREAM_CHUNK_SIZE;
+        char len_str[16]; sprintf(len_str, "%d", frame_len);
+        result = (cc_request_add(req, len_str, strlen(len_str) + 1) < 0 ||
+                  cc_request_add(req, content + pos, frame_len) < 0) ? GEN_ERR_ANY : 0;
+    }
+    /* a 0-length frame ends the stream */
+    if (result < 0 || cc_request_add(req, "0", 2) < 0) {
+        cc_request_free(req);
+        return GEN_ERR_ANY;
+    }
+    return cc_submit(client, req, done, args);
+}
+
+
+int cc_connected_users(cc_client_t *client, const char *const username, const cc_done_cb done, void *args) {
+    /*** Queues a CONNECTEDUSERS request; its result has the connected users if successful ***/
+    CHECK_ARGS(!client || !cc_field_is_valid(username), "Invalid Username")
+    cc_request_t *req = cc_request_new(CC_REPLY_USERS, CONNECTEDUSERS, username);
+    if (!req) return GEN_ERR_ANY;
+    return cc_submit(client, req, done, args);
+}
+
+
+int cc_history(cc_client_t *client, const char *const username, const char *const peer, const long long since,
+               const int max_messages, const cc_done_cb done, void *args) {
+    /*** Queues a HISTORY request for up to max_messages messages exchanged with peer after a given
+     * timestamp (ms since the Epoch, 0 for the first ones); its result has them in place of users,
+     * each one made of 5 '\0'-terminated fields: timestamp, sender, message ID, size, content ***/
+    CHECK_ARGS(!client || !cc_field_is_valid(username) || !cc_field_is_valid(peer) || max_messages < 0,
+               "Invalid History Fields")
+    cc_request_t *req = cc_request_new(CC_REPLY_USERS, HISTORY, username);
+    if (!req) return GEN_ERR_ANY;
+
+    char since_str[24]; sprintf(since_str, "%lld", since);
+    char max_str[16]; sprintf(max_str, "%d", max_messages);
+    if (cc_request_add(req, peer, strlen(peer) + 1) < 0 ||
+        cc_request_add(req, since_str, strlen(since_str) + 1) < 0 ||
+        cc_request_add(req, max_str, strlen(max_str) + 1) < 0) {
+        cc_request_free(req);
+        return GEN_ERR_ANY;
+    }
+    return cc_submit(client, req, done, args);
+}
+
+
+/***** Futures *****/
+cc_future_t *cc_future_new(void) {
+    /*** Sets up a future for the result of a single request ***/
+    cc_future_t *future = calloc(1, sizeof(cc_future_t));
+    CHECK_ERROR_WITH_ERRNO(!future, "Could not allocate future", NULL)
+    pthread_mutex_init(&future->mutex, NULL);
+    pthread_cond_init(&future->cond_done, NULL);
+    return future;
+}
+
+
+void cc_future_done(const cc_result_t *result, void *future) {
+    /*** Request callback that keeps a copy of the result in the future given as args,
+     * and wakes up whoever waits on it ***/
+    cc_future_t *cc_future = (cc_future_t *) future;
+    pthread_mutex_lock(&cc_future->mutex);
+    cc_future->result = *result;
+    if (result->users) {
+        cc_future->result.users = malloc(result->users_len);
+        if (cc_future->result.users) memcpy(cc_future->result.users, result->users, result->users_len);
+        else cc_future->result.status = CC_ERR_IO;
+    }
+    cc_future->done = TRUE;
+    pthread_cond_broadcast(&cc_future->cond_done);
+    pthread_mutex_unlock(&cc_future->mutex);
+}
+
+
+void cc_future_wait(cc_future_t *future, cc_result_t *result) {
+    /*** Waits for the request of a future to be done and gets its result;
+     * the users in it, if any, are then owned by the caller: see cc_result_free ***/
+    pthread_mutex_lock(&future->mutex);
+    while (!future->done) pthread_cond_wait(&future->cond_done, &future->mutex);
+    *result = future->result;
+    future->result.users = NULL;
+    pthread_mutex_unlock(&future->mutex);
+}
+
+
+void cc_future_free(cc_future_t *future) {
+    /*** Frees a future ***/
+    free(future->result.users);
+    pthread_mutex_destroy(&future->mutex);
+    pthread_cond_destroy(&future->cond_done);
+    free(future);
+}
+
+
+void cc_result_free(cc_result_t *result) {
+    /*** Frees the users in a result got from a future ***/
+    free(result->users);
+    result->users = NULL;
+}
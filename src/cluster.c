@@ -0,0 +1,351 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include "DS-Lab-Assignment/netUtil.h"
+#include "DS-Lab-Assignment/cluster.h"
+
+
+/* point of the hash ring owned by a node */
+typedef struct {
+    uint64_t hash;
+    int node;
+} cl_vnode_t;
+
+/* cluster node, with the persistent link this node keeps to it */
+typedef struct {
+    char addr[MAX_STR_SIZE];    /* "host:port", as given in the node list */
+    struct sockaddr_in sock_addr;
+    int link_socket;            /* -1 while not connected */
+    pthread_mutex_t mutex_link; /* one request at a time goes through a link */
+} cl_node_t;
+
+static cl_node_t *cl_nodes = NULL;
+static int cl_nodes_len = 0;
+static int cl_self_node = 0;
+static cl_vnode_t *cl_ring = NULL;      /* sorted by hash */
+static int cl_ring_len = 0;
+static int cl_links = 0;                /* node links being served */
+
+static uint64_t cl_hash(const char *string);
+static int cl_vnode_cmp(const void *vnode1, const void *vnode2);
+static int cl_parse_node(cl_node_t *node, const char *addr, size_t addr_len);
+static int cl_link_open(cl_node_t *node);
+static void cl_link_close(cl_node_t *node);
+static int cl_link_reply(cl_node_t *node, char *result, size_t result_size);
+
+
+static uint64_t cl_hash(const char *string) {
+    /*** 64-bit FNV-1a hash of a string ***/
+    uint64_t hash = 14695981039346656037ULL;
+    while (*string) {
+        hash ^= (unsigned char) *string++;
+        hash *= 1099511628211ULL;
+    }
+    /* FNV-1a alone spreads similar strings (node addresses) poorly over the ring */
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+
+static int cl_vnode_cmp(const void *vnode1, const void *vnode2) {
+    /*** Orders ring points by hash ***/
+    uint64_t hash1 = ((const cl_vnode_t *) vnode1)->hash, hash2 = ((const cl_vnode_t *) vnode2)->hash;
+    return (hash1 > hash2) - (hash1 < hash2);
+}
+
+
+static int cl_parse_node(cl_node_t *node, const char *const addr, const size_t addr_len) {
+    /*** Sets up a node from its "host:port" address ***/
+    int port;
+    struct hostent *host;
+    CHECK_ERROR(addr_len == 0 || addr_len >= MAX_STR_SIZE, "Invalid node address", GEN_ERR_INV_ARGS)
+    memcpy(node->addr, addr, addr_len);
+    node->addr[addr_len] = '\0';
+
+    char *colon = strrchr(node->addr, ':');
+    CHECK_ERROR(!colon || str_to_num(colon + 1, (void *) &port, INT) < 0, "Invalid node address", GEN_ERR_INV_ARGS)
+    *colon = '\0';
+    host = gethostbyname(node->addr);
+    *colon = ':';
+    CHECK_ERROR(!host, "Could not resolve node host", GEN_ERR_ANY)
+
+    bzero((char *) &node->sock_addr, sizeof(node->sock_addr));
+    memcpy(&node->sock_addr.sin_addr, host->h_addr_list[0], sizeof(struct in_addr));
+    node->sock_addr.sin_family = AF_INET;
+    node->sock_addr.sin_port = htons(port);
+
+    node->link_socket = -1;
+    pthread_mutex_init(&node->mutex_link, NULL);
+    return 0;
+}
+
+
+int cl_init(const char *const nodes, const int self) {
+    /*** Sets up cluster mode from a comma-separated list with the "host:port" of every node
+     * (the same list, in the same order, on all nodes) and the position of this node in it ***/
+    int ret_val;    /* needed for error-checking macros */
+
+    /* parse node list */
+    int n_nodes = 1;
+    for (const char *pos = nodes; *pos; pos++) n_nodes += (*pos == ',');
+    CHECK_ARGS(self < 0 || self >= n_nodes, "Invalid Node Index")
+
+    cl_nodes = calloc(n_nodes, sizeof(cl_node_t));
+    cl_ring = malloc(n_nodes * CL_VNODES * sizeof(cl_vnode_t));
+    CHECK_ERROR_WITH_ERRNO(!cl_nodes || !cl_ring, "Could not allocate cluster nodes", GEN_ERR_ANY)
+
+    const char *addr = nodes;
+    for (int node = 0; node < n_nodes; node++) {
+        const char *addr_end = strchr(addr, ',');
+        if (!addr_end) addr_end = addr + strlen(addr);
+        CHECK_FUNC_ERROR(cl_parse_node(&cl_nodes[node], addr, addr_end - addr), ret_val)
+        addr = addr_end + 1;
+    }
+
+    /* hash ring: CL_VNODES points per node, so that users spread evenly
+     * and only 1/n of them move when a node is added */
+    for (int node = 0; node < n_nodes; node++) {
+        for (int vnode = 0; vnode < CL_VNODES; vnode++) {
+            char vnode_key[MAX_STR_SIZE + 16];
+            sprintf(vnode_key, "%s#%d", cl_nodes[node].addr, vnode);
+            cl_ring[node * CL_VNODES + vnode].hash = cl_hash(vnode_key);
+            cl_ring[node * CL_VNODES + vnode].node = node;
+        }
+    }
+    cl_ring_len = n_nodes * CL_VNODES;
+    qsort(cl_ring, cl_ring_len, sizeof(cl_vnode_t), cl_vnode_cmp);
+
+    cl_nodes_len = n_nodes;
+    cl_self_node = self;
+    printf("s> node %d of %d in cluster\n", self, n_nodes); fflush(stdout);
+    return 0;
+}
+
+
+int cl_enabled(void) {
+    /*** Checks whether the server runs in cluster mode ***/
+    return cl_nodes_len > 1;
+}
+
+
+int cl_n_nodes(void) {
+    /*** Returns the number of nodes in the cluster (1 when not in cluster mode) ***/
+    return cl_nodes_len ? cl_nodes_len : 1;
+}
+
+
+int cl_self(void) {
+    /*** Returns the position of this node in the node list ***/
+    return cl_self_node;
+}
+
+
+int cl_home(const char *const username) {
+    /*** Returns the node a user lives in: owner of the first ring point at or after the user's hash ***/
+    if (!cl_enabled()) return cl_self_node;
+
+    uint64_t hash = cl_hash(username);
+    int low = 0, high = cl_ring_len;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (cl_ring[mid].hash < hash) low = mid + 1;
+        else high = mid;
+    }
+    return cl_ring[low % cl_ring_len].node;
+}
+
+
+int cl_is_local(const char *const username) {
+    /*** Checks whether a user lives in this node ***/
+    return cl_home(username) == cl_self_node;
+}
+
+
+const char *cl_node_addr(const int node) {
+    /*** Returns the "host:port" address of a given node ***/
+    return cl_nodes[node].addr;
+}
+
+
+/***** Inter-Node Links *****/
+int cl_link_admit(const struct sockaddr_storage *const peer_addr) {
+    /*** Checks whether a link opened from a given address may be served: only in cluster mode, from the
+     * host of another node, and while the number of links being served is below the cap; once admitted,
+     * cl_link_done must be called when the link is closed ***/
+    if (!cl_enabled() || peer_addr->ss_family != AF_INET) return FALSE;
+
+    const struct in_addr *peer_ip = &((const struct sockaddr_in *) peer_addr)->sin_addr;
+    int is_node = FALSE;
+    for (int node = 0; node < cl_nodes_len && !is_node; node++)
+        is_node = node != cl_self_node && cl_nodes[node].sock_addr.sin_addr.s_addr == peer_ip->s_addr;
+    if (!is_node) return FALSE;
+
+    int max_links = (cl_nodes_len - 1) * CL_LINKS_PER_NODE;
+    if (__atomic_add_fetch(&cl_links, 1, __ATOMIC_RELAXED) > max_links) {
+        __atomic_sub_fetch(&cl_links, 1, __ATOMIC_RELAXED);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+
+void cl_link_done(void) {
+    /*** A link admitted with cl_link_admit has been closed ***/
+    __atomic_sub_fetch(&cl_links, 1, __ATOMIC_RELAXED);
+}
+
+
+static int cl_link_open(cl_node_t *node) {
+    /*** Makes sure that the link to a given node is connected; node link mutex must be held ***/
+    int ret_val;    /* needed for error-checking macros */
+    if (node->link_socket >= 0) return 0;
+
+    int link_socket;
+    CHECK_FUNC_ERROR_WITH_ERRNO(link_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP), GEN_ERR_ANY)
+    CHECK_SOCK_ERROR(connect_timeout(link_socket, (struct sockaddr *) &node->sock_addr,
+                                     sizeof(node->sock_addr), CLT_CONNECT_TIMEOUT_MS), link_socket)
+
+    /* a node that doesn't answer in time is treated as a failed request */
+    struct timeval timeout = {CL_LINK_TIMEOUT_MS / 1000, (CL_LINK_TIMEOUT_MS % 1000) * 1000};
+    setsockopt(link_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    CHECK_SOCK_ERROR(send_string(link_socket, NODE_LINK), link_socket)
+
+    node->link_socket = link_socket;
+    return 0;
+}
+
+
+static void cl_link_close(cl_node_t *node) {
+    /*** Drops the link to a given node after an error; the next request opens a new one ***/
+    if (node->link_socket < 0) return;
+    close(node->link_socket);
+    node->link_socket = -1;
+}
+
+
+static int cl_link_reply(cl_node_t *node, char *result, const size_t result_size) {
+    /*** Receives the reply to a request from a given node: server error code, followed
+     * (if it is SRV_SUCCESS and result is not NULL) by a result string ***/
+    unsigned char server_error_code;
+    if (read_bytes(node->link_socket, (char *) &server_error_code, 1) != 1) return GEN_ERR_ANY;
+    if (server_error_code == SRV_SUCCESS && result &&
+        read_line(node->link_socket, result, (int) result_size) <= 0)
+        return GEN_ERR_ANY;
+    return server_error_code;
+}
+
+
+int cl_forward_send(const char *const sender, const char *const recipient, const char *const content,
+                    const int ttl, unsigned int *msg_id) {
+    /*** Forwards a message to the home node of its recipient, which stores or passes it;
+     * returns the server error code of the send, or GEN_ERR_ANY if the node could not be reached ***/
+    cl_node_t *node = &cl_nodes[cl_home(recipient)];
+    char ttl_str[16]; sprintf(ttl_str, "%d", ttl);
+    char msg_id_str[MSG_ID_MAX_STR_SIZE + 2];
+
+    pthread_mutex_lock(&node->mutex_link);
+    int result = GEN_ERR_ANY;
+    if (cl_link_open(node) == 0 &&
+        send_string(node->link_socket, NODE_SEND) == 0 &&
+        send_string(node->link_socket, sender) == 0 &&
+        send_string(node->link_socket, recipient) == 0 &&
+        send_string(node->link_socket, content) == 0 &&
+        send_string(node->link_socket, ttl_str) == 0)
+        result = cl_link_reply(node, msg_id_str, sizeof msg_id_str);
+    if (result < 0) cl_link_close(node);
+    pthread_mutex_unlock(&node->mutex_link);
+
+    if (result == SRV_SUCCESS && str_to_num(msg_id_str, (void *) msg_id, UINT) < 0) result = GEN_ERR_ANY;
+    return result;
+}
+
+
+int cl_forward_ack(const unsigned int msg_id, const char *const sender) {
+    /*** Has the home node of a sender send it the second ACK of a message ***/
+    cl_node_t *node = &cl_nodes[cl_home(sender)];
+    char msg_id_str[16]; sprintf(msg_id_str, "%u", msg_id);
+
+    pthread_mutex_lock(&node->mutex_link);
+    int result = GEN_ERR_ANY;
+    if (cl_link_open(node) == 0 &&
+        send_string(node->link_socket, NODE_ACK) == 0 &&
+        send_string(node->link_socket, msg_id_str) == 0 &&
+        send_string(node->link_socket, sender) == 0)
+        result = cl_link_reply(node, NULL, 0);
+    if (result < 0) cl_link_close(node);
+    pthread_mutex_unlock(&node->mutex_link);
+    return result;
+}
+
+
+int cl_forward_expired(const unsigned int msg_id, const char *const sender, const char *const recipient) {
+    /*** Has the home node of a sender tell it that a message has expired ***/
+    cl_node_t *node = &cl_nodes[cl_home(sender)];
+    char msg_id_str[16]; sprintf(msg_id_str, "%u", msg_id);
+
+    pthread_mutex_lock(&node->mutex_link);
+    int result = GEN_ERR_ANY;
+    if (cl_link_open(node) == 0 &&
+        send_string(node->link_socket, NODE_EXPIRED) == 0 &&
+        send_string(node->link_socket, msg_id_str) == 0 &&
+        send_string(node->link_socket, sender) == 0 &&
+        send_string(node->link_socket, recipient) == 0)
+        result = cl_link_reply(node, NULL, 0);
+    if (result < 0) cl_link_close(node);
+    pthread_mutex_unlock(&node->mutex_link);
+    return result;
+}
+
+
+int cl_get_connected(const int node_pos, char **users, size_t *users_len, size_t *n_users) {
+    /*** Gets the usernames of the connected users living in a given node, in the same format
+     * as db_get_connected_users; *users must be freed by the caller ***/
+    cl_node_t *node = &cl_nodes[node_pos];
+    char n_users_str[24];
+    char *buffer = NULL;
+    size_t len = 0;
+
+    pthread_mutex_lock(&node->mutex_link);
+    int result = GEN_ERR_ANY;
+    if (cl_link_open(node) == 0 && send_string(node->link_socket, NODE_CONNECTED) == 0)
+        result = cl_link_reply(node, n_users_str, sizeof n_users_str);
+
+    /* the usernames come in frames */
+    while (result == SRV_SUCCESS) {
+        char len_str[16];
+        int frame_len;
+        if (read_line(node->link_socket, len_str, sizeof len_str) <= 0 ||
+            str_to_num(len_str, (void *) &frame_len, INT) < 0 || frame_len < 0 || frame_len > STREAM_CHUNK_SIZE) {
+            result = GEN_ERR_ANY;
+            break;
+        }
+        if (!frame_len) break;
+
+        char *grown = realloc(buffer, len + frame_len);
+        if (!grown || read_bytes(node->link_socket, grown + len, frame_len) != frame_len) result = GEN_ERR_ANY;
+        if (grown) buffer = grown;
+        len += frame_len;
+    } // END while
+
+    if (result < 0) cl_link_close(node);
+    pthread_mutex_unlock(&node->mutex_link);
+
+    unsigned int node_n_users;
+    if (result != SRV_SUCCESS || str_to_num(n_users_str, (void *) &node_n_users, UINT) < 0) {
+        free(buffer);
+        return result == SRV_SUCCESS ? GEN_ERR_ANY : result;
+    }
+    *n_users = node_n_users;
+    *users = buffer;
+    *users_len = len;
+    return SRV_SUCCESS;
+}
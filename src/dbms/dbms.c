@@ -3,10 +3,43 @@
 #include <unistd.h>
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
 #include "DS-Lab-Assignment/dbms/dbmsUtil.h"
+#include "DS-Lab-Assignment/dbms/dbmsIndex.h"
 #include "DS-Lab-Assignment/dbms/dbms.h"
 
 
+/* the stripe of a user is held while writing its userdata entry, so that its message ID high-water mark
+ * never goes back on disk; users of other stripes are written meanwhile */
+static pthread_mutex_t msg_id_locks[MSG_ID_LOCK_STRIPES];
+static pthread_once_t msg_id_locks_once = PTHREAD_ONCE_INIT;
+
+static void msg_id_init_locks(void);
+static pthread_mutex_t *msg_id_lock(const char *username);
+static int io_op_usr_ent(entry_t *entry, char mode);
+static int creat_usr_tbl(entry_t *entry);
+
+
+static void msg_id_init_locks(void) {
+    /*** Sets up the message ID lock stripes ***/
+    for (int i = 0; i < MSG_ID_LOCK_STRIPES; i++) pthread_mutex_init(&msg_id_locks[i], NULL);
+}
+
+
+static pthread_mutex_t *msg_id_lock(const char *username) {
+    /*** Message ID lock stripe of a username, picked by its FNV-1a hash ***/
+    pthread_once(&msg_id_locks_once, msg_id_init_locks);
+    uint32_t hash = 2166136261u;
+    while (*username) {
+        hash ^= (unsigned char) *username++;
+        hash *= 16777619u;
+    }
+    return &msg_id_locks[hash % MSG_ID_LOCK_STRIPES];
+}
+
+
 int db_init_db(void) {
     /*** Initialize the DB: make sure that the DB db exists, create it if it doesn't ***/
     int ret_val;    /* needed for error-checking macros */
@@ -14,157 +47,399 @@ int db_init_db(void) {
     CHECK_FUNC_ERROR(open_directory(DB_DIR, OVERWRITE, &db), DBMS_ERR_ANY)
 
     closedir(db);
-    return DBMS_SUCCESS;
+    /* keep the DB root folder open, user tables are reached from it, wherever the layout puts them */
+    CHECK_FUNC_ERROR(dir_cache_init(), DBMS_ERR_ANY)
+    return layout_init();
 }
 
 
 int db_get_pend_msg(entry_t *entry) {
     /*** Reads a pending message of a given user entry ***/
+    CHECK_ARGS(entry->type != ENT_TYPE_P_MSG, "Invalid Entry Type")
+
+    char username[strlen(entry->username) + 1];
+    strcpy(username, entry->username);
+    size_t n_entries;
+    return db_get_pend_msgs(username, entry, 1, &n_entries);
+}
+
+
+int db_get_pend_msgs(const char *const username, entry_t *entries, const size_t max_entries, size_t *n_entries) {
+    /*** Reads up to max_entries pending messages of a given user,
+     * in a single pass over its pending messages table ***/
     int ret_val;    /* needed for error-checking macros */
     struct dirent *pend_msgs_entry;
-    int pend_msgs_table_is_empty = TRUE;    /* assume that there are no pending messages */
-
-    CHECK_ARGS(entry->type != ENT_TYPE_P_MSG, "Invalid Entry Type")
+    *n_entries = 0;
 
-    /* set up the path to open pending messages table directory for given username */
-    char table_path[strlen(DB_DIR) + strlen(entry->username) + strlen(PEND_MSGS_TABLE) + 9];
-    sprintf(table_path, "%s/%s-table/%s", DB_DIR, entry->username, PEND_MSGS_TABLE);
+    /* the index tells whether there is any pending message without opening the table */
+    idx_meta_t meta;
+    if (idx_get(username, &meta) && !meta.pend_msgs) return DBMS_ERR_NOT_EXISTS;
 
+    /* open pending messages table directory for given username, from its cached user table */
+    dir_ent_t *user_table = dir_get(username);
+    CHECK_ERROR_WITH_ERRNO(!user_table, "Could not open user table", DBMS_ERR_ANY)
     DIR *pend_msg_table;
-    CHECK_FUNC_ERROR(open_directory(table_path, READ, &pend_msg_table), DBMS_ERR_ANY)
+    int result = open_directory_at(user_table->table_fd, PEND_MSGS_TABLE, READ, &pend_msg_table);
+    dir_put(user_table);
+    CHECK_FUNC_ERROR(result, DBMS_ERR_ANY)
 
-    /* read directory entries */
-    while ((pend_msgs_entry = readdir(pend_msg_table)) != NULL && pend_msgs_table_is_empty) {
+    /* read directory entries, and the pending messages they name */
+    while (*n_entries < max_entries && (pend_msgs_entry = readdir(pend_msg_table)) != NULL) {
         if (!strcmp(pend_msgs_entry->d_name, ".") || !strcmp(pend_msgs_entry->d_name, "..")) continue;
 
-        /* found a pending message: read it and break out of the loop */
-        CHECK_FUNC_ERROR(str_to_num(pend_msgs_entry->d_name, (void *) &entry->msg.id, UINT),
-                         DBMS_ERR_ANY)
-        db_io_op_usr_ent(entry, READ);
-        pend_msgs_table_is_empty = FALSE;
+        /* a message deleted in the meantime is skipped */
+        int entry_fd = open_file_at(dirfd(pend_msg_table), pend_msgs_entry->d_name, READ);
+        if (entry_fd < 0) continue;
+        /* read_entry closes the entry fd on error */
+        if (read_entry(entry_fd, &entries[*n_entries]) == DBMS_SUCCESS) {
+            close(entry_fd);
+            (*n_entries)++;
+        }
     }
 
     closedir(pend_msg_table);
     /* if no pending messages were found, return an error */
-    return (!pend_msgs_table_is_empty) ? DBMS_SUCCESS : DBMS_ERR_NOT_EXISTS;
+    return (*n_entries) ? DBMS_SUCCESS : DBMS_ERR_NOT_EXISTS;
+}
+
+
+int db_del_pend_msgs(entry_t *entries, const size_t n_entries) {
+    /*** Deletes a batch of pending messages (with their bodies, if streamed) ***/
+    int result = DBMS_SUCCESS;
+    for (size_t i = 0; i < n_entries; i++)
+        if (db_io_op_usr_ent(&entries[i], DELETE) < 0) result = DBMS_ERR_ANY;
+    return result;
 }
 
 
 int db_empty_db(void) {
     /*** Simply deletes all files and directories in the DB root folder ***/
-    return remove_recursive(DB_DIR);
+    int result = remove_recursive(DB_DIR);
+    dir_forget_all();
+    return result;
 }
 
 
 int db_user_exists(const char *const username) {
     /*** Checks whether a given username exists in the DB ***/
-    /* set up the path to open username user_table */
-    size_t path_len = strlen(DB_DIR) + strlen(username) + 7;
-    char user_path[path_len];
-    sprintf(user_path, "%s/%s-table", DB_DIR, username);
-    DIR *user_table;
-
-    /* try to open it and see if it exists */
-    int result = open_directory(user_path, READ, &user_table);
-
-    if (result == DBMS_ERR_NOT_EXISTS) return FALSE;
-    else if (result == DBMS_SUCCESS) {
-        closedir(user_table);
+    /* users in the index exist; others are checked on disk in case the index missed them */
+    if (idx_get(username, NULL)) return TRUE;
+
+    /* try to open username user_table (it's then cached) and see if it exists */
+    dir_ent_t *user_table = dir_get(username);
+
+    if (!user_table && errno == ENOENT) return FALSE;
+    else if (user_table) {
+        dir_put(user_table);
+        if (idx_is_ready()) load_user_meta(username);
         return TRUE;
     }
 
-    /* some other error happened, so return its error code */
-    return result;
+    /* some other error happened */
+    perror("Could not open user table");
+    return DBMS_ERR_ANY;
 }
 
 
-int db_io_op_usr_ent(entry_t *entry, const char mode) {
+int db_user_connected(const char *const username) {
+    /*** Checks whether a given user is connected; answered from the index ***/
+    idx_meta_t meta;
+    if (!idx_get(username, &meta)) {
+        /* the index may have missed the user: look for it on disk */
+        int user_exists = db_user_exists(username);
+        if (user_exists == FALSE) return DBMS_ERR_NOT_EXISTS;
+        if (user_exists < 0) return user_exists;
+        if (!idx_get(username, &meta)) return DBMS_ERR_ANY;
+    }
+    return meta.status == STATUS_CN;
+}
+
+
+int db_get_connected_users(char **users, size_t *users_len, size_t *n_users) {
+    /*** Gets the usernames of all connected users from the presence list kept in the index,
+     * without reading any userdata entry; *users must be freed by the caller ***/
+    return idx_get_connected(users, users_len, n_users);
+}
+
+
+static int io_op_usr_ent(entry_t *entry, const char mode) {
     /*** Reads, writes or deletes a DB username entry;
      * entry type must be specified in given entry->type;
      * it can read, modify or delete an existing entry, or create a new one ***/
-    char error[MAX_STR_SIZE];   /* message displayed in perror */
+    char error[strlen(entry->username) + MSG_ID_MAX_STR_SIZE + 64];     /* message displayed in perror */
 
     CHECK_ARGS(entry->type != ENT_TYPE_UD && entry->type != ENT_TYPE_P_MSG, "Invalid Entry Type")
     CHECK_ARGS(mode != CREATE && mode != MODIFY && mode != READ && mode != DELETE, "Invalid File Mode")
 
-    /* set up the path to read/write username entry:
-     * set up path length */
-    size_t entry_len = strlen(DB_DIR) + strlen(entry->username) + 9;   /* account for common path elements */
-    /* account for specific path elements depending on entry type */
-    entry_len += (entry->type == ENT_TYPE_UD) ? strlen(USERDATA_ENTRY) :
-                 (strlen(PEND_MSGS_TABLE) + 1 + MSG_ID_MAX_STR_SIZE);
+    /* journal the user before modifying its table */
+    if (mode != READ) journal_user(entry->username);
 
-    char entry_path[entry_len];     /* set up actual path, depending on entry type */
-    (entry->type == ENT_TYPE_UD) ?
-    sprintf(entry_path, "%s/%s-table/%s", DB_DIR, entry->username, USERDATA_ENTRY) :
-    sprintf(entry_path, "%s/%s-table/%s/%u", DB_DIR, entry->username, PEND_MSGS_TABLE, entry->msg.id);
+    /* the entry is reached from its cached table directory:
+     * userdata entries live in the user table, pending messages in its pending messages table */
+    dir_ent_t *user_table = dir_get(entry->username);
+    if (!user_table) {
+        if (errno == ENOENT) {
+            fprintf(stderr, "%s-table doesn't exist\n", entry->username);
+            return DBMS_ERR_NOT_EXISTS;
+        }
+        perror("Error opening user table"); return DBMS_ERR_ANY;
+    }
+
+    char entry_name[MSG_ID_MAX_STR_SIZE + sizeof USERDATA_ENTRY];
+    int dir_fd = user_table->table_fd;
+    if (entry->type == ENT_TYPE_UD) strcpy(entry_name, USERDATA_ENTRY);
+    else {
+        sprintf(entry_name, "%u", entry->msg.id);
+        dir_fd = dir_sub_fd(user_table, DIR_PEND_MSGS, FALSE);
+    }
 
     /* delete entry */
     if (mode == DELETE) {
-        int result = remove_recursive(entry_path);
-        return (result < 0) ? result : DBMS_SUCCESS;
+        int result = (dir_fd < 0) ? -1 : unlinkat(dir_fd, entry_name, 0);
+        int error_num = errno;
+        dir_put(user_table);
+        if (result < 0) {
+            errno = error_num;
+            sprintf(error, "Error deleting entry %s of %s", entry_name, entry->username); perror(error);
+            return (error_num == ENOENT) ? DBMS_ERR_NOT_EXISTS : result;
+        }
+        if (entry->type == ENT_TYPE_P_MSG && entry->msg.flags & MSG_FLAG_STREAM) db_del_msg_body(entry);
+        if (entry->type == ENT_TYPE_P_MSG) {
+            idx_add_pend_msgs(entry->username, -1);
+            exp_disarm(entry);
+        }
+        db_dur_note_write();
+        note_mutation(DB_MUT_DEL, entry);
+        return DBMS_SUCCESS;
     }
 
-    /* open entry file to read/write it */
-    int entry_fd = open_file(entry_path, mode);
+    /* open entry file to read it; written entries go through a temporary entry in the user table,
+     * which takes their place once it's whole, so that a crash never leaves them torn */
+    int entry_fd = -1;
+    if (dir_fd >= 0)
+        entry_fd = (mode == READ) ? open_file_at(dir_fd, entry_name, mode) :
+                   write_entry_at(user_table->table_fd, dir_fd, entry_name, entry, mode);
+    int error_num = errno;
+    dir_put(user_table);
 
     if (entry_fd == -1) {
-        if (errno == ENOENT) {
-            sprintf(error, "%s doesn't exist", entry_path); perror(error);
+        errno = error_num;
+        if (error_num == ENOENT) {
+            sprintf(error, "Entry %s of %s doesn't exist", entry_name, entry->username); perror(error);
             return DBMS_ERR_NOT_EXISTS;
         }
         /* some other open() error */
-        sprintf(error, "Error opening %s", entry_path); perror(error);
+        sprintf(error, "Error %s entry %s of %s", (mode == READ) ? "opening" : "writing",
+                entry_name, entry->username); perror(error);
         return DBMS_ERR_ANY;
     }
 
-    /* read/write entry */
-    int result = ((mode == READ) ? read_entry : write_entry)(entry_fd, entry);
-    close(entry_fd);
+    /* read entry; read_entry closes the entry fd on error */
+    int result = DBMS_SUCCESS;
+    if (mode == READ && (result = read_entry(entry_fd, entry)) == DBMS_SUCCESS) close(entry_fd);
+    if (mode != READ) {
+        /* keep the index in sync with the DB */
+        if (entry->type == ENT_TYPE_UD)
+            idx_set_userdata(entry->username, entry->user.status, entry->user.last_msg_id);
+        else if (mode == CREATE) {
+            idx_add_pend_msgs(entry->username, 1);
+            exp_arm(entry);
+        }
+        db_dur_note_write();
+        note_mutation(DB_MUT_PUT, entry);
+    }
+    return result;
+}
+
+
+int db_io_op_usr_ent(entry_t *entry, const char mode) {
+    /*** Reads, writes or deletes a DB username entry;
+     * entry type must be specified in given entry->type;
+     * it can read, modify or delete an existing entry, or create a new one ***/
+    if (mode == READ) return io_op_usr_ent(entry, mode);
+
+    /* no checkpoint is taken halfway through a modification */
+    ckpt_hold();
+    if (entry->type != ENT_TYPE_UD || (mode != CREATE && mode != MODIFY)) {
+        int result = io_op_usr_ent(entry, mode);
+        ckpt_release();
+        return result;
+    }
+
+    /* the entry may have been read before a new block of message IDs was reserved:
+     * keep the reserved high-water mark instead of writing back the old one */
+    pthread_mutex_t *lock = msg_id_lock(entry->username);
+    pthread_mutex_lock(lock);
+    idx_meta_t meta;
+    if (idx_get(entry->username, &meta) && idx_msg_id_after(meta.reserved_msg_id, entry->user.last_msg_id))
+        entry->user.last_msg_id = meta.reserved_msg_id;
+    int result = io_op_usr_ent(entry, mode);
+    pthread_mutex_unlock(lock);
+    ckpt_release();
+
     return result;
 }
 
 
-int db_creat_usr_tbl(entry_t *entry) {
-    /*** Creates a table for the given username (entire structure) ***/
-    /* set up the path to open table directory for given username */
-    char user_table_path[strlen(DB_DIR) + strlen(entry->username) + 8];
-    sprintf(user_table_path, "%s/%s-table", DB_DIR, entry->username);
-
-    /* set up the path for the userdata entry to be created */
-    char ud_entry_path[strlen(user_table_path) + strlen(USERDATA_ENTRY) + 2];
-    sprintf(ud_entry_path, "%s/%s", user_table_path, USERDATA_ENTRY);
-
-    /* set up the path for the userdata entry to be created */
-    char p_msg_table_path[strlen(user_table_path) + strlen(PEND_MSGS_TABLE) + 2];
-    sprintf(p_msg_table_path, "%s/%s", user_table_path, PEND_MSGS_TABLE);
-
-    /* try to create username directory */
-    DIR *user_table;
-    int result = open_directory(user_table_path, CREATE, &user_table);
-    if (result == DBMS_ERR_EXISTS) {       /* user already exists */
-        closedir(user_table);
-        return DBMS_ERR_EXISTS;
-    } else if (result < 0) return DBMS_ERR_ANY;     /* some other error */
+int db_next_msg_id(const char *const username, unsigned int *msg_id) {
+    /*** Gives the next message ID of a given user from its counter in the index;
+     * the high-water mark in its userdata entry is only moved once every MSG_ID_BLOCK IDs,
+     * and recovery starts counting past it, so IDs stay unique after a crash ***/
+    int result = idx_next_msg_id(username, msg_id);
+
+    /* the user's stripe is only locked to reserve a new block, which another thread may have done meanwhile */
+    if (result == FALSE) {
+        pthread_mutex_t *lock = msg_id_lock(username);
+        ckpt_hold();
+        pthread_mutex_lock(lock);
+        result = idx_next_msg_id(username, msg_id);
+
+        if (result == FALSE) {
+            /* block used up: reserve the next one on disk before giving any ID from it */
+            idx_meta_t meta;
+            entry_t entry;
+            entry.type = ENT_TYPE_UD;
+            strcpy(entry.username, username);
+            result = (idx_get(username, &meta) && io_op_usr_ent(&entry, READ) == DBMS_SUCCESS) ?
+                     DBMS_SUCCESS : DBMS_ERR_ANY;
+
+            if (result == DBMS_SUCCESS) {
+                entry.user.last_msg_id = (unsigned int) (((unsigned long long) meta.reserved_msg_id + MSG_ID_BLOCK)
+                                                         % MSG_ID_MAX_VALUE);
+                /* set in the index first, so that the new mark isn't taken for one from the primary server */
+                idx_reserve_msg_ids(username, entry.user.last_msg_id);
+                result = io_op_usr_ent(&entry, MODIFY);
+                if (result == DBMS_SUCCESS) result = idx_next_msg_id(username, msg_id);
+                else idx_reserve_msg_ids(username, meta.reserved_msg_id);
+            }
+        }
+        pthread_mutex_unlock(lock);
+        ckpt_release();
+    }
+
+    if (result == DBMS_ERR_NOT_EXISTS) return result;
+    return (result == TRUE) ? DBMS_SUCCESS : DBMS_ERR_ANY;
+}
+
+
+static int creat_usr_tbl(entry_t *entry) {
+    /*** Creates a table for the given username (entire structure); the caller holds off checkpoints ***/
+    /* journal the user before creating its table */
+    journal_user(entry->username);
+
+    /* try to create username directory, where the layout puts it */
+    if (table_create(entry->username) < 0) {
+        if (errno == EEXIST) return DBMS_ERR_EXISTS;       /* user already exists */
+        perror("Could not create user table"); return DBMS_ERR_ANY;     /* some other error */
+    }
 
     /* at this point user table has been successfully created, so we continue */
 
     /* create userdata entry for given username */
     if (db_io_op_usr_ent(entry, CREATE) < 0) return DBMS_ERR_ANY;
 
-    /* now create pending messages table, within username table */
-    DIR *p_msg_table;
-    if (open_directory(p_msg_table_path, CREATE, &p_msg_table) < 0) return DBMS_ERR_ANY;
-    closedir(p_msg_table);
+    /* now create pending messages table, and message bodies table for streamed messages, within username table */
+    dir_ent_t *user_table = dir_get(entry->username);
+    CHECK_ERROR_WITH_ERRNO(!user_table, "Could not open user table", DBMS_ERR_ANY)
+    int result = (dir_sub_fd(user_table, DIR_PEND_MSGS, TRUE) < 0 ||
+                  dir_sub_fd(user_table, DIR_MSG_BODIES, TRUE) < 0) ? DBMS_ERR_ANY : DBMS_SUCCESS;
+    dir_put(user_table);
+    CHECK_ERROR_WITH_ERRNO(result < 0, "Could not create user inner tables", DBMS_ERR_ANY)
+
+    /* add the new user to the index */
+    idx_meta_t meta = {entry->user.status, entry->user.last_msg_id, 0, entry->user.last_msg_id};
+    idx_put(entry->username, &meta, TRUE);
+    db_dur_note_write();
     return DBMS_SUCCESS;
 }
 
 
+int db_creat_usr_tbl(entry_t *entry) {
+    /*** Creates a table for the given username (entire structure) ***/
+    ckpt_hold();
+    int result = creat_usr_tbl(entry);
+    ckpt_release();
+    return result;
+}
+
+
 int db_del_usr_tbl(const char *const username) {
     /*** Deletes a given username table if it exists ***/
-    /* set up the path to remove table directories for given username */
-    char table_path[strlen(DB_DIR) + strlen(username) + 8];
-    sprintf(table_path, "%s/%s-table", DB_DIR, username);
+    ckpt_hold();
+    journal_user(username);
+    int result = table_remove(username);
+    if (result >= 0) {
+        dir_forget(username);
+        idx_del(username);
+        db_hist_del_user(username);
+        db_dur_note_write();
+
+        entry_t entry;
+        entry.type = ENT_TYPE_UD;
+        strcpy(entry.username, username);
+        note_mutation(DB_MUT_RMTBL, &entry);
+    }
+    ckpt_release();
+    return result;
+}
+
+
+int db_open_msg_body(const entry_t *const entry, const char mode) {
+    /*** Opens the body of a streamed pending message to read it (READ),
+     * or to spool it as it arrives (CREATE); returns the open fd ***/
+    CHECK_ARGS(entry->type != ENT_TYPE_P_MSG, "Invalid Entry Type")
+    CHECK_ARGS(mode != READ && mode != CREATE, "Invalid File Mode")
+
+    /* the body is reached from the message bodies table of the cached user table; tables created
+     * before streamed messages existed have no message bodies table, so it's created when spooling */
+    char body_name[MSG_ID_MAX_STR_SIZE + 1];
+    sprintf(body_name, "%u", entry->msg.id);
+    dir_ent_t *user_table = dir_get(entry->username);
+    CHECK_ERROR_WITH_ERRNO(!user_table, "Could not open user table", DBMS_ERR_ANY)
+    int table_fd = dir_sub_fd(user_table, DIR_MSG_BODIES, mode == CREATE);
+
+    int body_fd = -1;
+    if (mode == READ) {
+        if (table_fd >= 0) body_fd = open_file_at(table_fd, body_name, READ);
+        dir_put(user_table);
+        CHECK_ERROR_WITH_ERRNO(body_fd < 0, "Could not open message body", DBMS_ERR_ANY)
+        return body_fd;
+    }
+
+    journal_user(entry->username);
+    /* a body left behind by an interrupted stream with the same ID is overwritten */
+    if (table_fd >= 0) body_fd = openat(table_fd, body_name, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    dir_put(user_table);
+    CHECK_ERROR_WITH_ERRNO(body_fd < 0, "Could not create message body", DBMS_ERR_ANY)
+    return body_fd;
+}
 
-    return remove_recursive(table_path);
+
+int db_close_msg_body(const int body_fd, const char mode) {
+    /*** Closes a message body opened with db_open_msg_body ***/
+    CHECK_ERROR_WITH_ERRNO(close(body_fd) < 0, "Could not close message body", DBMS_ERR_ANY)
+    if (mode == CREATE) db_dur_note_write();
+    return DBMS_SUCCESS;
+}
+
+
+int db_del_msg_body(const entry_t *const entry) {
+    /*** Deletes the body of a streamed pending message ***/
+    CHECK_ARGS(entry->type != ENT_TYPE_P_MSG, "Invalid Entry Type")
+
+    char body_name[MSG_ID_MAX_STR_SIZE + 1];
+    sprintf(body_name, "%u", entry->msg.id);
+
+    journal_user(entry->username);
+    dir_ent_t *user_table = dir_get(entry->username);
+    CHECK_ERROR_WITH_ERRNO(!user_table && errno != ENOENT, "Could not open user table", DBMS_ERR_ANY)
+    if (!user_table) return DBMS_SUCCESS;     /* deleted along with its table */
+    int table_fd = dir_sub_fd(user_table, DIR_MSG_BODIES, FALSE);
+    int result = (table_fd < 0) ? -1 : unlinkat(table_fd, body_name, 0);
+    int error_num = errno;
+    dir_put(user_table);
+    errno = error_num;
+    CHECK_ERROR_WITH_ERRNO(result < 0 && errno != ENOENT, "Could not delete message body", DBMS_ERR_ANY)
+    db_dur_note_write();
+    return DBMS_SUCCESS;
 }
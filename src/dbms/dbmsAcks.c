@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "DS-Lab-Assignment/dbms/dbmsUtil.h"
+#include "DS-Lab-Assignment/dbms/dbms.h"
+
+
+/* second ACKs that couldn't be sent to their sender are appended to its ack queue as raw message IDs;
+ * when the sender connects, the queue is moved to its ack batch, which is only removed once sent,
+ * so a batch interrupted by a failure or a crash is sent again (an ACK may arrive twice, never zero times) */
+static pthread_mutex_t mutex_acks = PTHREAD_MUTEX_INITIALIZER;
+
+static int ack_read_ids(int fd, unsigned int **msg_ids, size_t *n_msg_ids);
+
+
+static int ack_read_ids(const int fd, unsigned int **msg_ids, size_t *n_msg_ids) {
+    /*** Reads all message IDs in an ack queue or batch file; *msg_ids must be freed by the caller ***/
+    struct stat file_stat;
+    CHECK_ERROR_WITH_ERRNO(fstat(fd, &file_stat) < 0, "Could not stat ack queue", DBMS_ERR_ANY)
+
+    /* a torn trailing ID (crash in the middle of an append) is left out */
+    *n_msg_ids = (size_t) file_stat.st_size / sizeof(unsigned int);
+    *msg_ids = malloc((*n_msg_ids ? *n_msg_ids : 1) * sizeof(unsigned int));
+    CHECK_ERROR(!*msg_ids, "Could not allocate ack queue", DBMS_ERR_ANY)
+
+    int len = (int) (*n_msg_ids * sizeof(unsigned int));
+    if (read_bytes(fd, (char *) *msg_ids, len) != len) {
+        free(*msg_ids);
+        *msg_ids = NULL;
+        CHECK_ERROR(TRUE, "Could not read ack queue", DBMS_ERR_ANY)
+    }
+    return DBMS_SUCCESS;
+}
+
+
+int db_ack_queue_put(const char *const username, const unsigned int msg_id) {
+    /*** Appends the second ACK of a message to the ack queue of its sender ***/
+    dir_ent_t *user_table = dir_get(username);
+    if (!user_table) {
+        if (errno == ENOENT) return DBMS_ERR_NOT_EXISTS;       /* user table doesn't exist */
+        CHECK_ERROR_WITH_ERRNO(TRUE, "Could not open user table", DBMS_ERR_ANY)
+    }
+
+    pthread_mutex_lock(&mutex_acks);
+    int queue_fd = openat(user_table->table_fd, ACK_QUEUE_ENTRY, O_WRONLY | O_CREAT | O_APPEND, 0600);
+    dir_put(user_table);
+    if (queue_fd < 0) {
+        pthread_mutex_unlock(&mutex_acks);
+        CHECK_ERROR_WITH_ERRNO(TRUE, "Could not open ack queue", DBMS_ERR_ANY)
+    }
+
+    int result = (write_bytes(queue_fd, (const char *) &msg_id, sizeof msg_id) == sizeof msg_id) ?
+                 DBMS_SUCCESS : DBMS_ERR_ANY;
+    close(queue_fd);
+    pthread_mutex_unlock(&mutex_acks);
+
+    if (result == DBMS_SUCCESS) db_dur_note_write();
+    return result;
+}
+
+
+int db_ack_queue_take(const char *const username, unsigned int **msg_ids, size_t *n_msg_ids) {
+    /*** Moves the ack queue of a user to its ack batch, and reads the whole batch
+     * (ACKs of a batch that couldn't be sent included); the batch stays in the DB
+     * until db_ack_queue_release is called; *msg_ids must be freed by the caller ***/
+    *msg_ids = NULL;
+    *n_msg_ids = 0;
+    dir_ent_t *user_table = dir_get(username);
+    if (!user_table) {
+        if (errno == ENOENT) return DBMS_ERR_NOT_EXISTS;       /* user table doesn't exist */
+        CHECK_ERROR_WITH_ERRNO(TRUE, "Could not open user table", DBMS_ERR_ANY)
+    }
+    int table_fd = user_table->table_fd;
+    pthread_mutex_lock(&mutex_acks);
+
+    /* append the queue to the batch, then remove it */
+    int result = DBMS_SUCCESS;
+    int queue_fd = open_file_at(table_fd, ACK_QUEUE_ENTRY, READ);
+    if (queue_fd >= 0) {
+        unsigned int *queued_ids;
+        size_t n_queued_ids;
+        result = ack_read_ids(queue_fd, &queued_ids, &n_queued_ids);
+        close(queue_fd);
+
+        if (result == DBMS_SUCCESS) {
+            int len = (int) (n_queued_ids * sizeof(unsigned int));
+            int batch_fd = openat(table_fd, ACK_BATCH_ENTRY, O_WRONLY | O_CREAT | O_APPEND, 0600);
+            if (batch_fd < 0 || write_bytes(batch_fd, (const char *) queued_ids, len) != len ||
+                unlinkat(table_fd, ACK_QUEUE_ENTRY, 0) < 0) {
+                perror("Could not move ack queue to its batch");
+                result = DBMS_ERR_ANY;
+            }
+            if (batch_fd >= 0) close(batch_fd);
+            free(queued_ids);
+        }
+    } else if (errno != ENOENT) {
+        perror("Could not open ack queue");
+        result = DBMS_ERR_ANY;
+    }
+
+    /* read the batch */
+    if (result == DBMS_SUCCESS) {
+        int batch_fd = open_file_at(table_fd, ACK_BATCH_ENTRY, READ);
+        if (batch_fd >= 0) {
+            result = ack_read_ids(batch_fd, msg_ids, n_msg_ids);
+            close(batch_fd);
+        } else if (errno != ENOENT) {
+            perror("Could not open ack batch");
+            result = DBMS_ERR_ANY;
+        }
+    }
+    pthread_mutex_unlock(&mutex_acks);
+    dir_put(user_table);
+
+    if (queue_fd >= 0) db_dur_note_write();
+    if (result == DBMS_SUCCESS && !*n_msg_ids) {
+        free(*msg_ids);
+        *msg_ids = NULL;
+        return DBMS_ERR_NOT_EXISTS;
+    }
+    return result;
+}
+
+
+int db_ack_queue_release(const char *const username) {
+    /*** Removes the ack batch of a user, once it has been sent ***/
+    dir_ent_t *user_table = dir_get(username);
+    if (!user_table && errno == ENOENT) return DBMS_SUCCESS;      /* deleted along with its table */
+    CHECK_ERROR_WITH_ERRNO(!user_table, "Could not open user table", DBMS_ERR_ANY)
+
+    pthread_mutex_lock(&mutex_acks);
+    int result = unlinkat(user_table->table_fd, ACK_BATCH_ENTRY, 0);
+    int error_num = errno;
+    pthread_mutex_unlock(&mutex_acks);
+    dir_put(user_table);
+    errno = error_num;
+    CHECK_ERROR_WITH_ERRNO(result < 0 && errno != ENOENT, "Could not remove ack batch", DBMS_ERR_ANY)
+
+    db_dur_note_write();
+    return DBMS_SUCCESS;
+}
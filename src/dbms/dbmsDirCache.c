@@ -0,0 +1,287 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "DS-Lab-Assignment/dbms/dbmsUtil.h"
+
+
+/* directory fd cache: the DB root folder and the tables of the last DIR_CACHE_SIZE users used are kept open,
+ * so that entries are reached with openat() and friends, resolving a single name instead of a whole path;
+ * entries are reference counted, so a table evicted or deleted while a thread works in it is only closed
+ * once that thread is done with it; users are spread over stripes by the hash of their name, each one with
+ * its own mutex and LRU clock, and directories are opened and closed with no mutex held */
+typedef struct {
+    dir_ent_t ents[DIR_CACHE_SIZE / DIR_CACHE_STRIPES];
+    unsigned long clock;        /* LRU clock: last_use of the most recently used entry */
+    unsigned long forgets;      /* bumped when tables are forgotten, so tables opened meanwhile aren't cached */
+    pthread_mutex_t mutex;
+} dir_stripe_t;
+
+static int root_fd = -1;
+static dir_stripe_t dir_cache[DIR_CACHE_STRIPES];
+static pthread_once_t dir_cache_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t mutex_root_fd = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *const sub_table_names[DIR_N_SUB_TABLES] = {PEND_MSGS_TABLE, MSG_BODIES_TABLE};
+
+static void dir_cache_setup(void);
+static int dir_stripe(const char *username);
+static int dir_clear(dir_ent_t *ent, int *fds);
+static void dir_close(const int *fds, int n_fds);
+static dir_ent_t *dir_slot(dir_stripe_t *stripe, int *fds, int *n_fds);
+
+
+static void dir_cache_setup(void) {
+    /*** Sets up the stripes of the cache, with every entry empty ***/
+    int fds[DIR_N_SUB_TABLES + 1];
+    for (int i = 0; i < DIR_CACHE_STRIPES; i++) {
+        pthread_mutex_init(&dir_cache[i].mutex, NULL);
+        for (int j = 0; j < DIR_CACHE_SIZE / DIR_CACHE_STRIPES; j++) {
+            dir_ent_t *ent = &dir_cache[i].ents[j];
+            ent->table_fd = -1;
+            for (int k = 0; k < DIR_N_SUB_TABLES; k++) ent->sub_fds[k] = -1;
+            dir_clear(ent, fds);
+            ent->stripe = i;
+            ent->detached = FALSE;
+        }
+    }
+}
+
+
+static int dir_stripe(const char *username) {
+    /*** Cache stripe of a username, picked by its FNV-1a hash ***/
+    uint32_t hash = 2166136261u;
+    while (*username) {
+        hash ^= (unsigned char) *username++;
+        hash *= 16777619u;
+    }
+    return (int) (hash % DIR_CACHE_STRIPES);
+}
+
+
+static int dir_clear(dir_ent_t *ent, int *fds) {
+    /*** Leaves an entry empty, handing its open directories over to be closed with dir_close
+     * once the stripe mutex is released; returns the number of fds handed over ***/
+    int n_fds = 0;
+    if (ent->table_fd >= 0) fds[n_fds++] = ent->table_fd;
+    for (int i = 0; i < DIR_N_SUB_TABLES; i++)
+        if (ent->sub_fds[i] >= 0) fds[n_fds++] = ent->sub_fds[i];
+
+    ent->username[0] = '\0';
+    ent->table_fd = -1;
+    for (int i = 0; i < DIR_N_SUB_TABLES; i++) ent->sub_fds[i] = -1;
+    ent->refs = 0;
+    ent->stale = FALSE;
+    ent->last_use = 0;
+    return n_fds;
+}
+
+
+static void dir_close(const int *fds, const int n_fds) {
+    /*** Closes the directories handed over by dir_clear ***/
+    for (int i = 0; i < n_fds; i++) close(fds[i]);
+}
+
+
+static dir_ent_t *dir_slot(dir_stripe_t *stripe, int *fds, int *n_fds) {
+    /*** Gets a free entry of a stripe, evicting the least recently used one not in use (its directories
+     * are handed over to be closed); if every entry is in use, a detached one is allocated;
+     * the stripe mutex must be held ***/
+    dir_ent_t *victim = NULL;
+    *n_fds = 0;
+    for (int i = 0; i < DIR_CACHE_SIZE / DIR_CACHE_STRIPES; i++) {
+        dir_ent_t *ent = &stripe->ents[i];
+        if (ent->refs) continue;
+        if (ent->table_fd < 0) return ent;
+        if (!victim || ent->last_use < victim->last_use) victim = ent;
+    }
+    if (victim) {
+        *n_fds = dir_clear(victim, fds);
+        return victim;
+    }
+
+    victim = malloc(sizeof(dir_ent_t));
+    if (!victim) return NULL;
+    victim->table_fd = -1;
+    for (int i = 0; i < DIR_N_SUB_TABLES; i++) victim->sub_fds[i] = -1;
+    dir_clear(victim, fds);
+    victim->stripe = (int) (stripe - dir_cache);
+    victim->detached = TRUE;
+    return victim;
+}
+
+
+int dir_cache_init(void) {
+    /*** Opens the DB root folder; must be called once it exists ***/
+    pthread_once(&dir_cache_once, dir_cache_setup);
+    pthread_mutex_lock(&mutex_root_fd);
+    if (root_fd >= 0) close(root_fd);
+    root_fd = open(DB_DIR, O_RDONLY | O_DIRECTORY);
+    pthread_mutex_unlock(&mutex_root_fd);
+
+    CHECK_ERROR_WITH_ERRNO(root_fd < 0, "Could not open DB directory", DBMS_ERR_ANY)
+    return DBMS_SUCCESS;
+}
+
+
+int dir_root_fd(void) {
+    /*** Gives the open fd of the DB root folder ***/
+    return root_fd;
+}
+
+
+dir_ent_t *dir_get(const char *const username) {
+    /*** Gets the open table of a given user, opening it if it isn't cached;
+     * returns NULL with errno set (ENOENT if the user table doesn't exist);
+     * the entry must be given back with dir_put ***/
+    dir_stripe_t *stripe = &dir_cache[dir_stripe(username)];
+    int fds[DIR_N_SUB_TABLES + 1];
+    int n_fds;
+
+    while (TRUE) {
+        pthread_mutex_lock(&stripe->mutex);
+        for (int i = 0; i < DIR_CACHE_SIZE / DIR_CACHE_STRIPES; i++) {
+            dir_ent_t *ent = &stripe->ents[i];
+            if (ent->table_fd >= 0 && !ent->stale && !strcmp(ent->username, username)) {
+                ent->refs++;
+                ent->last_use = ++stripe->clock;
+                pthread_mutex_unlock(&stripe->mutex);
+                return ent;
+            }
+        }
+        unsigned long forgets = stripe->forgets;
+        pthread_mutex_unlock(&stripe->mutex);
+
+        /* not cached: opened with no mutex held */
+        int table_fd = table_open(username);
+        if (table_fd < 0) return NULL;
+
+        pthread_mutex_lock(&stripe->mutex);
+        /* a table forgotten meanwhile may be the one just opened: open it again */
+        if (stripe->forgets != forgets) {
+            pthread_mutex_unlock(&stripe->mutex);
+            close(table_fd);
+            continue;
+        }
+        /* another thread may have cached it meanwhile */
+        for (int i = 0; i < DIR_CACHE_SIZE / DIR_CACHE_STRIPES; i++) {
+            dir_ent_t *ent = &stripe->ents[i];
+            if (ent->table_fd >= 0 && !ent->stale && !strcmp(ent->username, username)) {
+                ent->refs++;
+                ent->last_use = ++stripe->clock;
+                pthread_mutex_unlock(&stripe->mutex);
+                close(table_fd);
+                return ent;
+            }
+        }
+
+        dir_ent_t *ent = dir_slot(stripe, fds, &n_fds);
+        if (ent) {
+            strcpy(ent->username, username);
+            ent->table_fd = table_fd;
+            ent->refs = 1;
+            ent->last_use = ++stripe->clock;
+        }
+        pthread_mutex_unlock(&stripe->mutex);
+
+        dir_close(fds, n_fds);
+        if (!ent) {
+            close(table_fd);
+            errno = ENOMEM;
+        }
+        return ent;
+    } // END while
+}
+
+
+int dir_sub_fd(dir_ent_t *ent, const int sub_table, const int create) {
+    /*** Gives the open fd of an inner table of a given user table, opening it on first use;
+     * the inner table is created if it doesn't exist and create is TRUE; returns -1 with errno set on error ***/
+    dir_stripe_t *stripe = &dir_cache[ent->stripe];
+    pthread_mutex_lock(&stripe->mutex);
+    int fd = ent->sub_fds[sub_table];
+    pthread_mutex_unlock(&stripe->mutex);
+    if (fd >= 0) return fd;
+
+    /* opened with no mutex held; if another thread has opened it meanwhile, its fd is kept */
+    fd = openat(ent->table_fd, sub_table_names[sub_table], O_RDONLY | O_DIRECTORY);
+    if (fd < 0 && errno == ENOENT && create &&
+        (mkdirat(ent->table_fd, sub_table_names[sub_table], S_IRWXU) == 0 || errno == EEXIST))
+        fd = openat(ent->table_fd, sub_table_names[sub_table], O_RDONLY | O_DIRECTORY);
+    if (fd < 0) return -1;
+
+    pthread_mutex_lock(&stripe->mutex);
+    int cached_fd = ent->sub_fds[sub_table];
+    if (cached_fd < 0) ent->sub_fds[sub_table] = fd;
+    pthread_mutex_unlock(&stripe->mutex);
+
+    if (cached_fd < 0) return fd;
+    close(fd);
+    return cached_fd;
+}
+
+
+void dir_put(dir_ent_t *ent) {
+    /*** Gives back an entry got with dir_get ***/
+    dir_stripe_t *stripe = &dir_cache[ent->stripe];
+    int fds[DIR_N_SUB_TABLES + 1];
+    int n_fds = 0, cleared = FALSE, detached = ent->detached;
+
+    pthread_mutex_lock(&stripe->mutex);
+    if (--ent->refs == 0 && (ent->stale || detached)) {
+        n_fds = dir_clear(ent, fds);
+        cleared = TRUE;
+    }
+    pthread_mutex_unlock(&stripe->mutex);
+
+    dir_close(fds, n_fds);
+    if (cleared && detached) free(ent);
+}
+
+
+void dir_forget(const char *const username) {
+    /*** Drops the cached table of a given user; must be called once the table has been deleted ***/
+    dir_stripe_t *stripe = &dir_cache[dir_stripe(username)];
+    int fds[DIR_N_SUB_TABLES + 1];
+    int n_fds = 0;
+
+    pthread_mutex_lock(&stripe->mutex);
+    stripe->forgets++;
+    for (int i = 0; i < DIR_CACHE_SIZE / DIR_CACHE_STRIPES; i++) {
+        dir_ent_t *ent = &stripe->ents[i];
+        if (ent->table_fd < 0 || ent->stale || strcmp(ent->username, username) != 0) continue;
+        if (ent->refs) ent->stale = TRUE;
+        else n_fds = dir_clear(ent, fds);
+        break;
+    }
+    pthread_mutex_unlock(&stripe->mutex);
+
+    dir_close(fds, n_fds);
+}
+
+
+void dir_forget_all(void) {
+    /*** Drops every cached table; must be called once the tables have been deleted ***/
+    int fds[DIR_CACHE_SIZE / DIR_CACHE_STRIPES * (DIR_N_SUB_TABLES + 1)];
+
+    for (int i = 0; i < DIR_CACHE_STRIPES; i++) {
+        dir_stripe_t *stripe = &dir_cache[i];
+        int n_fds = 0;
+        pthread_mutex_lock(&stripe->mutex);
+        stripe->forgets++;
+        for (int j = 0; j < DIR_CACHE_SIZE / DIR_CACHE_STRIPES; j++) {
+            dir_ent_t *ent = &stripe->ents[j];
+            if (ent->table_fd < 0) continue;
+            if (ent->refs) ent->stale = TRUE;
+            else n_fds += dir_clear(ent, fds + n_fds);
+        }
+        pthread_mutex_unlock(&stripe->mutex);
+
+        dir_close(fds, n_fds);
+    }
+}
@@ -0,0 +1,165 @@
+#define _GNU_SOURCE     /* needed for syncfs() */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include "DS-Lab-Assignment/util.h"
+#include "DS-Lab-Assignment/dbms/dbms.h"
+
+
+/* durability state: every DB write gets a sequence number; the committer thread
+ * syncs the DB filesystem and publishes the last sequence number made durable */
+static char dur_policy = DUR_NONE;
+static int dur_db_fd = -1;                  /* open fd on DB_DIR, used for syncfs() */
+static unsigned long dur_write_seq = 0;     /* sequence number of the last DB write */
+static unsigned long dur_commit_seq = 0;    /* sequence number of the last synced DB write */
+static unsigned long dur_failed_seq = 0;    /* sequence number of the last DB write of the last failed sync */
+static int dur_n_waiting = 0;               /* threads waiting for a sync in db_dur_sync_wait */
+static int dur_running = FALSE;
+
+/* sequence number of the last DB write done by the calling thread */
+static _Thread_local unsigned long thread_write_seq = 0;
+
+static pthread_mutex_t mutex_dur = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond_dur_pending = PTHREAD_COND_INITIALIZER;    /* unsynced writes, or a sync waited for */
+static pthread_cond_t cond_dur_committed = PTHREAD_COND_INITIALIZER;  /* a batch has been synced */
+static pthread_t committer_thread;
+
+void *db_dur_committer_thread(void *args);
+static int dur_wait(int wake_committer);
+
+
+void *db_dur_committer_thread(void *args) {
+    /*** Syncs DB writes to disk: once per batch of writes (DUR_GROUP)
+     * or once every DUR_PERIOD_MS milliseconds (DUR_PERIODIC), sooner if a thread waits for it ***/
+    pthread_mutex_lock(&mutex_dur);
+    while (dur_running) {
+        if (dur_policy == DUR_PERIODIC) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += (DUR_PERIOD_MS % 1000) * 1000000L;
+            deadline.tv_sec += DUR_PERIOD_MS / 1000 + deadline.tv_nsec / 1000000000L;
+            deadline.tv_nsec %= 1000000000L;
+            if (!dur_n_waiting || dur_write_seq == dur_commit_seq)
+                pthread_cond_timedwait(&cond_dur_pending, &mutex_dur, &deadline);
+        }
+        /* group commit: sleep until there are unsynced writes */
+        else while (dur_running && dur_write_seq == dur_commit_seq)
+            pthread_cond_wait(&cond_dur_pending, &mutex_dur);
+
+        if (dur_write_seq == dur_commit_seq) continue;
+
+        /* every write up to this point goes into the current batch;
+         * writes issued while syncing are left for the next one */
+        unsigned long batch_seq = dur_write_seq;
+        pthread_mutex_unlock(&mutex_dur);
+
+        int sync_result = syncfs(dur_db_fd);
+        if (sync_result < 0) perror("syncfs");
+
+        /* a failed sync is remembered for good: a later one succeeding doesn't make its writes durable */
+        pthread_mutex_lock(&mutex_dur);
+        if (sync_result < 0) dur_failed_seq = batch_seq;
+        dur_commit_seq = batch_seq;
+        pthread_cond_broadcast(&cond_dur_committed);
+    } // END while
+    pthread_mutex_unlock(&mutex_dur);
+
+    return NULL;
+}
+
+
+int db_dur_init(const char policy) {
+    /*** Sets up the durability policy for DB writes and starts the committer thread if needed;
+     * must be called after db_init_db ***/
+    CHECK_ARGS(policy != DUR_NONE && policy != DUR_PERIODIC && policy != DUR_GROUP, "Invalid Durability Policy")
+
+    dur_policy = policy;
+    if (policy == DUR_NONE) return DBMS_SUCCESS;
+
+    dur_db_fd = open(DB_DIR, O_RDONLY | O_DIRECTORY);
+    CHECK_ERROR_WITH_ERRNO(dur_db_fd < 0, "Could not open DB directory", DBMS_ERR_ANY)
+
+    dur_running = TRUE;
+    if (pthread_create(&committer_thread, NULL, db_dur_committer_thread, NULL) != 0) {
+        perror("pthread_create");
+        close(dur_db_fd);
+        dur_running = FALSE;
+        return DBMS_ERR_ANY;
+    }
+
+    return DBMS_SUCCESS;
+}
+
+
+int db_dur_parse_policy(const char *const string, char *policy) {
+    /*** Casts a durability policy name (none, periodic, group) to its DUR_* code ***/
+    if (!strcmp(string, "none")) *policy = DUR_NONE;
+    else if (!strcmp(string, "periodic")) *policy = DUR_PERIODIC;
+    else if (!strcmp(string, "group")) *policy = DUR_GROUP;
+    else return GEN_ERR_INV_ARGS;
+
+    return 0;
+}
+
+
+void db_dur_note_write(void) {
+    /*** Registers a DB write done by the calling thread, so that
+     * it gets included in the next sync batch ***/
+    if (dur_policy == DUR_NONE) return;
+
+    pthread_mutex_lock(&mutex_dur);
+    thread_write_seq = ++dur_write_seq;
+    if (dur_policy == DUR_GROUP) pthread_cond_signal(&cond_dur_pending);
+    pthread_mutex_unlock(&mutex_dur);
+}
+
+
+int db_dur_syncs(void) {
+    /*** Checks whether DB writes are synced to disk at all (any policy but DUR_NONE) ***/
+    return dur_policy != DUR_NONE;
+}
+
+
+int db_dur_commit_wait(void) {
+    /*** Blocks the calling thread until all its DB writes have been synced to disk;
+     * only blocks with DUR_GROUP policy, the other policies return right away ***/
+    if (dur_policy != DUR_GROUP) return DBMS_SUCCESS;
+
+    return dur_wait(FALSE);
+}
+
+
+int db_dur_sync_wait(void) {
+    /*** Blocks the calling thread until all its DB writes have been synced to disk, whatever the
+     * policy but DUR_NONE: the committer is woken up for it, so a periodic sync isn't waited for ***/
+    if (dur_policy == DUR_NONE) return DBMS_SUCCESS;
+    return dur_wait(TRUE);
+}
+
+
+static int dur_wait(const int wake_committer) {
+    /*** Waits for the batch holding the last DB write of the calling thread to be synced;
+     * fails if that write was in a batch whose sync failed, or in an earlier one ***/
+    pthread_mutex_lock(&mutex_dur);
+    if (wake_committer) {
+        dur_n_waiting++;
+        pthread_cond_signal(&cond_dur_pending);
+    }
+    while (dur_commit_seq < thread_write_seq)
+        pthread_cond_wait(&cond_dur_committed, &mutex_dur);
+    if (wake_committer) dur_n_waiting--;
+    int result = (thread_write_seq && thread_write_seq <= dur_failed_seq) ? DBMS_ERR_ANY : DBMS_SUCCESS;
+    pthread_mutex_unlock(&mutex_dur);
+
+    return result;
+}
+
+
+void db_dur_flush(void) {
+    /*** Syncs all DB writes to disk right away; async-signal-safe, so that
+     * it can be called from the server shutdown handler ***/
+    if (dur_db_fd >= 0) syncfs(dur_db_fd);
+}
@@ -0,0 +1,59 @@
+#include <stdio.h>
+#include <string.h>
+#include "DS-Lab-Assignment/dbms/dbmsEngine.h"
+#include "DS-Lab-Assignment/dbms/dbms.h"
+
+
+/* directory engine: the DB as a folder tree, one table directory per user and one file per entry */
+const db_engine_t db_dir_engine = {
+        .name = "dir",
+        .init_db = db_init_db,
+        .recover = db_recover,
+        .checkpoint = db_checkpoint,
+        .dur_init = db_dur_init,
+        .dur_commit_wait = db_dur_commit_wait,
+        .dur_flush = db_dur_flush,
+        .exp_init = db_exp_init,
+        .user_exists = db_user_exists,
+        .user_connected = db_user_connected,
+        .get_connected_users = db_get_connected_users,
+        .io_op_usr_ent = db_io_op_usr_ent,
+        .next_msg_id = db_next_msg_id,
+        .creat_usr_tbl = db_creat_usr_tbl,
+        .del_usr_tbl = db_del_usr_tbl,
+        .txn_apply = db_txn_apply,
+        .get_pend_msg = db_get_pend_msg,
+        .get_pend_msgs = db_get_pend_msgs,
+        .del_pend_msgs = db_del_pend_msgs,
+        .open_msg_body = db_open_msg_body,
+        .close_msg_body = db_close_msg_body,
+        .del_msg_body = db_del_msg_body,
+        .ack_queue_put = db_ack_queue_put,
+        .ack_queue_take = db_ack_queue_take,
+        .ack_queue_release = db_ack_queue_release,
+        .hist_init = db_hist_init,
+        .hist_enabled = db_hist_enabled,
+        .hist_put = db_hist_put,
+        .hist_get = db_hist_get,
+        .repl_set_hook = db_repl_set_hook,
+        .repl_reset = db_repl_reset,
+        .repl_apply = db_repl_apply,
+        .repl_snapshot = db_repl_snapshot,
+};
+
+static const db_engine_t *const engines[] = {&db_dir_engine, &db_mem_engine};
+
+const db_engine_t *db_engine = &db_dir_engine;
+
+
+int db_use_engine(const char *const name) {
+    /*** Selects the storage engine with a given name ***/
+    for (size_t i = 0; i < sizeof engines / sizeof engines[0]; i++)
+        if (!strcmp(engines[i]->name, name)) {
+            db_engine = engines[i];
+            return DBMS_SUCCESS;
+        }
+
+    fprintf(stderr, "Unknown storage engine %s\n", name);
+    return DBMS_ERR_NOT_EXISTS;
+}
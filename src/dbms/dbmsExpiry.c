@@ -0,0 +1,265 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include <pthread.h>
+#include "DS-Lab-Assignment/timerWheel.h"
+#include "DS-Lab-Assignment/dbms/dbmsUtil.h"
+#include "DS-Lab-Assignment/dbms/dbmsIndex.h"
+#include "DS-Lab-Assignment/dbms/dbms.h"
+
+
+/* expiry timer of a pending message; also linked in a hash table keyed by (username, msg ID),
+ * so that it can be cancelled when the message is delivered */
+typedef struct exp_timer {
+    tw_timer_t timer;               /* ticks are seconds since the Epoch */
+    char *username;
+    unsigned int msg_id;
+    struct exp_timer *hash_next;
+} exp_timer_t;
+
+typedef struct {
+    /*** Growable list of user names ***/
+    char **usernames;
+    size_t n_users;
+    size_t capacity;
+} exp_user_list_t;
+
+static timer_wheel_t exp_wheel;
+static exp_timer_t **exp_hash = NULL;
+static tw_timer_t *exp_backlog = NULL;     /* expired timers left for the next tick (batch was full) */
+static int exp_default_ttl = MSG_TTL_DEFAULT;
+static void (*exp_notify)(const entry_t *msg_entry) = NULL;
+static pthread_mutex_t mutex_exp = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t expiry_thread;
+
+static size_t exp_hash_pos(const char *username, unsigned int msg_id);
+static exp_timer_t *exp_unhash(const char *username, unsigned int msg_id);
+static int exp_unhash_timer(const exp_timer_t *exp_timer);
+static int collect_pend_user(const char *username, const idx_meta_t *meta, void *args);
+static void arm_stored_msgs(void);
+static void expire_msg(exp_timer_t *exp_timer);
+static void *db_exp_thread(void *args);
+
+
+static size_t exp_hash_pos(const char *username, const unsigned int msg_id) {
+    /*** FNV-1a hash of a (username, msg ID) pair ***/
+    size_t hash = 2166136261u;
+    while (*username) {
+        hash ^= (unsigned char) *username++;
+        hash *= 16777619u;
+    }
+    hash ^= msg_id;
+    hash *= 16777619u;
+    return hash & (EXP_HASH_BUCKETS - 1);
+}
+
+
+static exp_timer_t *exp_unhash(const char *const username, const unsigned int msg_id) {
+    /*** Removes the timer of a given message from the hash table and returns it;
+     * expiry mutex must be held ***/
+    exp_timer_t **link = &exp_hash[exp_hash_pos(username, msg_id)];
+    while (*link && ((*link)->msg_id != msg_id || strcmp((*link)->username, username) != 0))
+        link = &(*link)->hash_next;
+
+    exp_timer_t *exp_timer = *link;
+    if (exp_timer) *link = exp_timer->hash_next;
+    return exp_timer;
+}
+
+
+static int exp_unhash_timer(const exp_timer_t *const exp_timer) {
+    /*** Removes a given timer from the hash table; returns FALSE if it wasn't there;
+     * expiry mutex must be held ***/
+    exp_timer_t **link = &exp_hash[exp_hash_pos(exp_timer->username, exp_timer->msg_id)];
+    while (*link && *link != exp_timer) link = &(*link)->hash_next;
+
+    if (!*link) return FALSE;
+    *link = exp_timer->hash_next;
+    return TRUE;
+}
+
+
+void exp_arm(const entry_t *const entry) {
+    /*** Sets the expiry timer of a given pending message, or moves it if it was already set ***/
+    if (!exp_hash || entry->type != ENT_TYPE_P_MSG || !entry->msg.expires_at) return;
+
+    pthread_mutex_lock(&mutex_exp);
+    exp_timer_t *exp_timer = exp_unhash(entry->username, entry->msg.id);
+    /* a timer that has gone off is left to expire_msg, which will find it out of the hash table */
+    if (exp_timer && exp_timer->timer.pprev) tw_del(&exp_wheel, &exp_timer->timer);
+    else if ((exp_timer = malloc(sizeof(exp_timer_t))) && !(exp_timer->username = strdup(entry->username))) {
+        free(exp_timer);
+        exp_timer = NULL;
+    }
+
+    if (exp_timer) {
+        exp_timer->msg_id = entry->msg.id;
+        exp_timer->timer.expires = (unsigned long long) entry->msg.expires_at;
+        exp_timer->timer.data = exp_timer;
+        tw_add(&exp_wheel, &exp_timer->timer);
+
+        size_t pos = exp_hash_pos(entry->username, entry->msg.id);
+        exp_timer->hash_next = exp_hash[pos];
+        exp_hash[pos] = exp_timer;
+    } else perror("Could not allocate expiry timer");
+    pthread_mutex_unlock(&mutex_exp);
+}
+
+
+void exp_disarm(const entry_t *const entry) {
+    /*** Cancels the expiry timer of a given pending message (it has been delivered or deleted) ***/
+    if (!exp_hash || entry->type != ENT_TYPE_P_MSG) return;
+
+    pthread_mutex_lock(&mutex_exp);
+    exp_timer_t *exp_timer = exp_unhash(entry->username, entry->msg.id);
+    /* a timer that has gone off is not in the wheel anymore; expire_msg frees it */
+    if (exp_timer && exp_timer->timer.pprev) {
+        tw_del(&exp_wheel, &exp_timer->timer);
+        free(exp_timer->username);
+        free(exp_timer);
+    }
+    pthread_mutex_unlock(&mutex_exp);
+}
+
+
+static int collect_pend_user(const char *const username, const idx_meta_t *meta, void *args) {
+    /*** Adds a user to the user list in args if it has pending messages ***/
+    exp_user_list_t *pend_users = (exp_user_list_t *) args;
+    if (!meta->pend_msgs) return DBMS_SUCCESS;
+
+    if (pend_users->n_users == pend_users->capacity) {
+        size_t capacity = pend_users->capacity ? pend_users->capacity * 2 : 64;
+        char **grown = realloc(pend_users->usernames, capacity * sizeof(char *));
+        if (!grown) return DBMS_ERR_ANY;
+        pend_users->usernames = grown;
+        pend_users->capacity = capacity;
+    }
+
+    pend_users->usernames[pend_users->n_users] = strdup(username);
+    if (!pend_users->usernames[pend_users->n_users]) return DBMS_ERR_ANY;
+    pend_users->n_users++;
+    return DBMS_SUCCESS;
+}
+
+
+static void arm_stored_msgs(void) {
+    /*** Sets the expiry timers of the pending messages stored by previous server runs;
+     * only the tables of users that the index shows with pending messages are read ***/
+    exp_user_list_t pend_users = {NULL, 0, 0};
+    if (idx_for_each(collect_pend_user, &pend_users) < 0)
+        fprintf(stderr, "Could not list every user with pending messages\n");
+
+    for (size_t i = 0; i < pend_users.n_users; i++) {
+        DIR *pend_msg_table = NULL;
+        dir_ent_t *user_table = dir_get(pend_users.usernames[i]);
+        if (user_table) {
+            if (open_directory_at(user_table->table_fd, PEND_MSGS_TABLE, READ, &pend_msg_table) != DBMS_SUCCESS)
+                pend_msg_table = NULL;
+            dir_put(user_table);
+        }
+        struct dirent *pend_msgs_entry;
+        while (pend_msg_table && (pend_msgs_entry = readdir(pend_msg_table)) != NULL) {
+            if (!strcmp(pend_msgs_entry->d_name, ".") || !strcmp(pend_msgs_entry->d_name, "..")) continue;
+            entry_t entry;
+            entry.type = ENT_TYPE_P_MSG;
+            strcpy(entry.username, pend_users.usernames[i]);
+            if (str_to_num(pend_msgs_entry->d_name, (void *) &entry.msg.id, UINT) < 0) continue;
+            if (db_io_op_usr_ent(&entry, READ) == DBMS_SUCCESS) exp_arm(&entry);
+        }
+
+        if (pend_msg_table) closedir(pend_msg_table);
+        free(pend_users.usernames[i]);
+    }
+
+    free(pend_users.usernames);
+}
+
+
+static void expire_msg(exp_timer_t *exp_timer) {
+    /*** Deletes the pending message of a timer that has gone off and notifies its sender ***/
+    entry_t entry;
+    entry.type = ENT_TYPE_P_MSG;
+    strcpy(entry.username, exp_timer->username);
+    entry.msg.id = exp_timer->msg_id;
+
+    /* a timer that has gone off stays in the hash table until now, so that it is freed only here;
+     * if it's not there anymore, its message has been delivered or deleted in the meantime */
+    pthread_mutex_lock(&mutex_exp);
+    int still_pending = exp_unhash_timer(exp_timer);
+    pthread_mutex_unlock(&mutex_exp);
+    free(exp_timer->username);
+    free(exp_timer);
+
+    if (!still_pending || db_io_op_usr_ent(&entry, READ) < 0) return;
+    /* message ID has been given to a newer message */
+    if (!entry.msg.expires_at || entry.msg.expires_at > time(NULL)) return;
+
+    if (db_io_op_usr_ent(&entry, DELETE) < 0) return;
+    printf("s> MESSAGE %u FROM %s TO %s EXPIRED\n", entry.msg.id, entry.msg.sender, entry.username);
+    fflush(stdout);
+
+    if (exp_notify) exp_notify(&entry);
+}
+
+
+static void *db_exp_thread(void *args) {
+    /*** Expires pending messages: once per second, advances the timer wheel
+     * and removes at most EXP_BATCH_SIZE expired messages ***/
+    struct timespec tick = {1, 0};
+    arm_stored_msgs();
+
+    while (TRUE) {
+        nanosleep(&tick, NULL);
+
+        pthread_mutex_lock(&mutex_exp);
+        tw_timer_t *expired = tw_advance(&exp_wheel, (unsigned long long) time(NULL));
+        /* newly expired timers go after the ones left from previous ticks */
+        tw_timer_t **link = &exp_backlog;
+        while (*link) link = &(*link)->next;
+        *link = expired;
+
+        /* take a batch from the backlog */
+        tw_timer_t *batch = exp_backlog;
+        link = &exp_backlog;
+        for (int i = 0; i < EXP_BATCH_SIZE && *link; i++) link = &(*link)->next;
+        exp_backlog = *link;
+        *link = NULL;
+        pthread_mutex_unlock(&mutex_exp);
+
+        while (batch) {
+            tw_timer_t *next = batch->next;
+            expire_msg((exp_timer_t *) batch->data);
+            batch = next;
+        }
+    } // END while
+
+    return NULL;
+}
+
+
+int db_exp_init(const int default_ttl, void (*notify)(const entry_t *msg_entry)) {
+    /*** Sets up pending message expiry with a given default time to live (0 for none),
+     * and a function called with every message that expires ***/
+    exp_default_ttl = default_ttl;
+    exp_notify = notify;
+
+    exp_hash = calloc(EXP_HASH_BUCKETS, sizeof(exp_timer_t *));
+    CHECK_ERROR_WITH_ERRNO(!exp_hash, "Could not allocate expiry timers table", DBMS_ERR_ANY)
+    tw_init(&exp_wheel, (unsigned long long) time(NULL));
+
+    CHECK_ERROR_WITH_ERRNO(pthread_create(&expiry_thread, NULL, db_exp_thread, NULL) != 0,
+                           "Could not create expiry thread", DBMS_ERR_ANY)
+    pthread_detach(expiry_thread);
+    return DBMS_SUCCESS;
+}
+
+
+long long db_exp_deadline(const int ttl) {
+    /*** Returns the expiry time of a message stored now with a given time to live;
+     * a negative ttl stands for the default one; 0 if the message never expires ***/
+    int msg_ttl = (ttl < 0) ? exp_default_ttl : ttl;
+    return msg_ttl ? (long long) time(NULL) + msg_ttl : 0;
+}
@@ -0,0 +1,277 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "DS-Lab-Assignment/dbms/dbmsUtil.h"
+#include "DS-Lab-Assignment/dbms/dbms.h"
+
+
+/* message history: each conversation (pair of users) has a log, where delivered messages are appended
+ * as records of '\0'-terminated strings (timestamp, sender, message ID, size, content), and an index
+ * of fixed-size records pointing into the log, in time order; a range of messages is found with a binary
+ * search on the index, and read from the log with a single read, since their records are contiguous */
+typedef struct {
+    /*** History Index Record ***/
+    long long timestamp;            /* ms since the Epoch; strictly increasing within a conversation */
+    unsigned long long offset;      /* position of the message record in the log */
+    unsigned long long len;         /* length of the message record */
+} hist_idx_rec_t;
+
+static int hist_enabled = FALSE;
+static int hist_dir_fd = -1;        /* history folder, open for as long as the server runs */
+static pthread_mutex_t hist_locks[HIST_LOCK_STRIPES];  /* one held while appending to a conversation */
+
+static int hist_stripe(const char *low, const char *high);
+static int hist_open_at(const char *low, const char *high, const char *ext, int flags);
+static int hist_read_idx(int idx_fd, size_t pos, hist_idx_rec_t *idx_rec);
+
+
+int db_hist_init(const int enabled) {
+    /*** Turns the message history on or off; its directory is created if needed,
+     * and kept open so that appends reach conversations relative to it ***/
+    int ret_val;    /* needed for error-checking macros */
+    hist_enabled = enabled;
+    if (!enabled) return DBMS_SUCCESS;
+
+    char hist_path[strlen(DB_DIR) + strlen(HIST_DIR) + 2];
+    sprintf(hist_path, "%s/%s", DB_DIR, HIST_DIR);
+    DIR *hist_dir;
+    CHECK_FUNC_ERROR(open_directory(hist_path, OVERWRITE, &hist_dir), DBMS_ERR_ANY)
+    hist_dir_fd = dup(dirfd(hist_dir));
+    closedir(hist_dir);
+    CHECK_ERROR_WITH_ERRNO(hist_dir_fd < 0, "Could not open history directory", DBMS_ERR_ANY)
+
+    for (int i = 0; i < HIST_LOCK_STRIPES; i++) pthread_mutex_init(&hist_locks[i], NULL);
+    return DBMS_SUCCESS;
+}
+
+
+int db_hist_enabled(void) {
+    /*** Tells whether messages are kept in the history ***/
+    return hist_enabled;
+}
+
+
+static int hist_stripe(const char *const low, const char *const high) {
+    /*** FNV-1a hash of a conversation (the usernames of its pair of users), folded into its lock stripe ***/
+    uint32_t hash = 2166136261u;
+    for (const char *user = low; *user; user++) {
+        hash ^= (unsigned char) *user;
+        hash *= 16777619u;
+    }
+    hash *= 16777619u;      /* '\0' between usernames, so that "ab"+"c" and "a"+"bc" differ */
+    for (const char *user = high; *user; user++) {
+        hash ^= (unsigned char) *user;
+        hash *= 16777619u;
+    }
+    return (int) (hash % HIST_LOCK_STRIPES);
+}
+
+
+static int hist_open_at(const char *const low, const char *const high, const char *const ext, const int flags) {
+    /*** Opens the log or index of a conversation, relative to the history folder; with O_CREAT,
+     * the folder of its lowest user is created the first time it's needed ***/
+    char name[strlen(low) + strlen(high) + strlen(ext) + 2];
+    sprintf(name, "%s/%s%s", low, high, ext);
+    int fd = openat(hist_dir_fd, name, flags, 0600);
+    if (fd < 0 && errno == ENOENT && (flags & O_CREAT) &&
+        (mkdirat(hist_dir_fd, low, S_IRWXU) == 0 || errno == EEXIST))
+        fd = openat(hist_dir_fd, name, flags, 0600);
+    return fd;
+}
+
+
+static int hist_read_idx(const int idx_fd, const size_t pos, hist_idx_rec_t *idx_rec) {
+    /*** Reads the index record at a given position of a conversation index ***/
+    ssize_t bytes_read = pread(idx_fd, idx_rec, sizeof(hist_idx_rec_t), (off_t) (pos * sizeof(hist_idx_rec_t)));
+    CHECK_ERROR_WITH_ERRNO(bytes_read != sizeof(hist_idx_rec_t), "Could not read history index", DBMS_ERR_ANY)
+    return DBMS_SUCCESS;
+}
+
+
+int db_hist_put(const entry_t *const msg_entry) {
+    /*** Appends a delivered message to the history of its conversation;
+     * the content of streamed messages isn't kept, only their size ***/
+    CHECK_ARGS(msg_entry->type != ENT_TYPE_P_MSG, "Invalid Entry Type")
+    if (!hist_enabled) return DBMS_SUCCESS;
+
+    /* conversations are kept under the lowest username of the pair */
+    const char *sender = msg_entry->msg.sender, *recipient = msg_entry->username;
+    const char *low = (strcmp(sender, recipient) <= 0) ? sender : recipient;
+    const char *high = (low == sender) ? recipient : sender;
+
+    /* set up message record */
+    int streamed = (msg_entry->msg.flags & MSG_FLAG_STREAM) != 0;
+    unsigned long long size = streamed ? msg_entry->msg.size : strlen(msg_entry->msg.content);
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    hist_idx_rec_t idx_rec;
+    bzero(&idx_rec, sizeof(hist_idx_rec_t));
+    idx_rec.timestamp = now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+
+    /* appends to a conversation go one at a time; other conversations go on meanwhile */
+    pthread_mutex_t *lock = &hist_locks[hist_stripe(low, high)];
+    pthread_mutex_lock(lock);
+    int result = DBMS_ERR_ANY;
+    int idx_fd = hist_open_at(low, high, HIST_IDX_EXT, O_RDWR | O_CREAT);
+    int log_fd = hist_open_at(low, high, HIST_LOG_EXT, O_WRONLY | O_APPEND | O_CREAT);
+    struct stat idx_stat, log_stat;
+    if (idx_fd >= 0 && log_fd >= 0 && fstat(idx_fd, &idx_stat) == 0 && fstat(log_fd, &log_stat) == 0) {
+        /* a torn index record (crash in the middle of an append) is dropped;
+         * log bytes it pointed to are left behind, never to be read */
+        size_t n_recs = (size_t) idx_stat.st_size / sizeof(hist_idx_rec_t);
+        hist_idx_rec_t last_rec;
+        if ((off_t) (n_recs * sizeof(hist_idx_rec_t)) == idx_stat.st_size ||
+            ftruncate(idx_fd, (off_t) (n_recs * sizeof(hist_idx_rec_t))) == 0)
+            result = (n_recs > 0) ? hist_read_idx(idx_fd, n_recs - 1, &last_rec) : DBMS_SUCCESS;
+
+        if (result == DBMS_SUCCESS) {
+            /* timestamps are kept unique, so that they can be used as page cursors */
+            if (n_recs > 0 && idx_rec.timestamp <= last_rec.timestamp) idx_rec.timestamp = last_rec.timestamp + 1;
+
+            char record[3 * 24 + MAX_STR_SIZE + MAX_MSG_SIZE];
+            int record_len = sprintf(record, "%lld", idx_rec.timestamp) + 1;
+            record_len += sprintf(record + record_len, "%s", sender) + 1;
+            record_len += sprintf(record + record_len, "%u", msg_entry->msg.id) + 1;
+            record_len += sprintf(record + record_len, "%llu", size) + 1;
+            record_len += sprintf(record + record_len, "%s", streamed ? "" : msg_entry->msg.content) + 1;
+            idx_rec.offset = (unsigned long long) log_stat.st_size;
+            idx_rec.len = (unsigned long long) record_len;
+
+            /* log first: an index record never points past the end of the log */
+            if (write_bytes(log_fd, record, record_len) != record_len ||
+                pwrite(idx_fd, &idx_rec, sizeof(hist_idx_rec_t), (off_t) (n_recs * sizeof(hist_idx_rec_t))) !=
+                sizeof(hist_idx_rec_t))
+                result = DBMS_ERR_ANY;
+        }
+    }
+    if (result != DBMS_SUCCESS) perror("Could not append message to history");
+    if (idx_fd >= 0) close(idx_fd);
+    if (log_fd >= 0) close(log_fd);
+    pthread_mutex_unlock(lock);
+
+    if (result == DBMS_SUCCESS) db_dur_note_write();
+    return result;
+}
+
+
+int db_hist_get(const char *const username, const char *const peer, const long long since, const size_t max_records,
+                char **records, size_t *records_len, size_t *n_records) {
+    /*** Reads up to max_records messages of the conversation between two users, from the first one
+     * after a given timestamp (ms since the Epoch) on; *records must be freed by the caller ***/
+    *records = NULL;
+    *records_len = *n_records = 0;
+    if (!hist_enabled || !max_records) return DBMS_SUCCESS;
+
+    const char *low = (strcmp(username, peer) <= 0) ? username : peer;
+    const char *high = (low == username) ? peer : username;
+
+    /* no index: the users haven't exchanged any messages yet */
+    int idx_fd = hist_open_at(low, high, HIST_IDX_EXT, O_RDONLY);
+    if (idx_fd < 0 && errno == ENOENT) return DBMS_SUCCESS;
+    CHECK_ERROR_WITH_ERRNO(idx_fd < 0, "Could not open history index", DBMS_ERR_ANY)
+
+    /* index records appended from now on are left out */
+    struct stat idx_stat;
+    if (fstat(idx_fd, &idx_stat) < 0) {
+        close(idx_fd);
+        CHECK_ERROR_WITH_ERRNO(TRUE, "Could not stat history index", DBMS_ERR_ANY)
+    }
+    size_t n_recs = (size_t) idx_stat.st_size / sizeof(hist_idx_rec_t);
+
+    /* binary search for the first message after the given timestamp */
+    size_t first = 0, last = n_recs;
+    hist_idx_rec_t idx_rec;
+    while (first < last) {
+        size_t middle = first + (last - first) / 2;
+        if (hist_read_idx(idx_fd, middle, &idx_rec) < 0) {
+            close(idx_fd);
+            return DBMS_ERR_ANY;
+        }
+        if (idx_rec.timestamp <= since) first = middle + 1;
+        else last = middle;
+    } // END while
+
+    size_t n_page = (n_recs - first < max_records) ? n_recs - first : max_records;
+    if (!n_page) {
+        close(idx_fd);
+        return DBMS_SUCCESS;
+    }
+
+    /* page bounds: its message records are contiguous in the log */
+    hist_idx_rec_t first_rec, last_rec;
+    int result = (hist_read_idx(idx_fd, first, &first_rec) == DBMS_SUCCESS &&
+                  hist_read_idx(idx_fd, first + n_page - 1, &last_rec) == DBMS_SUCCESS) ? DBMS_SUCCESS : DBMS_ERR_ANY;
+    close(idx_fd);
+    if (result < 0) return result;
+
+    size_t page_len = (size_t) (last_rec.offset + last_rec.len - first_rec.offset);
+    *records = malloc(page_len);
+    CHECK_ERROR(!*records, "Could not allocate history page", DBMS_ERR_ANY)
+
+    int log_fd = hist_open_at(low, high, HIST_LOG_EXT, O_RDONLY);
+    if (log_fd < 0 || pread(log_fd, *records, page_len, (off_t) first_rec.offset) != (ssize_t) page_len) {
+        perror("Could not read history log");
+        if (log_fd >= 0) close(log_fd);
+        free(*records);
+        *records = NULL;
+        return DBMS_ERR_ANY;
+    }
+    close(log_fd);
+
+    *records_len = page_len;
+    *n_records = n_page;
+    return DBMS_SUCCESS;
+}
+
+
+int db_hist_del_user(const char *const username) {
+    /*** Deletes the history of every conversation of a given user ***/
+    if (!hist_enabled) return DBMS_SUCCESS;
+
+    /* conversations kept under the user */
+    char hist_path[strlen(DB_DIR) + strlen(HIST_DIR) + 2];
+    sprintf(hist_path, "%s/%s", DB_DIR, HIST_DIR);
+    char conv_path[sizeof hist_path + strlen(username) + 1];
+    sprintf(conv_path, "%s/%s", hist_path, username);
+    DIR *conv_dir;
+    int result = open_directory(conv_path, READ, &conv_dir);
+    if (result == DBMS_SUCCESS) {
+        closedir(conv_dir);
+        result = remove_recursive(conv_path);
+    }
+    if (result < 0 && result != DBMS_ERR_NOT_EXISTS) return DBMS_ERR_ANY;
+
+    /* conversations kept under users with a lower username */
+    DIR *hist_dir;
+    if (open_directory(hist_path, READ, &hist_dir) < 0) return DBMS_ERR_ANY;
+    struct dirent *low_entry;
+    result = DBMS_SUCCESS;
+    while ((low_entry = readdir(hist_dir)) != NULL) {
+        if (!strcmp(low_entry->d_name, ".") || !strcmp(low_entry->d_name, "..") ||
+            strcmp(low_entry->d_name, username) >= 0)
+            continue;
+
+        char log_path[sizeof hist_path + strlen(low_entry->d_name) + strlen(username) + strlen(HIST_LOG_EXT) + 2];
+        sprintf(log_path, "%s/%s/%s%s", hist_path, low_entry->d_name, username, HIST_LOG_EXT);
+        char idx_path[sizeof hist_path + strlen(low_entry->d_name) + strlen(username) + strlen(HIST_IDX_EXT) + 2];
+        sprintf(idx_path, "%s/%s/%s%s", hist_path, low_entry->d_name, username, HIST_IDX_EXT);
+
+        /* index first, so that it never points into a deleted log */
+        if ((unlink(idx_path) < 0 && errno != ENOENT) || (unlink(log_path) < 0 && errno != ENOENT)) {
+            perror("Could not delete history");
+            result = DBMS_ERR_ANY;
+        }
+    } // END while
+    closedir(hist_dir);
+
+    db_dur_note_write();
+    return result;
+}
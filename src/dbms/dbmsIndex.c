@@ -0,0 +1,357 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "DS-Lab-Assignment/dbms/dbmsIndex.h"
+
+
+/* in-memory user index: a chained hash table keyed by username */
+typedef struct idx_node {
+    char *username;
+    idx_meta_t meta;
+    int dirty;                  /* user has been journaled since the last checkpoint */
+    struct idx_node *next;
+    struct idx_node *cn_prev;   /* presence list: connected users, linked through these */
+    struct idx_node *cn_next;
+} idx_node_t;
+
+static idx_node_t **idx_buckets = NULL;
+static size_t idx_n_buckets = 0;
+static size_t idx_n_users = 0;
+static idx_node_t *idx_cn_head = NULL;  /* presence list */
+static size_t idx_n_cn = 0;             /* number of users in the presence list */
+static pthread_rwlock_t rwlock_idx = PTHREAD_RWLOCK_INITIALIZER;
+
+static size_t idx_hash(const char *username);
+static idx_node_t *idx_find(const char *username);
+static void idx_grow(void);
+static void idx_set_status(idx_node_t *node, unsigned char old_status);
+
+
+static size_t idx_hash(const char *username) {
+    /*** FNV-1a hash of a username ***/
+    size_t hash = 2166136261u;
+    while (*username) {
+        hash ^= (unsigned char) *username++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+
+static idx_node_t *idx_find(const char *const username) {
+    /*** Finds the node of a given username; index lock must be held ***/
+    idx_node_t *node = idx_buckets[idx_hash(username) & (idx_n_buckets - 1)];
+    while (node && strcmp(node->username, username) != 0) node = node->next;
+    return node;
+}
+
+
+static void idx_grow(void) {
+    /*** Doubles the number of buckets and rehashes all nodes; index write lock must be held ***/
+    size_t new_n_buckets = idx_n_buckets * 2;
+    idx_node_t **new_buckets = calloc(new_n_buckets, sizeof(idx_node_t *));
+    if (!new_buckets) return;   /* keep going with longer chains */
+
+    for (size_t i = 0; i < idx_n_buckets; i++) {
+        idx_node_t *node = idx_buckets[i];
+        while (node) {
+            idx_node_t *next = node->next;
+            size_t pos = idx_hash(node->username) & (new_n_buckets - 1);
+            node->next = new_buckets[pos];
+            new_buckets[pos] = node;
+            node = next;
+        }
+    }
+
+    free(idx_buckets);
+    idx_buckets = new_buckets;
+    idx_n_buckets = new_n_buckets;
+}
+
+
+static void idx_set_status(idx_node_t *node, const unsigned char old_status) {
+    /*** Keeps the presence list in step with a node whose status was old_status
+     * and is now node->meta.status; index write lock must be held ***/
+    if (old_status == node->meta.status) return;
+
+    if (node->meta.status == STATUS_CN) {   /* link node at the head of the presence list */
+        node->cn_prev = NULL;
+        node->cn_next = idx_cn_head;
+        if (idx_cn_head) idx_cn_head->cn_prev = node;
+        idx_cn_head = node;
+        idx_n_cn++;
+    } else {    /* unlink node */
+        if (node->cn_prev) node->cn_prev->cn_next = node->cn_next;
+        else idx_cn_head = node->cn_next;
+        if (node->cn_next) node->cn_next->cn_prev = node->cn_prev;
+        idx_n_cn--;
+    }
+}
+
+
+int idx_init(void) {
+    /*** Sets up an empty index ***/
+    pthread_rwlock_wrlock(&rwlock_idx);
+    if (!idx_buckets) {
+        idx_buckets = calloc(IDX_INIT_BUCKETS, sizeof(idx_node_t *));
+        idx_n_buckets = IDX_INIT_BUCKETS;
+    }
+    pthread_rwlock_unlock(&rwlock_idx);
+
+    CHECK_ERROR_WITH_ERRNO(!idx_buckets, "Could not allocate user index", DBMS_ERR_ANY)
+    return DBMS_SUCCESS;
+}
+
+
+int idx_is_ready(void) {
+    /*** Checks whether the index has been set up ***/
+    return idx_buckets != NULL;
+}
+
+
+int idx_put(const char *const username, const idx_meta_t *meta, const int dirty) {
+    /*** Inserts a user in the index, or replaces its metadata if it is already there ***/
+    if (!idx_buckets) return DBMS_ERR_ANY;
+
+    pthread_rwlock_wrlock(&rwlock_idx);
+    idx_node_t *node = idx_find(username);
+    if (!node) {
+        node = malloc(sizeof(idx_node_t));
+        if (node) node->username = strdup(username);
+        if (!node || !node->username) {
+            free(node);
+            pthread_rwlock_unlock(&rwlock_idx);
+            perror("Could not allocate user index node");
+            return DBMS_ERR_ANY;
+        }
+        size_t pos = idx_hash(username) & (idx_n_buckets - 1);
+        node->next = idx_buckets[pos];
+        idx_buckets[pos] = node;
+        node->dirty = FALSE;
+        node->meta.status = STATUS_DCN;
+        if (++idx_n_users > idx_n_buckets) idx_grow();
+    }
+    unsigned char old_status = node->meta.status;
+    node->meta = *meta;
+    idx_set_status(node, old_status);
+    node->dirty |= dirty;
+    pthread_rwlock_unlock(&rwlock_idx);
+
+    return DBMS_SUCCESS;
+}
+
+
+int idx_del(const char *const username) {
+    /*** Removes a user from the index ***/
+    if (!idx_buckets) return DBMS_ERR_ANY;
+
+    pthread_rwlock_wrlock(&rwlock_idx);
+    idx_node_t **link = &idx_buckets[idx_hash(username) & (idx_n_buckets - 1)];
+    while (*link && strcmp((*link)->username, username) != 0) link = &(*link)->next;
+
+    idx_node_t *node = *link;
+    if (node) {
+        *link = node->next;
+        idx_n_users--;
+        unsigned char old_status = node->meta.status;
+        node->meta.status = STATUS_DCN;
+        idx_set_status(node, old_status);
+    }
+    pthread_rwlock_unlock(&rwlock_idx);
+
+    if (!node) return DBMS_ERR_NOT_EXISTS;
+    free(node->username);
+    free(node);
+    return DBMS_SUCCESS;
+}
+
+
+int idx_get(const char *const username, idx_meta_t *meta) {
+    /*** Copies the metadata of a given user; returns TRUE if the user is in the index ***/
+    if (!idx_buckets) return FALSE;
+
+    pthread_rwlock_rdlock(&rwlock_idx);
+    idx_node_t *node = idx_find(username);
+    if (node && meta) *meta = node->meta;
+    pthread_rwlock_unlock(&rwlock_idx);
+
+    return node != NULL;
+}
+
+
+int idx_set_userdata(const char *const username, const unsigned char status, const unsigned int last_msg_id) {
+    /*** Updates the userdata fields kept in the index for a given user, once written to disk;
+     * last_msg_id is the high-water mark on disk: if it's past the reserved one (the entry
+     * comes from the primary server), IDs up to it may have been given, so they're skipped ***/
+    if (!idx_buckets) return DBMS_ERR_ANY;
+
+    pthread_rwlock_wrlock(&rwlock_idx);
+    idx_node_t *node = idx_find(username);
+    if (node) {
+        unsigned char old_status = node->meta.status;
+        node->meta.status = status;
+        if (idx_msg_id_after(last_msg_id, node->meta.reserved_msg_id)) {
+            node->meta.last_msg_id = last_msg_id;
+            node->meta.reserved_msg_id = last_msg_id;
+        }
+        idx_set_status(node, old_status);
+    }
+    pthread_rwlock_unlock(&rwlock_idx);
+
+    return node ? DBMS_SUCCESS : DBMS_ERR_NOT_EXISTS;
+}
+
+
+int idx_next_msg_id(const char *const username, unsigned int *msg_id) {
+    /*** Gives the next message ID of a given user from its reserved block;
+     * returns FALSE if the block is used up, so that a new one must be reserved first ***/
+    if (!idx_buckets) return DBMS_ERR_ANY;
+
+    pthread_rwlock_wrlock(&rwlock_idx);
+    idx_node_t *node = idx_find(username);
+    int result = node ? (node->meta.last_msg_id != node->meta.reserved_msg_id) : DBMS_ERR_NOT_EXISTS;
+    if (result == TRUE) {
+        node->meta.last_msg_id = (node->meta.last_msg_id + 1) % MSG_ID_MAX_VALUE;
+        *msg_id = node->meta.last_msg_id;
+    }
+    pthread_rwlock_unlock(&rwlock_idx);
+
+    return result;
+}
+
+
+int idx_reserve_msg_ids(const char *const username, const unsigned int reserved_msg_id) {
+    /*** Sets the last message ID a given user's reserved block goes up to ***/
+    if (!idx_buckets) return DBMS_ERR_ANY;
+
+    pthread_rwlock_wrlock(&rwlock_idx);
+    idx_node_t *node = idx_find(username);
+    if (node) node->meta.reserved_msg_id = reserved_msg_id;
+    pthread_rwlock_unlock(&rwlock_idx);
+
+    return node ? DBMS_SUCCESS : DBMS_ERR_NOT_EXISTS;
+}
+
+
+int idx_msg_id_after(const unsigned int msg_id, const unsigned int other_msg_id) {
+    /*** Checks whether a message ID comes after another one, IDs wrapping around at MSG_ID_MAX_VALUE ***/
+    unsigned int distance = (unsigned int) (((unsigned long long) msg_id + MSG_ID_MAX_VALUE - other_msg_id)
+                                            % MSG_ID_MAX_VALUE);
+    return distance != 0 && distance < MSG_ID_MAX_VALUE / 2;
+}
+
+
+int idx_add_pend_msgs(const char *const username, const int delta) {
+    /*** Adds delta to the number of pending messages of a given user ***/
+    if (!idx_buckets) return DBMS_ERR_ANY;
+
+    pthread_rwlock_wrlock(&rwlock_idx);
+    idx_node_t *node = idx_find(username);
+    if (node) {
+        if (delta < 0 && node->meta.pend_msgs < (unsigned int) -delta) node->meta.pend_msgs = 0;
+        else node->meta.pend_msgs += delta;
+    }
+    pthread_rwlock_unlock(&rwlock_idx);
+
+    return node ? DBMS_SUCCESS : DBMS_ERR_NOT_EXISTS;
+}
+
+
+int idx_test_and_set_dirty(const char *const username) {
+    /*** Marks a user as journaled since the last checkpoint;
+     * returns TRUE if it already was (or if there's no index), FALSE otherwise ***/
+    if (!idx_buckets) return TRUE;
+
+    pthread_rwlock_wrlock(&rwlock_idx);
+    idx_node_t *node = idx_find(username);
+    int was_dirty = node ? node->dirty : FALSE;
+    if (node) node->dirty = TRUE;
+    pthread_rwlock_unlock(&rwlock_idx);
+
+    return was_dirty;
+}
+
+
+void idx_clear_dirty(void) {
+    /*** Clears the dirty mark of every user (after a checkpoint) ***/
+    if (!idx_buckets) return;
+
+    pthread_rwlock_wrlock(&rwlock_idx);
+    for (size_t i = 0; i < idx_n_buckets; i++)
+        for (idx_node_t *node = idx_buckets[i]; node; node = node->next) node->dirty = FALSE;
+    pthread_rwlock_unlock(&rwlock_idx);
+}
+
+
+void idx_clear(void) {
+    /*** Removes every user from the index ***/
+    if (!idx_buckets) return;
+
+    pthread_rwlock_wrlock(&rwlock_idx);
+    for (size_t i = 0; i < idx_n_buckets; i++) {
+        idx_node_t *node = idx_buckets[i];
+        while (node) {
+            idx_node_t *next = node->next;
+            free(node->username);
+            free(node);
+            node = next;
+        }
+        idx_buckets[i] = NULL;
+    }
+    idx_n_users = 0;
+    idx_cn_head = NULL;
+    idx_n_cn = 0;
+    pthread_rwlock_unlock(&rwlock_idx);
+}
+
+
+size_t idx_size(void) {
+    /*** Returns the number of users in the index ***/
+    pthread_rwlock_rdlock(&rwlock_idx);
+    size_t size = idx_n_users;
+    pthread_rwlock_unlock(&rwlock_idx);
+    return size;
+}
+
+
+int idx_for_each(int (*func)(const char *, const idx_meta_t *, void *), void *args) {
+    /*** Calls func on every user in the index while holding the index read lock;
+     * stops and returns func's error code if it fails ***/
+    if (!idx_buckets) return DBMS_ERR_ANY;
+
+    int result = DBMS_SUCCESS;
+    pthread_rwlock_rdlock(&rwlock_idx);
+    for (size_t i = 0; i < idx_n_buckets && result >= 0; i++)
+        for (idx_node_t *node = idx_buckets[i]; node && result >= 0; node = node->next)
+            result = func(node->username, &node->meta, args);
+    pthread_rwlock_unlock(&rwlock_idx);
+
+    return (result < 0) ? result : DBMS_SUCCESS;
+}
+
+
+int idx_get_connected(char **names, size_t *names_len, size_t *n_names) {
+    /*** Takes a snapshot of the presence list: *names is set to a newly allocated buffer
+     * with the usernames of every connected user, each one '\0'-terminated;
+     * only connected users are visited, however many users there are in the index ***/
+    if (!idx_buckets) return DBMS_ERR_ANY;
+
+    pthread_rwlock_rdlock(&rwlock_idx);
+    size_t len = 0;
+    for (idx_node_t *node = idx_cn_head; node; node = node->cn_next) len += strlen(node->username) + 1;
+
+    char *buffer = malloc(len ? len : 1);
+    if (buffer) {
+        char *pos = buffer;
+        for (idx_node_t *node = idx_cn_head; node; node = node->cn_next)
+            pos = stpcpy(pos, node->username) + 1;
+        *n_names = idx_n_cn;
+    }
+    pthread_rwlock_unlock(&rwlock_idx);
+
+    CHECK_ERROR_WITH_ERRNO(!buffer, "Could not allocate connected users list", DBMS_ERR_ANY)
+    *names = buffer;
+    *names_len = len;
+    return DBMS_SUCCESS;
+}
@@ -0,0 +1,339 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "DS-Lab-Assignment/dbms/dbmsUtil.h"
+#include "DS-Lab-Assignment/dbms/dbms.h"
+
+
+/* user table layout: flat, every table right in the DB root folder (<username>-table), or hashed, every table
+ * two shard folders down, named after a hash of its username (ab/cd/<username>-table), so that no folder ever
+ * holds more than a few thousand entries; a flat DB switched to the hashed layout is migrated online: tables are
+ * moved one at a time by a background thread, and looked up in both places until it's done */
+static char layout = DB_LAYOUT_FLAT;
+static char layout_asked = '\0';     /* layout asked for with db_layout_use, if any */
+static int migrating = FALSE;       /* there may be tables left in the flat layout */
+
+/* read-held while resolving or walking tables, write-held by the migration while moving a table */
+static pthread_rwlock_t rwlock_layout = PTHREAD_RWLOCK_INITIALIZER;
+
+static void hashed_name(const char *username, char *name);
+static int is_shard_name(const char *name);
+static int make_shards(char *name);
+static int walk_dir(int dir_fd, const char *dir_name, int (*func)(const char *, void *), void *args);
+static int migrate_pass(size_t *n_moved);
+static void *migrate_thread(void *args);
+
+
+static void hashed_name(const char *const username, char *name) {
+    /*** Sets up the name of a user table in the hashed layout, relative to the DB root folder ***/
+    uint32_t hash = 2166136261u;    /* FNV-1a */
+    for (const unsigned char *c = (const unsigned char *) username; *c; c++) hash = (hash ^ *c) * 16777619u;
+    sprintf(name, "%02x/%02x/%s-table", (hash >> 8) & 0xff, hash & 0xff, username);
+}
+
+
+static int is_shard_name(const char *const name) {
+    /*** Checks whether a directory entry name is the name of a shard folder: 2 hex digits ***/
+    return strlen(name) == 2 && strspn(name, "0123456789abcdef") == 2;
+}
+
+
+static int make_shards(char *name) {
+    /*** Creates the shard folders of a user table in the hashed layout, given its name, if they don't exist ***/
+    name[2] = '\0';
+    int result = mkdirat(dir_root_fd(), name, S_IRWXU);
+    name[2] = '/';
+    name[5] = '\0';
+    if (result == 0 || errno == EEXIST) result = mkdirat(dir_root_fd(), name, S_IRWXU);
+    name[5] = '/';
+    return (result == 0 || errno == EEXIST) ? 0 : -1;
+}
+
+
+int db_layout_parse(const char *const string, char *layout_out) {
+    /*** Casts a user table layout name (flat, hashed) to its DB_LAYOUT_* code ***/
+    if (!strcmp(string, "flat")) *layout_out = DB_LAYOUT_FLAT;
+    else if (!strcmp(string, "hashed")) *layout_out = DB_LAYOUT_HASHED;
+    else return GEN_ERR_INV_ARGS;
+
+    return 0;
+}
+
+
+void db_layout_use(const char layout_in) {
+    /*** Asks for a user table layout; must be called before db_init_db ***/
+    layout_asked = layout_in;
+}
+
+
+int layout_init(void) {
+    /*** Sets the user table layout up once the DB root folder is open: a DB once switched to the hashed layout
+     * stays hashed, as recorded in its layout entry; a flat one asked to be hashed is switched and migrated ***/
+    char stored[16] = "";
+    int layout_fd = openat(dir_root_fd(), LAYOUT_ENTRY, O_RDONLY);
+    if (layout_fd >= 0) {
+        if (read(layout_fd, stored, sizeof stored - 1) < 0) stored[0] = '\0';
+        close(layout_fd);
+    } else if (errno != ENOENT) {
+        perror("Could not open DB layout entry");
+        return DBMS_ERR_ANY;
+    }
+
+    if (stored[0] == DB_LAYOUT_HASHED) {
+        layout = DB_LAYOUT_HASHED;
+        migrating = TRUE;       /* a previous migration may have been cut short: checked on db_layout_migrate */
+        if (layout_asked == DB_LAYOUT_FLAT) {
+            printf("s> DB layout is hashed: it can't go back to flat\n"); fflush(stdout);
+        }
+        return DBMS_SUCCESS;
+    }
+    if (layout_asked != DB_LAYOUT_HASHED) return DBMS_SUCCESS;
+
+    /* switch to the hashed layout: recorded before any table is created or moved in it */
+    layout_fd = openat(dir_root_fd(), LAYOUT_ENTRY, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    CHECK_ERROR_WITH_ERRNO(layout_fd < 0, "Could not create DB layout entry", DBMS_ERR_ANY)
+    char record[2] = {DB_LAYOUT_HASHED, '\n'};
+    int result = write_bytes(layout_fd, record, 2);
+    if (result >= 0) result = fsync(layout_fd);
+    close(layout_fd);
+    CHECK_ERROR_WITH_ERRNO(result < 0, "Could not write DB layout entry", DBMS_ERR_ANY)
+
+    layout = DB_LAYOUT_HASHED;
+    migrating = TRUE;
+    return DBMS_SUCCESS;
+}
+
+
+int table_open(const char *const username) {
+    /*** Opens the table directory of a given user, wherever it is in the layout;
+     * returns -1 with errno set (ENOENT if it doesn't exist) ***/
+    char name[TABLE_NAME_SIZE];
+    int table_fd;
+    pthread_rwlock_rdlock(&rwlock_layout);
+    if (layout == DB_LAYOUT_HASHED) {
+        hashed_name(username, name);
+        table_fd = openat(dir_root_fd(), name, O_RDONLY | O_DIRECTORY);
+        if (table_fd >= 0 || errno != ENOENT || !migrating) {
+            int error_num = errno;
+            pthread_rwlock_unlock(&rwlock_layout);
+            errno = error_num;
+            return table_fd;
+        }
+    }
+
+    /* flat layout, or a table not migrated yet */
+    sprintf(name, "%s-table", username);
+    table_fd = openat(dir_root_fd(), name, O_RDONLY | O_DIRECTORY);
+    int error_num = errno;
+    pthread_rwlock_unlock(&rwlock_layout);
+    errno = error_num;
+    return table_fd;
+}
+
+
+int table_create(const char *const username) {
+    /*** Creates the table directory of a given user, along with its shard folders in the hashed layout;
+     * returns -1 with errno set (EEXIST if the user has a table, wherever it is) ***/
+    char name[TABLE_NAME_SIZE];
+    int result;
+    pthread_rwlock_rdlock(&rwlock_layout);
+    if (layout == DB_LAYOUT_FLAT) {
+        sprintf(name, "%s-table", username);
+        result = mkdirat(dir_root_fd(), name, S_IRWXU);
+    } else {
+        /* a user whose table hasn't been migrated yet exists already */
+        struct stat table_stat;
+        sprintf(name, "%s-table", username);
+        if (migrating && fstatat(dir_root_fd(), name, &table_stat, 0) == 0) {
+            pthread_rwlock_unlock(&rwlock_layout);
+            errno = EEXIST;
+            return -1;
+        }
+
+        /* shard folders are only created by the first table in them */
+        hashed_name(username, name);
+        result = mkdirat(dir_root_fd(), name, S_IRWXU);
+        if (result < 0 && errno == ENOENT && make_shards(name) == 0) result = mkdirat(dir_root_fd(), name, S_IRWXU);
+    }
+    int error_num = errno;
+    pthread_rwlock_unlock(&rwlock_layout);
+    errno = error_num;
+    return result;
+}
+
+
+int table_remove(const char *const username) {
+    /*** Deletes the table directory of a given user, wherever it is in the layout ***/
+    char name[TABLE_NAME_SIZE];
+    char path[sizeof DB_DIR + TABLE_NAME_SIZE];
+    pthread_rwlock_rdlock(&rwlock_layout);
+    int result = DBMS_ERR_NOT_EXISTS;
+    if (layout == DB_LAYOUT_HASHED) {
+        hashed_name(username, name);
+        sprintf(path, "%s/%s", DB_DIR, name);
+        if (!migrating || faccessat(dir_root_fd(), name, F_OK, 0) == 0) result = remove_recursive(path);
+    }
+    if (result == DBMS_ERR_NOT_EXISTS && (layout == DB_LAYOUT_FLAT || migrating)) {
+        sprintf(path, "%s/%s-table", DB_DIR, username);
+        result = remove_recursive(path);
+    }
+    pthread_rwlock_unlock(&rwlock_layout);
+    return result;
+}
+
+
+static int walk_dir(const int dir_fd, const char *const dir_name,
+                    int (*func)(const char *, void *), void *args) {
+    /*** Calls func with the username of every user table in a given folder, and of every shard folder in it ***/
+    int sub_fd = openat(dir_fd, dir_name, O_RDONLY | O_DIRECTORY);
+    if (sub_fd < 0) return (errno == ENOENT) ? DBMS_SUCCESS : DBMS_ERR_ANY;
+    DIR *dir = fdopendir(sub_fd);
+    if (!dir) {
+        close(sub_fd);
+        return DBMS_ERR_ANY;
+    }
+
+    struct dirent *dir_entry;
+    const size_t suffix_len = strlen("-table");
+    int result = DBMS_SUCCESS;
+    while (result == DBMS_SUCCESS && (dir_entry = readdir(dir)) != NULL) {
+        size_t name_len = strlen(dir_entry->d_name);
+        if (dir_entry->d_name[0] == '.') continue;
+
+        if (layout == DB_LAYOUT_HASHED && is_shard_name(dir_entry->d_name)) {
+            result = walk_dir(dirfd(dir), dir_entry->d_name, func, args);
+            continue;
+        }
+        if (name_len <= suffix_len || strcmp(dir_entry->d_name + name_len - suffix_len, "-table") != 0) continue;
+
+        char username[name_len - suffix_len + 1];
+        memcpy(username, dir_entry->d_name, name_len - suffix_len);
+        username[name_len - suffix_len] = '\0';
+        result = func(username, args);
+    }
+
+    closedir(dir);
+    return result;
+}
+
+
+int table_for_each(int (*func)(const char *username, void *args), void *args) {
+    /*** Calls func with the username of every user table in the DB, stopping if it fails;
+     * tables aren't moved by the migration meanwhile ***/
+    pthread_rwlock_rdlock(&rwlock_layout);
+    int result = walk_dir(dir_root_fd(), ".", func, args);
+    pthread_rwlock_unlock(&rwlock_layout);
+    return result;
+}
+
+
+void layout_hold(void) {
+    /*** Keeps the migration from moving tables until layout_release ***/
+    pthread_rwlock_rdlock(&rwlock_layout);
+}
+
+
+void layout_release(void) {
+    /*** Lets the migration move tables again ***/
+    pthread_rwlock_unlock(&rwlock_layout);
+}
+
+
+static int migrate_pass(size_t *n_moved) {
+    /*** Moves every table left in the DB root folder to its place in the hashed layout;
+     * returns the number of tables found there ***/
+    int root_fd = openat(dir_root_fd(), ".", O_RDONLY | O_DIRECTORY);
+    DIR *root = (root_fd >= 0) ? fdopendir(root_fd) : NULL;
+    if (!root) {
+        if (root_fd >= 0) close(root_fd);
+        return DBMS_ERR_ANY;
+    }
+
+    struct dirent *dir_entry;
+    const size_t suffix_len = strlen("-table");
+    int n_found = 0;
+    while ((dir_entry = readdir(root)) != NULL) {
+        size_t name_len = strlen(dir_entry->d_name);
+        if (dir_entry->d_name[0] == '.' || name_len <= suffix_len ||
+            strcmp(dir_entry->d_name + name_len - suffix_len, "-table") != 0)
+            continue;
+        n_found++;
+
+        char username[name_len - suffix_len + 1];
+        memcpy(username, dir_entry->d_name, name_len - suffix_len);
+        username[name_len - suffix_len] = '\0';
+        char name[TABLE_NAME_SIZE];
+        hashed_name(username, name);
+
+        /* shard folders first; the move itself is a single rename, so tables are never half moved,
+         * and fds of the table opened meanwhile stay valid */
+        pthread_rwlock_wrlock(&rwlock_layout);
+        int result = make_shards(name);
+        if (result == 0) result = renameat(dir_root_fd(), dir_entry->d_name, dir_root_fd(), name);
+        pthread_rwlock_unlock(&rwlock_layout);
+
+        if (result == 0) (*n_moved)++;
+        else if (errno != ENOENT) perror("Could not move user table to hashed layout");
+    }
+
+    closedir(root);
+    return n_found;
+}
+
+
+int db_layout_migrate(void) {
+    /*** Moves the tables left in the flat layout of a hashed DB to their place; the DB keeps being served
+     * meanwhile, since tables are looked up in both places until the migration is done ***/
+    if (layout != DB_LAYOUT_HASHED || !migrating) return DBMS_SUCCESS;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    size_t n_moved = 0, n_moved_before;
+    int n_found;
+    /* a folder read while it changes may have entries missed: go on until a pass finds no table left,
+     * or can't move any of those it finds */
+    do {
+        n_moved_before = n_moved;
+        n_found = migrate_pass(&n_moved);
+    } while (n_found > 0 && n_moved > n_moved_before);
+    CHECK_ERROR(n_found != 0, "Could not migrate DB to hashed layout", DBMS_ERR_ANY)
+    pthread_rwlock_wrlock(&rwlock_layout);
+    migrating = FALSE;
+    pthread_rwlock_unlock(&rwlock_layout);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (n_moved) {
+        long elapsed_ms = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+        printf("s> migrated %zu user tables to hashed layout in %ld ms\n", n_moved, elapsed_ms);
+        fflush(stdout);
+    }
+    return DBMS_SUCCESS;
+}
+
+
+static void *migrate_thread(void *args) {
+    /*** Thread migrating the DB to the hashed layout in the background ***/
+    (void) args;
+    db_layout_migrate();
+    return NULL;
+}
+
+
+void layout_migrate_start(void) {
+    /*** Starts the migration of the tables left in the flat layout, if any, in a background thread ***/
+    if (layout != DB_LAYOUT_HASHED || !migrating) return;
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, migrate_thread, NULL) != 0) {
+        perror("Could not create layout migration thread");
+        return;
+    }
+    pthread_detach(thread);
+}
@@ -0,0 +1,753 @@
+#define _GNU_SOURCE     /* needed for memfd_create() */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "DS-Lab-Assignment/dbms/dbmsIndex.h"
+#include "DS-Lab-Assignment/dbms/dbmsEngine.h"
+
+
+/* in-memory engine: user tables live in a chained hash table of MEM_BUCKETS buckets, each one guarded by one
+ * of MEM_LOCK_STRIPES mutexes; user metadata (status, message IDs, presence list) is kept in the user index,
+ * as the directory engine does, and is only updated while holding the user's stripe lock; streamed message
+ * bodies are kept in memory files; nothing outlives the server, and there's no durability, message expiry
+ * or message history, so that the network layer can be measured without any disk effects */
+typedef struct mem_msg {
+    /*** Pending Message ***/
+    entry_t entry;
+    struct mem_msg *next;
+} mem_msg_t;
+
+typedef struct mem_body {
+    /*** Body Of A Streamed Pending Message ***/
+    unsigned int msg_id;
+    int fd;                     /* memory file holding the body */
+    struct mem_body *next;
+} mem_body_t;
+
+typedef struct mem_user {
+    /*** User Table ***/
+    entry_t ud;                 /* userdata entry */
+    mem_msg_t *pend_head;       /* pending messages, oldest first */
+    mem_msg_t *pend_tail;
+    mem_body_t *bodies;
+    unsigned int *acks;         /* second ACK queue; its first n_acks_batch IDs make up the ack batch */
+    size_t n_acks;
+    size_t n_acks_batch;
+    size_t acks_capacity;
+    struct mem_user *next;
+} mem_user_t;
+
+static mem_user_t **mem_buckets = NULL;
+static pthread_mutex_t mem_locks[MEM_LOCK_STRIPES];
+static void (*mem_mut_hook)(char op, const entry_t *entry) = NULL;
+
+static size_t mem_hash(const char *username);
+static mem_user_t **mem_lock_user(const char *username, pthread_mutex_t **lock);
+static mem_user_t *mem_find(mem_user_t **bucket, const char *username);
+static mem_msg_t **mem_find_msg(mem_user_t *user, unsigned int msg_id);
+static void mem_del_body(mem_user_t *user, unsigned int msg_id);
+static int mem_unlink_msg(mem_user_t *user, unsigned int msg_id, entry_t *entry);
+static void mem_free_user(mem_user_t *user);
+static int mem_push_entry(entry_t **entries, size_t *n_entries, size_t *capacity, const entry_t *entry);
+static void mem_note_mutation(char op, const entry_t *entry);
+static int mem_entry_exists(const entry_t *entry);
+static int mem_txn_written(const txn_write_t *writes, size_t n_writes, const entry_t *entry);
+
+static int mem_init_db(void);
+static int mem_recover(int keep_cn_users);
+static int mem_checkpoint(void);
+static int mem_dur_init(char policy);
+static int mem_dur_commit_wait(void);
+static void mem_dur_flush(void);
+static int mem_exp_init(int default_ttl, void (*notify)(const entry_t *msg_entry));
+static int mem_user_exists(const char *username);
+static int mem_user_connected(const char *username);
+static int mem_io_op_usr_ent(entry_t *entry, char mode);
+static int mem_next_msg_id(const char *username, unsigned int *msg_id);
+static int mem_creat_usr_tbl(entry_t *entry);
+static int mem_del_usr_tbl(const char *username);
+static int mem_txn_apply(const txn_write_t *writes, size_t n_writes);
+static int mem_get_pend_msg(entry_t *entry);
+static int mem_get_pend_msgs(const char *username, entry_t *entries, size_t max_entries, size_t *n_entries);
+static int mem_del_pend_msgs(entry_t *entries, size_t n_entries);
+static int mem_open_msg_body(const entry_t *entry, char mode);
+static int mem_close_msg_body(int body_fd, char mode);
+static int mem_del_msg_body(const entry_t *entry);
+static int mem_ack_queue_put(const char *username, unsigned int msg_id);
+static int mem_ack_queue_take(const char *username, unsigned int **msg_ids, size_t *n_msg_ids);
+static int mem_ack_queue_release(const char *username);
+static int mem_hist_init(int enabled);
+static int mem_hist_enabled(void);
+static int mem_hist_put(const entry_t *msg_entry);
+static int mem_hist_get(const char *username, const char *peer, long long since, size_t max_records,
+                        char **records, size_t *records_len, size_t *n_records);
+static void mem_repl_set_hook(void (*hook)(char op, const entry_t *entry));
+static int mem_repl_reset(void);
+static int mem_repl_apply(char op, entry_t *entry);
+static int mem_repl_snapshot(int (*emit)(char op, const entry_t *entry, void *args), void *args);
+
+const db_engine_t db_mem_engine = {
+        .name = "mem",
+        .init_db = mem_init_db,
+        .recover = mem_recover,
+        .checkpoint = mem_checkpoint,
+        .dur_init = mem_dur_init,
+        .dur_commit_wait = mem_dur_commit_wait,
+        .dur_flush = mem_dur_flush,
+        .exp_init = mem_exp_init,
+        .user_exists = mem_user_exists,
+        .user_connected = mem_user_connected,
+        .get_connected_users = idx_get_connected,
+        .io_op_usr_ent = mem_io_op_usr_ent,
+        .next_msg_id = mem_next_msg_id,
+        .creat_usr_tbl = mem_creat_usr_tbl,
+        .del_usr_tbl = mem_del_usr_tbl,
+        .txn_apply = mem_txn_apply,
+        .get_pend_msg = mem_get_pend_msg,
+        .get_pend_msgs = mem_get_pend_msgs,
+        .del_pend_msgs = mem_del_pend_msgs,
+        .open_msg_body = mem_open_msg_body,
+        .close_msg_body = mem_close_msg_body,
+        .del_msg_body = mem_del_msg_body,
+        .ack_queue_put = mem_ack_queue_put,
+        .ack_queue_take = mem_ack_queue_take,
+        .ack_queue_release = mem_ack_queue_release,
+        .hist_init = mem_hist_init,
+        .hist_enabled = mem_hist_enabled,
+        .hist_put = mem_hist_put,
+        .hist_get = mem_hist_get,
+        .repl_set_hook = mem_repl_set_hook,
+        .repl_reset = mem_repl_reset,
+        .repl_apply = mem_repl_apply,
+        .repl_snapshot = mem_repl_snapshot,
+};
+
+
+static size_t mem_hash(const char *username) {
+    /*** FNV-1a hash of a username ***/
+    size_t hash = 2166136261u;
+    while (*username) {
+        hash ^= (unsigned char) *username++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+
+static mem_user_t **mem_lock_user(const char *const username, pthread_mutex_t **lock) {
+    /*** Locks the stripe of a given username, and returns its bucket ***/
+    size_t pos = mem_hash(username) & (MEM_BUCKETS - 1);
+    *lock = &mem_locks[pos % MEM_LOCK_STRIPES];
+    pthread_mutex_lock(*lock);
+    return &mem_buckets[pos];
+}
+
+
+static mem_user_t *mem_find(mem_user_t **bucket, const char *const username) {
+    /*** Finds the table of a given username in its bucket; its stripe lock must be held ***/
+    mem_user_t *user = *bucket;
+    while (user && strcmp(user->ud.username, username) != 0) user = user->next;
+    return user;
+}
+
+
+static mem_msg_t **mem_find_msg(mem_user_t *user, const unsigned int msg_id) {
+    /*** Finds the link to a given pending message of a user; its stripe lock must be held ***/
+    mem_msg_t **link = &user->pend_head;
+    while (*link && (*link)->entry.msg.id != msg_id) link = &(*link)->next;
+    return link;
+}
+
+
+static void mem_del_body(mem_user_t *user, const unsigned int msg_id) {
+    /*** Deletes the body of a given streamed message of a user, if any; its stripe lock must be held ***/
+    mem_body_t **link = &user->bodies;
+    while (*link && (*link)->msg_id != msg_id) link = &(*link)->next;
+    if (!*link) return;
+
+    mem_body_t *body = *link;
+    *link = body->next;
+    close(body->fd);
+    free(body);
+}
+
+
+static int mem_unlink_msg(mem_user_t *user, const unsigned int msg_id, entry_t *entry) {
+    /*** Removes a given pending message of a user (with its body, if streamed), copying it to entry;
+     * returns FALSE if there's no such message; its stripe lock must be held ***/
+    mem_msg_t **link = mem_find_msg(user, msg_id);
+    if (!*link) return FALSE;
+
+    mem_msg_t *msg = *link;
+    *link = msg->next;
+    if (user->pend_tail == msg) {
+        /* the tail is now the previous message, if any */
+        user->pend_tail = user->pend_head;
+        while (user->pend_tail && user->pend_tail->next) user->pend_tail = user->pend_tail->next;
+    }
+    if (msg->entry.msg.flags & MSG_FLAG_STREAM) mem_del_body(user, msg_id);
+    *entry = msg->entry;
+    free(msg);
+    idx_add_pend_msgs(user->ud.username, -1);
+    return TRUE;
+}
+
+
+static void mem_free_user(mem_user_t *user) {
+    /*** Frees a user table that has been unlinked from its bucket ***/
+    while (user->pend_head) {
+        mem_msg_t *next = user->pend_head->next;
+        free(user->pend_head);
+        user->pend_head = next;
+    }
+    while (user->bodies) {
+        mem_body_t *next = user->bodies->next;
+        close(user->bodies->fd);
+        free(user->bodies);
+        user->bodies = next;
+    }
+    free(user->acks);
+    free(user);
+}
+
+
+static int mem_push_entry(entry_t **entries, size_t *n_entries, size_t *capacity, const entry_t *const entry) {
+    /*** Appends an entry to a growable array of entries ***/
+    if (*n_entries == *capacity) {
+        size_t new_capacity = *capacity ? *capacity * 2 : 64;
+        entry_t *new_entries = realloc(*entries, new_capacity * sizeof(entry_t));
+        CHECK_ERROR_WITH_ERRNO(!new_entries, "Could not allocate DB snapshot", DBMS_ERR_ANY)
+        *entries = new_entries;
+        *capacity = new_capacity;
+    }
+    (*entries)[(*n_entries)++] = *entry;
+    return DBMS_SUCCESS;
+}
+
+
+static void mem_note_mutation(const char op, const entry_t *const entry) {
+    /*** Passes a DB mutation that has just been done on to the mutation hook, if any ***/
+    if (mem_mut_hook) mem_mut_hook(op, entry);
+}
+
+
+static int mem_entry_exists(const entry_t *const entry) {
+    /*** Checks whether a given username entry is in the DB ***/
+    pthread_mutex_t *lock;
+    mem_user_t *user = mem_find(mem_lock_user(entry->username, &lock), entry->username);
+    int exists = user && (entry->type == ENT_TYPE_UD || *mem_find_msg(user, entry->msg.id));
+    pthread_mutex_unlock(lock);
+    return exists;
+}
+
+
+static int mem_init_db(void) {
+    /*** Initialize the DB: an empty hash table of user tables ***/
+    if (mem_buckets) return DBMS_SUCCESS;
+
+    mem_buckets = calloc(MEM_BUCKETS, sizeof(mem_user_t *));
+    CHECK_ERROR_WITH_ERRNO(!mem_buckets, "Could not allocate in-memory DB", DBMS_ERR_ANY)
+    for (int i = 0; i < MEM_LOCK_STRIPES; i++) pthread_mutex_init(&mem_locks[i], NULL);
+    return DBMS_SUCCESS;
+}
+
+
+static int mem_recover(const int keep_cn_users) {
+    /*** Nothing to recover: only sets up the user index ***/
+    (void) keep_cn_users;
+    return idx_init();
+}
+
+
+static int mem_checkpoint(void) {
+    /*** Nothing to checkpoint ***/
+    return DBMS_SUCCESS;
+}
+
+
+static int mem_dur_init(const char policy) {
+    /*** Nothing is ever written to disk, whatever the durability policy ***/
+    (void) policy;
+    return DBMS_SUCCESS;
+}
+
+
+static int mem_dur_commit_wait(void) {
+    /*** Nothing is ever written to disk, so there's nothing to wait for ***/
+    return DBMS_SUCCESS;
+}
+
+
+static void mem_dur_flush(void) {
+    /*** Nothing is ever written to disk, so there's nothing to flush ***/
+}
+
+
+static int mem_exp_init(const int default_ttl, void (*notify)(const entry_t *msg_entry)) {
+    /*** Pending messages don't expire in memory ***/
+    (void) default_ttl;
+    (void) notify;
+    return DBMS_SUCCESS;
+}
+
+
+static int mem_user_exists(const char *const username) {
+    /*** Checks whether a given username exists in the DB; the index has every user ***/
+    return idx_get(username, NULL) ? TRUE : FALSE;
+}
+
+
+static int mem_user_connected(const char *const username) {
+    /*** Checks whether a given user is connected; answered from the index ***/
+    idx_meta_t meta;
+    if (!idx_get(username, &meta)) return DBMS_ERR_NOT_EXISTS;
+    return meta.status == STATUS_CN;
+}
+
+
+static int mem_io_op_usr_ent(entry_t *entry, const char mode) {
+    /*** Reads, writes or deletes a DB username entry;
+     * entry type must be specified in given entry->type;
+     * it can read, modify or delete an existing entry, or create a new one ***/
+    CHECK_ARGS(entry->type != ENT_TYPE_UD && entry->type != ENT_TYPE_P_MSG, "Invalid Entry Type")
+    CHECK_ARGS(mode != CREATE && mode != MODIFY && mode != READ && mode != DELETE, "Invalid File Mode")
+    CHECK_ARGS(entry->type == ENT_TYPE_UD && mode == DELETE, "Invalid File Mode")
+
+    pthread_mutex_t *lock;
+    mem_user_t *user = mem_find(mem_lock_user(entry->username, &lock), entry->username);
+    if (!user) {
+        pthread_mutex_unlock(lock);
+        return DBMS_ERR_NOT_EXISTS;
+    }
+
+    int result = DBMS_SUCCESS;
+    if (entry->type == ENT_TYPE_UD) {
+        if (mode == READ) *entry = user->ud;
+        else {
+            user->ud = *entry;
+            idx_set_userdata(entry->username, entry->user.status, entry->user.last_msg_id);
+        }
+    } else if (mode == DELETE) {
+        if (!mem_unlink_msg(user, entry->msg.id, entry)) result = DBMS_ERR_NOT_EXISTS;
+    } else {
+        mem_msg_t **link = mem_find_msg(user, entry->msg.id);
+        if (mode == READ) {
+            if (*link) *entry = (*link)->entry;
+            else result = DBMS_ERR_NOT_EXISTS;
+        } else if (mode == MODIFY) {
+            if (*link) (*link)->entry = *entry;
+            else result = DBMS_ERR_NOT_EXISTS;
+        } else if (*link) result = DBMS_ERR_ANY;    /* CREATE of an existing message */
+        else {
+            mem_msg_t *msg = malloc(sizeof(mem_msg_t));
+            if (msg) {
+                msg->entry = *entry;
+                msg->next = NULL;
+                if (user->pend_tail) user->pend_tail->next = msg;
+                else user->pend_head = msg;
+                user->pend_tail = msg;
+                idx_add_pend_msgs(entry->username, 1);
+            } else result = DBMS_ERR_ANY;
+        }
+    }
+    pthread_mutex_unlock(lock);
+
+    if (mode != READ && result == DBMS_SUCCESS) mem_note_mutation((mode == DELETE) ? DB_MUT_DEL : DB_MUT_PUT, entry);
+    return result;
+}
+
+
+static int mem_next_msg_id(const char *const username, unsigned int *msg_id) {
+    /*** Gives the next message ID of a given user from its counter in the index;
+     * there's no high-water mark on disk, so a new block of IDs is reserved as soon as one is used up ***/
+    pthread_mutex_t *lock;
+    mem_user_t *user = mem_find(mem_lock_user(username, &lock), username);
+    int result = user ? idx_next_msg_id(username, msg_id) : DBMS_ERR_NOT_EXISTS;
+
+    if (result == FALSE) {
+        idx_meta_t meta;
+        result = idx_get(username, &meta) ? DBMS_SUCCESS : DBMS_ERR_ANY;
+        if (result == DBMS_SUCCESS) {
+            user->ud.user.last_msg_id = (unsigned int) (((unsigned long long) meta.reserved_msg_id + MSG_ID_BLOCK)
+                                                        % MSG_ID_MAX_VALUE);
+            idx_reserve_msg_ids(username, user->ud.user.last_msg_id);
+            result = idx_next_msg_id(username, msg_id);
+        }
+    }
+    pthread_mutex_unlock(lock);
+
+    if (result == DBMS_ERR_NOT_EXISTS) return result;
+    return (result == TRUE) ? DBMS_SUCCESS : DBMS_ERR_ANY;
+}
+
+
+static int mem_creat_usr_tbl(entry_t *entry) {
+    /*** Creates a table for the given username ***/
+    mem_user_t *user = calloc(1, sizeof(mem_user_t));
+    CHECK_ERROR_WITH_ERRNO(!user, "Could not allocate user table", DBMS_ERR_ANY)
+    user->ud = *entry;
+
+    pthread_mutex_t *lock;
+    mem_user_t **bucket = mem_lock_user(entry->username, &lock);
+    if (mem_find(bucket, entry->username)) {
+        pthread_mutex_unlock(lock);
+        free(user);
+        return DBMS_ERR_EXISTS;
+    }
+    user->next = *bucket;
+    *bucket = user;
+
+    /* add the new user to the index */
+    idx_meta_t meta = {entry->user.status, entry->user.last_msg_id, 0, entry->user.last_msg_id};
+    int result = idx_put(entry->username, &meta, FALSE);
+    pthread_mutex_unlock(lock);
+
+    if (result == DBMS_SUCCESS) mem_note_mutation(DB_MUT_PUT, entry);
+    return result;
+}
+
+
+static int mem_del_usr_tbl(const char *const username) {
+    /*** Deletes a given username table if it exists ***/
+    pthread_mutex_t *lock;
+    mem_user_t **link = mem_lock_user(username, &lock);
+    while (*link && strcmp((*link)->ud.username, username) != 0) link = &(*link)->next;
+
+    mem_user_t *user = *link;
+    if (user) {
+        *link = user->next;
+        idx_del(username);
+    }
+    pthread_mutex_unlock(lock);
+    if (!user) return DBMS_ERR_NOT_EXISTS;
+
+    mem_note_mutation(DB_MUT_RMTBL, &user->ud);
+    mem_free_user(user);
+    return DBMS_SUCCESS;
+}
+
+
+static int mem_txn_written(const txn_write_t *const writes, const size_t n_writes, const entry_t *const entry) {
+    /*** Checks whether any of the given transaction writes is to a given entry, or drops its user table ***/
+    for (size_t i = 0; i < n_writes; i++) {
+        const entry_t *written = &writes[i].entry;
+        if (strcmp(written->username, entry->username) != 0) continue;
+        if (writes[i].op == DB_MUT_RMTBL) return TRUE;
+        if (written->type == entry->type && (entry->type == ENT_TYPE_UD || written->msg.id == entry->msg.id))
+            return TRUE;
+    }
+    return FALSE;
+}
+
+
+static int mem_txn_apply(const txn_write_t *const writes, const size_t n_writes) {
+    /*** Applies the writes of a transaction: nothing outlives the server, so there's nothing to log,
+     * but they're all checked before any is applied, so that all of them are applied or none is;
+     * the users of the transaction are locked, so that no other transaction gets in between ***/
+    for (size_t i = 0; i < n_writes; i++) {
+        /* an entry written before in the same transaction is left as that write leaves it */
+        if (mem_txn_written(writes, i, &writes[i].entry)) continue;
+
+        if (mem_user_exists(writes[i].entry.username) == FALSE) return DBMS_ERR_NOT_EXISTS;
+        if (writes[i].op == DB_MUT_RMTBL) continue;
+        int exists = mem_entry_exists(&writes[i].entry);
+        if (writes[i].op == DB_MUT_PUT && writes[i].mode == CREATE && exists) return DBMS_ERR_EXISTS;
+        if ((writes[i].op == DB_MUT_DEL || writes[i].mode == MODIFY) && !exists) return DBMS_ERR_NOT_EXISTS;
+    }
+
+    int result = DBMS_SUCCESS;
+    for (size_t i = 0; i < n_writes; i++) {
+        entry_t entry = writes[i].entry;
+        int write_result;
+        if (writes[i].op == DB_MUT_RMTBL) write_result = mem_del_usr_tbl(entry.username);
+        else write_result = mem_io_op_usr_ent(&entry, (writes[i].op == DB_MUT_DEL) ? DELETE : writes[i].mode);
+        if (write_result < 0) result = write_result;
+    }
+    return result;
+}
+
+
+static int mem_get_pend_msg(entry_t *entry) {
+    /*** Reads a pending message of a given user entry ***/
+    CHECK_ARGS(entry->type != ENT_TYPE_P_MSG, "Invalid Entry Type")
+
+    char username[strlen(entry->username) + 1];
+    strcpy(username, entry->username);
+    size_t n_entries;
+    return mem_get_pend_msgs(username, entry, 1, &n_entries);
+}
+
+
+static int mem_get_pend_msgs(const char *const username, entry_t *entries, const size_t max_entries,
+                             size_t *n_entries) {
+    /*** Reads up to max_entries pending messages of a given user, oldest first ***/
+    *n_entries = 0;
+    pthread_mutex_t *lock;
+    mem_user_t *user = mem_find(mem_lock_user(username, &lock), username);
+    for (mem_msg_t *msg = user ? user->pend_head : NULL; msg && *n_entries < max_entries; msg = msg->next)
+        entries[(*n_entries)++] = msg->entry;
+    pthread_mutex_unlock(lock);
+
+    return (*n_entries) ? DBMS_SUCCESS : DBMS_ERR_NOT_EXISTS;
+}
+
+
+static int mem_del_pend_msgs(entry_t *entries, const size_t n_entries) {
+    /*** Deletes a batch of pending messages (with their bodies, if streamed) under a single lock;
+     * they must all belong to the same user ***/
+    if (!n_entries) return DBMS_SUCCESS;
+
+    pthread_mutex_t *lock;
+    mem_user_t *user = mem_find(mem_lock_user(entries[0].username, &lock), entries[0].username);
+    int deleted[n_entries];
+    for (size_t i = 0; i < n_entries; i++) deleted[i] = user && mem_unlink_msg(user, entries[i].msg.id, &entries[i]);
+    pthread_mutex_unlock(lock);
+
+    int result = DBMS_SUCCESS;
+    for (size_t i = 0; i < n_entries; i++) {
+        if (deleted[i]) mem_note_mutation(DB_MUT_DEL, &entries[i]);
+        else result = DBMS_ERR_NOT_EXISTS;
+    }
+    return result;
+}
+
+
+static int mem_open_msg_body(const entry_t *const entry, const char mode) {
+    /*** Opens the body of a streamed pending message to read it (READ), from its start,
+     * or to spool it as it arrives (CREATE), in a new memory file; returns the open fd ***/
+    CHECK_ARGS(entry->type != ENT_TYPE_P_MSG, "Invalid Entry Type")
+    CHECK_ARGS(mode != READ && mode != CREATE, "Invalid File Mode")
+
+    mem_body_t *new_body = NULL;
+    int body_fd = -1;
+    if (mode == CREATE) {
+        new_body = malloc(sizeof(mem_body_t));
+        CHECK_ERROR_WITH_ERRNO(!new_body, "Could not allocate message body", DBMS_ERR_ANY)
+        body_fd = memfd_create("msg_body", 0);
+        /* the table keeps its own fd, and the caller gets another one to write the body through */
+        new_body->fd = (body_fd < 0) ? -1 : dup(body_fd);
+        if (new_body->fd < 0) {
+            perror("Could not create message body");
+            if (body_fd >= 0) close(body_fd);
+            free(new_body);
+            return DBMS_ERR_ANY;
+        }
+        new_body->msg_id = entry->msg.id;
+    }
+
+    pthread_mutex_t *lock;
+    mem_user_t *user = mem_find(mem_lock_user(entry->username, &lock), entry->username);
+    if (!user) errno = ENOENT;
+    else if (mode == CREATE) {
+        /* a body left behind by an interrupted stream with the same ID is replaced */
+        mem_del_body(user, entry->msg.id);
+        new_body->next = user->bodies;
+        user->bodies = new_body;
+    } else {
+        mem_body_t *body = user->bodies;
+        while (body && body->msg_id != entry->msg.id) body = body->next;
+        if (body) {
+            /* reopened, so that every reader gets its own file offset */
+            char fd_path[32];
+            sprintf(fd_path, "/proc/self/fd/%d", body->fd);
+            body_fd = open(fd_path, O_RDONLY);
+        } else errno = ENOENT;
+    }
+    int error_num = errno;
+    pthread_mutex_unlock(lock);
+
+    if (!user && mode == CREATE) {
+        close(new_body->fd);
+        close(body_fd);
+        free(new_body);
+        body_fd = -1;
+    }
+    errno = error_num;
+    CHECK_ERROR_WITH_ERRNO(body_fd < 0, "Could not open message body", DBMS_ERR_ANY)
+    return body_fd;
+}
+
+
+static int mem_close_msg_body(const int body_fd, const char mode) {
+    /*** Closes a message body opened with mem_open_msg_body ***/
+    (void) mode;
+    CHECK_ERROR_WITH_ERRNO(close(body_fd) < 0, "Could not close message body", DBMS_ERR_ANY)
+    return DBMS_SUCCESS;
+}
+
+
+static int mem_del_msg_body(const entry_t *const entry) {
+    /*** Deletes the body of a streamed pending message ***/
+    CHECK_ARGS(entry->type != ENT_TYPE_P_MSG, "Invalid Entry Type")
+
+    pthread_mutex_t *lock;
+    mem_user_t *user = mem_find(mem_lock_user(entry->username, &lock), entry->username);
+    if (user) mem_del_body(user, entry->msg.id);
+    pthread_mutex_unlock(lock);
+    return DBMS_SUCCESS;
+}
+
+
+static int mem_ack_queue_put(const char *const username, const unsigned int msg_id) {
+    /*** Appends the second ACK of a message to the ack queue of its sender ***/
+    pthread_mutex_t *lock;
+    mem_user_t *user = mem_find(mem_lock_user(username, &lock), username);
+    int result = user ? DBMS_SUCCESS : DBMS_ERR_NOT_EXISTS;
+
+    if (user && user->n_acks == user->acks_capacity) {
+        size_t new_capacity = user->acks_capacity ? user->acks_capacity * 2 : 16;
+        unsigned int *new_acks = realloc(user->acks, new_capacity * sizeof(unsigned int));
+        if (new_acks) {
+            user->acks = new_acks;
+            user->acks_capacity = new_capacity;
+        } else result = DBMS_ERR_ANY;
+    }
+    if (result == DBMS_SUCCESS) user->acks[user->n_acks++] = msg_id;
+    pthread_mutex_unlock(lock);
+    return result;
+}
+
+
+static int mem_ack_queue_take(const char *const username, unsigned int **msg_ids, size_t *n_msg_ids) {
+    /*** Moves the ack queue of a user to its ack batch, and reads the whole batch;
+     * the batch stays in the DB until mem_ack_queue_release is called; *msg_ids must be freed by the caller ***/
+    *msg_ids = NULL;
+    *n_msg_ids = 0;
+    pthread_mutex_t *lock;
+    mem_user_t *user = mem_find(mem_lock_user(username, &lock), username);
+    int result = (user && user->n_acks) ? DBMS_SUCCESS : DBMS_ERR_NOT_EXISTS;
+
+    if (result == DBMS_SUCCESS) {
+        *msg_ids = malloc(user->n_acks * sizeof(unsigned int));
+        if (*msg_ids) {
+            memcpy(*msg_ids, user->acks, user->n_acks * sizeof(unsigned int));
+            *n_msg_ids = user->n_acks_batch = user->n_acks;
+        } else result = DBMS_ERR_ANY;
+    }
+    pthread_mutex_unlock(lock);
+    return result;
+}
+
+
+static int mem_ack_queue_release(const char *const username) {
+    /*** Removes the ack batch of a user, once it has been sent ***/
+    pthread_mutex_t *lock;
+    mem_user_t *user = mem_find(mem_lock_user(username, &lock), username);
+    if (user) {
+        user->n_acks -= user->n_acks_batch;
+        memmove(user->acks, user->acks + user->n_acks_batch, user->n_acks * sizeof(unsigned int));
+        user->n_acks_batch = 0;
+    }
+    pthread_mutex_unlock(lock);
+    return DBMS_SUCCESS;
+}
+
+
+static int mem_hist_init(const int enabled) {
+    /*** There's no message history in memory ***/
+    CHECK_ERROR(enabled, "Message history is not available in the in-memory engine", DBMS_ERR_ANY)
+    return DBMS_SUCCESS;
+}
+
+
+static int mem_hist_enabled(void) {
+    /*** There's no message history in memory ***/
+    return FALSE;
+}
+
+
+static int mem_hist_put(const entry_t *const msg_entry) {
+    /*** There's no message history in memory: delivered messages are just dropped ***/
+    (void) msg_entry;
+    return DBMS_SUCCESS;
+}
+
+
+static int mem_hist_get(const char *const username, const char *const peer, const long long since,
+                        const size_t max_records, char **records, size_t *records_len, size_t *n_records) {
+    /*** There's no message history in memory ***/
+    (void) username; (void) peer; (void) since; (void) max_records;
+    (void) records; (void) records_len; (void) n_records;
+    return DBMS_ERR_ANY;
+}
+
+
+static void mem_repl_set_hook(void (*hook)(char op, const entry_t *entry)) {
+    /*** Sets the function called with every DB mutation, after it has been done ***/
+    mem_mut_hook = hook;
+}
+
+
+static int mem_repl_reset(void) {
+    /*** Deletes every user table and empties the index ***/
+    for (size_t pos = 0; pos < MEM_BUCKETS; pos++) {
+        pthread_mutex_t *lock = &mem_locks[pos % MEM_LOCK_STRIPES];
+        pthread_mutex_lock(lock);
+        mem_user_t *user = mem_buckets[pos];
+        mem_buckets[pos] = NULL;
+        pthread_mutex_unlock(lock);
+
+        while (user) {
+            mem_user_t *next = user->next;
+            mem_free_user(user);
+            user = next;
+        }
+    }
+
+    idx_clear();
+    return DBMS_SUCCESS;
+}
+
+
+static int mem_repl_apply(const char op, entry_t *entry) {
+    /*** Applies a DB mutation received from the primary: entries are written whole,
+     * so applying a mutation more than once leaves the DB as applying it once ***/
+    switch (op) {
+        case DB_MUT_PUT:
+            if (entry->type == ENT_TYPE_UD && mem_user_exists(entry->username) == FALSE)
+                return mem_creat_usr_tbl(entry);
+            return mem_io_op_usr_ent(entry, mem_entry_exists(entry) ? MODIFY : CREATE);
+        case DB_MUT_DEL:
+            if (!mem_entry_exists(entry)) return DBMS_SUCCESS;
+            return mem_io_op_usr_ent(entry, DELETE);
+        case DB_MUT_RMTBL:
+            if (mem_user_exists(entry->username) == FALSE) return DBMS_SUCCESS;
+            return mem_del_usr_tbl(entry->username);
+        default:
+            fprintf(stderr, "Invalid DB mutation\n");
+            return DBMS_ERR_ANY;
+    }
+}
+
+
+static int mem_repl_snapshot(int (*emit)(char op, const entry_t *entry, void *args), void *args) {
+    /*** Walks the whole DB, calling emit with a DB_MUT_PUT mutation for every entry in it;
+     * each bucket is copied under its lock, and emitted once the lock has been released ***/
+    entry_t *entries = NULL;
+    size_t capacity = 0;
+    int result = DBMS_SUCCESS;
+
+    for (size_t pos = 0; pos < MEM_BUCKETS && result == DBMS_SUCCESS; pos++) {
+        pthread_mutex_t *lock = &mem_locks[pos % MEM_LOCK_STRIPES];
+        size_t n_entries = 0;
+        pthread_mutex_lock(lock);
+        for (mem_user_t *user = mem_buckets[pos]; user && result == DBMS_SUCCESS; user = user->next) {
+            /* the userdata entry goes first, then the pending messages */
+            result = mem_push_entry(&entries, &n_entries, &capacity, &user->ud);
+            for (mem_msg_t *msg = user->pend_head; msg && result == DBMS_SUCCESS; msg = msg->next)
+                result = mem_push_entry(&entries, &n_entries, &capacity, &msg->entry);
+        }
+        pthread_mutex_unlock(lock);
+
+        for (size_t i = 0; i < n_entries && result == DBMS_SUCCESS; i++)
+            if (emit(DB_MUT_PUT, &entries[i], args) < 0) result = DBMS_ERR_ANY;
+    }
+
+    free(entries);
+    return result;
+}
@@ -0,0 +1,473 @@
+#define _GNU_SOURCE     /* needed for PTHREAD_RWLOCK_WRITER_NONRECURSIVE_INITIALIZER_NP */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include "DS-Lab-Assignment/dbms/dbmsUtil.h"
+#include "DS-Lab-Assignment/dbms/dbmsIndex.h"
+#include "DS-Lab-Assignment/dbms/dbmsTxn.h"
+#include "DS-Lab-Assignment/dbms/dbms.h"
+
+
+#define CHECKPOINT_MAGIC "DSCKPT01"     /* marks both ends of a complete checkpoint file */
+#define CHECKPOINT_MAGIC_LEN 8
+#define RECOVERY_SCAN_THREADS 8         /* threads used to scan the DB when there's no usable checkpoint */
+
+/* journal: names of the users modified since the last checkpoint, appended before each modification */
+static int journal_fd = -1;
+static size_t journal_len = 0;      /* bytes appended since the last checkpoint */
+
+/* read-held from journaling a user until its table and index entry have been modified, write-held while taking
+ * a checkpoint, so that it never misses a modification whose user is dropped from the journal; writers are
+ * preferred, so that checkpoints aren't put off forever under load, and holds nest within a thread instead */
+static pthread_rwlock_t rwlock_ckpt = PTHREAD_RWLOCK_WRITER_NONRECURSIVE_INITIALIZER_NP;
+static _Thread_local int ckpt_holds = 0;
+static pthread_mutex_t mutex_ckpt = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond_ckpt_due = PTHREAD_COND_INITIALIZER;    /* journal grown past CKPT_JOURNAL_MAX_SIZE */
+
+typedef struct {
+    /*** Slice of user names loaded by a scan thread ***/
+    char **usernames;
+    size_t from;
+    size_t to;
+    int result;
+} scan_job_t;
+
+typedef struct {
+    /*** Growable list of user names ***/
+    char **usernames;
+    size_t n_users;
+    size_t capacity;
+} user_list_t;
+
+static int count_pend_msgs(int table_fd, unsigned int *pend_msgs);
+static int load_checkpoint(void);
+static int replay_journal(void);
+static int collect_user(const char *username, void *args);
+static int scan_db(void);
+static void *scan_thread(void *args);
+static int collect_cn_user(const char *username, const idx_meta_t *meta, void *args);
+static int reset_cn_users(void);
+static int write_checkpoint_user(const char *username, const idx_meta_t *meta, void *args);
+static void *ckpt_thread(void *args);
+
+
+static int count_pend_msgs(const int table_fd, unsigned int *pend_msgs) {
+    /*** Counts the entries of the pending messages table in a given open user table ***/
+    DIR *pend_msg_table;
+    int result = open_directory_at(table_fd, PEND_MSGS_TABLE, READ, &pend_msg_table);
+    if (result != DBMS_SUCCESS) return result;
+
+    struct dirent *pend_msgs_entry;
+    *pend_msgs = 0;
+    while ((pend_msgs_entry = readdir(pend_msg_table)) != NULL)
+        if (strcmp(pend_msgs_entry->d_name, ".") != 0 && strcmp(pend_msgs_entry->d_name, "..") != 0)
+            (*pend_msgs)++;
+
+    closedir(pend_msg_table);
+    return DBMS_SUCCESS;
+}
+
+
+int load_user_meta(const char *const username) {
+    /*** (Re)loads the index metadata of a given user from its table on disk;
+     * removes the user from the index if its table doesn't exist anymore ***/
+    /* the table is opened once, wherever the layout puts it, and its entries are reached from it */
+    int table_fd = table_open(username);
+    int entry_fd = (table_fd < 0) ? -1 : open_file_at(table_fd, USERDATA_ENTRY, READ);
+    if (entry_fd < 0) {
+        int error_num = errno;
+        if (table_fd >= 0) close(table_fd);
+        if (error_num != ENOENT) return DBMS_ERR_ANY;
+        idx_del(username);
+        return DBMS_ERR_NOT_EXISTS;
+    }
+
+    entry_t entry;
+    int result = read_entry(entry_fd, &entry);
+    if (result == DBMS_SUCCESS) close(entry_fd);    /* read_entry closes the entry fd on error */
+    if (result < 0) {
+        close(table_fd);
+        return result;
+    }
+
+    /* IDs up to the high-water mark on disk may have been given before a crash: skip them */
+    idx_meta_t meta = {entry.user.status, entry.user.last_msg_id, 0, entry.user.last_msg_id};
+    result = count_pend_msgs(table_fd, &meta.pend_msgs);
+    close(table_fd);
+    if (result < 0) return DBMS_ERR_ANY;
+
+    return idx_put(username, &meta, FALSE);
+}
+
+
+void journal_user(const char *const username) {
+    /*** Appends a user to the journal, unless it's been journaled since the last checkpoint;
+     * must be called before modifying the user's table, so that recovery reloads it from disk ***/
+    if (journal_fd < 0 || idx_test_and_set_dirty(username)) return;
+
+    /* record: name length followed by the name, written with a single write() */
+    uint16_t name_len = (uint16_t) strlen(username);
+    char record[sizeof(uint16_t) + MAX_STR_SIZE];
+    memcpy(record, &name_len, sizeof(uint16_t));
+    memcpy(record + sizeof(uint16_t), username, name_len);
+
+    size_t record_len = sizeof(uint16_t) + name_len;
+    if (write_bytes(journal_fd, record, (int) record_len) < 0) {
+        perror("Error writing journal record");
+        return;
+    }
+
+    /* wake the checkpoint thread up once the journal gets too long */
+    size_t len = __atomic_add_fetch(&journal_len, record_len, __ATOMIC_RELAXED);
+    if (len >= CKPT_JOURNAL_MAX_SIZE && len - record_len < CKPT_JOURNAL_MAX_SIZE) {
+        pthread_mutex_lock(&mutex_ckpt);
+        pthread_cond_signal(&cond_ckpt_due);
+        pthread_mutex_unlock(&mutex_ckpt);
+    }
+}
+
+
+void ckpt_hold(void) {
+    /*** Keeps checkpoints from being taken until ckpt_release; must be called before journaling
+     * a user and modifying its table, and before taking any lock the modification needs ***/
+    if (ckpt_holds++ == 0) pthread_rwlock_rdlock(&rwlock_ckpt);
+}
+
+
+void ckpt_release(void) {
+    /*** Lets checkpoints be taken again ***/
+    if (--ckpt_holds == 0) pthread_rwlock_unlock(&rwlock_ckpt);
+}
+
+
+static int load_checkpoint(void) {
+    /*** Loads the users' metadata stored in the last checkpoint into the index ***/
+    char checkpoint_path[strlen(DB_DIR) + strlen(CHECKPOINT_ENTRY) + 2];
+    sprintf(checkpoint_path, "%s/%s", DB_DIR, CHECKPOINT_ENTRY);
+
+    FILE *checkpoint = fopen(checkpoint_path, "rb");
+    if (!checkpoint) return DBMS_ERR_NOT_EXISTS;
+
+    char magic[CHECKPOINT_MAGIC_LEN];
+    uint64_t n_users;
+    int result = DBMS_SUCCESS;
+
+    if (fread(magic, CHECKPOINT_MAGIC_LEN, 1, checkpoint) != 1 ||
+        memcmp(magic, CHECKPOINT_MAGIC, CHECKPOINT_MAGIC_LEN) != 0 ||
+        fread(&n_users, sizeof(uint64_t), 1, checkpoint) != 1)
+        result = DBMS_ERR_ANY;
+
+    /* user records */
+    for (uint64_t i = 0; i < n_users && result == DBMS_SUCCESS; i++) {
+        uint16_t name_len;
+        idx_meta_t meta;
+        char username[MAX_STR_SIZE];
+
+        if (fread(&name_len, sizeof(uint16_t), 1, checkpoint) != 1 || name_len >= MAX_STR_SIZE ||
+            fread(&meta.status, sizeof(meta.status), 1, checkpoint) != 1 ||
+            fread(&meta.last_msg_id, sizeof(meta.last_msg_id), 1, checkpoint) != 1 ||
+            fread(&meta.pend_msgs, sizeof(meta.pend_msgs), 1, checkpoint) != 1 ||
+            fread(username, name_len, 1, checkpoint) != 1) {
+            result = DBMS_ERR_ANY;
+            break;
+        }
+        username[name_len] = '\0';
+        meta.reserved_msg_id = meta.last_msg_id;
+        result = idx_put(username, &meta, FALSE);
+    }
+
+    /* a checkpoint is only valid if it's complete */
+    if (result == DBMS_SUCCESS && (fread(magic, CHECKPOINT_MAGIC_LEN, 1, checkpoint) != 1 ||
+        memcmp(magic, CHECKPOINT_MAGIC, CHECKPOINT_MAGIC_LEN) != 0))
+        result = DBMS_ERR_ANY;
+
+    fclose(checkpoint);
+    if (result < 0) fprintf(stderr, "Discarding invalid checkpoint %s\n", checkpoint_path);
+    return result;
+}
+
+
+static int replay_journal(void) {
+    /*** Reloads from disk every user journaled since the last checkpoint ***/
+    char journal_path[strlen(DB_DIR) + strlen(JOURNAL_ENTRY) + 2];
+    sprintf(journal_path, "%s/%s", DB_DIR, JOURNAL_ENTRY);
+
+    FILE *journal = fopen(journal_path, "rb");
+    if (!journal) return (errno == ENOENT) ? DBMS_SUCCESS : DBMS_ERR_ANY;
+
+    uint16_t name_len;
+    char username[MAX_STR_SIZE];
+    int result = DBMS_SUCCESS;
+
+    /* a torn record at the end of the journal just ends the replay */
+    while (fread(&name_len, sizeof(uint16_t), 1, journal) == 1 && name_len < MAX_STR_SIZE &&
+           fread(username, name_len, 1, journal) == 1) {
+        username[name_len] = '\0';
+        if (load_user_meta(username) == DBMS_ERR_ANY) {
+            result = DBMS_ERR_ANY;
+            break;
+        }
+    }
+
+    fclose(journal);
+    return result;
+}
+
+
+static void *scan_thread(void *args) {
+    /*** Loads a slice of users from disk into the index ***/
+    scan_job_t *job = (scan_job_t *) args;
+    job->result = DBMS_SUCCESS;
+
+    for (size_t i = job->from; i < job->to; i++)
+        if (load_user_meta(job->usernames[i]) == DBMS_ERR_ANY) job->result = DBMS_ERR_ANY;
+
+    return NULL;
+}
+
+
+static int collect_user(const char *const username, void *args) {
+    /*** Adds a user to the user list in args ***/
+    user_list_t *users = (user_list_t *) args;
+    if (users->n_users == users->capacity) {
+        char **grown = realloc(users->usernames, (users->capacity *= 2) * sizeof(char *));
+        if (!grown) return DBMS_ERR_ANY;
+        users->usernames = grown;
+    }
+    users->usernames[users->n_users] = strdup(username);
+    if (!users->usernames[users->n_users]) return DBMS_ERR_ANY;
+    users->n_users++;
+    return DBMS_SUCCESS;
+}
+
+
+static int scan_db(void) {
+    /*** Rebuilds the index by walking every user table in the DB, using RECOVERY_SCAN_THREADS threads ***/
+    /* collect user names from table directory names, wherever the layout puts them */
+    user_list_t users = {malloc(1024 * sizeof(char *)), 0, 1024};
+    CHECK_ERROR_WITH_ERRNO(!users.usernames, "Could not allocate user list", DBMS_ERR_ANY)
+    if (table_for_each(collect_user, &users) < 0) {
+        perror("Could not collect user tables");
+        for (size_t i = 0; i < users.n_users; i++) free(users.usernames[i]);
+        free(users.usernames);
+        return DBMS_ERR_ANY;
+    }
+    char **usernames = users.usernames;
+    size_t n_users = users.n_users;
+
+    /* split users among scan threads */
+    pthread_t threads[RECOVERY_SCAN_THREADS];
+    scan_job_t jobs[RECOVERY_SCAN_THREADS];
+    size_t slice = (n_users + RECOVERY_SCAN_THREADS - 1) / RECOVERY_SCAN_THREADS;
+    int n_threads = 0, result = DBMS_SUCCESS;
+
+    for (int i = 0; i < RECOVERY_SCAN_THREADS && (size_t) i * slice < n_users; i++) {
+        jobs[i].usernames = usernames;
+        jobs[i].from = i * slice;
+        jobs[i].to = (jobs[i].from + slice < n_users) ? jobs[i].from + slice : n_users;
+        if (pthread_create(&threads[i], NULL, scan_thread, &jobs[i]) != 0) {
+            scan_thread(&jobs[i]);      /* load this slice in the calling thread */
+            threads[i] = pthread_self();
+        }
+        n_threads++;
+    }
+
+    for (int i = 0; i < n_threads; i++) {
+        if (!pthread_equal(threads[i], pthread_self())) pthread_join(threads[i], NULL);
+        if (jobs[i].result < 0) result = jobs[i].result;
+    }
+
+    for (size_t i = 0; i < n_users; i++) free(usernames[i]);
+    free(usernames);
+    return result;
+}
+
+
+static int collect_cn_user(const char *const username, const idx_meta_t *meta, void *args) {
+    /*** Adds a user to the user list in args if it's marked as connected ***/
+    user_list_t *cn_users = (user_list_t *) args;
+    if (meta->status != STATUS_CN) return DBMS_SUCCESS;
+
+    if (cn_users->n_users == cn_users->capacity) {
+        size_t capacity = cn_users->capacity ? cn_users->capacity * 2 : 64;
+        char **grown = realloc(cn_users->usernames, capacity * sizeof(char *));
+        if (!grown) return DBMS_ERR_ANY;
+        cn_users->usernames = grown;
+        cn_users->capacity = capacity;
+    }
+
+    cn_users->usernames[cn_users->n_users] = strdup(username);
+    if (!cn_users->usernames[cn_users->n_users]) return DBMS_ERR_ANY;
+    cn_users->n_users++;
+    return DBMS_SUCCESS;
+}
+
+
+static int reset_cn_users(void) {
+    /*** Marks as disconnected every user left connected by the previous server run:
+     * their listening threads were bound to the old server session ***/
+    user_list_t cn_users = {NULL, 0, 0};
+    int result = idx_for_each(collect_cn_user, &cn_users);
+
+    for (size_t i = 0; i < cn_users.n_users; i++) {
+        entry_t entry;
+        entry.type = ENT_TYPE_UD;
+        strcpy(entry.username, cn_users.usernames[i]);
+
+        if (result >= 0 && db_io_op_usr_ent(&entry, READ) == DBMS_SUCCESS) {
+            entry.user.status = STATUS_DCN;
+            bzero(&entry.user.ip, sizeof(struct in_addr));
+            bzero(&entry.user.port, sizeof(uint16_t));
+            bzero(entry.user.sock_path, UNIX_PATH_MAX_SIZE);
+            if (db_io_op_usr_ent(&entry, MODIFY) < 0) result = DBMS_ERR_ANY;
+        }
+        free(cn_users.usernames[i]);
+    }
+
+    free(cn_users.usernames);
+    return result;
+}
+
+
+static int write_checkpoint_user(const char *const username, const idx_meta_t *meta, void *args) {
+    /*** Writes a user record to the checkpoint file given in args ***/
+    FILE *checkpoint = (FILE *) args;
+    uint16_t name_len = (uint16_t) strlen(username);
+
+    if (fwrite(&name_len, sizeof(uint16_t), 1, checkpoint) != 1 ||
+        fwrite(&meta->status, sizeof(meta->status), 1, checkpoint) != 1 ||
+        fwrite(&meta->reserved_msg_id, sizeof(meta->reserved_msg_id), 1, checkpoint) != 1 ||
+        fwrite(&meta->pend_msgs, sizeof(meta->pend_msgs), 1, checkpoint) != 1 ||
+        fwrite(username, name_len, 1, checkpoint) != 1)
+        return DBMS_ERR_ANY;
+
+    return DBMS_SUCCESS;
+}
+
+
+int db_checkpoint(void) {
+    /*** Writes the index to a new checkpoint, atomically replacing the previous one,
+     * and then truncates the journal; DB modifications are held off meanwhile ***/
+    char checkpoint_path[strlen(DB_DIR) + strlen(CHECKPOINT_ENTRY) + 2];
+    sprintf(checkpoint_path, "%s/%s", DB_DIR, CHECKPOINT_ENTRY);
+    char tmp_path[sizeof checkpoint_path + 4];
+    sprintf(tmp_path, "%s.tmp", checkpoint_path);
+
+    pthread_rwlock_wrlock(&rwlock_ckpt);
+    FILE *checkpoint = fopen(tmp_path, "wb");
+    if (!checkpoint) {
+        pthread_rwlock_unlock(&rwlock_ckpt);
+        CHECK_ERROR_WITH_ERRNO(TRUE, "Could not create checkpoint", DBMS_ERR_ANY)
+    }
+
+    uint64_t n_users = idx_size();
+    int result = DBMS_SUCCESS;
+    if (fwrite(CHECKPOINT_MAGIC, CHECKPOINT_MAGIC_LEN, 1, checkpoint) != 1 ||
+        fwrite(&n_users, sizeof(uint64_t), 1, checkpoint) != 1 ||
+        idx_for_each(write_checkpoint_user, checkpoint) < 0 ||
+        fwrite(CHECKPOINT_MAGIC, CHECKPOINT_MAGIC_LEN, 1, checkpoint) != 1 ||
+        fflush(checkpoint) != 0 || fsync(fileno(checkpoint)) < 0)
+        result = DBMS_ERR_ANY;
+
+    if (fclose(checkpoint) != 0) result = DBMS_ERR_ANY;
+    if (result < 0 || rename(tmp_path, checkpoint_path) < 0) {
+        perror("Error writing checkpoint");
+        unlink(tmp_path);
+        pthread_rwlock_unlock(&rwlock_ckpt);
+        return DBMS_ERR_ANY;
+    }
+
+    /* the checkpoint covers every journaled user now */
+    if (journal_fd >= 0 && ftruncate(journal_fd, 0) < 0) perror("Error truncating journal");
+    __atomic_store_n(&journal_len, 0, __ATOMIC_RELAXED);
+    idx_clear_dirty();
+    pthread_rwlock_unlock(&rwlock_ckpt);
+    db_dur_flush();
+
+    return DBMS_SUCCESS;
+}
+
+
+static void *ckpt_thread(void *args) {
+    /*** Takes a checkpoint once the journal grows past CKPT_JOURNAL_MAX_SIZE bytes, or every
+     * CKPT_PERIOD_MS milliseconds if any user has been journaled, so that the journal stays short
+     * and recovery doesn't have to reload many users from disk ***/
+    (void) args;
+    pthread_mutex_lock(&mutex_ckpt);
+    while (TRUE) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += (CKPT_PERIOD_MS % 1000) * 1000000L;
+        deadline.tv_sec += CKPT_PERIOD_MS / 1000 + deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        while (__atomic_load_n(&journal_len, __ATOMIC_RELAXED) < CKPT_JOURNAL_MAX_SIZE &&
+               pthread_cond_timedwait(&cond_ckpt_due, &mutex_ckpt, &deadline) != ETIMEDOUT);
+        if (!__atomic_load_n(&journal_len, __ATOMIC_RELAXED)) continue;
+
+        pthread_mutex_unlock(&mutex_ckpt);
+        db_checkpoint();
+        pthread_mutex_lock(&mutex_ckpt);
+    } // END while
+
+    return NULL;
+}
+
+
+int db_recover(const int keep_cn_users) {
+    /*** Startup recovery: loads the user index from the last checkpoint and the journal
+     * (or scans the whole DB if there's no usable checkpoint), marks users left connected
+     * by the previous run as disconnected (unless keep_cn_users is TRUE: the previous run
+     * handed this one over, and their listening threads are still there), writes a fresh checkpoint
+     * and starts taking them periodically;
+     * must be called after db_init_db and before serving any request ***/
+    int ret_val;    /* needed for error-checking macros */
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    CHECK_FUNC_ERROR(idx_init(), DBMS_ERR_ANY)
+
+    /* checkpoint + journal replay, or full scan as a fallback */
+    int from_checkpoint = (load_checkpoint() == DBMS_SUCCESS && replay_journal() == DBMS_SUCCESS);
+    if (!from_checkpoint) {
+        idx_clear();
+        CHECK_FUNC_ERROR(scan_db(), DBMS_ERR_ANY)
+    }
+
+    /* transactions cut short by a crash are redone on top of the index, which keeps up with their writes */
+    CHECK_FUNC_ERROR(db_txn_recover(), DBMS_ERR_ANY)
+
+    /* open journal for appending */
+    char journal_path[strlen(DB_DIR) + strlen(JOURNAL_ENTRY) + 2];
+    sprintf(journal_path, "%s/%s", DB_DIR, JOURNAL_ENTRY);
+    journal_fd = open(journal_path, O_WRONLY | O_CREAT | O_APPEND, 0600);
+    CHECK_ERROR_WITH_ERRNO(journal_fd < 0, "Could not open journal", DBMS_ERR_ANY)
+
+    if (!keep_cn_users) {
+        CHECK_FUNC_ERROR(reset_cn_users(), DBMS_ERR_ANY)
+    }
+    CHECK_FUNC_ERROR(db_checkpoint(), DBMS_ERR_ANY)
+
+    /* later checkpoints are taken in the background while requests are served */
+    pthread_t thread;
+    CHECK_ERROR_WITH_ERRNO(pthread_create(&thread, NULL, ckpt_thread, NULL) != 0,
+                           "Could not create checkpoint thread", DBMS_ERR_ANY)
+    pthread_detach(thread);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    long elapsed_ms = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+    printf("s> recovered %zu users from %s in %ld ms\n", idx_size(),
+           from_checkpoint ? "checkpoint" : "DB scan", elapsed_ms);
+    fflush(stdout);
+
+    /* tables left in the flat layout of a hashed DB are moved while requests are served */
+    layout_migrate_start();
+
+    return DBMS_SUCCESS;
+}
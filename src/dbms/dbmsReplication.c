@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include "DS-Lab-Assignment/dbms/dbmsUtil.h"
+#include "DS-Lab-Assignment/dbms/dbmsIndex.h"
+#include "DS-Lab-Assignment/dbms/dbms.h"
+
+
+/* function called with every DB mutation, once it has been done; set before serving any request */
+static void (*mut_hook)(char op, const entry_t *entry) = NULL;
+
+typedef struct {
+    /*** Arguments Of A Snapshot Walk ***/
+    int (*emit)(char op, const entry_t *entry, void *args);
+    void *args;
+} snapshot_args_t;
+
+static int entry_exists(const entry_t *entry);
+static int snapshot_user(const char *username, int (*emit)(char op, const entry_t *entry, void *args), void *args);
+static int snapshot_table(const char *username, void *args);
+
+
+void note_mutation(const char op, const entry_t *const entry) {
+    /*** Passes a DB mutation that has just been done on to the mutation hook, if any ***/
+    if (mut_hook) mut_hook(op, entry);
+}
+
+
+static int entry_exists(const entry_t *const entry) {
+    /*** Checks whether a given username entry is on disk, without reading it ***/
+    dir_ent_t *user_table = dir_get(entry->username);
+    if (!user_table) return FALSE;
+
+    char entry_name[MSG_ID_MAX_STR_SIZE + sizeof USERDATA_ENTRY];
+    int dir_fd = user_table->table_fd;
+    if (entry->type == ENT_TYPE_UD) strcpy(entry_name, USERDATA_ENTRY);
+    else {
+        sprintf(entry_name, "%u", entry->msg.id);
+        dir_fd = dir_sub_fd(user_table, DIR_PEND_MSGS, FALSE);
+    }
+
+    int exists = dir_fd >= 0 && faccessat(dir_fd, entry_name, F_OK, 0) == 0;
+    dir_put(user_table);
+    return exists;
+}
+
+
+void db_repl_set_hook(void (*hook)(char op, const entry_t *entry)) {
+    /*** Sets the function called with every DB mutation (DB_MUT_PUT, DB_MUT_DEL or DB_MUT_RMTBL),
+     * after it has been done; it's called by the mutating thread, so it must not block ***/
+    mut_hook = hook;
+}
+
+
+int db_repl_reset(void) {
+    /*** Deletes every user table and empties the index, so that a standby
+     * can load a fresh copy of the primary's DB ***/
+    int ret_val;    /* needed for error-checking macros */
+    DIR *db;
+    CHECK_FUNC_ERROR(open_directory(DB_DIR, READ, &db), DBMS_ERR_ANY)
+
+    /* shard folders of the hashed layout go along with the tables in them; none is moved meanwhile */
+    layout_hold();
+    struct dirent *db_entry;
+    int result = DBMS_SUCCESS;
+    while ((db_entry = readdir(db)) != NULL) {
+        /* hidden entries are the checkpoint and the journal */
+        if (db_entry->d_name[0] == '.') continue;
+
+        char table_path[strlen(DB_DIR) + strlen(db_entry->d_name) + 2];
+        sprintf(table_path, "%s/%s", DB_DIR, db_entry->d_name);
+        if (remove_recursive(table_path) < 0) result = DBMS_ERR_ANY;
+    }
+    closedir(db);
+    layout_release();
+    dir_forget_all();
+
+    idx_clear();
+    CHECK_FUNC_ERROR(db_checkpoint(), DBMS_ERR_ANY)
+    return result;
+}
+
+
+int db_repl_apply(const char op, entry_t *entry) {
+    /*** Applies a DB mutation received from the primary: entries are written whole,
+     * so applying a mutation more than once leaves the DB as applying it once ***/
+    switch (op) {
+        case DB_MUT_PUT:
+            if (entry->type == ENT_TYPE_UD && db_user_exists(entry->username) == FALSE)
+                return db_creat_usr_tbl(entry);
+            return db_io_op_usr_ent(entry, entry_exists(entry) ? MODIFY : CREATE);
+        case DB_MUT_DEL:
+            if (!entry_exists(entry)) return DBMS_SUCCESS;
+            return db_io_op_usr_ent(entry, DELETE);
+        case DB_MUT_RMTBL:
+            if (db_user_exists(entry->username) == FALSE) return DBMS_SUCCESS;
+            return db_del_usr_tbl(entry->username);
+        default:
+            fprintf(stderr, "Invalid DB mutation\n");
+            return DBMS_ERR_ANY;
+    }
+}
+
+
+static int snapshot_user(const char *const username,
+                         int (*emit)(char op, const entry_t *entry, void *args), void *args) {
+    /*** Emits the userdata entry of a given user, followed by its pending messages ***/
+    int ret_val;    /* needed for error-checking macros */
+    entry_t entry;
+    entry.type = ENT_TYPE_UD;
+    strcpy(entry.username, username);
+    /* user deleted in the meantime */
+    if (db_io_op_usr_ent(&entry, READ) < 0) return DBMS_SUCCESS;
+    CHECK_FUNC_ERROR(emit(DB_MUT_PUT, &entry, args), DBMS_ERR_ANY)
+
+    dir_ent_t *user_table = dir_get(username);
+    if (!user_table) return DBMS_SUCCESS;
+    DIR *pend_msg_table;
+    int open_result = open_directory_at(user_table->table_fd, PEND_MSGS_TABLE, READ, &pend_msg_table);
+    dir_put(user_table);
+    if (open_result != DBMS_SUCCESS) return DBMS_SUCCESS;
+
+    struct dirent *pend_msgs_entry;
+    int result = DBMS_SUCCESS;
+    while (result == DBMS_SUCCESS && (pend_msgs_entry = readdir(pend_msg_table)) != NULL) {
+        if (!strcmp(pend_msgs_entry->d_name, ".") || !strcmp(pend_msgs_entry->d_name, "..")) continue;
+
+        entry.type = ENT_TYPE_P_MSG;
+        strcpy(entry.username, username);
+        if (str_to_num(pend_msgs_entry->d_name, (void *) &entry.msg.id, UINT) < 0) continue;
+        /* message delivered in the meantime */
+        if (db_io_op_usr_ent(&entry, READ) < 0) continue;
+        if (emit(DB_MUT_PUT, &entry, args) < 0) result = DBMS_ERR_ANY;
+    }
+
+    closedir(pend_msg_table);
+    return result;
+}
+
+
+static int snapshot_table(const char *const username, void *args) {
+    /*** Emits the entries of the table of a given user, as found by the DB walk ***/
+    snapshot_args_t *snapshot = (snapshot_args_t *) args;
+    return snapshot_user(username, snapshot->emit, snapshot->args);
+}
+
+
+int db_repl_snapshot(int (*emit)(char op, const entry_t *entry, void *args), void *args) {
+    /*** Walks the whole DB, calling emit with a DB_MUT_PUT mutation for every entry in it;
+     * the DB may be modified meanwhile, so mutations hooked from before the walk
+     * must be applied after it for the copy to be up to date ***/
+    snapshot_args_t snapshot = {emit, args};
+    return table_for_each(snapshot_table, &snapshot);
+}
@@ -0,0 +1,350 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include "DS-Lab-Assignment/dbms/dbmsUtil.h"
+#include "DS-Lab-Assignment/dbms/dbmsEngine.h"
+#include "DS-Lab-Assignment/dbms/dbmsTxn.h"
+#include "DS-Lab-Assignment/dbms/dbms.h"
+
+
+#define TXN_RECORD_MAGIC "DSTXNR01"     /* first bytes of a transaction log record */
+#define TXN_RECORD_MAGIC_LEN 8
+
+typedef struct {
+    /*** Transaction Log Record Header: followed by the writes of the transaction ***/
+    char magic[TXN_RECORD_MAGIC_LEN];
+    uint64_t n_writes;
+    uint64_t checksum;          /* FNV-1a hash of the writes, so that a torn record is told apart */
+} txn_record_t;
+
+/* user locks: a transaction locks the stripes of its users, in ascending order so that transactions don't deadlock */
+static pthread_mutex_t txn_locks[TXN_LOCK_STRIPES];
+static pthread_once_t txn_locks_once = PTHREAD_ONCE_INIT;
+
+/* directory engine transaction log: a transaction with more than one write is logged to a free slot before its
+ * writes are applied, and its record is truncated once they are; recovery redoes the records left in the slots */
+static int txn_slot_fds[TXN_LOG_SLOTS];
+static int txn_slot_busy[TXN_LOG_SLOTS];
+static int txn_log_ready = FALSE;
+static pthread_mutex_t mutex_txn_log = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond_txn_slot_free = PTHREAD_COND_INITIALIZER;
+
+static void txn_init_locks(void);
+static int txn_stripe(const char *username);
+static int txn_holds(const db_txn_t *txn, const char *username);
+static int txn_push(db_txn_t *txn, char op, char mode, const entry_t *entry);
+static int txn_same_entry(const entry_t *entry, const entry_t *other);
+static uint64_t txn_checksum(const txn_write_t *writes, size_t n_writes);
+static int txn_slot_take(void);
+static void txn_slot_put(int slot);
+static int txn_log_write(int slot, const txn_write_t *writes, size_t n_writes);
+static int txn_apply_write(const txn_write_t *write);
+static int txn_redo_writes(txn_write_t *writes, size_t n_writes);
+static int txn_redo(int slot_fd);
+
+
+/**** Transactions ****/
+static void txn_init_locks(void) {
+    /*** Sets up the user lock stripes ***/
+    for (int i = 0; i < TXN_LOCK_STRIPES; i++) pthread_mutex_init(&txn_locks[i], NULL);
+}
+
+
+static int txn_stripe(const char *username) {
+    /*** FNV-1a hash of a username, folded into its lock stripe ***/
+    uint32_t hash = 2166136261u;
+    while (*username) {
+        hash ^= (unsigned char) *username++;
+        hash *= 16777619u;
+    }
+    return (int) (hash % TXN_LOCK_STRIPES);
+}
+
+
+static int txn_holds(const db_txn_t *const txn, const char *const username) {
+    /*** Checks whether a transaction has locked a given user ***/
+    int stripe = txn_stripe(username);
+    for (int i = 0; i < txn->n_stripes; i++)
+        if (txn->stripes[i] == stripe) return TRUE;
+    return FALSE;
+}
+
+
+static int txn_push(db_txn_t *txn, const char op, const char mode, const entry_t *const entry) {
+    /*** Buffers a write of a transaction, to be applied on commit ***/
+    CHECK_ARGS(!txn_holds(txn, entry->username), "User Not Locked By Transaction")
+    CHECK_ARGS(txn->n_writes == TXN_MAX_WRITES, "Too Many Transaction Writes")
+
+    txn_write_t *write = &txn->writes[txn->n_writes++];
+    write->op = op;
+    write->mode = mode;
+    write->entry = *entry;
+    return DBMS_SUCCESS;
+}
+
+
+static int txn_same_entry(const entry_t *const entry, const entry_t *const other) {
+    /*** Checks whether two entries are the same username entry ***/
+    if (entry->type != other->type || strcmp(entry->username, other->username) != 0) return FALSE;
+    return entry->type == ENT_TYPE_UD || entry->msg.id == other->msg.id;
+}
+
+
+int db_txn_begin(db_txn_t *txn, const char *const *usernames, const size_t n_users) {
+    /*** Starts a transaction on the entries of given users, locking them until it's committed or aborted;
+     * the users of a transaction are given upfront, so that their locks are always taken in the same order ***/
+    CHECK_ARGS(n_users == 0 || n_users > TXN_MAX_USERS, "Invalid Number Of Transaction Users")
+    pthread_once(&txn_locks_once, txn_init_locks);
+
+    /* stripes sorted by insertion, without duplicates */
+    txn->n_stripes = 0;
+    txn->n_writes = 0;
+    for (size_t i = 0; i < n_users; i++) {
+        int stripe = txn_stripe(usernames[i]), pos = txn->n_stripes;
+        if (txn_holds(txn, usernames[i])) continue;
+        while (pos > 0 && txn->stripes[pos - 1] > stripe) {
+            txn->stripes[pos] = txn->stripes[pos - 1];
+            pos--;
+        }
+        txn->stripes[pos] = stripe;
+        txn->n_stripes++;
+    }
+
+    for (int i = 0; i < txn->n_stripes; i++) pthread_mutex_lock(&txn_locks[txn->stripes[i]]);
+    return DBMS_SUCCESS;
+}
+
+
+int db_txn_read(db_txn_t *txn, entry_t *entry) {
+    /*** Reads a username entry of a user locked by a transaction; entries written by the transaction
+     * are read as they will be once it's committed ***/
+    CHECK_ARGS(!txn_holds(txn, entry->username), "User Not Locked By Transaction")
+
+    for (size_t i = txn->n_writes; i-- > 0;) {
+        const txn_write_t *write = &txn->writes[i];
+        if (write->op == DB_MUT_RMTBL && !strcmp(write->entry.username, entry->username))
+            return DBMS_ERR_NOT_EXISTS;
+        if (!txn_same_entry(&write->entry, entry)) continue;
+        if (write->op == DB_MUT_DEL) return DBMS_ERR_NOT_EXISTS;
+        *entry = write->entry;
+        return DBMS_SUCCESS;
+    }
+    return db_engine->io_op_usr_ent(entry, READ);
+}
+
+
+int db_txn_put(db_txn_t *txn, const entry_t *const entry, const char mode) {
+    /*** Buffers the creation (CREATE) or modification (MODIFY) of a username entry ***/
+    CHECK_ARGS(mode != CREATE && mode != MODIFY, "Invalid File Mode")
+    return txn_push(txn, DB_MUT_PUT, mode, entry);
+}
+
+
+int db_txn_del(db_txn_t *txn, const entry_t *const entry) {
+    /*** Buffers the deletion of a username entry ***/
+    return txn_push(txn, DB_MUT_DEL, DELETE, entry);
+}
+
+
+int db_txn_drop_user(db_txn_t *txn, const char *const username) {
+    /*** Buffers the deletion of a whole user table ***/
+    entry_t entry;
+    entry.type = ENT_TYPE_UD;
+    strcpy(entry.username, username);
+    return txn_push(txn, DB_MUT_RMTBL, DELETE, &entry);
+}
+
+
+int db_txn_commit(db_txn_t *txn) {
+    /*** Applies the writes of a transaction, all of them or none (even on a crash, by the directory engine),
+     * and unlocks its users ***/
+    int result = txn->n_writes ? db_engine->txn_apply(txn->writes, txn->n_writes) : DBMS_SUCCESS;
+    db_txn_abort(txn);
+    return result;
+}
+
+
+void db_txn_abort(db_txn_t *txn) {
+    /*** Drops the writes of a transaction and unlocks its users; does nothing if it's been committed ***/
+    for (int i = txn->n_stripes; i-- > 0;) pthread_mutex_unlock(&txn_locks[txn->stripes[i]]);
+    txn->n_stripes = 0;
+    txn->n_writes = 0;
+}
+
+
+/**** Directory Engine Transaction Log ****/
+static uint64_t txn_checksum(const txn_write_t *const writes, const size_t n_writes) {
+    /*** FNV-1a hash of the writes of a transaction ***/
+    const unsigned char *bytes = (const unsigned char *) writes;
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < n_writes * sizeof(txn_write_t); i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+
+static int txn_slot_take(void) {
+    /*** Takes a free transaction log slot, sleeping until there is one ***/
+    pthread_mutex_lock(&mutex_txn_log);
+    int slot;
+    while (TRUE) {
+        for (slot = 0; slot < TXN_LOG_SLOTS && txn_slot_busy[slot]; slot++) continue;
+        if (slot < TXN_LOG_SLOTS) break;
+        pthread_cond_wait(&cond_txn_slot_free, &mutex_txn_log);
+    }
+    txn_slot_busy[slot] = TRUE;
+    pthread_mutex_unlock(&mutex_txn_log);
+    return slot;
+}
+
+
+static void txn_slot_put(const int slot) {
+    /*** Gives a transaction log slot back, emptied ***/
+    if (ftruncate(txn_slot_fds[slot], 0) < 0) perror("Error truncating transaction log");
+
+    pthread_mutex_lock(&mutex_txn_log);
+    txn_slot_busy[slot] = FALSE;
+    pthread_cond_signal(&cond_txn_slot_free);
+    pthread_mutex_unlock(&mutex_txn_log);
+}
+
+
+int db_txn_log_record(const int log_fd, const txn_write_t *const writes, const size_t n_writes) {
+    /*** Writes the record of a transaction at the start of a transaction log file, with a single write;
+     * returns its size ***/
+    txn_record_t record;
+    memcpy(record.magic, TXN_RECORD_MAGIC, TXN_RECORD_MAGIC_LEN);
+    record.n_writes = n_writes;
+    record.checksum = txn_checksum(writes, n_writes);
+
+    struct iovec iov[2] = {{&record, sizeof record}, {(void *) writes, n_writes * sizeof(txn_write_t)}};
+    ssize_t len = (ssize_t) (iov[0].iov_len + iov[1].iov_len);
+    CHECK_ERROR_WITH_ERRNO(pwritev(log_fd, iov, 2, 0) != len, "Error writing transaction log", DBMS_ERR_ANY)
+    return (int) len;
+}
+
+
+static int txn_log_write(const int slot, const txn_write_t *const writes, const size_t n_writes) {
+    /*** Writes the record of a transaction to a log slot; it's synced before the transaction is applied,
+     * along with the other DB writes of its batch, unless DB writes aren't synced at all (DUR_NONE),
+     * in which case it only outlives a server crash ***/
+    int ret_val;    /* needed for error-checking macros */
+    CHECK_FUNC_ERROR(db_txn_log_record(txn_slot_fds[slot], writes, n_writes), DBMS_ERR_ANY)
+    db_dur_note_write();
+    CHECK_ERROR(db_dur_sync_wait() < 0, "Error syncing transaction log", DBMS_ERR_ANY)
+    return DBMS_SUCCESS;
+}
+
+
+static int txn_apply_write(const txn_write_t *const write) {
+    /*** Applies a transaction write to the DB ***/
+    entry_t entry = write->entry;
+    switch (write->op) {
+        case DB_MUT_PUT: return db_io_op_usr_ent(&entry, write->mode);
+        case DB_MUT_DEL: return db_io_op_usr_ent(&entry, DELETE);
+        case DB_MUT_RMTBL: return db_del_usr_tbl(entry.username);
+        default:
+            fprintf(stderr, "Invalid transaction write\n");
+            return DBMS_ERR_ANY;
+    }
+}
+
+
+int db_txn_apply(const txn_write_t *const writes, const size_t n_writes) {
+    /*** Applies the writes of a transaction; a single entry write is atomic by itself, since entries are
+     * written whole to a temporary entry that then takes their place (write_entry_at), but several writes,
+     * or a user table deletion (many unlinks), are logged first, so that recovery redoes them after a crash ***/
+    int logged = txn_log_ready && (n_writes > 1 || writes[0].op == DB_MUT_RMTBL);
+    int slot = -1;
+    if (logged) {
+        slot = txn_slot_take();
+        if (txn_log_write(slot, writes, n_writes) < 0) {
+            txn_slot_put(slot);
+            return DBMS_ERR_ANY;
+        }
+    }
+
+    int result = DBMS_SUCCESS;
+    for (size_t i = 0; i < n_writes; i++)
+        if (txn_apply_write(&writes[i]) < 0) result = DBMS_ERR_ANY;
+
+    /* if a write failed, the logged transaction is redone right away, while its users are still locked:
+     * left to recovery, its record could undo the writes of later transactions on the same users */
+    if (logged) {
+        if (result < 0) {
+            txn_write_t redo_writes[TXN_MAX_WRITES];
+            memcpy(redo_writes, writes, n_writes * sizeof(txn_write_t));
+            result = txn_redo_writes(redo_writes, n_writes);
+        }
+        /* the writes must be on disk before their record is dropped, as in db_txn_recover;
+         * writes that can't be synced fail the transaction, like a failed write */
+        if (db_dur_sync_wait() < 0) result = DBMS_ERR_ANY;
+        txn_slot_put(slot);
+    }
+    return result;
+}
+
+
+static int txn_redo_writes(txn_write_t *writes, const size_t n_writes) {
+    /*** Redoes the writes of a logged transaction like replicated mutations: whole entries, so redoing
+     * writes that were applied already does no harm ***/
+    int result = DBMS_SUCCESS;
+    for (size_t i = 0; i < n_writes; i++) {
+        if (db_repl_apply(writes[i].op, &writes[i].entry) < 0) {
+            fprintf(stderr, "Could not redo write of %s from transaction log\n", writes[i].entry.username);
+            result = DBMS_ERR_ANY;
+        }
+    }
+    return result;
+}
+
+
+static int txn_redo(const int slot_fd) {
+    /*** Redoes the transaction logged in a slot, if any; a torn record is from a transaction
+     * that was never applied, so it's dropped; returns TRUE if a transaction was redone ***/
+    txn_record_t record;
+    txn_write_t writes[TXN_MAX_WRITES];
+
+    if (pread(slot_fd, &record, sizeof record, 0) != sizeof record ||
+        memcmp(record.magic, TXN_RECORD_MAGIC, TXN_RECORD_MAGIC_LEN) != 0 ||
+        record.n_writes == 0 || record.n_writes > TXN_MAX_WRITES)
+        return FALSE;
+    ssize_t len = (ssize_t) (record.n_writes * sizeof(txn_write_t));
+    if (pread(slot_fd, writes, len, sizeof record) != len || txn_checksum(writes, record.n_writes) != record.checksum)
+        return FALSE;
+
+    txn_redo_writes(writes, record.n_writes);
+    return TRUE;
+}
+
+
+int db_txn_recover(void) {
+    /*** Opens the transaction log slots, redoing the transactions left in them by a crash;
+     * must be called once the index has been loaded ***/
+    int n_redone = 0;
+    for (int slot = 0; slot < TXN_LOG_SLOTS; slot++) {
+        char slot_path[strlen(DB_DIR) + strlen(TXN_LOG_ENTRY) + 16];
+        sprintf(slot_path, "%s/%s-%d", DB_DIR, TXN_LOG_ENTRY, slot);
+        txn_slot_fds[slot] = open(slot_path, O_RDWR | O_CREAT, 0600);
+        CHECK_ERROR_WITH_ERRNO(txn_slot_fds[slot] < 0, "Could not open transaction log", DBMS_ERR_ANY)
+        n_redone += txn_redo(txn_slot_fds[slot]);
+    }
+
+    /* redone writes must be on disk before their records are dropped */
+    if (n_redone) {
+        sync();
+        printf("s> redid %d transactions from the transaction log\n", n_redone); fflush(stdout);
+    }
+    for (int slot = 0; slot < TXN_LOG_SLOTS; slot++) {
+        CHECK_ERROR_WITH_ERRNO(ftruncate(txn_slot_fds[slot], 0) < 0, "Error truncating transaction log",
+                               DBMS_ERR_ANY)
+    }
+
+    txn_log_ready = TRUE;
+    return DBMS_SUCCESS;
+}
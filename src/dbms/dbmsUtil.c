@@ -10,12 +10,18 @@
 
 int open_file(const char *const path, const char mode) {
     /*** Open given path file with given mode ***/
+    return open_file_at(AT_FDCWD, path, mode);
+}
+
+
+int open_file_at(const int dir_fd, const char *const name, const char mode) {
+    /*** Open given file, relative to a given open directory, with given mode ***/
     int fd;
 
     switch (mode) {
-        case READ: fd = open(path, O_RDONLY); break;
-        case CREATE: fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0600); break;
-        case MODIFY: fd = open(path, O_WRONLY | O_TRUNC); break;
+        case READ: fd = openat(dir_fd, name, O_RDONLY); break;
+        case CREATE: fd = openat(dir_fd, name, O_WRONLY | O_CREAT | O_EXCL, 0600); break;
+        case MODIFY: fd = openat(dir_fd, name, O_WRONLY | O_TRUNC); break;
         default:
             fprintf(stderr, "Invalid open mode");
             return GEN_ERR_INV_ARGS;
@@ -27,6 +33,13 @@ int open_file(const char *const path, const char mode) {
 
 int open_directory(const char *const path, const char mode, DIR **directory) {
     /*** Open given path as a directory with given mode and map it to given DIR **directory ***/
+    return open_directory_at(AT_FDCWD, path, mode, directory);
+}
+
+
+int open_directory_at(const int dir_fd, const char *const name, const char mode, DIR **directory) {
+    /*** Open given directory, relative to a given open directory, with given mode
+     * and map it to given DIR **directory ***/
     errno = 0;
     int ret_val;    /* needed for error-checking macros */
     char error[MAX_STR_SIZE];   /* message displayed in perror */
@@ -34,23 +47,36 @@ int open_directory(const char *const path, const char mode, DIR **directory) {
     CHECK_ARGS(mode != CREATE && mode != READ && mode != OVERWRITE, "Invalid Open Mode")
 
     /* try to open directory */
-    *directory = opendir(path);
+    int fd = openat(dir_fd, name, O_RDONLY | O_DIRECTORY);
 
-    if (!*directory) {
+    if (fd < 0) {
         if (errno == ENOENT) {      /* directory doesn't exist */
             if (mode == CREATE || mode == OVERWRITE) {   /* so create it */
-                CHECK_FUNC_ERROR_WITH_ERRNO(mkdir(path, S_IRWXU), DBMS_ERR_ANY)
+                CHECK_FUNC_ERROR_WITH_ERRNO(mkdirat(dir_fd, name, S_IRWXU), DBMS_ERR_ANY)
                 /* and try to open it */
-                *directory = opendir(path);
-                CHECK_ERROR_WITH_ERRNO(!*directory, "Could not open directory", DBMS_ERR_ANY)
+                fd = openat(dir_fd, name, O_RDONLY | O_DIRECTORY);
+                CHECK_ERROR_WITH_ERRNO(fd < 0, "Could not open directory", DBMS_ERR_ANY)
+                *directory = fdopendir(fd);
+                if (!*directory) {
+                    perror("Could not open directory");
+                    close(fd);
+                    return DBMS_ERR_ANY;
+                }
                 return DBMS_SUCCESS;
             } else return DBMS_ERR_NOT_EXISTS; /* mode == READ */
-        } else {    /* some other opendir() error */
-            sprintf(error, "Could not open %s directory", path); perror(error);
+        } else {    /* some other openat() error */
+            sprintf(error, "Could not open %s directory", name); perror(error);
             return DBMS_ERR_ANY;
         }
     }
 
+    *directory = fdopendir(fd);
+    if (!*directory) {
+        perror("Could not open directory");
+        close(fd);
+        return DBMS_ERR_ANY;
+    }
+
     /* directory exists, depending on given mode, this is success or error */
     return ((mode == CREATE) ? DBMS_ERR_EXISTS : DBMS_SUCCESS);
 }
@@ -115,6 +141,8 @@ int read_entry(const int entry_fd, entry_t *entry) {
         return DBMS_ERR_ANY;
     }
 
+    /* entries written before new fields were added to entry_t are shorter: zero those fields */
+    if (bytes_read < (ssize_t) sizeof(entry_t)) memset((char *) entry + bytes_read, 0, sizeof(entry_t) - bytes_read);
     return DBMS_SUCCESS;
 }
 
@@ -133,3 +161,32 @@ int write_entry(const int entry_fd, entry_t *entry) {
 
     return DBMS_SUCCESS;
 }
+
+
+int write_entry_at(const int tmp_dir_fd, const int dir_fd, const char *const name, const entry_t *entry,
+                   const char mode) {
+    /*** Creates (CREATE) or modifies (MODIFY) an entry, relative to a given open directory, so that a crash
+     * never leaves it half-written: the entry is written whole to a temporary file in tmp_dir_fd (on the same
+     * file system), which then takes its place in a single step; returns -1 with errno set on error ***/
+    char tmp_name[strlen(name) + sizeof TMP_ENTRY_EXT + 1];
+    sprintf(tmp_name, ".%s%s", name, TMP_ENTRY_EXT);
+
+    /* like open_file_at, an entry to modify must exist */
+    if (mode == MODIFY && faccessat(dir_fd, name, F_OK, 0) < 0) return -1;
+
+    int tmp_fd = openat(tmp_dir_fd, tmp_name, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (tmp_fd < 0) return -1;
+    int result = (write_bytes(tmp_fd, (const char *) entry, sizeof(entry_t)) == sizeof(entry_t)) ? 0 : -1;
+    if (close(tmp_fd) < 0) result = -1;
+
+    /* a new entry is linked instead, which fails if it exists already, as O_EXCL does */
+    if (result == 0)
+        result = (mode == CREATE) ? linkat(tmp_dir_fd, tmp_name, dir_fd, name, 0)
+                                  : renameat(tmp_dir_fd, tmp_name, dir_fd, name);
+    if (result < 0 || mode == CREATE) {
+        int error_num = errno;
+        unlinkat(tmp_dir_fd, tmp_name, 0);
+        errno = error_num;
+    }
+    return result;
+}
@@ -0,0 +1,201 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include "DS-Lab-Assignment/dedup.h"
+
+
+#define DD_SENDER_BUCKETS 1024  /* hash buckets holding the senders' token tables; must be a power of 2 */
+
+#define DD_FREE '\0'
+#define DD_PENDING 'p'          /* SEND being served */
+#define DD_DONE 'd'             /* SEND served: first ACK sent or message delivered */
+
+/* a SEND token of a sender */
+typedef struct {
+    char token[DEDUP_TOKEN_SIZE];
+    uint64_t req_hash;          /* hash of recipient and content, so a reused token is told apart from a retry */
+    unsigned int msg_id;
+    char state;
+    long long done_ms;          /* when the SEND was served; the token expires DEDUP_TTL seconds later */
+} dd_token_t;
+
+/* recent SEND tokens of a sender; when there is no room left, the oldest served one is dropped */
+typedef struct dd_sender {
+    char username[MAX_STR_SIZE];
+    dd_token_t tokens[DEDUP_PER_SENDER];
+    struct dd_sender *next;
+} dd_sender_t;
+
+static dd_sender_t *dd_senders[DD_SENDER_BUCKETS];
+static pthread_mutex_t mutex_dd = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond_dd_done = PTHREAD_COND_INITIALIZER;     /* some pending SEND was settled */
+
+static long long dd_now_ms(void);
+static uint64_t dd_hash(uint64_t hash, const void *key, size_t len);
+static int dd_token_live(const dd_token_t *token, long long now_ms);
+static dd_sender_t *dd_get_sender(const char *username, long long now_ms, int create);
+static dd_token_t *dd_find_token(dd_sender_t *sender, const char *token, long long now_ms);
+static dd_token_t *dd_new_token(dd_sender_t *sender, long long now_ms);
+
+
+static long long dd_now_ms(void) {
+    /*** Returns a monotonic timestamp in milliseconds ***/
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+}
+
+
+static uint64_t dd_hash(uint64_t hash, const void *key, const size_t len) {
+    /*** Adds a key to a 64-bit FNV-1a hash (14695981039346656037 to start a new one) ***/
+    const unsigned char *byte = key;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= byte[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+
+static int dd_token_live(const dd_token_t *token, const long long now_ms) {
+    /*** Checks whether a token slot is in use: pending, or served less than DEDUP_TTL seconds ago ***/
+    return token->state == DD_PENDING ||
+           (token->state == DD_DONE && now_ms - token->done_ms < DEDUP_TTL * 1000LL);
+}
+
+
+static dd_sender_t *dd_get_sender(const char *const username, const long long now_ms, const int create) {
+    /*** Finds the token table of a sender, setting up an empty one if asked to; tables of other
+     * senders in the same bucket whose tokens have all expired are freed on the way;
+     * returns NULL if not found or out of memory; mutex_dd must be held ***/
+    dd_sender_t **link = &dd_senders[dd_hash(14695981039346656037ULL, username, strlen(username)) &
+                                     (DD_SENDER_BUCKETS - 1)];
+    dd_sender_t *found = NULL;
+
+    while (*link) {
+        dd_sender_t *sender = *link;
+        if (!strcmp(sender->username, username)) {
+            found = sender;
+            link = &sender->next;
+            continue;
+        }
+
+        int live = FALSE;
+        for (int i = 0; i < DEDUP_PER_SENDER && !live; i++) live = dd_token_live(&sender->tokens[i], now_ms);
+        if (live) link = &sender->next;
+        else {
+            *link = sender->next;
+            free(sender);
+        }
+    } // END while
+
+    if (found || !create) return found;
+
+    found = calloc(1, sizeof(dd_sender_t));
+    if (!found) return NULL;
+    strcpy(found->username, username);
+    *link = found;
+    return found;
+}
+
+
+static dd_token_t *dd_find_token(dd_sender_t *sender, const char *const token, const long long now_ms) {
+    /*** Finds a live token of a sender; returns NULL if not found; mutex_dd must be held ***/
+    for (int i = 0; i < DEDUP_PER_SENDER; i++)
+        if (dd_token_live(&sender->tokens[i], now_ms) && !strcmp(sender->tokens[i].token, token))
+            return &sender->tokens[i];
+    return NULL;
+}
+
+
+static dd_token_t *dd_new_token(dd_sender_t *sender, const long long now_ms) {
+    /*** Takes a slot for a new token of a sender: a free or expired one, or else the one
+     * of the oldest SEND served; returns NULL if every SEND of the sender is pending ***/
+    dd_token_t *oldest = NULL;
+    for (int i = 0; i < DEDUP_PER_SENDER; i++) {
+        dd_token_t *slot = &sender->tokens[i];
+        if (!dd_token_live(slot, now_ms)) return slot;
+        if (slot->state == DD_DONE && (!oldest || slot->done_ms < oldest->done_ms)) oldest = slot;
+    }
+    return oldest;
+}
+
+
+uint64_t dd_req_hash(const char *const recipient, const char *const content, const size_t content_len) {
+    /*** Hash of the recipient and content of a SEND ***/
+    uint64_t hash = dd_hash(14695981039346656037ULL, recipient, strlen(recipient) + 1);
+    return dd_hash(hash, content, content_len);
+}
+
+
+int dd_claim(const char *const sender, const char *const token, const uint64_t req_hash, unsigned int *msg_id) {
+    /*** Looks up the token of a SEND made by a sender: a new one is recorded as pending, and the caller
+     * must settle it once the SEND is served; a retry waits for the first try to be served, for up to
+     * DEDUP_WAIT_MS, and gets its message ID; returns a DD_* result, or GEN_ERR_ANY if out of memory ***/
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += (DEDUP_WAIT_MS % 1000) * 1000000L;
+    deadline.tv_sec += DEDUP_WAIT_MS / 1000 + deadline.tv_nsec / 1000000000L;
+    deadline.tv_nsec %= 1000000000L;
+    int result;
+
+    pthread_mutex_lock(&mutex_dd);
+    while (TRUE) {
+        long long now_ms = dd_now_ms();
+        dd_sender_t *sender_tokens = dd_get_sender(sender, now_ms, TRUE);
+        if (!sender_tokens) {
+            result = GEN_ERR_ANY;
+            break;
+        }
+
+        dd_token_t *entry = dd_find_token(sender_tokens, token, now_ms);
+        if (!entry) {
+            /* first try */
+            entry = dd_new_token(sender_tokens, now_ms);
+            if (!entry) {
+                result = DD_BUSY;
+                break;
+            }
+            strcpy(entry->token, token);
+            entry->req_hash = req_hash;
+            entry->state = DD_PENDING;
+            result = DD_NEW;
+            break;
+        }
+
+        if (entry->req_hash != req_hash) result = DD_REUSED;
+        else if (entry->state == DD_DONE) {
+            *msg_id = entry->msg_id;
+            result = DD_SENT;
+        }
+        /* the first try is still being served: wait for it, then look the token up again,
+         * since it's gone if the first try failed */
+        else if (pthread_cond_timedwait(&cond_dd_done, &mutex_dd, &deadline) == ETIMEDOUT) result = DD_BUSY;
+        else continue;
+        break;
+    } // END while
+    pthread_mutex_unlock(&mutex_dd);
+
+    return result;
+}
+
+
+void dd_settle(const char *const sender, const char *const token, const unsigned int msg_id, const int sent) {
+    /*** Settles the pending token of a SEND once it's served: if the message was sent, retries get its ID
+     * from now on; if it wasn't, the token is dropped, so a retry is served as a first try ***/
+    pthread_mutex_lock(&mutex_dd);
+    long long now_ms = dd_now_ms();
+    dd_sender_t *sender_tokens = dd_get_sender(sender, now_ms, FALSE);
+    dd_token_t *entry = sender_tokens ? dd_find_token(sender_tokens, token, now_ms) : NULL;
+    if (entry && entry->state == DD_PENDING) {
+        if (sent) {
+            entry->msg_id = msg_id;
+            entry->state = DD_DONE;
+            entry->done_ms = now_ms;
+        } else entry->state = DD_FREE;
+        pthread_cond_broadcast(&cond_dd_done);
+    }
+    pthread_mutex_unlock(&mutex_dd);
+}
@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "DS-Lab-Assignment/handoff.h"
+
+
+/* graceful restart: a running server listens on a local Unix socket; a new server started with the same
+ * path connects to it and gets the client listening socket passed over (SCM_RIGHTS), so the port is never
+ * closed; the old server then stops accepting, drains its work and exits, which the new one sees as EOF,
+ * and only then does the new one open the DB and start accepting */
+
+static int ho_set_addr(const char *path, struct sockaddr_un *addr);
+
+
+static int ho_set_addr(const char *const path, struct sockaddr_un *addr) {
+    /*** Sets up the address of the handoff socket ***/
+    CHECK_ARGS(strlen(path) >= sizeof addr->sun_path, "Handoff Socket Path Too Long")
+    bzero(addr, sizeof(struct sockaddr_un));
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, path);
+    return GEN_SUCCESS;
+}
+
+
+int ho_take_over(const char *const path, int *listen_socket) {
+    /*** Asks the server running at a given handoff socket for its listening socket, and waits
+     * until that server has drained its work and exited; returns FALSE if there's no server running ***/
+    int ret_val;    /* needed for error-checking macros */
+    struct sockaddr_un ho_addr;
+    int ho_socket;
+    CHECK_FUNC_ERROR(ho_set_addr(path, &ho_addr), GEN_ERR_INV_ARGS)
+    CHECK_FUNC_ERROR_WITH_ERRNO(ho_socket = socket(AF_UNIX, SOCK_STREAM, 0), GEN_ERR_ANY)
+
+    if (connect(ho_socket, (struct sockaddr *) &ho_addr, sizeof ho_addr) < 0) {
+        close(ho_socket);
+        if (errno == ENOENT || errno == ECONNREFUSED) return FALSE;     /* no server, or a stale socket file */
+        CHECK_ERROR_WITH_ERRNO(TRUE, "Could not connect to handoff socket", GEN_ERR_ANY)
+    }
+
+    /* receive the listening socket, passed along a single byte */
+    char byte;
+    struct iovec iov = {&byte, 1};
+    union {
+        struct cmsghdr header;
+        char space[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct msghdr msg;
+    bzero(&msg, sizeof msg);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.space;
+    msg.msg_controllen = sizeof control.space;
+
+    struct cmsghdr *cmsg;
+    if (recvmsg(ho_socket, &msg, 0) != 1 || !(cmsg = CMSG_FIRSTHDR(&msg)) || cmsg->cmsg_level != SOL_SOCKET ||
+        cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(int))) {
+        close(ho_socket);
+        CHECK_ERROR(TRUE, "Could not receive listening socket", GEN_ERR_ANY)
+    }
+    memcpy(listen_socket, CMSG_DATA(cmsg), sizeof(int));
+
+    /* the old server closes the handoff connection by exiting */
+    ssize_t bytes_read;
+    while ((bytes_read = recv(ho_socket, &byte, 1, 0)) > 0 || (bytes_read < 0 && errno == EINTR)) continue;
+    close(ho_socket);
+    return TRUE;
+}
+
+
+int ho_listen(const char *const path) {
+    /*** Creates the handoff socket a new server connects to, replacing a stale socket file ***/
+    int ret_val;    /* needed for error-checking macros */
+    struct sockaddr_un ho_addr;
+    int ho_socket;
+    CHECK_FUNC_ERROR(ho_set_addr(path, &ho_addr), GEN_ERR_INV_ARGS)
+    CHECK_FUNC_ERROR_WITH_ERRNO(ho_socket = socket(AF_UNIX, SOCK_STREAM, 0), GEN_ERR_ANY)
+
+    unlink(path);
+    CHECK_SOCK_ERROR(bind(ho_socket, (struct sockaddr *) &ho_addr, sizeof ho_addr), ho_socket)
+    CHECK_SOCK_ERROR(listen(ho_socket, 1), ho_socket)
+    return ho_socket;
+}
+
+
+int ho_hand_over(const int ho_socket, const int listen_socket) {
+    /*** Accepts a new server on the handoff socket and passes it the listening socket;
+     * returns the handoff connection, which must be left open until this server exits ***/
+    int ret_val;    /* needed for error-checking macros */
+    int new_server_socket;
+    CHECK_FUNC_ERROR_WITH_ERRNO(new_server_socket = accept(ho_socket, NULL, NULL), GEN_ERR_ANY)
+
+    char byte = 0;
+    struct iovec iov = {&byte, 1};
+    union {
+        struct cmsghdr header;
+        char space[CMSG_SPACE(sizeof(int))];
+    } control;
+    bzero(&control, sizeof control);
+    struct msghdr msg;
+    bzero(&msg, sizeof msg);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.space;
+    msg.msg_controllen = sizeof control.space;
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &listen_socket, sizeof(int));
+
+    CHECK_SOCK_ERROR(sendmsg(new_server_socket, &msg, 0), new_server_socket)
+    return new_server_socket;
+}
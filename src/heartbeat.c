@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "DS-Lab-Assignment/netUtil.h"
+#include "DS-Lab-Assignment/dbms/dbmsEngine.h"
+#include "DS-Lab-Assignment/heartbeat.h"
+
+
+/* heartbeat probe of a connected user's listening thread */
+typedef struct {
+    entry_t entry;      /* userdata entry read when the probe started */
+    int socket;         /* -1 once the probe has finished */
+    int alive;
+} hb_probe_t;
+
+static int hb_interval = HB_INTERVAL;
+static char *hb_suspects = NULL;        /* users whose last probe failed, each one '\0'-terminated */
+static size_t hb_suspects_len = 0;
+static pthread_t heartbeat_thread;
+
+int hb_is_suspect(const char *username);
+int hb_probe_start(hb_probe_t *probe, const char *username);
+void hb_probe_wait(hb_probe_t *probes, int n_probes);
+void hb_mark_dead(const hb_probe_t *probe);
+void hb_round(void);
+void *hb_thread(void *args);
+
+
+int hb_is_suspect(const char *const username) {
+    /*** Checks whether the previous probe of a given user failed too ***/
+    for (size_t pos = 0; pos < hb_suspects_len; pos += strlen(hb_suspects + pos) + 1)
+        if (!strcmp(hb_suspects + pos, username)) return TRUE;
+    return FALSE;
+}
+
+
+int hb_probe_start(hb_probe_t *probe, const char *const username) {
+    /*** Starts a non-blocking connection to the listening thread of a given user;
+     * returns FALSE if the user is no longer connected, so there's nothing to probe ***/
+    struct sockaddr_storage clt_listen_addr;
+    probe->socket = -1;
+    probe->alive = FALSE;
+
+    probe->entry.type = ENT_TYPE_UD;
+    strcpy(probe->entry.username, username);
+    if (db_engine->io_op_usr_ent(&probe->entry, READ) < 0 || probe->entry.user.status != STATUS_CN)
+        return FALSE;
+
+    socklen_t addr_size = set_listener_addr(&probe->entry.user, &clt_listen_addr);
+
+    if ((probe->socket = socket(clt_listen_addr.ss_family, SOCK_STREAM, 0)) < 0) {
+        /* not the listener's fault: leave the user alone */
+        probe->alive = TRUE;
+        return TRUE;
+    }
+    fcntl(probe->socket, F_SETFL, fcntl(probe->socket, F_GETFL) | O_NONBLOCK);
+
+    if (connect(probe->socket, (struct sockaddr *) &clt_listen_addr, addr_size) < 0 &&
+        errno != EINPROGRESS) {
+        close(probe->socket);
+        probe->socket = -1;
+    }
+    return TRUE;
+}
+
+
+void hb_probe_wait(hb_probe_t *probes, const int n_probes) {
+    /*** Waits at most HB_TIMEOUT_MS for the connections of a batch of probes to be set up;
+     * a listener that accepts the connection gets a HEARTBEAT and is alive ***/
+    struct pollfd poll_fds[HB_BATCH_SIZE];
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (TRUE) {
+        int n_fds = 0;
+        for (int i = 0; i < n_probes; i++) {
+            if (probes[i].socket < 0) continue;
+            poll_fds[n_fds].fd = probes[i].socket;
+            poll_fds[n_fds].events = POLLOUT;
+            n_fds++;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        int elapsed_ms = (int) ((now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000);
+        if (!n_fds || elapsed_ms >= HB_TIMEOUT_MS) break;
+        if (poll(poll_fds, n_fds, HB_TIMEOUT_MS - elapsed_ms) < 0 && errno != EINTR) break;
+
+        /* finished connections: successful ones get their heartbeat */
+        for (int i = 0, fd = 0; i < n_probes; i++) {
+            if (probes[i].socket < 0) continue;
+            if (poll_fds[fd++].revents) {
+                int sock_error = 0;
+                socklen_t error_len = sizeof(sock_error);
+                getsockopt(probes[i].socket, SOL_SOCKET, SO_ERROR, &sock_error, &error_len);
+                probes[i].alive = !sock_error && send_string(probes[i].socket, HEARTBEAT) == 0;
+                close(probes[i].socket);
+                probes[i].socket = -1;
+            }
+        }
+    } // END while
+
+    /* listeners that didn't answer in time */
+    for (int i = 0; i < n_probes; i++) {
+        if (probes[i].socket < 0) continue;
+        close(probes[i].socket);
+        probes[i].socket = -1;
+    }
+}
+
+
+void hb_mark_dead(const hb_probe_t *probe) {
+    /*** Changes the status of a user whose listening thread is gone to disconnected,
+     * unless it has connected again from another listener since it was probed ***/
+    entry_t entry;
+    entry.type = ENT_TYPE_UD;
+    strcpy(entry.username, probe->entry.username);
+
+    /* read and updated in a transaction, so that a CONNECT can't get in between */
+    db_txn_t txn;
+    const char *users[] = {entry.username};
+    db_txn_begin(&txn, users, 1);
+    int result = db_txn_read(&txn, &entry);
+    if (result < 0 || entry.user.status != STATUS_CN ||
+        entry.user.ip.s_addr != probe->entry.user.ip.s_addr || entry.user.port != probe->entry.user.port ||
+        strcmp(entry.user.sock_path, probe->entry.user.sock_path) != 0) {
+        db_txn_abort(&txn);
+        return;
+    }
+
+    entry.user.status = STATUS_DCN;
+    result = db_txn_put(&txn, &entry, MODIFY);
+    if (result == DBMS_SUCCESS) result = db_txn_commit(&txn);
+    db_txn_abort(&txn);     /* unless committed */
+    if (result < 0) return;
+    printf("s> HEARTBEAT %s LOST\n", entry.username);
+    fflush(stdout);
+}
+
+
+void hb_round(void) {
+    /*** Probes the listening threads of all connected users, HB_BATCH_SIZE at a time;
+     * users failing two probes in a row are disconnected ***/
+    char *users = NULL;
+    size_t users_len = 0, n_users = 0;
+    if (db_engine->get_connected_users(&users, &users_len, &n_users) < 0) return;
+
+    hb_probe_t probes[HB_BATCH_SIZE];
+    char *failed = malloc(users_len ? users_len : 1);     /* users whose probe fails this round */
+    size_t failed_len = 0;
+
+    size_t pos = 0;
+    while (pos < users_len) {
+        /* start a batch of probes */
+        int n_probes = 0;
+        while (pos < users_len && n_probes < HB_BATCH_SIZE) {
+            if (hb_probe_start(&probes[n_probes], users + pos)) n_probes++;
+            pos += strlen(users + pos) + 1;
+        }
+
+        hb_probe_wait(probes, n_probes);
+
+        for (int i = 0; i < n_probes; i++) {
+            if (probes[i].alive) continue;
+            if (hb_is_suspect(probes[i].entry.username)) hb_mark_dead(&probes[i]);
+            else if (failed) failed_len = stpcpy(failed + failed_len, probes[i].entry.username) + 1 - failed;
+        }
+    } // END while
+
+    free(hb_suspects);
+    hb_suspects = failed;
+    hb_suspects_len = failed ? failed_len : 0;
+    free(users);
+}
+
+
+void *hb_thread(void *args) {
+    /*** Keeps the liveness of the listening threads up to date, so that messages to users
+     * whose client has crashed are stored as pending without waiting on a dead peer ***/
+    struct timespec interval = {hb_interval, 0};
+    while (TRUE) {
+        nanosleep(&interval, NULL);
+        hb_round();
+    }
+    return NULL;
+}
+
+
+int hb_init(const int interval) {
+    /*** Starts the heartbeat thread, probing listeners every given number of seconds (0 for never) ***/
+    hb_interval = interval;
+    if (!hb_interval) return 0;
+
+    CHECK_ERROR_WITH_ERRNO(pthread_create(&heartbeat_thread, NULL, hb_thread, NULL) != 0,
+                           "Could not create heartbeat thread", GEN_ERR_ANY)
+    pthread_detach(heartbeat_thread);
+    return 0;
+}
@@ -1,15 +1,22 @@
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
 #include "DS-Lab-Assignment/util.h"
 #include "DS-Lab-Assignment/netUtil.h"
+#include "DS-Lab-Assignment/reaper.h"
 
 
 /*** Sending functions ***/
 int send_server_reply(const int socket, const reply_t *reply) {
     /*** Sends server_error_code member to socket ***/
     int ret_val;    /* needed for error-checking macros */
-    CHECK_SOCK_ERROR(write_bytes(socket, (const char *) &reply->server_error_code, 1), socket)
+    CHECK_FUNC_ERROR_WITH_ERRNO(write_bytes(socket, (const char *) &reply->server_error_code, 1), GEN_ERR_ANY)
     return 0;
 }
 
@@ -17,11 +24,155 @@ int send_server_reply(const int socket, const reply_t *reply) {
 int send_string(const int socket, const char *string) {
     /*** Sends a string to socket ***/
     int ret_val;    /* needed for error-checking macros */
-    CHECK_SOCK_ERROR(write_bytes(socket, string, (int) (strlen(string) + 1)), socket)
+    CHECK_FUNC_ERROR_WITH_ERRNO(write_bytes(socket, string, (int) (strlen(string) + 1)), GEN_ERR_ANY)
     return 0;
 }
 
 
+int send_frame(const int socket, const char *buffer, const int len) {
+    /*** Sends a streamed message frame to socket: length string followed by len bytes;
+     * a frame with len 0 ends the stream ***/
+    int ret_val;    /* needed for error-checking macros */
+    char len_str[16]; sprintf(len_str, "%d", len);
+
+    CHECK_FUNC_ERROR(send_string(socket, len_str), GEN_ERR_ANY)
+    if (len > 0) {
+        CHECK_FUNC_ERROR_WITH_ERRNO(write_bytes(socket, buffer, len), GEN_ERR_ANY)
+    }
+    return 0;
+}
+
+
+int send_busy_reply(const int socket, const int retry_after_ms) {
+    /*** Sends SRV_ERR_BUSY server reply followed by the time (ms) the client should wait before retrying ***/
+    int ret_val;    /* needed for error-checking macros */
+    reply_t reply = {.server_error_code = SRV_ERR_BUSY};
+    char retry_str[16]; sprintf(retry_str, "%d", retry_after_ms);
+
+    CHECK_FUNC_ERROR(send_server_reply(socket, &reply), GEN_ERR_ANY)
+    CHECK_FUNC_ERROR(send_string(socket, retry_str), GEN_ERR_ANY)
+    return 0;
+}
+
+
+int send_redirect_reply(const int socket, const char *const node_addr) {
+    /*** Sends SRV_ERR_REDIRECT server reply followed by the address ("host:port")
+     * of the node the client should send its request to ***/
+    int ret_val;    /* needed for error-checking macros */
+    reply_t reply = {.server_error_code = SRV_ERR_REDIRECT};
+
+    CHECK_FUNC_ERROR(send_server_reply(socket, &reply), GEN_ERR_ANY)
+    CHECK_FUNC_ERROR(send_string(socket, node_addr), GEN_ERR_ANY)
+    return 0;
+}
+
+
+int connect_timeout(const int socket, const struct sockaddr *addr, const socklen_t addr_len, const int timeout_ms) {
+    /*** Connects a socket like connect, but gives up after timeout_ms (errno is then ETIMEDOUT),
+     * so that a dead peer can't hold the calling thread for the whole TCP connect timeout ***/
+    int flags = fcntl(socket, F_GETFL);
+    if (flags < 0 || fcntl(socket, F_SETFL, flags | O_NONBLOCK) < 0) return connect(socket, addr, addr_len);
+
+    int result = connect(socket, addr, addr_len);
+
+    /* a Unix socket whose listener has a full backlog is refused right away instead of connecting in the
+     * background: it's tried again until the timeout */
+    for (int waited_ms = 0; result < 0 && errno == EAGAIN && addr->sa_family == AF_UNIX; waited_ms += UNIX_RETRY_MS) {
+        if (waited_ms >= timeout_ms) {
+            errno = ETIMEDOUT;
+            break;
+        }
+        poll(NULL, 0, UNIX_RETRY_MS);
+        result = connect(socket, addr, addr_len);
+    }
+
+    if (result < 0 && errno == EINPROGRESS) {
+        struct pollfd poll_fd = {.fd = socket, .events = POLLOUT};
+        int ready;
+        while ((ready = poll(&poll_fd, 1, timeout_ms)) < 0 && errno == EINTR);
+
+        int sock_error = 0;
+        socklen_t error_len = sizeof(sock_error);
+        if (ready == 0) sock_error = ETIMEDOUT;
+        else if (ready < 0) sock_error = errno;
+        else getsockopt(socket, SOL_SOCKET, SO_ERROR, &sock_error, &error_len);
+
+        result = sock_error ? -1 : 0;
+        errno = sock_error;
+    }
+
+    int saved_errno = errno;
+    fcntl(socket, F_SETFL, flags);
+    errno = saved_errno;
+    return result;
+}
+
+
+/*** Addressing functions ***/
+socklen_t set_listener_addr(const struct userdata *user, struct sockaddr_storage *addr) {
+    /*** Sets up the address of the listening thread of a given user: its Unix socket path if it has one,
+     * else its IP and port; returns the size of the address ***/
+    bzero(addr, sizeof(struct sockaddr_storage));
+    if (user->sock_path[0]) {
+        struct sockaddr_un *un_addr = (struct sockaddr_un *) addr;
+        un_addr->sun_family = AF_UNIX;
+        strncpy(un_addr->sun_path, user->sock_path, sizeof un_addr->sun_path - 1);
+        return sizeof(struct sockaddr_un);
+    }
+
+    struct sockaddr_in *in_addr = (struct sockaddr_in *) addr;
+    in_addr->sin_family = AF_INET;
+    in_addr->sin_addr = user->ip;
+    in_addr->sin_port = htons(user->port);
+    return sizeof(struct sockaddr_in);
+}
+
+
+int unix_listen(const char *const path) {
+    /*** Creates a listening socket bound to a given Unix socket path, replacing a stale socket file ***/
+    int ret_val;    /* needed for error-checking macros */
+    struct sockaddr_un addr;
+    int unix_socket;
+    CHECK_ARGS(strlen(path) >= sizeof addr.sun_path, "Unix Socket Path Too Long")
+    bzero(&addr, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    CHECK_FUNC_ERROR_WITH_ERRNO(unix_socket = socket(AF_UNIX, SOCK_STREAM, 0), GEN_ERR_ANY)
+    unlink(path);
+    CHECK_SOCK_ERROR(bind(unix_socket, (struct sockaddr *) &addr, sizeof addr), unix_socket)
+    CHECK_SOCK_ERROR(listen(unix_socket, LISTEN_BACKLOG), unix_socket)
+    return unix_socket;
+}
+
+
+int unix_path_valid(const char *const path, const int len) {
+    /*** Checks that a Unix socket path given by a client is well formed: absolute, short enough
+     * to fit in sun_path, made of printable chars, and with no "." or ".." components ***/
+    if (len < 2 || len >= UNIX_PATH_MAX_SIZE || path[0] != '/' || path[len - 1] == '/') return FALSE;
+    for (int pos = 0; pos < len; pos++) {
+        if (path[pos] <= ' ' || path[pos] == 0x7f) return FALSE;
+        if (path[pos] != '/') continue;
+
+        /* component after this '/' */
+        int comp_len = 1;
+        while (pos + comp_len < len && path[pos + comp_len] != '/') comp_len++;
+        comp_len--;
+        if (comp_len == 0 || (comp_len == 1 && path[pos + 1] == '.') ||
+            (comp_len == 2 && path[pos + 1] == '.' && path[pos + 2] == '.'))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+
+int username_valid(const char *const username) {
+    /*** Checks that a username given by a client can be used as a single DB path component:
+     * not empty, no '/', and not "." or ".." ***/
+    if (username[0] == '\0' || strchr(username, '/') != NULL) return FALSE;
+    return strcmp(username, ".") != 0 && strcmp(username, "..") != 0;
+}
+
 /*** Receiving functions ***/
 int recv_string(const int socket, char *string) {
     /*** Receives a string from socket ***/
@@ -29,3 +180,118 @@ int recv_string(const int socket, char *string) {
     CHECK_SOCK_ERROR(read_line(socket, string, MAX_MSG_SIZE), socket)
     return 0;
 }
+
+
+void conn_init(conn_t *conn, const int socket) {
+    /*** Sets up a connection with an empty receive buffer ***/
+    conn->socket = socket;
+    conn->start = 0;
+    conn->end = 0;
+    conn->watch = NULL;
+}
+
+
+void conn_release(conn_t *conn) {
+    /*** Discards the parsed part of the receive buffer to make room for new bytes;
+     * slices received before this call are no longer valid ***/
+    memmove(conn->buffer, conn->buffer + conn->start, conn->end - conn->start);
+    conn->end -= conn->start;
+    conn->start = 0;
+}
+
+
+int recv_slice(conn_t *conn, slice_t *slice) {
+    /*** Receives a string field from a connection without copying it: the field is
+     * '\0'-terminated in place and the slice points to it; like recv_string,
+     * it ends at '\0' or '\n' and keeps at most (MAX_MSG_SIZE - 1) chars ***/
+    int scan = conn->start;     /* position where the search for the field end goes on */
+
+    while (TRUE) {
+        char *field_end = memchr(conn->buffer + scan, '\0', conn->end - scan);
+        char *line_end = memchr(conn->buffer + scan, '\n', conn->end - scan);
+        if (line_end && (!field_end || line_end < field_end)) field_end = line_end;
+        if (field_end) {
+            scan = (int) (field_end - conn->buffer);
+            break;
+        }
+        scan = conn->end;
+
+        /* field end not received yet */
+        if (conn->end == CONN_BUF_SIZE) {
+            /* like read_line, chars past (MAX_MSG_SIZE - 1) are discarded: a field that fills the buffer
+             * already has more than that, so its tail is dropped to make room for the rest of it */
+            int kept_end = conn->start + MAX_MSG_SIZE - 1;
+            CHECK_ERROR(kept_end >= CONN_BUF_SIZE, "Request too long for connection buffer", GEN_ERR_ANY)
+            conn->end = kept_end;
+            scan = kept_end;
+        }
+        if (conn->watch) rp_wait_begin(conn->watch);
+        ssize_t bytes_read = recv(conn->socket, conn->buffer + conn->end, CONN_BUF_SIZE - conn->end, 0);
+        if (conn->watch) rp_wait_end(conn->watch);
+        if (bytes_read < 0 && errno == EINTR) continue;
+        if (bytes_read <= 0) return GEN_ERR_ANY;    /* error or EOF in the middle of a field */
+        conn->end += (int) bytes_read;
+    }
+
+    conn->buffer[scan] = '\0';
+    slice->ptr = conn->buffer + conn->start;
+    slice->len = scan - conn->start;
+    if (slice->len > MAX_MSG_SIZE - 1) {    /* discard > (MAX_MSG_SIZE - 1) chars */
+        /* the discarded chars are dropped from the buffer, so that its parsed part
+         * holds just the fields received, each one '\0'-terminated */
+        slice->len = MAX_MSG_SIZE - 1;
+        int discarded = scan - (conn->start + slice->len);
+        memmove(conn->buffer + conn->start + slice->len, conn->buffer + scan, conn->end - scan);
+        conn->end -= discarded;
+        scan -= discarded;
+    }
+
+    conn->start = scan + 1;
+    return slice->len;
+}
+
+
+int recv_bytes(conn_t *conn, char *buffer, const int len) {
+    /*** Receives len raw bytes from a connection into given buffer:
+     * first the ones already in the receive buffer, then straight from the socket;
+     * returns fewer than len bytes if the peer closed the connection first ***/
+    int received = conn->end - conn->start;
+    if (received > len) received = len;
+
+    memcpy(buffer, conn->buffer + conn->start, received);
+    conn->start += received;
+
+    /* each recv is a wait of its own, so that the peer is held to the idle timeout only while it sends nothing */
+    while (received < len) {
+        if (conn->watch) rp_wait_begin(conn->watch);
+        ssize_t bytes_read = recv(conn->socket, buffer + received, len - received, 0);
+        if (conn->watch) rp_wait_end(conn->watch);
+        if (bytes_read < 0 && errno == EINTR) continue;
+        if (bytes_read < 0) return GEN_ERR_ANY;
+        if (bytes_read == 0) break;     /* EOF */
+        received += (int) bytes_read;
+    } // END while
+    return received;
+}
+
+
+int recv_frame(conn_t *conn, char *buffer, const int buf_space) {
+    /*** Receives a streamed message frame from a connection into given buffer;
+     * returns the frame length, which is 0 for the frame that ends the stream;
+     * releases the connection buffer, since a stream doesn't fit in it ***/
+    int ret_val;    /* needed for error-checking macros */
+    slice_t len_str;
+    int len;
+
+    /* the request fields are in, so the request deadline is over; frames are only held to the idle timeout */
+    if (conn->watch) rp_request_done(conn->watch);
+    conn_release(conn);
+    CHECK_FUNC_ERROR(recv_slice(conn, &len_str), GEN_ERR_ANY)
+    CHECK_ERROR(str_to_num(len_str.ptr, (void *) &len, INT) < 0 || len < 0 || len > buf_space,
+                "Invalid frame length", GEN_ERR_ANY)
+    if (!len) return 0;
+
+    CHECK_FUNC_ERROR(recv_bytes(conn, buffer, len), GEN_ERR_ANY)
+    CHECK_ERROR(ret_val != len, "Stream ended in the middle of a frame", GEN_ERR_ANY)
+    return len;
+}
@@ -0,0 +1,70 @@
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "DS-Lab-Assignment/normalize.h"
+
+#define NORM_BLOCK_SIZE 16      /* bytes checked at a time by the SSE2 kernel */
+
+static int norm_is_space(char c);
+static int norm_collapse_run(char *string, int len, int *read_pos, int write_pos);
+
+
+static int norm_is_space(const char c) {
+    /*** Whitespace as isspace() in the C locale: ' ', '\t', '\n', '\v', '\f' and '\r' ***/
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+
+static int norm_collapse_run(char *string, const int len, int *read_pos, int write_pos) {
+    /*** Copies the char at *read_pos to write_pos, unless it starts a run of two or more
+     * whitespace chars, which is replaced with a single space; returns the new write position ***/
+    int run_end = *read_pos + 1;
+    if (norm_is_space(string[*read_pos]))
+        while (run_end < len && norm_is_space(string[run_end])) run_end++;
+
+    string[write_pos] = (run_end - *read_pos >= 2) ? ' ' : string[*read_pos];
+    *read_pos = run_end;
+    return write_pos + 1;
+}
+
+
+int norm_collapse_spaces(char *string, const int len) {
+    /*** Replaces, in place, every run of two or more whitespace chars with a single space,
+     * like re.sub("\s\s+", " ", string) on ASCII text; returns the new length, and '\0'-terminates
+     * the string if it shrinks; with SSE2, blocks holding no such run are copied 16 bytes at a time ***/
+    int read_pos = 0, write_pos = 0;
+
+#ifdef __SSE2__
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i below_tab = _mm_set1_epi8('\t' - 1);
+    const __m128i above_cr = _mm_set1_epi8('\r' + 1);
+#endif
+
+    while (read_pos < len) {
+#ifdef __SSE2__
+        if (read_pos + NORM_BLOCK_SIZE <= len) {
+            __m128i block = _mm_loadu_si128((const __m128i *) (string + read_pos));
+            /* bytes >= 0x80 are negative, so they never fall in the '\t'..'\r' range */
+            __m128i is_space = _mm_or_si128(_mm_cmpeq_epi8(block, space),
+                                            _mm_and_si128(_mm_cmpgt_epi8(block, below_tab),
+                                                          _mm_cmplt_epi8(block, above_cr)));
+            int space_mask = _mm_movemask_epi8(is_space);
+
+            /* no two whitespace chars in a row, and no run going on past the block:
+             * runs are always consumed whole, so none comes in from the previous block */
+            if (!(space_mask & (space_mask >> 1)) && !(space_mask & (1 << (NORM_BLOCK_SIZE - 1)))) {
+                /* writes never get ahead of reads, so the block can be stored in place */
+                if (write_pos != read_pos) _mm_storeu_si128((__m128i *) (string + write_pos), block);
+                read_pos += NORM_BLOCK_SIZE;
+                write_pos += NORM_BLOCK_SIZE;
+                continue;
+            }
+        }
+#endif
+        write_pos = norm_collapse_run(string, len, &read_pos, write_pos);
+    } // END while
+
+    if (write_pos < len) string[write_pos] = '\0';
+    return write_pos;
+}
@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include "DS-Lab-Assignment/reaper.h"
+
+
+static timer_wheel_t rp_wheel;      /* ticks are ms of CLOCK_MONOTONIC */
+static int rp_running = FALSE;
+static int rp_idle_ms = CONN_IDLE_TIMEOUT_MS;
+static int rp_request_ms = CONN_REQUEST_TIMEOUT_MS;
+static pthread_mutex_t mutex_rp = PTHREAD_MUTEX_INITIALIZER;
+
+static long long rp_now_ms(void);
+static long long rp_next_check(const rp_watch_t *watch, long long now_ms);
+static int rp_check(rp_watch_t *watch, long long now_ms);
+static void *rp_reaper_thread(void *args);
+
+
+static long long rp_now_ms(void) {
+    /*** Returns a monotonic timestamp in milliseconds ***/
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+}
+
+
+static long long rp_next_check(const rp_watch_t *watch, const long long now_ms) {
+    /*** Time at which a watched connection may have to be reaped: the earliest of the end of its idle time
+     * and its request deadline; while the server isn't waiting on the peer, idle time doesn't go by ***/
+    long long next_ms = now_ms + (rp_idle_ms ? rp_idle_ms : rp_request_ms);
+    long long deadline_ms = __atomic_load_n(&watch->request_deadline_ms, __ATOMIC_RELAXED);
+
+    if (rp_idle_ms && __atomic_load_n(&watch->waiting, __ATOMIC_ACQUIRE))
+        next_ms = __atomic_load_n(&watch->wait_start_ms, __ATOMIC_RELAXED) + rp_idle_ms;
+    if (deadline_ms && deadline_ms < next_ms) next_ms = deadline_ms;
+    return next_ms;
+}
+
+
+static int rp_check(rp_watch_t *watch, const long long now_ms) {
+    /*** Shuts a watched connection down if the server has been waiting on its peer for too long, so that
+     * the service thread blocked on it gets an error; returns FALSE if the connection is still fine;
+     * mutex_rp must be held, so that the socket isn't closed in the meantime ***/
+    if (!__atomic_load_n(&watch->waiting, __ATOMIC_ACQUIRE)) return FALSE;
+    long long idle_ms = now_ms - __atomic_load_n(&watch->wait_start_ms, __ATOMIC_RELAXED);
+    long long deadline_ms = __atomic_load_n(&watch->request_deadline_ms, __ATOMIC_RELAXED);
+
+    if (rp_idle_ms && idle_ms >= rp_idle_ms) {
+        printf("s> connection reaped: nothing received for %lld ms\n", idle_ms); fflush(stdout);
+    } else if (deadline_ms && now_ms >= deadline_ms) {
+        printf("s> connection reaped: request not received within %d ms\n", rp_request_ms); fflush(stdout);
+    } else return FALSE;
+
+    shutdown(watch->socket, SHUT_RDWR);
+    return TRUE;
+}
+
+
+static void *rp_reaper_thread(void *args) {
+    /*** Ticks the timer wheel every RP_TICK_MS: connections whose timers go off are either reaped
+     * or, if their peers aren't late after all, rearmed ***/
+    struct timespec interval = {RP_TICK_MS / 1000, (RP_TICK_MS % 1000) * 1000000L};
+    while (TRUE) {
+        nanosleep(&interval, NULL);
+
+        pthread_mutex_lock(&mutex_rp);
+        long long now_ms = rp_now_ms();
+        tw_timer_t *timer = tw_advance(&rp_wheel, now_ms);
+        while (timer) {
+            tw_timer_t *next = timer->next;
+            rp_watch_t *watch = (rp_watch_t *) timer->data;
+            timer->next = NULL;
+
+            if (!rp_check(watch, now_ms)) {
+                timer->expires = rp_next_check(watch, now_ms);
+                tw_add(&rp_wheel, timer);
+            }
+            timer = next;
+        } // END while
+        pthread_mutex_unlock(&mutex_rp);
+    } // END while
+    return NULL;
+}
+
+
+int rp_init(const int idle_timeout_ms, const int request_timeout_ms) {
+    /*** Starts reaping connections whose peers go idle_timeout_ms without sending anything
+     * or take over request_timeout_ms to send their requests; a timeout of 0 is disabled ***/
+    rp_idle_ms = idle_timeout_ms;
+    rp_request_ms = request_timeout_ms;
+    if (!rp_idle_ms && !rp_request_ms) return 0;
+
+    tw_init(&rp_wheel, rp_now_ms());
+    pthread_t reaper_th;
+    CHECK_ERROR(pthread_create(&reaper_th, NULL, rp_reaper_thread, NULL) != 0, "Could not start reaper thread",
+                GEN_ERR_ANY)
+    pthread_detach(reaper_th);
+    rp_running = TRUE;
+    return 0;
+}
+
+
+void rp_watch(rp_watch_t *watch, const int socket) {
+    /*** Starts watching a connection whose request is about to be received; writes to it
+     * give up once its peer hasn't made room for idle_timeout_ms ***/
+    long long now_ms = rp_now_ms();
+    watch->timer.data = watch;
+    watch->timer.pprev = NULL;
+    watch->timer.next = NULL;
+    watch->socket = socket;
+    watch->request_deadline_ms = rp_request_ms ? now_ms + rp_request_ms : 0;
+    watch->wait_start_ms = now_ms;
+    watch->waiting = FALSE;
+    if (!rp_running) return;
+
+    rp_send_deadline(socket);
+    pthread_mutex_lock(&mutex_rp);
+    watch->timer.expires = rp_next_check(watch, now_ms);
+    tw_add(&rp_wheel, &watch->timer);
+    pthread_mutex_unlock(&mutex_rp);
+}
+
+
+void rp_send_deadline(const int socket) {
+    /*** Makes writes to a socket give up once its peer hasn't made room for idle_timeout_ms,
+     * so that a peer that stops reading can't hold the writing thread ***/
+    if (!rp_idle_ms) return;
+    struct timeval send_timeout = {rp_idle_ms / 1000, (rp_idle_ms % 1000) * 1000};
+    setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof send_timeout);
+}
+
+
+void rp_unwatch(rp_watch_t *watch) {
+    /*** Stops watching a connection; once this returns, it isn't shut down anymore and may be closed ***/
+    if (!rp_running) return;
+    pthread_mutex_lock(&mutex_rp);
+    tw_del(&rp_wheel, &watch->timer);
+    pthread_mutex_unlock(&mutex_rp);
+}
+
+
+void rp_wait_begin(rp_watch_t *watch) {
+    /*** The server is about to block receiving from the peer of a watched connection; lock-free ***/
+    __atomic_store_n(&watch->wait_start_ms, rp_now_ms(), __ATOMIC_RELAXED);
+    __atomic_store_n(&watch->waiting, TRUE, __ATOMIC_RELEASE);
+}
+
+
+void rp_wait_end(rp_watch_t *watch) {
+    /*** The server is done receiving from the peer of a watched connection; lock-free ***/
+    __atomic_store_n(&watch->waiting, FALSE, __ATOMIC_RELEASE);
+}
+
+
+void rp_request_done(rp_watch_t *watch) {
+    /*** The request fields of a watched connection are in: the request deadline no longer applies,
+     * so that the content of a stream can take as long as its peer keeps sending it ***/
+    __atomic_store_n(&watch->request_deadline_ms, 0, __ATOMIC_RELAXED);
+}
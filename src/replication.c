@@ -0,0 +1,324 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include "DS-Lab-Assignment/netUtil.h"
+#include "DS-Lab-Assignment/dbms/dbmsEngine.h"
+#include "DS-Lab-Assignment/replication.h"
+
+
+/* DB mutation waiting to be shipped to the standby */
+typedef struct repl_rec {
+    char op;
+    entry_t entry;
+    struct repl_rec *next;
+} repl_rec_t;
+
+/* mutation queue of the standby being served (only one at a time) */
+static repl_rec_t *repl_head = NULL, *repl_tail = NULL;
+static size_t repl_len = 0;
+static int repl_active = FALSE;         /* mutations are only queued while a standby is connected */
+static int repl_overflow = FALSE;       /* standby too slow: it will have to sync again */
+static pthread_mutex_t mutex_repl = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond_repl_not_empty = PTHREAD_COND_INITIALIZER;
+static int repl_listen_socket = -1;
+static pthread_t repl_listen_th;
+
+void repl_hook(char op, const entry_t *entry);
+int repl_send_record(int socket, char op, const entry_t *entry);
+int repl_snapshot_emit(char op, const entry_t *entry, void *args);
+void repl_ship(int standby_socket);
+void *repl_listen_thread(void *args);
+int repl_recv_record(conn_t *conn);
+int repl_follow(int primary_socket, int *synced);
+int repl_elapsed_ms(const struct timespec *since);
+
+
+/***** Primary Side *****/
+void repl_hook(const char op, const entry_t *const entry) {
+    /*** DB mutation hook: queues the mutation for the standby, if there's one ***/
+    pthread_mutex_lock(&mutex_repl);
+    if (repl_active && !repl_overflow) {
+        repl_rec_t *rec = (repl_len < REPL_QUEUE_MAX) ? malloc(sizeof(repl_rec_t)) : NULL;
+        if (rec) {
+            rec->op = op;
+            memcpy(&rec->entry, entry, sizeof(entry_t));
+            rec->next = NULL;
+            if (repl_tail) repl_tail->next = rec;
+            else repl_head = rec;
+            repl_tail = rec;
+            repl_len++;
+        } else repl_overflow = TRUE;
+        pthread_cond_signal(&cond_repl_not_empty);
+    }
+    pthread_mutex_unlock(&mutex_repl);
+}
+
+
+int repl_send_record(const int socket, const char op, const entry_t *const entry) {
+    /*** Sends a DB mutation to the standby; streamed pending messages go with their body ***/
+    int ret_val;    /* needed for error-checking macros */
+    char op_str[2] = {op, '\0'};
+    CHECK_FUNC_ERROR(send_string(socket, REPL_MUTATION), GEN_ERR_ANY)
+    CHECK_FUNC_ERROR(send_string(socket, op_str), GEN_ERR_ANY)
+    CHECK_FUNC_ERROR(send_frame(socket, (const char *) entry, sizeof(entry_t)), GEN_ERR_ANY)
+
+    if (op != DB_MUT_PUT || entry->type != ENT_TYPE_P_MSG || !(entry->msg.flags & MSG_FLAG_STREAM))
+        return 0;
+
+    /* a body deleted in the meantime is sent empty: its deletion follows */
+    int body_fd = db_engine->open_msg_body(entry, READ);
+    int result = 0;
+    if (body_fd >= 0) {
+        char chunk[STREAM_CHUNK_SIZE];
+        ssize_t chunk_len;
+        while (result == 0 && (chunk_len = read(body_fd, chunk, STREAM_CHUNK_SIZE)) > 0)
+            result = send_frame(socket, chunk, (int) chunk_len);
+        db_engine->close_msg_body(body_fd, READ);
+    }
+    if (result < 0) return GEN_ERR_ANY;
+    return send_frame(socket, NULL, 0);
+}
+
+
+int repl_snapshot_emit(const char op, const entry_t *const entry, void *args) {
+    /*** Sends an entry of the DB copy to the standby; called by db_repl_snapshot ***/
+    return repl_send_record(*(int *) args, op, entry) < 0 ? DBMS_ERR_ANY : DBMS_SUCCESS;
+}
+
+
+void repl_ship(int standby_socket) {
+    /*** Serves a standby: sends it a copy of the DB, then every DB mutation as it happens;
+     * mutations are queued from before the copy starts, so none is missed ***/
+    pthread_mutex_lock(&mutex_repl);
+    repl_active = TRUE;
+    repl_overflow = FALSE;
+    pthread_mutex_unlock(&mutex_repl);
+
+    int result = (send_string(standby_socket, REPL_SYNC) < 0 ||
+                  db_engine->repl_snapshot(repl_snapshot_emit, &standby_socket) < 0 ||
+                  send_string(standby_socket, REPL_SYNCED) < 0) ? GEN_ERR_ANY : 0;
+    if (result == 0) {
+        printf("s> standby in sync\n"); fflush(stdout);
+    }
+
+    while (result == 0) {
+        /* take the whole queue, or wait for it to fill up until it's time to ping the standby */
+        pthread_mutex_lock(&mutex_repl);
+        if (!repl_head && !repl_overflow) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += (REPL_PING_MS % 1000) * 1000000L;
+            deadline.tv_sec += REPL_PING_MS / 1000 + deadline.tv_nsec / 1000000000L;
+            deadline.tv_nsec %= 1000000000L;
+            pthread_cond_timedwait(&cond_repl_not_empty, &mutex_repl, &deadline);
+        }
+        repl_rec_t *batch = repl_head;
+        int overflow = repl_overflow;
+        repl_head = repl_tail = NULL;
+        repl_len = 0;
+        pthread_mutex_unlock(&mutex_repl);
+
+        /* a standby that can't keep up is told so before being dropped, so that it doesn't take over */
+        if (overflow) {
+            send_string(standby_socket, REPL_RESYNC);
+            result = GEN_ERR_ANY;
+        } else if (!batch) result = send_string(standby_socket, REPL_PING);
+
+        while (batch) {
+            repl_rec_t *next = batch->next;
+            if (result == 0) result = repl_send_record(standby_socket, batch->op, &batch->entry);
+            free(batch);
+            batch = next;
+        }
+    } // END while
+
+    /* stop queueing mutations */
+    pthread_mutex_lock(&mutex_repl);
+    repl_active = FALSE;
+    while (repl_head) {
+        repl_rec_t *next = repl_head->next;
+        free(repl_head);
+        repl_head = next;
+    }
+    repl_tail = NULL;
+    repl_len = 0;
+    pthread_mutex_unlock(&mutex_repl);
+
+    printf("s> standby lost\n"); fflush(stdout);
+}
+
+
+void *repl_listen_thread(void *args) {
+    /*** Accepts standby connections, serving one standby at a time ***/
+    while (TRUE) {
+        int standby_socket = accept(repl_listen_socket, NULL, NULL);
+        if (standby_socket < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            perror("Error accepting standby connection");
+            return NULL;
+        }
+
+        printf("s> standby connected\n"); fflush(stdout);
+        repl_ship(standby_socket);
+        close(standby_socket);
+    } // END while
+}
+
+
+int repl_primary_init(const int repl_port) {
+    /*** Makes this server a primary: standby servers can connect to given port
+     * to get a copy of the DB that is kept up to date ***/
+    int ret_val;    /* needed for error-checking macros */
+    struct sockaddr_in repl_addr;
+    int val = 1;
+
+    CHECK_FUNC_ERROR_WITH_ERRNO(repl_listen_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP), GEN_ERR_ANY)
+    CHECK_SOCK_ERROR(setsockopt(repl_listen_socket, SOL_SOCKET, SO_REUSEADDR, (char *) &val, sizeof(int)),
+                     repl_listen_socket)
+
+    bzero((char *) &repl_addr, sizeof(repl_addr));
+    repl_addr.sin_family = AF_INET;
+    repl_addr.sin_addr.s_addr = INADDR_ANY;
+    repl_addr.sin_port = htons(repl_port);
+
+    CHECK_SOCK_ERROR(bind(repl_listen_socket, (struct sockaddr *) &repl_addr, sizeof repl_addr), repl_listen_socket)
+    CHECK_SOCK_ERROR(listen(repl_listen_socket, 1), repl_listen_socket)
+
+    db_engine->repl_set_hook(repl_hook);
+    CHECK_ERROR_WITH_ERRNO(pthread_create(&repl_listen_th, NULL, repl_listen_thread, NULL) != 0,
+                           "Could not create replication thread", GEN_ERR_ANY)
+    pthread_detach(repl_listen_th);
+
+    printf("s> replication on port %d\n", repl_port); fflush(stdout);
+    return 0;
+}
+
+
+/***** Standby Side *****/
+int repl_recv_record(conn_t *conn) {
+    /*** Receives a DB mutation from the primary and applies it ***/
+    int ret_val;    /* needed for error-checking macros */
+    slice_t op_str;
+    entry_t entry;
+
+    CHECK_FUNC_ERROR(recv_slice(conn, &op_str), GEN_ERR_ANY)
+    char op = op_str.ptr[0];
+    CHECK_FUNC_ERROR(recv_frame(conn, (char *) &entry, sizeof(entry_t)), GEN_ERR_ANY)
+    CHECK_ERROR(ret_val != sizeof(entry_t), "Invalid replication record", GEN_ERR_ANY)
+
+    /* the body of a streamed pending message comes before the message entry is written */
+    if (op == DB_MUT_PUT && entry.type == ENT_TYPE_P_MSG && entry.msg.flags & MSG_FLAG_STREAM) {
+        char chunk[STREAM_CHUNK_SIZE];
+        int chunk_len;
+        int body_fd = db_engine->open_msg_body(&entry, CREATE);
+        while ((chunk_len = recv_frame(conn, chunk, STREAM_CHUNK_SIZE)) > 0)
+            if (body_fd >= 0 && write_bytes(body_fd, chunk, chunk_len) < 0) {
+                db_engine->close_msg_body(body_fd, CREATE);
+                body_fd = -1;
+            }
+        if (body_fd >= 0) db_engine->close_msg_body(body_fd, CREATE);
+        if (chunk_len < 0) return GEN_ERR_ANY;
+    }
+
+    /* a mutation that can't be applied only leaves that entry behind */
+    if (db_engine->repl_apply(op, &entry) < 0)
+        fprintf(stderr, "Could not apply replicated mutation to user %s\n", entry.username);
+    return 0;
+}
+
+
+int repl_follow(const int primary_socket, int *synced) {
+    /*** Applies what the primary sends until the connection is lost or goes silent,
+     * or until the primary asks for a new sync (returns 0 then) ***/
+    conn_t conn;
+    slice_t op_code;
+    conn_init(&conn, primary_socket);
+
+    while (TRUE) {
+        conn_release(&conn);
+        if (recv_slice(&conn, &op_code) < 0) return GEN_ERR_ANY;
+
+        if (!strcmp(op_code.ptr, REPL_PING)) continue;
+        else if (!strcmp(op_code.ptr, REPL_MUTATION)) {
+            if (repl_recv_record(&conn) < 0) return GEN_ERR_ANY;
+        } else if (!strcmp(op_code.ptr, REPL_SYNC)) {
+            *synced = FALSE;
+            if (db_engine->repl_reset() < 0) return GEN_ERR_ANY;
+        } else if (!strcmp(op_code.ptr, REPL_SYNCED)) {
+            *synced = TRUE;
+            printf("s> standby in sync with primary\n"); fflush(stdout);
+        } else if (!strcmp(op_code.ptr, REPL_RESYNC)) {
+            printf("s> standby dropped by primary: syncing again\n"); fflush(stdout);
+            return 0;
+        } else return GEN_ERR_ANY;
+    } // END while
+}
+
+
+int repl_elapsed_ms(const struct timespec *const since) {
+    /*** Time (ms of CLOCK_MONOTONIC) elapsed since a given moment ***/
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int) ((now.tv_sec - since->tv_sec) * 1000 + (now.tv_nsec - since->tv_nsec) / 1000000);
+}
+
+
+int repl_standby_run(const char *const primary) {
+    /*** Makes this server a standby of a given primary ("host:port" of its replication port):
+     * returns once the primary can't be reached for REPL_TAKEOVER_MS after the DB has been in sync with it,
+     * so that this server takes over; until then, it keeps connecting to it again ***/
+    struct sockaddr_in primary_addr;
+    struct hostent *primary_host;
+    int primary_port;
+    int synced = FALSE;
+    int lost = FALSE;               /* the connection to the primary is lost, since lost_at */
+    struct timespec lost_at;
+
+    /* parse primary address */
+    const char *colon = strrchr(primary, ':');
+    CHECK_ARGS(!colon || str_to_num(colon + 1, (void *) &primary_port, INT) < 0, "Invalid Primary Address")
+    char hostname[colon - primary + 1];
+    memcpy(hostname, primary, colon - primary);
+    hostname[colon - primary] = '\0';
+    primary_host = gethostbyname(hostname);
+    CHECK_ERROR(!primary_host, "Could not resolve primary host", GEN_ERR_ANY)
+
+    bzero((char *) &primary_addr, sizeof(primary_addr));
+    memcpy(&primary_addr.sin_addr, primary_host->h_addr_list[0], sizeof(struct in_addr));
+    primary_addr.sin_family = AF_INET;
+    primary_addr.sin_port = htons(primary_port);
+
+    printf("s> standby of %s\n", primary); fflush(stdout);
+    struct timespec retry = {REPL_RETRY_MS / 1000, (REPL_RETRY_MS % 1000) * 1000000L};
+    struct timeval timeout = {REPL_TIMEOUT_MS / 1000, (REPL_TIMEOUT_MS % 1000) * 1000};
+
+    /* a lost connection isn't a lost primary: it may have dropped this standby, or stalled for a while */
+    while (!synced || !lost || repl_elapsed_ms(&lost_at) < REPL_TAKEOVER_MS) {
+        int primary_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (primary_socket < 0 || connect_timeout(primary_socket, (struct sockaddr *) &primary_addr,
+                                                  sizeof(primary_addr), REPL_TIMEOUT_MS) < 0) {
+            if (primary_socket >= 0) close(primary_socket);
+            nanosleep(&retry, NULL);
+            continue;
+        }
+
+        /* a primary that sends nothing for REPL_TIMEOUT_MS (not even a ping) is reconnected to */
+        setsockopt(primary_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        repl_follow(primary_socket, &synced);
+        close(primary_socket);
+
+        lost = TRUE;
+        clock_gettime(CLOCK_MONOTONIC, &lost_at);
+    } // END while
+
+    printf("s> primary lost: taking over\n"); fflush(stdout);
+    return 0;
+}
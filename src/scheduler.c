@@ -0,0 +1,183 @@
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include "DS-Lab-Assignment/scheduler.h"
+
+
+#define SCHED_QUEUE_SIZE 64     /* max number of jobs waiting per class; connections are bounded by admission */
+
+/* jobs of a class waiting for a service thread, and what is left of the class share in this round */
+typedef struct {
+    sched_job_t jobs[SCHED_QUEUE_SIZE];
+    int head;
+    int size;
+    int weight;                 /* jobs taken per round of the weighted round robin */
+    int credits;                /* jobs that may still be taken in this round */
+} sched_queue_t;
+
+static sched_queue_t sched_queues[SCHED_N_CLASSES] = {
+        {.weight = SCHED_WEIGHT_CONTROL, .credits = SCHED_WEIGHT_CONTROL},
+        {.weight = SCHED_WEIGHT_MESSAGE, .credits = SCHED_WEIGHT_MESSAGE},
+        {.weight = SCHED_WEIGHT_BACKGROUND, .credits = SCHED_WEIGHT_BACKGROUND},
+};
+static int max_bulk_threads = 1;    /* service threads that may be busy with jobs other than control ones */
+static int busy_threads = 0;        /* service threads running a job */
+static int busy_bulk_threads = 0;   /* service threads running a job other than a control one */
+static pthread_mutex_t mutex_sched = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond_sched_ready = PTHREAD_COND_INITIALIZER;      /* a job may be taken */
+static pthread_cond_t cond_sched_drained = PTHREAD_COND_INITIALIZER;    /* no jobs waiting or running */
+
+static int sched_put(const sched_job_t *job);
+static sched_queue_t *sched_pick(void);
+static int sched_waiting(void);
+
+
+static int sched_put(const sched_job_t *job) {
+    /*** Queues a job in the queue of its class; returns GEN_ERR_ANY if the queue is full ***/
+    sched_queue_t *queue = &sched_queues[job->class];
+
+    pthread_mutex_lock(&mutex_sched);
+    if (queue->size == SCHED_QUEUE_SIZE) {
+        pthread_mutex_unlock(&mutex_sched);
+        return GEN_ERR_ANY;
+    }
+    queue->jobs[(queue->head + queue->size) % SCHED_QUEUE_SIZE] = *job;
+    queue->size += 1;
+    pthread_cond_signal(&cond_sched_ready);
+    pthread_mutex_unlock(&mutex_sched);
+    return 0;
+}
+
+
+static sched_queue_t *sched_pick(void) {
+    /*** Weighted round robin: picks the highest priority class with jobs waiting and credits left,
+     * starting a new round once every class with jobs waiting has used its credits; jobs other than
+     * control ones can't take the service threads kept for control requests; returns NULL if
+     * there is no job that can be taken; mutex_sched must be held ***/
+    int bulk_allowed = busy_bulk_threads < max_bulk_threads;
+
+    for (int round = 0; round < 2; round++) {
+        for (int class = 0; class < SCHED_N_CLASSES; class++) {
+            sched_queue_t *queue = &sched_queues[class];
+            if (queue->size && queue->credits > 0 && (class == SCHED_CONTROL || bulk_allowed)) return queue;
+        }
+        for (int class = 0; class < SCHED_N_CLASSES; class++) sched_queues[class].credits = sched_queues[class].weight;
+    }
+    return NULL;
+}
+
+
+static int sched_waiting(void) {
+    /*** Number of jobs waiting, of any class; mutex_sched must be held ***/
+    int n_jobs = 0;
+    for (int class = 0; class < SCHED_N_CLASSES; class++) n_jobs += sched_queues[class].size;
+    return n_jobs;
+}
+
+
+void sched_init(const int n_threads) {
+    /*** Sets the number of service threads taking jobs, SCHED_CONTROL_RESERVED of which
+     * are kept for control requests (but at least one thread may take other jobs) ***/
+    pthread_mutex_lock(&mutex_sched);
+    max_bulk_threads = (n_threads - SCHED_CONTROL_RESERVED > 1) ? n_threads - SCHED_CONTROL_RESERVED : 1;
+    pthread_mutex_unlock(&mutex_sched);
+}
+
+
+int sched_classify(const int socket) {
+    /*** Finds out the class of the request made over a new connection, by peeking at its op_code;
+     * returns GEN_ERR_ANY if the op_code hasn't fully arrived yet ***/
+    char op_code[32];
+    ssize_t bytes_read = recv(socket, op_code, sizeof op_code - 1, MSG_PEEK | MSG_DONTWAIT);
+    if (bytes_read < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return GEN_ERR_ANY;
+    /* on EOF or error, the service thread finds out when it receives the request */
+    if (bytes_read <= 0) return SCHED_MESSAGE;
+
+    /* the op_code ends at '\0' or '\n', like every other field */
+    op_code[bytes_read] = '\0';
+    size_t len = strcspn(op_code, "\n");
+    if (len == (size_t) bytes_read) return (bytes_read == sizeof op_code - 1) ? SCHED_MESSAGE : GEN_ERR_ANY;
+    op_code[len] = '\0';
+
+    if (!strcmp(op_code, REGISTER) || !strcmp(op_code, UNREGISTER) || !strcmp(op_code, CONNECT) ||
+        !strcmp(op_code, DISCONNECT) || !strcmp(op_code, CONNECTEDUSERS))
+        return SCHED_CONTROL;
+    return SCHED_MESSAGE;
+}
+
+
+int sched_put_conn(const int socket, const int class) {
+    /*** Queues a client connection to be served, as a request of a given class ***/
+    sched_job_t job = {.socket = socket, .task = NULL, .args = NULL, .class = class};
+    return sched_put(&job);
+}
+
+
+int sched_put_task(void (*task)(void *args), void *args) {
+    /*** Queues a background task; returns GEN_ERR_ANY if there are too many of them,
+     * so the caller should run it itself ***/
+    sched_job_t job = {.socket = -1, .task = task, .args = args, .class = SCHED_BACKGROUND};
+    return sched_put(&job);
+}
+
+
+void sched_take(sched_job_t *job) {
+    /*** Takes the next job to run, sleeping until there is one; called by service threads ***/
+    sched_queue_t *queue;
+
+    pthread_mutex_lock(&mutex_sched);
+    while (!(queue = sched_pick()))
+        pthread_cond_wait(&cond_sched_ready, &mutex_sched);
+
+    *job = queue->jobs[queue->head];
+    queue->head = (queue->head + 1) % SCHED_QUEUE_SIZE;
+    queue->size -= 1;
+    queue->credits -= 1;
+    busy_threads += 1;
+    if (job->class != SCHED_CONTROL) busy_bulk_threads += 1;
+    pthread_mutex_unlock(&mutex_sched);
+}
+
+
+void sched_done(const sched_job_t *job) {
+    /*** Tells the scheduler that a job taken has been run ***/
+    pthread_mutex_lock(&mutex_sched);
+    busy_threads -= 1;
+    if (job->class != SCHED_CONTROL) {
+        /* a job that was held back to keep threads for control requests may be taken now */
+        busy_bulk_threads -= 1;
+        pthread_cond_signal(&cond_sched_ready);
+    }
+    if (busy_threads == 0 && sched_waiting() == 0) pthread_cond_broadcast(&cond_sched_drained);
+    pthread_mutex_unlock(&mutex_sched);
+}
+
+
+int sched_depth(void) {
+    /*** Number of client connections waiting to be served ***/
+    pthread_mutex_lock(&mutex_sched);
+    int depth = sched_queues[SCHED_CONTROL].size + sched_queues[SCHED_MESSAGE].size;
+    pthread_mutex_unlock(&mutex_sched);
+    return depth;
+}
+
+
+int sched_drain(const int timeout_ms) {
+    /*** Waits for every job, waiting or running, to be done, for up to timeout_ms;
+     * returns the number of jobs left ***/
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+    deadline.tv_sec += timeout_ms / 1000 + deadline.tv_nsec / 1000000000L;
+    deadline.tv_nsec %= 1000000000L;
+
+    pthread_mutex_lock(&mutex_sched);
+    while ((busy_threads > 0 || sched_waiting() > 0) &&
+           pthread_cond_timedwait(&cond_sched_drained, &mutex_sched, &deadline) != ETIMEDOUT)
+        continue;
+    int jobs_left = busy_threads + sched_waiting();
+    pthread_mutex_unlock(&mutex_sched);
+    return jobs_left;
+}
@@ -1,32 +1,150 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include "DS-Lab-Assignment/netUtil.h"
+#include "DS-Lab-Assignment/admission.h"
+#include "DS-Lab-Assignment/cluster.h"
+#include "DS-Lab-Assignment/dedup.h"
+#include "DS-Lab-Assignment/normalize.h"
+#include "DS-Lab-Assignment/reaper.h"
+#include "DS-Lab-Assignment/scheduler.h"
+#include "DS-Lab-Assignment/trace.h"
 #include "DS-Lab-Assignment/dbms/dbms.h"
+#include "DS-Lab-Assignment/dbms/dbmsEngine.h"
 #include "DS-Lab-Assignment/services.h"
 
 
+#define MSG_POOL_SIZE 64    /* max number of free message entries kept for reuse */
+
+/* message entry pool: a message is copied once, from the connection buffer into a pooled entry,
+ * which is then passed by reference through storage and delivery */
+static entry_t *msg_pool[MSG_POOL_SIZE];
+static int msg_pool_free = 0;   /* number of free entries in msg_pool */
+static pthread_mutex_t mutex_msg_pool = PTHREAD_MUTEX_INITIALIZER;
+
 /***** Auxiliary functions *****/
-void aux_send_init(const request_t *request, reply_t *reply, entry_t *entry);
-void aux_send_msg_pass(const request_t *request, reply_t *reply, entry_t *recipient_entry, entry_t *msg_entry);
-void aux_send_first_ack(int socket, reply_t *reply, unsigned int msg_id);
-int aux_connect_send_pend_msgs(entry_t *pend_msg_entry);
+int aux_admit_user(int socket, const char *op_code, const char *username);
+int aux_home_user(int socket, const char *op_code, const char *username);
+entry_t *aux_msg_entry_get(void);
+void aux_msg_entry_put(entry_t *msg_entry);
+void aux_msg_entry_set(entry_t *msg_entry, const slice_t *sender, const slice_t *recipient, const slice_t *content);
+void aux_send_init(const slice_t *sender, const slice_t *recipient, reply_t *reply, db_txn_t *txn, entry_t *entry,
+                   unsigned int *msg_id);
+int aux_send_msg_pass(entry_t *recipient_entry, const entry_t *msg_entry);
+int aux_same_listener(const entry_t *entry, const entry_t *other);
+int aux_send_lost_recipient(db_txn_t *txn, entry_t *recipient_entry);
+int aux_send_first_ack(int socket, reply_t *reply, unsigned int msg_id);
+int aux_send_claim(int socket, const char *op_code, const slice_t *sender, const slice_t *recipient,
+                   const slice_t *content, const char *token);
+void aux_send_message(conn_t *conn, const char *op_code, const slice_t *sender, const slice_t *recipient,
+                      const slice_t *content, int ttl, const char *token);
+int aux_send_remote(int socket, const slice_t *sender, const slice_t *recipient, const slice_t *content, int ttl,
+                    unsigned int *msg_id);
+void *aux_node_link_thread(void *args);
+void aux_send_users(int socket, reply_t *reply, const char *users, size_t users_len, size_t n_users);
+
+/***** Services Called By Another Node Over A Node Link, Served By Server *****/
+void srv_node_send(conn_t *conn);
+void srv_node_ack(conn_t *conn);
+void srv_node_expired(conn_t *conn);
+void srv_node_connected(conn_t *conn);
+int aux_send_stream_spool(conn_t *conn, entry_t *msg_entry, int *clt_listen_socket);
+int aux_connect_send_pend_msgs(const char *username);
+int aux_connect_send_acks(const char *username);
+void aux_connect_deliver(void *args);
+int aux_send_ack(unsigned int msg_id, const char *sender);
 int aux_connect_clt_listen_thread(entry_t *entry);
 
 /***** Services Called By Server, Served By Client Listening Thread *****/
-int clt_send_message(request_t *request, entry_t *entry);
-int clt_send_mess_ack(request_t *request, entry_t *entry);
+int clt_send_message(const entry_t *msg_entry, entry_t *entry);
+int clt_send_message_stream(const entry_t *msg_entry, entry_t *entry);
+int clt_send_mess_ack(unsigned int msg_id, const char *sender);
+int clt_send_mess_acks(const unsigned int *msg_ids, size_t n_msg_ids, const char *sender);
+int clt_send_mess_expired(unsigned int msg_id, const char *sender, const char *recipient);
+
+
+int aux_admit_user(const int socket, const char *const op_code, const char *const username) {
+    /*** Applies the per-user rate limit to a request, for the client it comes from; if it is rejected,
+     * sends a busy reply to the client and returns FALSE;
+     * called in server-side services ***/
+    int retry_after_ms = adm_admit_user(username, socket);
+    if (!retry_after_ms) return TRUE;
+
+    printf("s> %s %s BUSY\n", op_code, username); fflush(stdout);
+    send_busy_reply(socket, retry_after_ms);
+    return FALSE;
+}
+
+
+int aux_home_user(const int socket, const char *const op_code, const char *const username) {
+    /*** In cluster mode, checks that a request is served by the home node of the user it's made for;
+     * if it isn't, sends a redirect reply with the address of that node and returns FALSE;
+     * called in server-side services ***/
+    if (cl_is_local(username)) return TRUE;
+
+    const char *home_addr = cl_node_addr(cl_home(username));
+    printf("s> %s %s REDIRECT %s\n", op_code, username, home_addr); fflush(stdout);
+    send_redirect_reply(socket, home_addr);
+    return FALSE;
+}
+
+
+entry_t *aux_msg_entry_get(void) {
+    /*** Takes a message entry from the pool, or allocates a new one if the pool is empty ***/
+    entry_t *msg_entry = NULL;
+
+    pthread_mutex_lock(&mutex_msg_pool);
+    if (msg_pool_free > 0) msg_entry = msg_pool[--msg_pool_free];
+    pthread_mutex_unlock(&mutex_msg_pool);
+
+    if (!msg_entry && !(msg_entry = malloc(sizeof(entry_t)))) perror("Could not allocate message entry");
+    return msg_entry;
+}
+
+
+void aux_msg_entry_put(entry_t *msg_entry) {
+    /*** Gives a message entry back to the pool ***/
+    pthread_mutex_lock(&mutex_msg_pool);
+    if (msg_pool_free < MSG_POOL_SIZE) {
+        msg_pool[msg_pool_free++] = msg_entry;
+        msg_entry = NULL;
+    }
+    pthread_mutex_unlock(&mutex_msg_pool);
+
+    free(msg_entry);    /* pool is full */
+}
+
+
+void aux_msg_entry_set(entry_t *msg_entry, const slice_t *sender, const slice_t *recipient, const slice_t *content) {
+    /*** Sets up a pending message entry from the request fields;
+     * this is the only copy of the message made by the server;
+     * called in srv_send and srv_send_stream functions ***/
+    msg_entry->type = ENT_TYPE_P_MSG;
+    memcpy(msg_entry->username, recipient->ptr, recipient->len + 1);
+    memcpy(msg_entry->msg.sender, sender->ptr, sender->len + 1);
+    if (content) memcpy(msg_entry->msg.content, content->ptr, content->len + 1);
+    else msg_entry->msg.content[0] = '\0';
+    msg_entry->msg.flags = 0;
+    msg_entry->msg.size = 0;
+    msg_entry->msg.expires_at = 0;
+}
 
 
-void aux_send_init(const request_t *const request, reply_t *reply, entry_t *entry) {
-    /*** Checks that both users exist updates the recipient's last message ID,
-     * and sets up server reply (first ACK);
-     * called in srv_send function ***/
+void aux_send_init(const slice_t *sender, const slice_t *recipient, reply_t *reply, db_txn_t *txn, entry_t *entry,
+                   unsigned int *msg_id) {
+    /*** Checks that both users exist, reads the recipient's entry (in a given transaction, if any),
+     * gives the message a new ID from the recipient's counter (no DB write, but once every
+     * MSG_ID_BLOCK messages) and sets up server reply (first ACK);
+     * called in srv_send and srv_send_stream functions ***/
     /* check that both users exist */
-    int sender_exists = db_user_exists(request->message.sender);
-    int recipient_exists = db_user_exists(request->recipient);
+    /* a sender living in another node has been checked by that node, which forwarded the message */
+    int sender_exists = cl_is_local(sender->ptr) ? db_engine->user_exists(sender->ptr) : TRUE;
+    int recipient_exists = db_engine->user_exists(recipient->ptr);
 
     if (!sender_exists || !recipient_exists)
         reply->server_error_code = SRV_ERR_SEND_USR_NOT_EXISTS;
@@ -35,127 +153,191 @@ void aux_send_init(const request_t *const request, reply_t *reply, entry_t *entr
     else {    /* set up first ACK to be sent to sender client */
         reply->server_error_code = SRV_SUCCESS;
 
-        /* update last msg ID in recipient user */
+        /* read recipient user entry, and get its next msg ID */
         entry->type = ENT_TYPE_UD;
-        strcpy(entry->username, request->recipient);
-        /* read recipient user entry */
-        if (db_io_op_usr_ent(entry, READ) < 0)
+        memcpy(entry->username, recipient->ptr, recipient->len + 1);
+        int io_result = txn ? db_txn_read(txn, entry) : db_engine->io_op_usr_ent(entry, READ);
+        if (io_result < 0 || db_engine->next_msg_id(entry->username, msg_id) < 0)
             reply->server_error_code = SRV_ERR_SEND_ANY;
-        else {
-            /* update last msg ID & write it to DB */
-            entry->user.last_msg_id = (entry->user.last_msg_id + 1) % MSG_ID_MAX_VALUE;
-            if (db_io_op_usr_ent(entry, MODIFY) < 0)
-                reply->server_error_code = SRV_ERR_SEND_ANY;
-        }
     }
 }
 
 
-void aux_send_msg_pass(const request_t *const request, reply_t *reply, entry_t *recipient_entry, entry_t *msg_entry) {
-    /*** Sends a given message to a given recipient;
-     * called in srv_send function ***/
-    /* set up message entry */
-    msg_entry->type = ENT_TYPE_P_MSG;
-    strcpy(msg_entry->username, request->recipient);
-    strcpy(msg_entry->msg.sender, request->message.sender);
-    strcpy(msg_entry->msg.content, request->message.content);
-    msg_entry->msg.id = recipient_entry->user.last_msg_id;
-
-    /* check whether recipient user is connected */
-    if (recipient_entry->user.status == STATUS_CN) {
-        /* set up a request for SEND_MESSAGE service */
-        request_t send_msg_request;
-        strcpy(send_msg_request.op_code, SEND_MESSAGE);
-        strcpy(send_msg_request.message.sender, request->message.sender);
-        send_msg_request.message.id = recipient_entry->user.last_msg_id;
-        strcpy(send_msg_request.message.content, request->message.content);
-
-        /* send message to recipient user */
-        int send_result = clt_send_message(&send_msg_request, recipient_entry);
-
-        /* server log message if SEND MESSAGE succeeds */
-        if (send_result == SRV_SUCCESS) {
-            printf("s> SEND MESSAGE %u FROM %s TO %s\n", msg_entry->msg.id,
-                   request->message.sender, request->recipient);
-            fflush(stdout);
-        } else {
-            /* if sending fails, change recipient user's status to disconnected */
-            recipient_entry->user.status = STATUS_DCN;
-
-            /* update recipient user entry in DB */
-            if (db_io_op_usr_ent(recipient_entry, MODIFY) < 0)
-                reply->server_error_code = SRV_ERR_SEND_ANY;
-            /* at this point, we must try to store the message as pending */
-        }
-    }
+int aux_send_msg_pass(entry_t *recipient_entry, const entry_t *const msg_entry) {
+    /*** Sends a given message to a given connected recipient; returns TRUE if it got through;
+     * called in aux_send_message function ***/
+    /* send message to recipient user */
+    if (clt_send_message(msg_entry, recipient_entry) != SRV_SUCCESS) return FALSE;
+
+    /* server log message if SEND MESSAGE succeeds */
+    printf("s> SEND MESSAGE %u FROM %s TO %s\n", msg_entry->msg.id, msg_entry->msg.sender, msg_entry->username);
+    fflush(stdout);
+    return TRUE;
 }
 
 
-void aux_send_first_ack(const int socket, reply_t *reply, const unsigned int msg_id) {
+int aux_same_listener(const entry_t *const entry, const entry_t *const other) {
+    /*** Checks whether two userdata entries of a user point to the same listening thread ***/
+    return entry->user.ip.s_addr == other->user.ip.s_addr && entry->user.port == other->user.port &&
+           !strcmp(entry->user.sock_path, other->user.sock_path);
+}
+
+
+int aux_send_lost_recipient(db_txn_t *txn, entry_t *recipient_entry) {
+    /*** Changes the status of a connected recipient a message couldn't be sent to to disconnected,
+     * in a given transaction, unless it has connected again since then (to another listening thread);
+     * called in aux_send_message, srv_send_stream and aux_connect_send_pend_msgs functions ***/
+    entry_t current = *recipient_entry;
+    recipient_entry->user.status = STATUS_DCN;      /* the message is stored either way */
+
+    int result = db_txn_read(txn, &current);
+    if (result < 0) return result;
+    if (current.user.status != STATUS_CN || !aux_same_listener(&current, recipient_entry)) return DBMS_SUCCESS;
+
+    current.user.status = STATUS_DCN;
+    return db_txn_put(txn, &current, MODIFY);
+}
+
+
+int aux_send_first_ack(const int socket, reply_t *reply, const unsigned int msg_id) {
     /*** Sends reply to sender client (first ACK and msg ID if success, error otherwise);
-     * called in srv_send function ***/
-    if (send_server_reply(socket, reply) < 0) return;
+     * the ACK is held back until the DB writes of this SEND are durable (DUR_GROUP policy);
+     * returns TRUE if the SEND was successful, even if the reply couldn't be sent;
+     * called in srv_send and srv_send_stream functions ***/
+    if (reply->server_error_code == SRV_SUCCESS && db_engine->dur_commit_wait() < 0)
+        reply->server_error_code = SRV_ERR_SEND_ANY;
 
     /* send msg ID if send service was successful */
-    if (reply->server_error_code == SRV_SUCCESS) {
+    if (send_server_reply(socket, reply) == 0 && reply->server_error_code == SRV_SUCCESS) {
         char msg_id_str[16];
         sprintf(msg_id_str, "%u", msg_id);
         send_string(socket, msg_id_str);
     }
+    return reply->server_error_code == SRV_SUCCESS;
+}
+
+
+int aux_send_claim(const int socket, const char *const op_code, const slice_t *sender, const slice_t *recipient,
+                   const slice_t *content, const char *const token) {
+    /*** Claims the idempotency token of a SEND; if it's a retry of a SEND already served, or the token
+     * can't be claimed, replies to the client and returns FALSE; otherwise, the SEND must be served
+     * and its token settled; called in aux_send_message function ***/
+    reply_t reply;
+    unsigned int msg_id;
+
+    switch (dd_claim(sender->ptr, token, dd_req_hash(recipient->ptr, content->ptr, content->len), &msg_id)) {
+        case DD_NEW:
+            return TRUE;
+        case DD_SENT:
+            printf("s> %s FROM %s TOKEN %s RETRY OF MESSAGE %u\n", op_code, sender->ptr, token, msg_id);
+            fflush(stdout);
+            reply.server_error_code = SRV_SUCCESS;
+            aux_send_first_ack(socket, &reply, msg_id);
+            return FALSE;
+        case DD_BUSY:
+            printf("s> %s FROM %s TOKEN %s BUSY\n", op_code, sender->ptr, token); fflush(stdout);
+            send_busy_reply(socket, ADM_RETRY_AFTER_MS);
+            return FALSE;
+        case DD_REUSED:
+            printf("s> %s FROM %s TOKEN %s REUSED\n", op_code, sender->ptr, token); fflush(stdout);
+            /* fall through */
+        default:
+            reply.server_error_code = SRV_ERR_SEND_ANY;
+            send_server_reply(socket, &reply);
+            return FALSE;
+    }
 }
 
 
-int aux_connect_send_pend_msgs(entry_t *pend_msg_entry) {
-    /*** Reads pending messages of a user (given by username member in given entry),
-     * sends them out and deletes them from the list;
-     * called in srv_connect function ***/
+int aux_send_stream_spool(conn_t *conn, entry_t *msg_entry, int *clt_listen_socket) {
+    /*** Receives the frames of a streamed message, spooling them to the message body
+     * and forwarding them to the recipient's listening thread as they arrive, if given one
+     * (*clt_listen_socket >= 0); only one frame is held in memory at a time;
+     * *clt_listen_socket is closed and set to -1 if forwarding fails;
+     * called in srv_send_stream function ***/
+    char frame[STREAM_CHUNK_SIZE];
+    int frame_len;
+    int body_fd = db_engine->open_msg_body(msg_entry, CREATE);
+    int result = (body_fd < 0) ? SRV_ERR_SEND_ANY : SRV_SUCCESS;
+
+    msg_entry->msg.size = 0;
+    while ((frame_len = recv_frame(conn, frame, STREAM_CHUNK_SIZE)) > 0) {
+        msg_entry->msg.size += frame_len;
+        if (msg_entry->msg.size > STREAM_MAX_SIZE) result = SRV_ERR_SEND_ANY;
+        /* after an error, keep draining the stream so that the sender gets its reply */
+        if (result != SRV_SUCCESS) continue;
+
+        if (write_bytes(body_fd, frame, frame_len) < 0) {
+            perror("Error spooling message body");
+            result = SRV_ERR_SEND_ANY;
+        }
 
-    /* set up send message request */
-    request_t send_msg_request;
-    strcpy(send_msg_request.op_code, SEND_MESSAGE);
-    /* set up a request for SEND_MESS_ACK service */
-    request_t send_msg_ack_request;
-    strcpy(send_msg_ack_request.op_code, SEND_MESS_ACK);
+        /* forward frame; if it fails, recipient gets the message from the pending table */
+        if (*clt_listen_socket >= 0 && send_frame(*clt_listen_socket, frame, frame_len) < 0) {
+            close(*clt_listen_socket);
+            *clt_listen_socket = -1;
+        }
+    }
+
+    if (body_fd >= 0) db_engine->close_msg_body(body_fd, CREATE);
+    if (frame_len < 0) return GEN_ERR_ANY;      /* sender went away in the middle of the stream */
+    if (result != SRV_SUCCESS) return result;
+
+    /* end stream for recipient */
+    if (*clt_listen_socket >= 0 && send_frame(*clt_listen_socket, NULL, 0) < 0) {
+        close(*clt_listen_socket);
+        *clt_listen_socket = -1;
+    }
+    return SRV_SUCCESS;
+}
+
+
+int aux_connect_send_pend_msgs(const char *const username) {
+    /*** Reads pending messages of a user, a batch at a time, sends them out and deletes them from the list;
+     * called in srv_connect and aux_connect_deliver functions ***/
 
-    /* set up sender user entry */
-    entry_t sender_entry;
-    sender_entry.type = ENT_TYPE_UD;
     /* set up recipient user entry */
     entry_t recipient_entry;
     recipient_entry.type = ENT_TYPE_UD;
-    strcpy(recipient_entry.username, pend_msg_entry->username);
-    if (db_io_op_usr_ent(&recipient_entry, READ) < 0) return DBMS_ERR_ANY;
-
-    while (db_get_pend_msg(pend_msg_entry) == DBMS_SUCCESS) {
-        /* set up rest of send message request */
-        strcpy(send_msg_request.message.sender, pend_msg_entry->msg.sender);
-        send_msg_request.message.id = pend_msg_entry->msg.id;
-        strcpy(send_msg_request.message.content, pend_msg_entry->msg.content);
-
-        /* set up rest of send message request */
-        send_msg_ack_request.message.id = pend_msg_entry->msg.id;
-
-        /* set up rest of sender user entry */
-        strcpy(sender_entry.username, pend_msg_entry->msg.sender);
-
-        /* send message */
-        /* server log message if SEND MESSAGE succeeds */
-        if (clt_send_message(&send_msg_request, &recipient_entry) == SRV_SUCCESS) {
-            printf("s> SEND MESSAGE %u FROM %s TO %s\n", send_msg_request.message.id,
-                   send_msg_request.message.sender, send_msg_request.recipient);
-            fflush(stdout);
+    strcpy(recipient_entry.username, username);
+    if (db_engine->io_op_usr_ent(&recipient_entry, READ) < 0) return DBMS_ERR_ANY;
+
+    entry_t pend_msgs[PEND_MSGS_BATCH];
+    size_t n_pend_msgs;
+    while (db_engine->get_pend_msgs(username, pend_msgs, PEND_MSGS_BATCH, &n_pend_msgs) == DBMS_SUCCESS) {
+        size_t n_sent = 0;
+        int send_result = SRV_SUCCESS;
+
+        while (n_sent < n_pend_msgs && send_result == SRV_SUCCESS) {
+            /* send message */
+            entry_t *pend_msg_entry = &pend_msgs[n_sent];
+            send_result = (pend_msg_entry->msg.flags & MSG_FLAG_STREAM) ?
+                    clt_send_message_stream(pend_msg_entry, &recipient_entry) :
+                    clt_send_message(pend_msg_entry, &recipient_entry);
+
+            /* server log message if SEND MESSAGE succeeds, and keep the message in the history */
+            if (send_result == SRV_SUCCESS) {
+                printf("s> SEND MESSAGE %u FROM %s TO %s\n", pend_msg_entry->msg.id,
+                       pend_msg_entry->msg.sender, pend_msg_entry->username);
+                fflush(stdout);
+                db_engine->hist_put(pend_msg_entry);
+                n_sent++;
+            }
+        } // END while
 
-            /* pending message has been sent successfully, so delete it from the list */
-            db_io_op_usr_ent(pend_msg_entry, DELETE);
+        /* pending messages sent successfully are deleted from the list all at once */
+        db_engine->del_pend_msgs(pend_msgs, n_sent);
 
-            /* send second ACK to sender listening thread */
-            clt_send_mess_ack(&send_msg_ack_request, &sender_entry);
-        } else {
-            /* if sending fails, change recipient user's status to disconnected */
-            recipient_entry.user.status = STATUS_DCN;
+        /* send second ACKs to sender listening threads */
+        for (size_t i = 0; i < n_sent; i++) aux_send_ack(pend_msgs[i].msg.id, pend_msgs[i].msg.sender);
 
-            /* update recipient user entry in DB */
-            db_io_op_usr_ent(&recipient_entry, MODIFY);
+        if (send_result != SRV_SUCCESS) {
+            /* if sending fails, change recipient user's status to disconnected, unless it has connected again */
+            db_txn_t txn;
+            const char *users[] = {username};
+            db_txn_begin(&txn, users, 1);
+            if (aux_send_lost_recipient(&txn, &recipient_entry) == DBMS_SUCCESS) db_txn_commit(&txn);
+            db_txn_abort(&txn);     /* unless committed */
             return SRV_ERR_SEND_ANY;
         }
     } // END while
@@ -164,29 +346,88 @@ int aux_connect_send_pend_msgs(entry_t *pend_msg_entry) {
 }
 
 
+void aux_connect_deliver(void *args) {
+    /*** Background task: sends a user that has just connected the second ACKs and the pending
+     * messages queued while it was offline; args is the username, which is freed;
+     * queued in srv_connect function ***/
+    char *username = (char *) args;
+
+    /* send second ACKs queued while the user was offline, in one batch */
+    aux_connect_send_acks(username);
+
+    /* send pending messages */
+    aux_connect_send_pend_msgs(username);
+    free(username);
+}
+
+
+int aux_connect_send_acks(const char *const username) {
+    /*** Sends the second ACKs queued for a user while it couldn't get them, all in one connection;
+     * they stay queued if sending fails; called in srv_connect and aux_connect_deliver functions ***/
+    unsigned int *msg_ids;
+    size_t n_msg_ids;
+
+    int take_result = db_engine->ack_queue_take(username, &msg_ids, &n_msg_ids);
+    if (take_result == DBMS_ERR_NOT_EXISTS) return SRV_SUCCESS;     /* no queued ACKs */
+    if (take_result < 0) return GEN_ERR_ANY;
+
+    int result = clt_send_mess_acks(msg_ids, n_msg_ids, username);
+    if (result == SRV_SUCCESS) {
+        db_engine->ack_queue_release(username);
+        printf("s> SEND %zu QUEUED ACKS TO %s\n", n_msg_ids, username); fflush(stdout);
+    }
+    free(msg_ids);
+    return result;
+}
+
+
+int aux_send_ack(const unsigned int msg_id, const char *const sender) {
+    /*** Sends the second ACK of a message to its sender; if the sender is offline or its
+     * listening thread can't be reached, the ACK is queued in the DB, to be sent when it connects;
+     * called once a message has been delivered, and in srv_node_ack function ***/
+
+    /* a sender living in another node is sent the ACK (or has it queued) by that node */
+    if (!cl_is_local(sender)) {
+        if (cl_forward_ack(msg_id, sender) == SRV_SUCCESS) return SRV_SUCCESS;
+        printf("s> ACK %u TO %s LOST: NODE %s UNREACHABLE\n", msg_id, sender, cl_node_addr(cl_home(sender)));
+        fflush(stdout);
+        return GEN_ERR_ANY;
+    }
+
+    if (db_engine->user_connected(sender) == TRUE && clt_send_mess_ack(msg_id, sender) == SRV_SUCCESS) return SRV_SUCCESS;
+
+    if (db_engine->ack_queue_put(sender, msg_id) < 0) {
+        printf("s> ACK %u TO %s LOST\n", msg_id, sender); fflush(stdout);
+        return GEN_ERR_ANY;
+    }
+    printf("s> ACK %u TO %s QUEUED\n", msg_id, sender); fflush(stdout);
+    return SRV_SUCCESS;
+}
+
+
 int aux_connect_clt_listen_thread(entry_t *entry) {
     /*** Connects to client listening thread of a given user;
      * called in client-side services (clt_send_message and clt_send_mess_ack functions) ***/
-    struct sockaddr_in clt_listen_addr;
+    struct sockaddr_storage clt_listen_addr;
     int clt_listen_socket;
     int ret_val;    /* needed for error-checking macros */
 
-    /* read IP and port from given user entry */
-    if (db_io_op_usr_ent(entry, READ) < 0)
+    /* read listener address from given user entry */
+    if (db_engine->io_op_usr_ent(entry, READ) < 0)
         return DBMS_ERR_ANY;
 
-    /* create client socket */
-    CHECK_FUNC_ERROR_WITH_ERRNO(clt_listen_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP), GEN_ERR_ANY)
+    /* set up client listening thread address: a Unix socket for listeners on this host, if registered */
+    socklen_t addr_size = set_listener_addr(&entry->user, &clt_listen_addr);
 
-    /* set up client listening thread address */
-    bzero((char*) &clt_listen_addr, sizeof(struct sockaddr_in));
-    memcpy (&(clt_listen_addr.sin_addr), &(entry->user.ip), sizeof(struct in_addr));
-    clt_listen_addr.sin_family = AF_INET;
-    clt_listen_addr.sin_port = htons(entry->user.port);
+    /* create client socket */
+    CHECK_FUNC_ERROR_WITH_ERRNO(clt_listen_socket = socket(clt_listen_addr.ss_family, SOCK_STREAM, 0), GEN_ERR_ANY)
 
     /* connect to client listening thread */
-    CHECK_FUNC_ERROR_WITH_ERRNO(connect(clt_listen_socket, (struct sockaddr *) &clt_listen_addr,sizeof(clt_listen_addr)), GEN_ERR_ANY)
+    CHECK_SOCK_ERROR(connect_timeout(clt_listen_socket, (struct sockaddr *) &clt_listen_addr,
+                                     addr_size, CLT_CONNECT_TIMEOUT_MS), clt_listen_socket)
 
+    /* a listening thread that stops reading can't hold the sending thread either */
+    rp_send_deadline(clt_listen_socket);
     return clt_listen_socket;
 }
 
@@ -194,9 +435,9 @@ int aux_connect_clt_listen_thread(entry_t *entry) {
 /***** Services *****/
 
 /**** Client-side ****/
-int clt_send_message(request_t *request, entry_t *entry) {
+int clt_send_message(const entry_t *const msg_entry, entry_t *entry) {
     /*** Executes SEND_MESSAGE service:
-     * sends a message (contained in given request) to the
+     * sends a message (contained in given message entry) to the
      * client's listening thread (user in given entry);
      * called in aux_connect_send_pend_msgs and aux_send_msg_pass functions ***/
     int ret_val;    /* needed for error-checking macros */
@@ -204,118 +445,242 @@ int clt_send_message(request_t *request, entry_t *entry) {
     CHECK_FUNC_ERROR(clt_listen_socket = aux_connect_clt_listen_thread(entry), GEN_ERR_ANY)
 
     /* set up message ID string */
-    char msg_id_str[16]; sprintf(msg_id_str, "%u", request->message.id);
+    char msg_id_str[16]; sprintf(msg_id_str, "%u", msg_entry->msg.id);
 
     /* send stuff */
-    if (send_string(clt_listen_socket, request->op_code) < 0 ||
-    send_string(clt_listen_socket, request->message.sender) < 0 ||
-    send_string(clt_listen_socket, msg_id_str) < 0 ||
-    send_string(clt_listen_socket, request->message.content) < 0)
+    int result = (send_string(clt_listen_socket, SEND_MESSAGE) < 0 ||
+                  send_string(clt_listen_socket, msg_entry->msg.sender) < 0 ||
+                  send_string(clt_listen_socket, msg_id_str) < 0 ||
+                  send_string(clt_listen_socket, msg_entry->msg.content) < 0) ? GEN_ERR_ANY : SRV_SUCCESS;
+
+    close(clt_listen_socket);
+    return result;
+}
+
+
+int clt_send_message_stream(const entry_t *const msg_entry, entry_t *entry) {
+    /*** Executes SEND_MESSAGE_STREAM service for a stored message:
+     * sends the streamed message body of given pending message entry frame by frame
+     * to the client's listening thread (user in given entry);
+     * called in aux_connect_send_pend_msgs and srv_send_stream functions ***/
+    int ret_val;    /* needed for error-checking macros */
+    char frame[STREAM_CHUNK_SIZE];
+    int clt_listen_socket;
+    int body_fd;
+    CHECK_FUNC_ERROR(body_fd = db_engine->open_msg_body(msg_entry, READ), GEN_ERR_ANY)
+
+    if ((clt_listen_socket = aux_connect_clt_listen_thread(entry)) < 0) {
+        db_engine->close_msg_body(body_fd, READ);
         return GEN_ERR_ANY;
+    }
+
+    /* set up message ID string */
+    char msg_id_str[16]; sprintf(msg_id_str, "%u", msg_entry->msg.id);
 
-    /* if all went well */
+    /* send stuff */
+    int result = (send_string(clt_listen_socket, SEND_MESSAGE_STREAM) < 0 ||
+                  send_string(clt_listen_socket, msg_entry->msg.sender) < 0 ||
+                  send_string(clt_listen_socket, msg_id_str) < 0) ? GEN_ERR_ANY : SRV_SUCCESS;
+
+    unsigned long long bytes_left = msg_entry->msg.size;
+    while (result == SRV_SUCCESS && bytes_left > 0) {
+        int frame_len = (bytes_left < STREAM_CHUNK_SIZE) ? (int) bytes_left : STREAM_CHUNK_SIZE;
+        if (read_bytes(body_fd, frame, frame_len) != frame_len ||
+            send_frame(clt_listen_socket, frame, frame_len) < 0)
+            result = GEN_ERR_ANY;
+        bytes_left -= frame_len;
+    }
+    if (result == SRV_SUCCESS && send_frame(clt_listen_socket, NULL, 0) < 0) result = GEN_ERR_ANY;
+
+    db_engine->close_msg_body(body_fd, READ);
     close(clt_listen_socket);
-    return SRV_SUCCESS;
+    return result;
 }
 
 
-int clt_send_mess_ack(request_t *request, entry_t *entry) {
+int clt_send_mess_ack(const unsigned int msg_id, const char *const sender) {
     /*** Executes SEND_MESS_ACK service:
      * sends second ACK to sender client listening thread
      * (meaning the message has been delivered to the recipient);
-     * called in srv_send function ***/
+     * called in aux_send_ack function ***/
     int ret_val;    /* needed for error-checking macros */
     int clt_listen_socket;
-    CHECK_FUNC_ERROR(clt_listen_socket = aux_connect_clt_listen_thread(entry), GEN_ERR_ANY)
+
+    /* set up sender user entry */
+    entry_t sender_entry;
+    sender_entry.type = ENT_TYPE_UD;
+    strcpy(sender_entry.username, sender);
+    CHECK_FUNC_ERROR(clt_listen_socket = aux_connect_clt_listen_thread(&sender_entry), GEN_ERR_ANY)
 
     /* set up message ID */
-    char msg_id_str[16]; sprintf(msg_id_str, "%u", request->message.id);
+    char msg_id_str[16]; sprintf(msg_id_str, "%u", msg_id);
 
     /* send stuff */
-    send_string(clt_listen_socket, request->op_code);
-    send_string(clt_listen_socket, msg_id_str);
+    int result = (send_string(clt_listen_socket, SEND_MESS_ACK) < 0 ||
+                  send_string(clt_listen_socket, msg_id_str) < 0) ? GEN_ERR_ANY : SRV_SUCCESS;
 
-    /* if all went well */
     close(clt_listen_socket);
-    return SRV_SUCCESS;
+    return result;
+}
+
+
+int clt_send_mess_acks(const unsigned int *msg_ids, const size_t n_msg_ids, const char *const sender) {
+    /*** Executes SEND_MESS_ACKS service:
+     * sends second ACKs queued while the sender couldn't get them to its listening thread,
+     * as '\0'-terminated message IDs in frames; called in aux_connect_send_acks function ***/
+    int ret_val;    /* needed for error-checking macros */
+    int clt_listen_socket;
+
+    /* set up sender user entry */
+    entry_t sender_entry;
+    sender_entry.type = ENT_TYPE_UD;
+    strcpy(sender_entry.username, sender);
+    CHECK_FUNC_ERROR(clt_listen_socket = aux_connect_clt_listen_thread(&sender_entry), GEN_ERR_ANY)
+
+    /* set up message IDs */
+    char *msg_ids_str = malloc(n_msg_ids * (MSG_ID_MAX_STR_SIZE + 1));
+    if (!msg_ids_str) {
+        close(clt_listen_socket);
+        return GEN_ERR_ANY;
+    }
+    size_t msg_ids_len = 0;
+    for (size_t i = 0; i < n_msg_ids; i++)
+        msg_ids_len += sprintf(msg_ids_str + msg_ids_len, "%u", msg_ids[i]) + 1;
+
+    /* send stuff */
+    char n_msg_ids_str[24]; sprintf(n_msg_ids_str, "%zu", n_msg_ids);
+    int result = (send_string(clt_listen_socket, SEND_MESS_ACKS) < 0 ||
+                  send_string(clt_listen_socket, n_msg_ids_str) < 0) ? GEN_ERR_ANY : SRV_SUCCESS;
+    for (size_t pos = 0; result == SRV_SUCCESS && pos < msg_ids_len; pos += STREAM_CHUNK_SIZE) {
+        int frame_len = (msg_ids_len - pos < STREAM_CHUNK_SIZE) ? (int) (msg_ids_len - pos) : STREAM_CHUNK_SIZE;
+        if (send_frame(clt_listen_socket, msg_ids_str + pos, frame_len) < 0) result = GEN_ERR_ANY;
+    }
+    if (result == SRV_SUCCESS && send_frame(clt_listen_socket, NULL, 0) < 0) result = GEN_ERR_ANY;
+
+    close(clt_listen_socket);
+    free(msg_ids_str);
+    return result;
+}
+
+
+int clt_send_mess_expired(const unsigned int msg_id, const char *const sender, const char *const recipient) {
+    /*** Executes SEND_MESS_EXPIRED service:
+     * tells sender client listening thread that a message has expired before
+     * it could be delivered to the recipient; called in srv_notify_expired function ***/
+    int ret_val;    /* needed for error-checking macros */
+    int clt_listen_socket;
+
+    /* set up sender user entry */
+    entry_t sender_entry;
+    sender_entry.type = ENT_TYPE_UD;
+    strcpy(sender_entry.username, sender);
+    CHECK_FUNC_ERROR(clt_listen_socket = aux_connect_clt_listen_thread(&sender_entry), GEN_ERR_ANY)
+
+    /* set up message ID */
+    char msg_id_str[16]; sprintf(msg_id_str, "%u", msg_id);
+
+    /* send stuff */
+    int result = (send_string(clt_listen_socket, SEND_MESS_EXPIRED) < 0 ||
+                  send_string(clt_listen_socket, msg_id_str) < 0 ||
+                  send_string(clt_listen_socket, recipient) < 0) ? GEN_ERR_ANY : SRV_SUCCESS;
+
+    close(clt_listen_socket);
+    return result;
 }
 
 
 /**** Server-side ****/
-void srv_register(const int socket, request_t *request) {
+void srv_register(conn_t *conn) {
     /*** Executes REGISTER service ***/
     reply_t reply;
     entry_t entry;
+    slice_t username;
 
     /* receive stuff */
-    if (recv_string(socket, request->username) < 0) return;
+    if (recv_slice(conn, &username) < 0) return;
+    if (!aux_admit_user(conn->socket, REGISTER, username.ptr)) return;
+    if (!aux_home_user(conn->socket, REGISTER, username.ptr)) return;
 
     /* set up user entry */
-    strcpy(entry.username, request->username);
+    memcpy(entry.username, username.ptr, username.len + 1);
     entry.type = ENT_TYPE_UD;
-    entry.user.last_msg_id = 0;
+    bzero(&entry.user, sizeof(struct userdata));    /* new users start disconnected */
 
     /* create user entry in DB */
-    reply.server_error_code = (db_creat_usr_tbl(&entry) == DBMS_ERR_EXISTS) ?
+    reply.server_error_code = (db_engine->creat_usr_tbl(&entry) == DBMS_ERR_EXISTS) ?
             SRV_ERR_REG_USR_ALREADY_REG : SRV_SUCCESS;
 
     /* server log message */
     if (reply.server_error_code == SRV_SUCCESS) {
-        printf("s> %s %s OK\n", REGISTER, request->username); fflush(stdout);
+        printf("s> %s %s OK\n", REGISTER, username.ptr); fflush(stdout);
     } else {
-        printf("s> %s %s FAIL\n", REGISTER, request->username); fflush(stdout);
+        printf("s> %s %s FAIL\n", REGISTER, username.ptr); fflush(stdout);
     }
 
     /* no need to error handle this call: whether it fails or not, the server
      * is just going to move on(continue in the while loop) */
-    send_server_reply(socket, &reply);
+    send_server_reply(conn->socket, &reply);
 }
 
 
-void srv_unregister(const int socket, request_t *request) {
+void srv_unregister(conn_t *conn) {
     /*** Executes UNREGISTER service ***/
     reply_t reply;
+    slice_t username;
 
     /* receive stuff */
-    if (recv_string(socket, request->username) < 0) return;
-
-    /* check whether user exists */
-    int user_exists = db_user_exists(request->username);
+    if (recv_slice(conn, &username) < 0) return;
+    if (!aux_admit_user(conn->socket, UNREGISTER, username.ptr)) return;
+    if (!aux_home_user(conn->socket, UNREGISTER, username.ptr)) return;
+
+    /* check whether user exists, and delete its table in the same transaction, which a crash can't cut short */
+    db_txn_t txn;
+    const char *users[] = {username.ptr};
+    db_txn_begin(&txn, users, 1);
+    int user_exists = db_engine->user_exists(username.ptr);
     if (user_exists == TRUE)
-        reply.server_error_code = (db_del_usr_tbl(request->username) < 0) ?
+        reply.server_error_code = (db_txn_drop_user(&txn, username.ptr) < 0 || db_txn_commit(&txn) < 0) ?
                 SRV_ERR_UNREG_ANY : SRV_SUCCESS;
     else if (user_exists == FALSE)
         reply.server_error_code = SRV_ERR_UNREG_USR_NOT_EXISTS;
     else reply.server_error_code = SRV_ERR_UNREG_ANY;
+    db_txn_abort(&txn);
 
     /* server log message */
     if (reply.server_error_code == SRV_SUCCESS) {
-        printf("s> %s %s OK\n", UNREGISTER, request->username); fflush(stdout);
+        printf("s> %s %s OK\n", UNREGISTER, username.ptr); fflush(stdout);
     } else {
-        printf("s> %s %s FAIL\n", UNREGISTER, request->username); fflush(stdout);
+        printf("s> %s %s FAIL\n", UNREGISTER, username.ptr); fflush(stdout);
     }
 
     /* send reply to client */
-    send_server_reply(socket, &reply);
+    send_server_reply(conn->socket, &reply);
 }
 
 
-void srv_connect(const int socket, request_t *request) {
+void srv_connect(conn_t *conn) {
     /*** Executes CONNECT service ***/
     reply_t reply;
     entry_t entry;
-    struct sockaddr_in client_addr;
+    struct sockaddr_storage client_addr;
+    slice_t username, client_port;
 
     /* receive stuff */
-    if (recv_string(socket, request->username) < 0) return;
-    if (recv_string(socket, request->client_port) < 0) return;
+    if (recv_slice(conn, &username) < 0) return;
+    if (recv_slice(conn, &client_port) < 0) return;
+    if (!aux_admit_user(conn->socket, CONNECT, username.ptr)) return;
+    if (!aux_home_user(conn->socket, CONNECT, username.ptr)) return;
 
     /* set up user entry */
-    strcpy(entry.username, request->username);
+    memcpy(entry.username, username.ptr, username.len + 1);
     entry.type = ENT_TYPE_UD;
 
-    /* read user entry from DB */
-    int io_result = db_io_op_usr_ent(&entry, READ);
+    /* read user entry from DB, and update it in the same transaction, so that
+     * no other CONNECT (or SEND marking the user as disconnected) gets in between */
+    db_txn_t txn;
+    const char *users[] = {username.ptr};
+    db_txn_begin(&txn, users, 1);
+    int io_result = db_txn_read(&txn, &entry);
 
     if (io_result == DBMS_ERR_NOT_EXISTS)
         reply.server_error_code = SRV_ERR_CN_USR_NOT_EXISTS;
@@ -325,25 +690,42 @@ void srv_connect(const int socket, request_t *request) {
         if (entry.user.status == STATUS_CN)
             reply.server_error_code = SRV_ERR_CN_USR_ALREADY_CN;
         else {    /* entry.user.status == STATUS_DCN */
+            reply.server_error_code = SRV_SUCCESS;
+
             /* prepare entry to write it to DB */
-            /* cast the client port to short */
-            int tmp_port;
-            if (str_to_num(request->client_port, (void *) &tmp_port, INT) < 0)
+            /* get client IP; connections through the server Unix socket have none, they come from this host */
+            socklen_t client_addr_size = sizeof client_addr;
+            bzero(&client_addr, sizeof client_addr);
+            if (getpeername(conn->socket, (struct sockaddr *) &client_addr, &client_addr_size) < 0)
                 reply.server_error_code = SRV_ERR_CN_ANY;
 
-            /* get client IP */
-            socklen_t client_addr_size = sizeof client_addr;
-            if (getpeername(socket, (struct sockaddr *) &client_addr, &client_addr_size) < 0)
+            /* listener on this host reached through a Unix socket: its path is given instead of a port;
+             * only clients that came in through the server Unix socket may give one, since the server
+             * connects to it and writes to it: others could point it at any local service */
+            int tmp_port = 0;
+            int is_unix_path = client_port.ptr[0] == '/';
+            if (is_unix_path &&
+                (client_addr.ss_family != AF_UNIX || !unix_path_valid(client_port.ptr, client_port.len)))
                 reply.server_error_code = SRV_ERR_CN_ANY;
+            /* cast the client port to short */
+            else if (!is_unix_path && str_to_num(client_port.ptr, (void *) &tmp_port, INT) < 0)
+                reply.server_error_code = SRV_ERR_CN_ANY;
+
+            struct in_addr client_ip;
+            client_ip.s_addr = htonl(INADDR_LOOPBACK);
+            if (client_addr.ss_family == AF_INET) client_ip = ((struct sockaddr_in *) &client_addr)->sin_addr;
 
             /* set up entry */
             if (reply.server_error_code != SRV_ERR_CN_ANY) {
                 entry.user.status = STATUS_CN;
                 entry.user.port = (uint16_t) tmp_port;
-                entry.user.ip = client_addr.sin_addr;
+                entry.user.ip = client_ip;
+                bzero(entry.user.sock_path, UNIX_PATH_MAX_SIZE);
+                if (is_unix_path) memcpy(entry.user.sock_path, client_port.ptr, client_port.len + 1);
 
                 /* update user entry in DB */
-                io_result = db_io_op_usr_ent(&entry, MODIFY);
+                io_result = db_txn_put(&txn, &entry, MODIFY);
+                if (io_result == DBMS_SUCCESS) io_result = db_txn_commit(&txn);
                 if (io_result == DBMS_ERR_NOT_EXISTS)
                     reply.server_error_code = SRV_ERR_CN_USR_NOT_EXISTS;
                 else if (io_result < 0)
@@ -352,43 +734,53 @@ void srv_connect(const int socket, request_t *request) {
             }
         } //END inner else
     } //END outer else
+    db_txn_abort(&txn);     /* unless committed */
 
     /* server log message */
     if (reply.server_error_code == SRV_SUCCESS) {
-        printf("s> %s %s OK\n", CONNECT, request->username); fflush(stdout);
+        printf("s> %s %s OK\n", CONNECT, username.ptr); fflush(stdout);
     } else {
-        printf("s> %s %s FAIL\n", CONNECT, request->username); fflush(stdout);
+        printf("s> %s %s FAIL\n", CONNECT, username.ptr); fflush(stdout);
     }
 
     /* send reply to client */
-    send_server_reply(socket, &reply);
+    send_server_reply(conn->socket, &reply);
+    if (reply.server_error_code != SRV_SUCCESS) return;
 
-    /* set up pending message entry */
-    entry_t pend_msg_entry;
-    pend_msg_entry.type = ENT_TYPE_P_MSG;
-    strcpy(pend_msg_entry.username, request->username);
+    /* queued second ACKs and pending messages are sent in the background, so that a big backlog
+     * doesn't hold a service thread up while other users log in; if that can't be done, they're sent now */
+    char *user = strdup(username.ptr);
+    if (user && sched_put_task(aux_connect_deliver, user) == 0) return;
+    free(user);
+
+    /* send second ACKs queued while the user was offline, in one batch */
+    aux_connect_send_acks(username.ptr);
 
     /* send pending messages */
-    if (aux_connect_send_pend_msgs(&pend_msg_entry) != SRV_SUCCESS) {
-        reply.server_error_code = SRV_ERR_SEND_ANY;
-    }
+    aux_connect_send_pend_msgs(username.ptr);
 }
 
 
-void srv_disconnect(const int socket, request_t *request) {
+void srv_disconnect(conn_t *conn) {
     /*** Executes DISCONNECT service ***/
     reply_t reply;
     entry_t entry;
+    slice_t username;
 
     /* receive stuff */
-    if (recv_string(socket, request->username) < 0) return;
+    if (recv_slice(conn, &username) < 0) return;
+    if (!aux_admit_user(conn->socket, DISCONNECT, username.ptr)) return;
+    if (!aux_home_user(conn->socket, DISCONNECT, username.ptr)) return;
 
     /* set up user entry */
-    strcpy(entry.username, request->username);
+    memcpy(entry.username, username.ptr, username.len + 1);
     entry.type = ENT_TYPE_UD;
 
-    /* read user entry from DB */
-    int io_result = db_io_op_usr_ent(&entry, READ);
+    /* read user entry from DB, and update it in the same transaction */
+    db_txn_t txn;
+    const char *users[] = {username.ptr};
+    db_txn_begin(&txn, users, 1);
+    int io_result = db_txn_read(&txn, &entry);
     if (io_result == DBMS_ERR_NOT_EXISTS)
         reply.server_error_code = SRV_ERR_DCN_USR_NOT_EXISTS;
     else if (io_result < 0)
@@ -401,9 +793,11 @@ void srv_disconnect(const int socket, request_t *request) {
             entry.user.status = STATUS_DCN;
             bzero(&entry.user.ip, sizeof(struct in_addr));
             bzero(&entry.user.port, sizeof(uint16_t));
+            bzero(entry.user.sock_path, UNIX_PATH_MAX_SIZE);
 
             /* update user entry in DB */
-            io_result = db_io_op_usr_ent(&entry, MODIFY);
+            io_result = db_txn_put(&txn, &entry, MODIFY);
+            if (io_result == DBMS_SUCCESS) io_result = db_txn_commit(&txn);
             if (io_result == DBMS_ERR_NOT_EXISTS)
                 reply.server_error_code = SRV_ERR_DCN_USR_NOT_EXISTS;
             else if (io_result < 0)
@@ -411,72 +805,611 @@ void srv_disconnect(const int socket, request_t *request) {
             else reply.server_error_code = SRV_SUCCESS;        /* user entry was correctly updated */
         } //END inner else
     } //END outer else
+    db_txn_abort(&txn);     /* unless committed */
 
     /* server log message */
     if (reply.server_error_code == SRV_SUCCESS) {
-        printf("s> %s %s OK\n", DISCONNECT, request->username); fflush(stdout);
+        printf("s> %s %s OK\n", DISCONNECT, username.ptr); fflush(stdout);
     } else {
-        printf("s> %s %s FAIL\n", DISCONNECT, request->username); fflush(stdout);
+        printf("s> %s %s FAIL\n", DISCONNECT, username.ptr); fflush(stdout);
     }
 
     /* send reply to client */
-    send_server_reply(socket, &reply);
+    send_server_reply(conn->socket, &reply);
 }
 
 
-void srv_send(const int socket, request_t *request) {
-    /*** Executes SEND service ***/
+void aux_send_message(conn_t *conn, const char *op_code, const slice_t *sender, const slice_t *recipient,
+                      const slice_t *content, const int ttl, const char *const token) {
+    /*** Stores or passes a message whose fields have been received, with a given time to live
+     * as a pending message (negative for the default one); if an idempotency token is given
+     * (NULL otherwise), retries of the SEND get the ID of the message and are otherwise ignored;
+     * called in srv_send and srv_send_ext functions ***/
     reply_t reply;
-    entry_t msg_entry;
     entry_t recipient_entry;
-    reply_t send_msg_reply;     /* used for message transmission */
+    unsigned int msg_id;
+
+    /* messages forwarded by other nodes have been admitted (and deduplicated) there */
+    if (strcmp(op_code, NODE_SEND) != 0) {
+        if (!aux_admit_user(conn->socket, op_code, sender->ptr)) return;
+        if (!aux_home_user(conn->socket, op_code, sender->ptr)) return;
+        if (token && !aux_send_claim(conn->socket, op_code, sender, recipient, content, token)) return;
+
+        if (!cl_is_local(recipient->ptr)) {
+            int sent = aux_send_remote(conn->socket, sender, recipient, content, ttl, &msg_id);
+            if (token) dd_settle(sender->ptr, token, msg_id, sent);
+            return;
+        }
+    }
 
-    /* receive stuff */
-    if (recv_string(socket, request->message.sender) < 0) return;
-    if (recv_string(socket, request->recipient) < 0) return;
-    if (recv_string(socket, request->message.content) < 0) return;
+    /* the recipient is locked from the read of its entry until its message is stored, so that
+     * a CONNECT can't get in between and miss the message when its pending messages are sent */
+    db_txn_t txn;
+    const char *users[] = {recipient->ptr};
+    db_txn_begin(&txn, users, 1);
+    aux_send_init(sender, recipient, &reply, &txn, &recipient_entry, &msg_id);
 
-    aux_send_init(request, &reply, &recipient_entry);
+    /* set up message entry */
+    entry_t *msg_entry = aux_msg_entry_get();
+    if (!msg_entry) reply.server_error_code = SRV_ERR_SEND_ANY;
 
     /* if previous steps have failed, just send error code to client */
     if (reply.server_error_code != SRV_SUCCESS) {
-        send_server_reply(socket, &reply);
+        db_txn_abort(&txn);
+        send_server_reply(conn->socket, &reply);
+        if (msg_entry) aux_msg_entry_put(msg_entry);
+        if (token) dd_settle(sender->ptr, token, msg_id, FALSE);
         return;
     }
 
-    /* message passing */
-    aux_send_msg_pass(request, &reply, &recipient_entry, &msg_entry);
+    aux_msg_entry_set(msg_entry, sender, recipient, content);
+    msg_entry->msg.id = msg_id;
+    msg_entry->msg.expires_at = db_exp_deadline(ttl);
+
+    /* message passing: the recipient isn't kept locked while the message goes over the network */
+    if (recipient_entry.user.status == STATUS_CN) {
+        db_txn_abort(&txn);
+        if (!aux_send_msg_pass(&recipient_entry, msg_entry)) {
+            /* if sending fails, change recipient user's status to disconnected, and store the message */
+            db_txn_begin(&txn, users, 1);
+            if (aux_send_lost_recipient(&txn, &recipient_entry) < 0)
+                reply.server_error_code = SRV_ERR_SEND_ANY;
+        }
+    }
 
     /* if recipient user is disconnected or message transmission has failed */
-    if (recipient_entry.user.status == STATUS_DCN || send_msg_reply.server_error_code != SRV_SUCCESS) {
-        /* store message in recipient user's pending message list */
-        if (db_io_op_usr_ent(&msg_entry, CREATE) < 0)
+    if (recipient_entry.user.status == STATUS_DCN) {
+        /* store message in recipient user's pending message list, in one go with its status change, if any */
+        if (reply.server_error_code != SRV_SUCCESS || db_txn_put(&txn, msg_entry, CREATE) < 0 ||
+            db_txn_commit(&txn) < 0)
             reply.server_error_code = SRV_ERR_SEND_ANY;
+        db_txn_abort(&txn);     /* unless committed */
 
         /* server log message */
         if (reply.server_error_code == SRV_SUCCESS) {
-            printf("s> MESSAGE %u FROM %s TO %s STORED\n", msg_entry.msg.id,
-                   request->message.sender, request->recipient);
+            printf("s> MESSAGE %u FROM %s TO %s STORED\n", msg_entry->msg.id,
+                   msg_entry->msg.sender, msg_entry->username);
             fflush(stdout);
         }
     }
 
+    /* a delivered message is kept in the history before its sender is answered, so that it can't send
+     * another one that gets there first */
+    if (recipient_entry.user.status == STATUS_CN) db_engine->hist_put(msg_entry);
+
     /* send reply to sender client (first ACK and msg ID if success, error otherwise) */
-    aux_send_first_ack(socket, &reply, msg_entry.msg.id);
+    int acked = aux_send_first_ack(conn->socket, &reply, msg_entry->msg.id);
+
+    /* a message that reached its recipient must not be sent again, even if the SEND failed afterwards */
+    if (token) dd_settle(sender->ptr, token, msg_entry->msg.id, acked || recipient_entry.user.status == STATUS_CN);
 
     /* check that recipient user is still connected (message transmission hasn't failed) */
     if (recipient_entry.user.status == STATUS_CN) {
-        /* set up a request for SEND_MESS_ACK service */
-        request_t send_msg_ack_request;
-        strcpy(send_msg_ack_request.op_code, SEND_MESS_ACK);
-        send_msg_ack_request.message.id = recipient_entry.user.last_msg_id;
+        /* send second ACK to sender listening thread */
+        aux_send_ack(msg_entry->msg.id, msg_entry->msg.sender);
+    }
 
-        /* set up sender user entry */
-        entry_t sender_entry;
-        sender_entry.type = ENT_TYPE_UD;
-        strcpy(sender_entry.username, request->message.sender);
+    aux_msg_entry_put(msg_entry);
+}
 
-        /* send second ACK to sender listening thread */
-        clt_send_mess_ack(&send_msg_ack_request, &sender_entry);
+
+int aux_send_remote(const int socket, const slice_t *sender, const slice_t *recipient,
+                    const slice_t *content, const int ttl, unsigned int *msg_id) {
+    /*** Forwards a message to the home node of its recipient, which stores or passes it,
+     * and relays its reply to the sender client (the second ACK comes from that node);
+     * returns TRUE if the message was sent, setting its ID;
+     * called in aux_send_message function ***/
+    reply_t reply;
+    *msg_id = 0;
+
+    int sender_exists = db_engine->user_exists(sender->ptr);
+    if (!sender_exists) reply.server_error_code = SRV_ERR_SEND_USR_NOT_EXISTS;
+    else if (sender_exists < 0) reply.server_error_code = SRV_ERR_SEND_ANY;
+    else {
+        int result = cl_forward_send(sender->ptr, recipient->ptr, content->ptr, ttl, msg_id);
+        reply.server_error_code = (result < 0) ? SRV_ERR_SEND_ANY : result;
+    }
+
+    /* server log message */
+    if (reply.server_error_code == SRV_SUCCESS) {
+        printf("s> MESSAGE %u FROM %s TO %s FORWARDED TO %s\n", *msg_id, sender->ptr, recipient->ptr,
+               cl_node_addr(cl_home(recipient->ptr)));
+        fflush(stdout);
+    }
+
+    return aux_send_first_ack(socket, &reply, *msg_id);
+}
+
+
+void srv_send(conn_t *conn) {
+    /*** Executes SEND service ***/
+    slice_t sender, recipient, content;
+
+    /* receive stuff */
+    if (recv_slice(conn, &sender) < 0) return;
+    if (recv_slice(conn, &recipient) < 0) return;
+    if (recv_slice(conn, &content) < 0) return;
+
+    aux_send_message(conn, SEND, &sender, &recipient, &content, -1, NULL);
+}
+
+
+void srv_send_ext(conn_t *conn) {
+    /*** Executes SEND_EXT service: same as SEND, followed by "key=value" options
+     * ended by an empty string (time to live, content normalization, idempotency token);
+     * unknown options are ignored ***/
+    slice_t sender, recipient, content, option;
+    int ttl = -1;       /* default time to live */
+    int normalize = FALSE;
+    char token[DEDUP_TOKEN_SIZE] = "";
+    int valid_opts = TRUE;
+
+    /* receive stuff */
+    if (recv_slice(conn, &sender) < 0) return;
+    if (recv_slice(conn, &recipient) < 0) return;
+    if (recv_slice(conn, &content) < 0) return;
+    while (TRUE) {
+        if (recv_slice(conn, &option) < 0) return;
+        if (!option.len) break;
+
+        const char *value = strchr(option.ptr, '=');
+        if (!value) continue;
+        value++;
+        if (!strncmp(option.ptr, SEND_OPT_TTL "=", strlen(SEND_OPT_TTL) + 1) &&
+            (str_to_num(value, (void *) &ttl, INT) < 0 || ttl <= 0))
+            valid_opts = FALSE;
+        if (!strncmp(option.ptr, SEND_OPT_NORM "=", strlen(SEND_OPT_NORM) + 1) &&
+            (str_to_num(value, (void *) &normalize, INT) < 0 || (normalize != FALSE && normalize != TRUE)))
+            valid_opts = FALSE;
+        if (!strncmp(option.ptr, SEND_OPT_TOKEN "=", strlen(SEND_OPT_TOKEN) + 1)) {
+            if (!*value || strlen(value) >= DEDUP_TOKEN_SIZE) valid_opts = FALSE;
+            else strcpy(token, value);
+        }
+    } // END while
+
+    if (!valid_opts) {
+        reply_t reply;
+        reply.server_error_code = SRV_ERR_SEND_ANY;
+        send_server_reply(conn->socket, &reply);
+        return;
+    }
+
+    /* the content is still in the connection buffer, so it's normalized in place */
+    if (normalize) content.len = norm_collapse_spaces((char *) content.ptr, content.len);
+
+    aux_send_message(conn, SEND_EXT, &sender, &recipient, &content, ttl, *token ? token : NULL);
+}
+
+
+void srv_send_stream(conn_t *conn) {
+    /*** Executes SEND_STREAM service: same as SEND, but the message content
+     * is received in frames, so it can be of any size up to STREAM_MAX_SIZE ***/
+    reply_t reply;
+    entry_t recipient_entry;
+    unsigned int msg_id;
+    slice_t sender, recipient;
+    int clt_listen_socket = -1;
+    int delivered = FALSE;
+
+    /* receive stuff */
+    long long trace_time_us = tr_clock();
+    if (recv_slice(conn, &sender) < 0) return;
+    if (recv_slice(conn, &recipient) < 0) return;
+
+    /* the request is traced with the size of its content once the stream is over,
+     * but by then frames have overwritten its fields in the connection buffer */
+    char trace_fields[CONN_BUF_SIZE];
+    int trace_len = 0;
+    if (tr_enabled()) {
+        trace_len = conn->start;
+        memcpy(trace_fields, conn->buffer, trace_len);
+    }
+
+    /* per-user rate limit and home node; a rejected stream still has to be drained before replying */
+    int retry_after_ms = adm_admit_user(sender.ptr, conn->socket);
+    const char *home_addr = cl_is_local(sender.ptr) ? NULL : cl_node_addr(cl_home(sender.ptr));
+    if (retry_after_ms) reply.server_error_code = SRV_ERR_BUSY;
+    else if (home_addr) reply.server_error_code = SRV_ERR_REDIRECT;
+    else if (!cl_is_local(recipient.ptr)) {
+        /* streams are not forwarded between nodes */
+        printf("s> %s %s TO %s IN ANOTHER NODE FAIL\n", SEND_STREAM, sender.ptr, recipient.ptr); fflush(stdout);
+        reply.server_error_code = SRV_ERR_SEND_ANY;
+    } else aux_send_init(&sender, &recipient, &reply, NULL, &recipient_entry, &msg_id);
+
+    /* set up message entry */
+    entry_t *msg_entry = aux_msg_entry_get();
+    if (!msg_entry) reply.server_error_code = SRV_ERR_SEND_ANY;
+
+    /* if previous steps have failed, drain the stream and just send error code to client */
+    if (reply.server_error_code != SRV_SUCCESS) {
+        char frame[STREAM_CHUNK_SIZE];
+        int frame_len;
+        long long body_size = 0;
+        if (retry_after_ms) {
+            printf("s> %s %s BUSY\n", SEND_STREAM, sender.ptr); fflush(stdout);
+        } else if (home_addr) {
+            printf("s> %s %s REDIRECT %s\n", SEND_STREAM, sender.ptr, home_addr); fflush(stdout);
+        }
+        while ((frame_len = recv_frame(conn, frame, STREAM_CHUNK_SIZE)) > 0) body_size += frame_len;
+        if (frame_len == 0 && trace_len) tr_record(trace_time_us, trace_fields, trace_len, body_size);
+        if (frame_len == 0 && retry_after_ms) send_busy_reply(conn->socket, retry_after_ms);
+        else if (frame_len == 0 && home_addr) send_redirect_reply(conn->socket, home_addr);
+        else if (frame_len == 0) send_server_reply(conn->socket, &reply);
+        if (msg_entry) aux_msg_entry_put(msg_entry);
+        return;
+    }
+
+    /* request fields are copied before frames start to overwrite the connection buffer */
+    aux_msg_entry_set(msg_entry, &sender, &recipient, NULL);
+    msg_entry->msg.id = msg_id;
+    msg_entry->msg.flags = MSG_FLAG_STREAM;
+    msg_entry->msg.expires_at = db_exp_deadline(-1);
+
+    /* open the stream to the recipient's listening thread if it is connected */
+    if (recipient_entry.user.status == STATUS_CN &&
+        (clt_listen_socket = aux_connect_clt_listen_thread(&recipient_entry)) >= 0) {
+        char msg_id_str[16]; sprintf(msg_id_str, "%u", msg_entry->msg.id);
+        if (send_string(clt_listen_socket, SEND_MESSAGE_STREAM) < 0 ||
+            send_string(clt_listen_socket, msg_entry->msg.sender) < 0 ||
+            send_string(clt_listen_socket, msg_id_str) < 0) {
+            close(clt_listen_socket);
+            clt_listen_socket = -1;
+        }
+    }
+
+    /* receive, spool & forward message content */
+    int stream_result = aux_send_stream_spool(conn, msg_entry, &clt_listen_socket);
+    if (stream_result != SRV_SUCCESS) {
+        if (clt_listen_socket >= 0) close(clt_listen_socket);
+        db_engine->del_msg_body(msg_entry);
+        if (stream_result == GEN_ERR_ANY) {     /* sender went away, nothing to reply to */
+            aux_msg_entry_put(msg_entry);
+            return;
+        }
+        reply.server_error_code = SRV_ERR_SEND_ANY;
+    } else if (clt_listen_socket >= 0) {   /* whole message forwarded to recipient */
+        close(clt_listen_socket);
+        delivered = TRUE;
+    } else {    /* recipient is disconnected or forwarding has failed */
+        /* the recipient is read again in the transaction that stores the message, since it may have
+         * connected while the stream went on (to another listening thread, if forwarding failed):
+         * then its pending messages may have been sent already, so this one is sent from its body */
+        db_txn_t txn;
+        const char *users[] = {msg_entry->username};
+        entry_t current = recipient_entry;
+        db_txn_begin(&txn, users, 1);
+        if (db_txn_read(&txn, &current) == DBMS_SUCCESS && current.user.status == STATUS_CN &&
+            (recipient_entry.user.status != STATUS_CN || !aux_same_listener(&current, &recipient_entry))) {
+            /* the recipient isn't kept locked while the message goes over the network */
+            db_txn_abort(&txn);
+            recipient_entry = current;
+            delivered = clt_send_message_stream(msg_entry, &recipient_entry) == SRV_SUCCESS;
+            if (!delivered) db_txn_begin(&txn, users, 1);
+        }
+
+        /* if sending fails, change recipient user's status to disconnected; then store message in recipient
+         * user's pending message list, in the same transaction; its body is already spooled */
+        if (!delivered) {
+            if ((recipient_entry.user.status == STATUS_CN && aux_send_lost_recipient(&txn, &recipient_entry) < 0) ||
+                db_txn_put(&txn, msg_entry, CREATE) < 0 || db_txn_commit(&txn) < 0)
+                reply.server_error_code = SRV_ERR_SEND_ANY;
+            db_txn_abort(&txn);     /* unless committed */
+
+            /* server log message */
+            if (reply.server_error_code == SRV_SUCCESS) {
+                printf("s> MESSAGE %u FROM %s TO %s STORED\n", msg_entry->msg.id,
+                       msg_entry->msg.sender, msg_entry->username);
+                fflush(stdout);
+            }
+        }
+    }
+
+    /* a delivered message is kept in the history before its sender is answered, as in aux_send_message */
+    if (delivered) {
+        db_engine->del_msg_body(msg_entry);
+        printf("s> SEND MESSAGE %u FROM %s TO %s\n", msg_entry->msg.id,
+               msg_entry->msg.sender, msg_entry->username);
+        fflush(stdout);
+        db_engine->hist_put(msg_entry);
+    }
+
+    /* send reply to sender client (first ACK and msg ID if success, error otherwise) */
+    aux_send_first_ack(conn->socket, &reply, msg_entry->msg.id);
+    if (trace_len) tr_record(trace_time_us, trace_fields, trace_len, msg_entry->msg.size);
+
+    /* send second ACK to sender listening thread if the message got delivered */
+    if (delivered) aux_send_ack(msg_entry->msg.id, msg_entry->msg.sender);
+
+    aux_msg_entry_put(msg_entry);
+}
+
+
+void aux_send_users(const int socket, reply_t *reply, const char *users, const size_t users_len,
+                    const size_t n_users) {
+    /*** Sends a list of users ('\0'-separated usernames) to a client or node:
+     * reply, followed by the number of users and frames holding the users themselves;
+     * called in srv_connected_users and srv_node_connected functions,
+     * and in srv_history function, for a list of history messages ***/
+    if (send_server_reply(socket, reply) < 0 || reply->server_error_code != SRV_SUCCESS) return;
+
+    char n_users_str[24]; sprintf(n_users_str, "%zu", n_users);
+    int result = send_string(socket, n_users_str);
+    for (size_t pos = 0; result == 0 && pos < users_len; pos += STREAM_CHUNK_SIZE) {
+        int frame_len = (users_len - pos < STREAM_CHUNK_SIZE) ? (int) (users_len - pos) : STREAM_CHUNK_SIZE;
+        result = send_frame(socket, users + pos, frame_len);
+    }
+    if (result == 0) send_frame(socket, NULL, 0);
+}
+
+
+void srv_connected_users(conn_t *conn) {
+    /*** Executes CONNECTEDUSERS service: the list of connected users is taken
+     * from the presence set kept in memory and sent in a single streamed reply;
+     * in cluster mode, the lists of the other nodes are added to the local one ***/
+    reply_t reply;
+    slice_t username;
+    char *users = NULL;
+    size_t users_len = 0, n_users = 0;
+
+    /* receive stuff */
+    if (recv_slice(conn, &username) < 0) return;
+    if (!aux_admit_user(conn->socket, CONNECTEDUSERS, username.ptr)) return;
+    if (!aux_home_user(conn->socket, CONNECTEDUSERS, username.ptr)) return;
+
+    /* only connected users can ask who is connected */
+    int user_connected = db_engine->user_connected(username.ptr);
+    if (user_connected == FALSE || user_connected == DBMS_ERR_NOT_EXISTS)
+        reply.server_error_code = SRV_ERR_CONNUSRS_USR_NOT_CN;
+    else if (user_connected < 0 || db_engine->get_connected_users(&users, &users_len, &n_users) < 0)
+        reply.server_error_code = SRV_ERR_CONNUSRS_ANY;
+    else reply.server_error_code = SRV_SUCCESS;
+
+    /* users connected to other nodes */
+    for (int node = 0; reply.server_error_code == SRV_SUCCESS && node < cl_n_nodes(); node++) {
+        char *node_users;
+        size_t node_users_len, node_n_users;
+        if (node == cl_self()) continue;
+        if (cl_get_connected(node, &node_users, &node_users_len, &node_n_users) != SRV_SUCCESS) {
+            /* the list goes on without the users of an unreachable node */
+            printf("s> %s NODE %s UNREACHABLE\n", CONNECTEDUSERS, cl_node_addr(node)); fflush(stdout);
+            continue;
+        }
+
+        char *grown = realloc(users, users_len + node_users_len + 1);
+        if (grown) {
+            users = grown;
+            memcpy(users + users_len, node_users, node_users_len);
+            users_len += node_users_len;
+            n_users += node_n_users;
+        } else reply.server_error_code = SRV_ERR_CONNUSRS_ANY;
+        free(node_users);
+    }
+
+    /* server log message */
+    if (reply.server_error_code == SRV_SUCCESS) {
+        printf("s> %s OK\n", CONNECTEDUSERS); fflush(stdout);
+    } else {
+        printf("s> %s FAIL\n", CONNECTEDUSERS); fflush(stdout);
+    }
+
+    /* send reply to client, followed by the number of users and the users themselves */
+    aux_send_users(conn->socket, &reply, users, users_len, n_users);
+    free(users);
+}
+
+
+void srv_history(conn_t *conn) {
+    /*** Executes HISTORY service: a page of the messages delivered between the user and a peer,
+     * read from the history store with a single read; the client asks for the next page
+     * after the timestamp of the last message it got ***/
+    reply_t reply;
+    slice_t username, peer, since_str, max_str;
+    long long since;
+    int max_records;
+    char *records = NULL;
+    size_t records_len = 0, n_records = 0;
+
+    /* receive stuff */
+    if (recv_slice(conn, &username) < 0) return;
+    if (recv_slice(conn, &peer) < 0) return;
+    if (recv_slice(conn, &since_str) < 0) return;
+    if (recv_slice(conn, &max_str) < 0) return;
+    if (!aux_admit_user(conn->socket, HISTORY, username.ptr)) return;
+    if (!aux_home_user(conn->socket, HISTORY, username.ptr)) return;
+
+    /* only connected users can read their history */
+    char *endptr;
+    errno = 0;
+    since = strtoll(since_str.ptr, &endptr, 10);
+    int user_connected = username_valid(username.ptr) ? db_engine->user_connected(username.ptr) : DBMS_ERR_NOT_EXISTS;
+    if (!db_engine->hist_enabled())
+        reply.server_error_code = SRV_ERR_HIST_DISABLED;
+    else if (user_connected == FALSE || user_connected == DBMS_ERR_NOT_EXISTS)
+        reply.server_error_code = SRV_ERR_HIST_USR_NOT_CN;
+    else if (user_connected < 0 || errno || *endptr || since_str.len == 0 ||
+             str_to_num(max_str.ptr, (void *) &max_records, INT) < 0 || max_records < 0)
+        reply.server_error_code = SRV_ERR_HIST_ANY;
+    /* the peer names a history file: it must be a registered user (remote ones live on their node) */
+    else if (!username_valid(peer.ptr) || (cl_is_local(peer.ptr) && db_engine->user_exists(peer.ptr) != TRUE))
+        reply.server_error_code = SRV_ERR_HIST_ANY;
+    else {
+        if (max_records > HIST_PAGE_MAX) max_records = HIST_PAGE_MAX;
+        reply.server_error_code = (db_engine->hist_get(username.ptr, peer.ptr, since, (size_t) max_records,
+                                               &records, &records_len, &n_records) < 0) ?
+                                  SRV_ERR_HIST_ANY : SRV_SUCCESS;
+    }
+
+    /* server log message */
+    if (reply.server_error_code == SRV_SUCCESS) {
+        printf("s> %s %s %s OK\n", HISTORY, username.ptr, peer.ptr); fflush(stdout);
+    } else {
+        printf("s> %s %s %s FAIL\n", HISTORY, username.ptr, peer.ptr); fflush(stdout);
+    }
+
+    /* send reply to client, followed by the number of messages and the messages themselves */
+    aux_send_users(conn->socket, &reply, records, records_len, n_records);
+    free(records);
+}
+
+
+/**** Node Links (Cluster Mode) ****/
+void srv_node_link(conn_t *conn) {
+    /*** Executes NODE_LINK service: another node opens a persistent link to send its requests;
+     * the link is served by its own thread, so that it doesn't hold a service thread ***/
+    /* requests sent over links are trusted, so links are only taken from the other nodes, and only a few */
+    struct sockaddr_storage peer_addr;
+    socklen_t peer_addr_size = sizeof peer_addr;
+    if (getpeername(conn->socket, (struct sockaddr *) &peer_addr, &peer_addr_size) < 0 ||
+        !cl_link_admit(&peer_addr)) {
+        printf("s> %s FAIL\n", NODE_LINK); fflush(stdout);
+        return;
+    }
+
+    conn_t *link_conn = malloc(sizeof(conn_t));
+    if (!link_conn) {
+        cl_link_done();
+        return;
+    }
+
+    /* requests sent right after NODE_LINK may be in the connection buffer already */
+    memcpy(link_conn, conn, sizeof(conn_t));
+    link_conn->socket = dup(conn->socket);
+    link_conn->watch = NULL;    /* node links stay open for as long as the other node keeps them */
+
+    pthread_t link_th;
+    if (link_conn->socket < 0 || pthread_create(&link_th, NULL, aux_node_link_thread, link_conn) != 0) {
+        perror("Could not serve node link");
+        if (link_conn->socket >= 0) close(link_conn->socket);
+        free(link_conn);
+        cl_link_done();
+        return;
+    }
+    pthread_detach(link_th);
+}
+
+
+void *aux_node_link_thread(void *args) {
+    /*** Serves the requests sent by another node over a link, one at a time, until it's closed ***/
+    conn_t *conn = (conn_t *) args;
+    slice_t op_code;
+
+    while (TRUE) {
+        conn_release(conn);
+        if (recv_slice(conn, &op_code) <= 0) break;
+
+        if (!strcmp(op_code.ptr, NODE_SEND))
+            srv_node_send(conn);
+        else if (!strcmp(op_code.ptr, NODE_ACK))
+            srv_node_ack(conn);
+        else if (!strcmp(op_code.ptr, NODE_EXPIRED))
+            srv_node_expired(conn);
+        else if (!strcmp(op_code.ptr, NODE_CONNECTED))
+            srv_node_connected(conn);
+        else break;
+    } // END while
+
+    close(conn->socket);
+    free(conn);
+    cl_link_done();
+    return NULL;
+}
+
+
+void srv_node_send(conn_t *conn) {
+    /*** Executes NODE_SEND service: stores or passes a message to a user living in this node,
+     * sent by a user living in the node at the other end of the link ***/
+    slice_t sender, recipient, content, ttl_str;
+    int ttl;
+
+    /* receive stuff */
+    if (recv_slice(conn, &sender) < 0) return;
+    if (recv_slice(conn, &recipient) < 0) return;
+    if (recv_slice(conn, &content) < 0) return;
+    if (recv_slice(conn, &ttl_str) < 0) return;
+    if (str_to_num(ttl_str.ptr, (void *) &ttl, INT) < 0) ttl = -1;
+
+    aux_send_message(conn, NODE_SEND, &sender, &recipient, &content, ttl, NULL);
+}
+
+
+void srv_node_ack(conn_t *conn) {
+    /*** Executes NODE_ACK service: sends the second ACK of a message to its sender,
+     * a user living in this node, or queues it if the sender is offline ***/
+    reply_t reply = {.server_error_code = SRV_SUCCESS};
+    slice_t msg_id_str, sender;
+    unsigned int msg_id;
+
+    /* receive stuff */
+    if (recv_slice(conn, &msg_id_str) < 0) return;
+    if (recv_slice(conn, &sender) < 0) return;
+
+    if (str_to_num(msg_id_str.ptr, (void *) &msg_id, UINT) < 0 || !cl_is_local(sender.ptr) ||
+        aux_send_ack(msg_id, sender.ptr) < 0)
+        reply.server_error_code = SRV_ERR_SEND_ANY;
+    send_server_reply(conn->socket, &reply);
+}
+
+
+void srv_node_expired(conn_t *conn) {
+    /*** Executes NODE_EXPIRED service: tells a sender living in this node
+     * that a message has expired ***/
+    reply_t reply = {.server_error_code = SRV_SUCCESS};
+    slice_t msg_id_str, sender, recipient;
+    unsigned int msg_id;
+
+    /* receive stuff */
+    if (recv_slice(conn, &msg_id_str) < 0) return;
+    if (recv_slice(conn, &sender) < 0) return;
+    if (recv_slice(conn, &recipient) < 0) return;
+
+    if (str_to_num(msg_id_str.ptr, (void *) &msg_id, UINT) < 0 || !cl_is_local(sender.ptr))
+        reply.server_error_code = SRV_ERR_SEND_ANY;
+    else if (db_engine->user_connected(sender.ptr) == TRUE)
+        clt_send_mess_expired(msg_id, sender.ptr, recipient.ptr);
+    send_server_reply(conn->socket, &reply);
+}
+
+
+void srv_node_connected(conn_t *conn) {
+    /*** Executes NODE_CONNECTED service: sends the users connected to this node ***/
+    reply_t reply = {.server_error_code = SRV_SUCCESS};
+    char *users = NULL;
+    size_t users_len = 0, n_users = 0;
+
+    if (db_engine->get_connected_users(&users, &users_len, &n_users) < 0)
+        reply.server_error_code = SRV_ERR_CONNUSRS_ANY;
+    aux_send_users(conn->socket, &reply, users, users_len, n_users);
+    free(users);
+}
+
+
+void srv_notify_expired(const entry_t *const msg_entry) {
+    /*** Tells the sender of a pending message that has expired, if it is connected;
+     * called by the DBMS expiry thread ***/
+    if (!cl_is_local(msg_entry->msg.sender)) {
+        cl_forward_expired(msg_entry->msg.id, msg_entry->msg.sender, msg_entry->username);
+        return;
     }
+    if (db_engine->user_connected(msg_entry->msg.sender) != TRUE) return;
+    clt_send_mess_expired(msg_entry->msg.id, msg_entry->msg.sender, msg_entry->username);
 }
@@ -0,0 +1,93 @@
+#include <string.h>
+#include "DS-Lab-Assignment/timerWheel.h"
+
+
+static void tw_link(tw_timer_t **slot, tw_timer_t *timer);
+static void tw_cascade(timer_wheel_t *wheel, int level);
+
+
+static void tw_link(tw_timer_t **slot, tw_timer_t *timer) {
+    /*** Links a timer at the head of a slot list ***/
+    timer->pprev = slot;
+    timer->next = *slot;
+    if (*slot) (*slot)->pprev = &timer->next;
+    *slot = timer;
+}
+
+
+static void tw_cascade(timer_wheel_t *wheel, const int level) {
+    /*** Moves the timers of the current slot of a given level down to the lower levels ***/
+    int pos = (int) ((wheel->now >> (level * TW_SLOT_BITS)) & (TW_SLOTS - 1));
+    tw_timer_t *timer = wheel->slots[level][pos];
+    wheel->slots[level][pos] = NULL;
+
+    while (timer) {
+        tw_timer_t *next = timer->next;
+        tw_add(wheel, timer);
+        timer = next;
+    }
+}
+
+
+void tw_init(timer_wheel_t *wheel, const unsigned long long now) {
+    /*** Sets up an empty timer wheel whose current tick is now ***/
+    memset(wheel->slots, 0, sizeof wheel->slots);
+    wheel->now = now;
+}
+
+
+void tw_add(timer_wheel_t *wheel, tw_timer_t *timer) {
+    /*** Adds a timer to the wheel: the further away it goes off, the higher the level it goes in;
+     * timers that are already due go off on the next tick ***/
+    if (timer->expires <= wheel->now) timer->expires = wheel->now + 1;
+
+    /* timers beyond the range of the wheel wait in the last slot of the top level */
+    unsigned long long expires = timer->expires;
+    if (expires - wheel->now >= TW_MAX_TICKS) expires = wheel->now + TW_MAX_TICKS - 1;
+
+    int level = 0;
+    while (level < TW_LEVELS - 1 && expires - wheel->now >= 1ULL << ((level + 1) * TW_SLOT_BITS)) level++;
+
+    int pos = (int) ((expires >> (level * TW_SLOT_BITS)) & (TW_SLOTS - 1));
+    tw_link(&wheel->slots[level][pos], timer);
+}
+
+
+void tw_del(timer_wheel_t *wheel, tw_timer_t *timer) {
+    /*** Removes a timer that has not gone off yet from the wheel ***/
+    (void) wheel;
+    if (!timer->pprev) return;      /* not in the wheel */
+    *timer->pprev = timer->next;
+    if (timer->next) timer->next->pprev = timer->pprev;
+    timer->pprev = NULL;
+    timer->next = NULL;
+}
+
+
+tw_timer_t *tw_advance(timer_wheel_t *wheel, const unsigned long long now) {
+    /*** Advances the wheel up to tick now; returns the list (linked through next)
+     * of the timers that have gone off, which are no longer in the wheel ***/
+    tw_timer_t *expired = NULL;
+
+    while (wheel->now < now) {
+        wheel->now++;
+
+        /* at the start of a new turn of a level, the next slot of the level above is cascaded down */
+        for (int level = 1; level < TW_LEVELS; level++) {
+            if (wheel->now & ((1ULL << (level * TW_SLOT_BITS)) - 1)) break;
+            tw_cascade(wheel, level);
+        }
+
+        /* every timer in the current slot of the bottom level goes off now */
+        tw_timer_t **slot = &wheel->slots[0][wheel->now & (TW_SLOTS - 1)];
+        while (*slot) {
+            tw_timer_t *timer = *slot;
+            *slot = timer->next;
+            timer->pprev = NULL;
+            timer->next = expired;
+            expired = timer;
+        }
+    }
+
+    return expired;
+}
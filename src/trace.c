@@ -0,0 +1,171 @@
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include "DS-Lab-Assignment/trace.h"
+
+/* trace file: TRACE_MAGIC, followed by a record per request made of three varints (LEB128) and the fields:
+ *     delay since the previous record in us (zigzag-encoded, since requests are recorded once served but keep
+ *     the time they were received at), body size + 1 (0 if not a stream), fields length, fields */
+
+#define TR_VARINT_MAX 10        /* max bytes of a 64-bit varint */
+
+static int trace_fd = -1;
+static long long trace_start_us;
+static long long last_time_us = 0;          /* time of the last record, since the trace started */
+static char trace_buf[TRACE_BUF_SIZE];      /* records not written out yet */
+static size_t trace_buf_len = 0;
+static pthread_mutex_t mutex_trace = PTHREAD_MUTEX_INITIALIZER;
+
+static long long tr_now_us(void);
+static size_t tr_put_varint(char *buffer, unsigned long long value);
+static int tr_get_varint(FILE *trace, unsigned long long *value);
+static void tr_write_out(void);
+static void *tr_flush_thread(void *args);
+
+
+static long long tr_now_us(void) {
+    /*** Returns a monotonic timestamp in microseconds ***/
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+
+static size_t tr_put_varint(char *buffer, unsigned long long value) {
+    /*** Encodes a varint into a buffer; returns the number of bytes used ***/
+    size_t len = 0;
+    while (value >= 0x80) {
+        buffer[len++] = (char) (value | 0x80);
+        value >>= 7;
+    }
+    buffer[len++] = (char) value;
+    return len;
+}
+
+
+static int tr_get_varint(FILE *trace, unsigned long long *value) {
+    /*** Decodes a varint from a trace file; returns 0 on EOF before its first byte ***/
+    *value = 0;
+    for (int shift = 0; shift < 7 * TR_VARINT_MAX; shift += 7) {
+        int byte = getc(trace);
+        if (byte == EOF) return shift ? GEN_ERR_ANY : 0;
+        *value |= (unsigned long long) (byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return 1;
+    }
+    return GEN_ERR_ANY;
+}
+
+
+static void tr_write_out(void) {
+    /*** Writes buffered records out to the trace file; mutex_trace must be held ***/
+    if (trace_buf_len && write_bytes(trace_fd, trace_buf, (int) trace_buf_len) < 0) perror("Error writing trace");
+    trace_buf_len = 0;
+}
+
+
+static void *tr_flush_thread(void *args) {
+    /*** Writes buffered records out every TRACE_FLUSH_MS, so that a trace is complete
+     * but for its last records even if the server is killed ***/
+    struct timespec interval = {TRACE_FLUSH_MS / 1000, (TRACE_FLUSH_MS % 1000) * 1000000L};
+    while (TRUE) {
+        nanosleep(&interval, NULL);
+        tr_flush();
+    }
+    return NULL;
+}
+
+
+int tr_init(const char *const path) {
+    /*** Starts tracing the requests to a new trace file ***/
+    int ret_val;    /* needed for error-checking macros */
+    CHECK_FUNC_ERROR_WITH_ERRNO(trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644), GEN_ERR_ANY)
+    CHECK_FUNC_ERROR(write_bytes(trace_fd, TRACE_MAGIC, strlen(TRACE_MAGIC)), GEN_ERR_ANY)
+    trace_start_us = tr_now_us();
+
+    pthread_t flush_th;
+    CHECK_ERROR(pthread_create(&flush_th, NULL, tr_flush_thread, NULL) != 0, "Could not start trace thread",
+                GEN_ERR_ANY)
+    pthread_detach(flush_th);
+
+    printf("s> tracing requests to %s\n", path); fflush(stdout);
+    return 0;
+}
+
+
+int tr_enabled(void) {
+    /*** Checks whether requests are being traced ***/
+    return trace_fd >= 0;
+}
+
+
+long long tr_clock(void) {
+    /*** Time since the trace started in microseconds, to be given to tr_record ***/
+    return tr_now_us() - trace_start_us;
+}
+
+
+void tr_record(long long time_us, const char *const fields, const int fields_len, const long long body_size) {
+    /*** Appends a request received at a given time (from tr_clock) to the trace; a request served after
+     * one received later than it is recorded after it, with a negative delay ***/
+    char header[3 * TR_VARINT_MAX];
+
+    pthread_mutex_lock(&mutex_trace);
+    long long delay_us = time_us - last_time_us;
+    unsigned long long zigzag_delay = ((unsigned long long) delay_us << 1) ^ (unsigned long long) (delay_us >> 63);
+    size_t header_len = tr_put_varint(header, zigzag_delay);
+    header_len += tr_put_varint(header + header_len, body_size + 1);
+    header_len += tr_put_varint(header + header_len, fields_len);
+    last_time_us = time_us;
+
+    if (trace_buf_len + header_len + fields_len > TRACE_BUF_SIZE) tr_write_out();
+    memcpy(trace_buf + trace_buf_len, header, header_len);
+    memcpy(trace_buf + trace_buf_len + header_len, fields, fields_len);
+    trace_buf_len += header_len + fields_len;
+    pthread_mutex_unlock(&mutex_trace);
+}
+
+
+void tr_flush(void) {
+    /*** Writes the records buffered so far out to the trace file ***/
+    if (!tr_enabled()) return;
+    pthread_mutex_lock(&mutex_trace);
+    tr_write_out();
+    pthread_mutex_unlock(&mutex_trace);
+}
+
+
+FILE *tr_open(const char *const path) {
+    /*** Opens a trace file to read its requests; returns NULL if it can't be read or isn't a trace ***/
+    char magic[sizeof TRACE_MAGIC];
+    FILE *trace = fopen(path, "rb");
+    if (!trace) {
+        perror("Could not open trace");
+        return NULL;
+    }
+    if (fread(magic, 1, strlen(TRACE_MAGIC), trace) != strlen(TRACE_MAGIC) ||
+        memcmp(magic, TRACE_MAGIC, strlen(TRACE_MAGIC)) != 0) {
+        fprintf(stderr, "%s is not a trace file\n", path);
+        fclose(trace);
+        return NULL;
+    }
+    return trace;
+}
+
+
+int tr_read(FILE *trace, tr_request_t *request) {
+    /*** Reads the next request of a trace; returns 0 at the end of the trace ***/
+    unsigned long long delay_us, body_size, fields_len;
+    int result = tr_get_varint(trace, &delay_us);
+    if (result <= 0) return result;
+
+    CHECK_ERROR(tr_get_varint(trace, &body_size) <= 0 || tr_get_varint(trace, &fields_len) <= 0 ||
+                fields_len > CONN_BUF_SIZE || fread(request->fields, 1, fields_len, trace) != fields_len,
+                "Truncated trace record", GEN_ERR_ANY)
+    request->delay_us = (long long) (delay_us >> 1) ^ -(long long) (delay_us & 1);
+    request->body_size = (long long) body_size - 1;
+    request->fields_len = (int) fields_len;
+    return 1;
+}